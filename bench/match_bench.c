@@ -0,0 +1,139 @@
+/*
+ * match_bench.c: compares the w24match kernels with the matching they replaced
+ *
+ * Builds a directory's worth of synthetic file names (packed and padded the way w24scan keeps
+ * getdents64 names) and times, per name:
+ * - basename() + strcmp() on the full path, as compareFileName() did for w24fn,
+ * - fnmatch("*.ext") per extension, as find -name did for w24ft,
+ * - w24_match_many() with every kernel the CPU supports, case-sensitive and not.
+ *
+ * Usage: bench/match_bench [names] [rounds]     (make bench)
+ */
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime; basename() comes from libgen.h, the version compareFileName() used
+#include <fnmatch.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../w24match.h"
+
+static const char *extensions[] = { "txt", "c", "h", "jpg", "png", "pdf", "tar.gz", "md", "Makefile", "o" };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, double seconds, size_t checks, size_t matches)
+{
+    printf("%-34s %8.2f ns/name  %zu matches\n", what, seconds * 1e9 / checks, matches);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    char *names = malloc(count * 48 + W24_MATCH_PADDING);
+    char *paths = malloc(count * 64);
+    const char **name = malloc(count * sizeof(*name));
+    const char **path = malloc(count * sizeof(*path));
+    size_t *length = malloc(count * sizeof(*length));
+    unsigned char *hits = malloc(count);
+    const char *target = "report-2024.txt";
+    const char *suffixes[] = { ".txt", ".jpg", ".tar.gz" };
+    const char *globs[] = { "*.txt", "*.jpg", "*.tar.gz" };
+    const char *kernels[] = { "scalar", "sse4.2", "avx2" };
+    size_t used = 0, matches;
+    double start;
+
+    if (names == NULL || paths == NULL || name == NULL || path == NULL || length == NULL || hits == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    srand(24);
+    for (size_t i = 0; i < count; i++) {
+        char stem[32];
+        int stem_len = 3 + rand() % 20;
+
+        for (int j = 0; j < stem_len; j++)
+            stem[j] = "abcdefghijklmnopqrstuvwxyz-_0123456789"[rand() % 38];
+        stem[stem_len] = '\0';
+        name[i] = names + used;
+        if (i % 1000 == 0)
+            length[i] = sprintf(names + used, "%s", i % 2000 == 0 ? target : "REPORT-2024.TXT");
+        else
+            length[i] = sprintf(names + used, "%s.%s", stem, extensions[rand() % 10]);
+        used += length[i] + 1;
+        path[i] = paths + i * 64;
+        snprintf(paths + i * 64, 64, "/home/user/project/%s", name[i]);
+    }
+
+    printf("%zu names, %d rounds, default kernel %s\n\n", count, rounds, w24_match_kernel());
+
+    // the previous w24fn path
+    start = now();
+    matches = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) {
+            char copy[64];
+            memcpy(copy, path[i], 64); // basename() may modify its argument
+            matches += strcmp(basename(copy), target) == 0;
+        }
+    }
+    report("name: basename + strcmp", now() - start, count * rounds, matches / rounds);
+
+    start = now();
+    matches = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++)
+            matches += strcmp(name[i], target) == 0;
+    }
+    report("name: strcmp", now() - start, count * rounds, matches / rounds);
+
+    // the previous w24ft path
+    start = now();
+    matches = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) {
+            int hit = 0;
+            for (int g = 0; g < 3 && !hit; g++)
+                hit = fnmatch(globs[g], name[i], 0) == 0;
+            matches += hit;
+        }
+    }
+    report("extensions: fnmatch", now() - start, count * rounds, matches / rounds);
+
+    for (int k = 0; k < 3; k++) {
+        for (unsigned flags = 0; flags <= W24_MATCH_NOCASE; flags += W24_MATCH_NOCASE) {
+            struct w24_match match;
+            char label[64];
+
+            if (w24_match_set_kernel(kernels[k]) == -1) {
+                printf("%-34s (not supported by this CPU)\n", kernels[k]);
+                break;
+            }
+
+            w24_match_name_init(&match, target, flags);
+            start = now();
+            for (int r = 0; r < rounds; r++)
+                matches = w24_match_many(&match, name, length, count, hits);
+            snprintf(label, sizeof(label), "name: %s%s", kernels[k], flags ? " nocase" : "");
+            report(label, now() - start, count * rounds, matches);
+
+            w24_match_suffixes_init(&match, suffixes, 3, flags);
+            start = now();
+            for (int r = 0; r < rounds; r++)
+                matches = w24_match_many(&match, name, length, count, hits);
+            snprintf(label, sizeof(label), "extensions: %s%s", kernels[k], flags ? " nocase" : "");
+            report(label, now() - start, count * rounds, matches);
+        }
+    }
+
+    return 0;
+}
@@ -10,11 +10,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <arpa/inet.h>
 #include <pthread.h>
-#include <sys/select.h>
-#include <ftw.h>
-#include <regex.h>
+#include <time.h>
+
+#include "w24trace.h"
+#include "w24codec.h"
+#include "w24client.h"
 
 #define SERVER_IP "127.0.0.1"
 #define MIRROR_IP "127.0.0.1"
@@ -22,547 +23,857 @@
 #define MIRROR_IP_PORT1 4501
 #define MIRROR_IP_PORT2 4502
 #define MAX_MSG_LENGTH 4096
+#define HEARTBEAT_INTERVAL 30 // seconds an idle session waits before it pings the server, well within its idle timeout
 
-int clientCount; // to store the count of client and take respective action
+/*
+ * State of one session of this client, kept as the session's data (see w24session.h).
+ */
+struct client_session {
+    int index; // 1-based; prefixes the output when several sessions run
+    int connected; // the session was ready at least once
+    int count; // client count sent by the server, names the downloaded archives
+    int success_command_count; // answered commands, numbers the downloaded archives
+    char command[MAX_MSG_LENGTH]; // command in flight
+    int conditional; // it was sent as a conditional request, to revalidate its cached reply
+    int line; // -b: input line of the command in flight, 0 if none
+    struct timespec started; // -b: when the command was sent
+    struct w24_result result; // -b: the reply so far
+    int downloading; // -b: the archive of the command is being downloaded
+    int downloaded; // -b: the download succeeded, set by the download's thread before the session is attached
+    char archive_path[MAX_MSG_LENGTH]; // -b: where the archive is saved
+};
 
 /*
- * countWords: Counts the number of words in a given string
- * 
- * Parameters:
- * - message: The string in which words are to be counted
+ * Where commands come from: stdin watched by the event loop (a terminal or a pipe), or a file read
+ * directly when a session needs its next command (a script given with -f, or stdin redirected
+ * from a regular file, which epoll cannot watch).
+ */
+struct command_input {
+    FILE *file; // read directly, NULL when stdin is watched
+    int script; // -f or -b: no prompt, blank lines and '#' comments are skipped
+    char *pending; // bytes read from stdin and not yet taken as commands
+    size_t length, size;
+    int eof;
+    int prompted; // the prompt is shown and no command was taken since
+    int line; // lines read so far
+};
+
+char codec_offer[W24_CODEC_LIST_MAX]; // codecs we can unpack, most preferred first
+int codec_level = 0; // preferred compression level, 0: server default
+int num_sessions = 1; // sessions run at once (-j)
+int connected_sessions; // sessions that got connected
+int batch = 0; // -b: one JSON line per command on stdout, nothing else
+int use_cache = 1; // keep the replies to dirlist and w24fn in $HOME/w24project/.cache, -n: do not
+int deadline_ms = 0; // -d: how long the server may work on each command, 0: no bound
+int failed_commands; // -b: commands that were invalid, rejected or not answered
+struct w24_loop *loop; // drives every session
+struct command_input input;
+
+/*
+ * isArchiveReply: Checks whether a server response announces an archive ("ARCHIVE <id> <length> <extension>")
+ */
+
+int isArchiveReply(const char *message) {
+    return strncmp(message, "ARCHIVE ", 8) == 0;
+}
+
+/*
+ * A download handed to its own thread: the session's socket is detached from the event loop and
+ * attached again, possibly reconnected, when the download is over.
+ */
+struct download_job {
+    struct w24_session *session;
+    int clientSocket;
+    int port;
+    char archive_id[MAX_MSG_LENGTH];
+    unsigned long long length;
+    char command[MAX_MSG_LENGTH];
+    char filename[MAX_MSG_LENGTH];
+};
+
+/*
+ * printSessionTag: Prefixes the output of a session with its number when several sessions share the terminal
+ */
+
+void printSessionTag(struct client_session *cs) {
+    if (num_sessions > 1) {
+        printf("[%d] ", cs->index);
+    }
+}
+
+/*
+ * checkCommand: Checks a command before it is sent and tells how its reply is delimited (see w24_client_check())
  * 
  * Return Value:
- * - int: The number of words in the given string
+ * - int: 1 if the command can be sent, 0 if it was rejected (the reason is printed)
+ */
+
+int checkCommand(const char *message, enum w24_reply_shape *shape) {
+    char error[MAX_MSG_LENGTH];
+
+    if (!w24_client_check(message, shape, error, sizeof(error))) {
+        printf("%s\n", error);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * printReply: Prints the text reply of a command
  * 
- * Explanation:
- * This function iterates through each character in the given string.
- * It maintains a flag 'in_word' to indicate whether the current character is inside a word or not.
- * If the current character is a space and we were inside a word, it increments the word count.
- * If the current character is not a space, it sets the 'in_word' flag to 1, indicating that we are inside a word.
- * After iterating through the entire string, if the last character was part of a word, it increments the count.
- * Finally, it returns the count of words in the string.
+ * Parameters:
+ * - command: The command that was sent
+ * - reply: The server's reply
  */
 
-int countWords(char *message) 
-{
-    int count = 0;
-    int in_word = 0; // Flag to indicate whether we are currently inside a word
-
-    // Iterate through each character in the string
-    for (int i = 0; message[i] != '\0'; i++) {
-        // Check if the current character is a space
-        if (message[i] == ' ') {
-            // If we were inside a word, increment the word count
-            if (in_word) {
-                count++;
-                in_word = 0; // Reset the flag
-            }
-        } else {
-            // If the current character is not a space, we are inside a word
-            in_word = 1;
+void printReply(const char *command, const char *reply) {
+    if (strstr(reply, "Request stopped: ") == reply) { // cancelled, past its deadline (-d) or abandoned
+        printf("%s\n", reply);
+    }
+    else if(strcmp("dirlist -a", command)==0){
+        // Print server response
+        printf("Directories under the home directory are (in alphabetical order): \n%s", reply);
+    }
+    else if(strcmp("dirlist -t", command)==0){
+        printf("Directories under the home directory are (in order or creation): \n%s", reply);
+    }
+    else if (strstr(command, "w24fn ") == command) {
+
+        if(strcmp(reply,"No file found")==0 || strcmp(reply,"nftw failed.")==0 || strcmp(reply,"Error in retrieving file stat.")==0){
+            printf("%s\n",reply);
+            return;
+        }
+        else{
+            printf("File information: \n\n");
+
+            printf("File name: %s\n", command + 6);
+            printf("%s\n\n",reply);
         }
     }
+    else if((strstr(command, "w24fdb ") == command) || (strstr(command, "w24fda ") == command))
+    {
+        if(strcmp(reply,"No file found")==0){
+            printf("No file found.\n");
+        }
+        else if(isArchiveReply(reply)){
+            printf("TAR file received for dates. Saving to project folder $HOME/w24project/\n");
+        }
+        else{
+            printf("%s\n", reply); // why the scan or the archive failed
+        }
+    }
+    else if(strstr(command, "w24fz ") == command){
 
-    // Increment count if the string ends with a word
-    if (in_word) {
-        count++;
+        if(strcmp(reply,"No file found")==0){
+            printf("No file found.\n");
+        }
+        else if(isArchiveReply(reply)){
+            printf("TAR file received for size constraints. Saving to project folder $HOME/w24project/\n");
+        }
+        else{
+            printf("%s\n", reply); // why the scan or the archive failed
+        }
     }
+    else if((strstr(command, "w24fg ") == command) || (strstr(command, "w24fr ") == command)){
 
-    return count;
+        if(isArchiveReply(reply)){
+            printf("TAR file received for name pattern. Saving to project folder $HOME/w24project/\n");
+        }
+        else{
+            printf("%s\n", reply); // "No file found" or why the pattern was rejected
+        }
+    }
+    else if(strstr(command, "w24ft ") == command){
+
+        if(strcmp(reply,"No file found")==0){
+            printf("No file found.\n");
+        }
+        else if(isArchiveReply(reply)){
+            printf("No file found.\n");
+            printf("TAR file received for extension list. Saving to project folder $HOME/w24project/\n");
+        }
+        else{
+            printf("%s\n", reply); // why the scan or the archive failed
+        }
+    }
+    else
+    {
+        printf("Message from server: %s \n", reply);
+    }
 }
 
 /*
- * isWordLimitExceeded: Checks if the word count in a message exceeds a specified limit
- * 
- * Parameters:
- * - message: The message to be checked
- * - limit: The maximum number of words allowed
- * 
- * Return Value:
- * - int: 1 if the word count exceeds the limit, 0 otherwise
- * 
- * Explanation:
- * This function calculates the number of words in the given message using the countWords() function.
- * It then compares the word count with the specified limit.
- * If the word count is greater than the limit, it returns 1, indicating that the word limit is exceeded.
- * Otherwise, it returns 0, indicating that the word limit is not exceeded.
+ * printFrame: Prints one framed reply: the file list of w24fg/w24fr/w24fuzzy ("FILES <length> <count>"),
+ * the table of w24top/w24agg ("TABLE <length> <rows>"), the matching lines of w24grep ("LINES <length> <count>"
+ * frames, then "END 0 <files> <lines> [truncated]") or an ERROR frame explaining why the request was rejected
  */
 
-int isWordLimitExceeded(char *message, int limit) {
-    int word_count = countWords(message);
-    return word_count > limit ? 1 : 0;
+void printFrame(const struct w24_reply *reply) {
+    if (strcmp(reply->type, "FILES") == 0) {
+        if (reply->length == 0) {
+            printf("No file found.\n");
+        }
+        else {
+            printf("Matching files (%s):\n%s", reply->attrs, reply->data);
+        }
+    }
+    else if (strcmp(reply->type, "TABLE") == 0) {
+        printf("%s", reply->data);
+    }
+    else if (strcmp(reply->type, "LINES") == 0) {
+        fwrite(reply->data, 1, reply->length, stdout);
+    }
+    else if (strcmp(reply->type, "END") == 0) {
+        unsigned long files = 0, lines = 0;
+        sscanf(reply->attrs, "%lu %lu", &files, &lines);
+        printf("%lu matching lines in %lu files%s\n", lines, files, strstr(reply->attrs, "truncated") != NULL ? " (truncated)" : "");
+    }
+    else {
+        printf("%s\n", reply->attrs); // ERROR: why the request was rejected
+    }
+    fflush(stdout);
 }
 
 /*
-  Copy a file from a source path to a destination path.
- 
-  Parameters:
-   - source_path: Path of the source file to copy.
-   - destination_path: Path of the destination directory where the file will be copied.
-   - filename: Name of the file to be copied.
- 
-  Returns:
-   - 1 if the file is copied successfully.
-   - 0 if an error occurs during the copy operation.
- 
-  This function constructs the source and destination file paths using the provided
-  source_path, destination_path, and filename. It then constructs and executes a command
-  to copy the file using the 'cp' command in Unix-like systems. The function opens a
-  pipe to execute the command and checks the exit status to ensure the success of the
-  copy operation. If successful, it returns 1; otherwise, it returns 0.
-
+ * printJsonString: Prints length bytes of text as a JSON string
  */
 
-int copy_file_to_home(char *source_path, char *destination_path, char * filename) {
-    // Construct the source file path
-    char source_file_path[MAX_MSG_LENGTH];
-    snprintf(source_file_path, sizeof(source_file_path), "%s", source_path);
+void printJsonString(const char *text, size_t length) {
+    putchar('"');
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
 
-    // Construct the destination file path
-    char destination_file_path[MAX_MSG_LENGTH];
-    snprintf(destination_file_path, sizeof(destination_file_path), "%s/w24project/%s", destination_path, filename);
-
-    // Construct and execute the command to copy the file
-    char command[MAX_MSG_LENGTH];
-    snprintf(command, sizeof(command), "cp %s %s", source_file_path, destination_file_path);
-    //printf("Command is: %s", command);
-    
-    FILE *fp = popen(command, "r");
-    if (fp == NULL) {
-        perror("Error executing command");
-        return 0;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        }
+        else if (c == '\n') {
+            printf("\\n");
+        }
+        else if (c == '\t') {
+            printf("\\t");
+        }
+        else if (c < 0x20 || c == 0x7f) {
+            printf("\\u%04x", c);
+        }
+        else {
+            putchar(c);
+        }
     }
+    putchar('"');
+}
 
-    // Check the exit status of the command
-    int status = pclose(fp);
-    if (status == -1) {
-        perror("Error closing pipe");
-        return 0;
-    } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-        fprintf(stderr, "Command failed with exit status %d\n", WEXITSTATUS(status));
-        return 0;
-    }
+/*
+ * printJsonList: Prints the fields of text, split at separator, as a JSON array of strings; a trailing separator
+ * only ends the last field
+ */
 
-    printf("File copied successfully to home\n");
-    return 1;
-}
+void printJsonList(const char *text, size_t length, char separator) {
+    const char *end = text + length;
 
+    putchar('[');
+    while (text < end) {
+        const char *next = memchr(text, separator, (size_t)(end - text));
+        size_t field = next != NULL ? (size_t)(next - text) : (size_t)(end - text);
+
+        printJsonString(text, field);
+        text += field + (next != NULL);
+        if (text < end) {
+            putchar(',');
+        }
+    }
+    putchar(']');
+}
 
 /*
- * This function handles writing messages to the server and receiving responses.
+ * printResult: Prints the outcome of a session's command as one JSON line (-b)
  *
  * Parameters:
- *  - arg: Pointer to the client socket file descriptor.
+ * - cs: The session, with the command, its input line and its result
+ * - port: The node the session is connected to
+ * - error: Why the command failed, NULL to take the outcome from the result
+ * - invalid: The command was rejected before it was sent
  *
- * This function prompts the user to enter a command and sends it to the server using the client socket.
- * It then waits for the server's response and handles different types of responses accordingly.
- * Supported commands include 'dirlist -a', 'dirlist -t', 'w24fn', 'w24fdb', 'w24fda', 'w24fz', and 'w24ft'.
- * Responses are printed to the console, and in case of receiving a TAR file response, it copies the file to the project folder.
+ * Explanation:
+ * {"line":N,"session":N,"node":PORT,"command":"...","status":"ok|error|invalid", ..., "ms":N} where a failed
+ * command carries "error" and a successful one its "type" and what comes with it: "text" for text replies,
+ * "files" (w24fg, w24fr, w24fuzzy), "columns" and "rows" (w24top, w24agg), "lines", "files", "matches" and
+ * "truncated" (w24grep), "archive" and "bytes" for a downloaded archive.
  */
 
-void * write_to_server(void * arg)
-{
-    int clientSocket = *((int *)arg);
-    char message[MAX_MSG_LENGTH];
-    char *message_copy, *message_copy2;
-
-    // start client loop
-    int i=1;
-    int success_command_count = 0;
-    
-    while(i)
-    {
-    	// Send a message to the server
-        printf("Kindly enter your command: ");
-        fgets(message, sizeof(message), stdin);
-        
-        printf("-----------------------------------------\n");
-        // Remove the newline character from the end of the input message
-    	if (message[strlen(message) - 1] == '\n') {
-        	message[strlen(message) - 1] = '\0';
-    	}
+void printResult(struct client_session *cs, int port, const char *error, int invalid) {
+    static const char *types[] = { "text", "files", "table", "lines", "archive", "error" };
+    struct w24_result *result = &cs->result;
+    const char *data = result->data != NULL ? result->data : "";
+    struct timespec now;
 
-	    
-        message_copy = strdup(message);
-        message_copy2 = strdup(message); // while printing file information
+    if (error == NULL && result->type == W24_RESULT_ERROR) {
+        error = result->attrs;
+    }
+    else if (error == NULL && result->type == W24_RESULT_TEXT &&
+             (strstr(data, "Request stopped: ") == data || strcmp(data, "File scan failed") == 0 || strcmp(data, "Archive creation failed") == 0)) {
+        error = data; // the archive commands answer their failures in text
+    }
 
-        //printf("Entered command: %s\n", message_copy);
+    printf("{\"line\":%d,\"session\":%d,\"node\":%d,\"command\":", cs->line, cs->index, port);
+    printJsonString(cs->command, strlen(cs->command));
+    printf(",\"status\":\"%s\"", invalid ? "invalid" : error != NULL ? "error" : "ok");
+    if (error != NULL) {
+        failed_commands++;
+        printf(",\"error\":");
+        printJsonString(error, strlen(error));
+    }
+    else {
+        printf(",\"type\":\"%s\"", types[result->type]);
+        if (result->type == W24_RESULT_TEXT) {
+            printf(",\"text\":");
+            printJsonString(data, result->length);
+        }
+        else if (result->type == W24_RESULT_FILES) {
+            printf(",\"files\":");
+            printJsonList(data, result->length, '\n');
+        }
+        else if (result->type == W24_RESULT_TABLE) {
+            // the first row names the columns
+            const char *row = memchr(data, '\n', result->length);
+            size_t header = row != NULL ? (size_t)(row - data) : result->length;
+
+            printf(",\"columns\":");
+            printJsonList(data, header, '\t');
+            printf(",\"rows\":[");
+            for (row = data + header + (row != NULL); row < data + result->length; ) {
+                const char *next = memchr(row, '\n', (size_t)(data + result->length - row));
+                size_t row_length = next != NULL ? (size_t)(next - row) : (size_t)(data + result->length - row);
+
+                printf("%s", row != data + header + 1 ? "," : "");
+                printJsonList(row, row_length, '\t');
+                row += row_length + (next != NULL);
+            }
+            printf("]");
+        }
+        else if (result->type == W24_RESULT_LINES) {
+            unsigned long files = 0, lines = 0;
 
-        if(strcmp("dirlist -a", message_copy)==0){
-        	// do nothing. Skip to printing output of command
+            sscanf(result->attrs, "%lu %lu", &files, &lines);
+            printf(",\"lines\":");
+            printJsonList(data, result->length, '\n');
+            printf(",\"files\":%lu,\"matches\":%lu,\"truncated\":%s", files, lines, strstr(result->attrs, "truncated") != NULL ? "true" : "false");
         }
-        else if(strcmp("dirlist -t", message_copy)==0){
-        	// do nothing. Skip to printing output of command
+        else if (result->type == W24_RESULT_ARCHIVE) {
+            printf(",\"archive\":");
+            printJsonString(cs->archive_path, strlen(cs->archive_path));
+            printf(",\"bytes\":%llu", result->archive_length);
         }
-        else if (strstr(message_copy, "w24fn ") == message_copy) {
-	        
-	        // extract filename after "w24fn "
-	        char * filename = strtok(message_copy + 6, "\n");
-	        //printf("Filename is: %s\n", filename);
+    }
+    if (!invalid) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf(",\"ms\":%ld", (long)((now.tv_sec - cs->started.tv_sec) * 1000 + (now.tv_nsec - cs->started.tv_nsec) / 1000000));
+    }
+    printf("}\n");
+    fflush(stdout);
 
-            if (filename == NULL)
-            {
-                printf("Invalid Command\n");    
-                continue;
+    w24_result_free(result);
+    cs->line = 0;
+}
+
+/*
+ * nextCommand: Takes the next command from the input
+ * 
+ * Return Value:
+ * - int: 1 with the command in message, 0 if none has arrived yet, -1 at the end of the input
+ */
+
+int nextCommand(char *message, size_t size) {
+    while (1) {
+        if (input.file != NULL) {
+            if (input.eof || fgets(message, size, input.file) == NULL) {
+                input.eof = 1;
+                return -1;
             }
-	    } 
-	    else if (strstr(message_copy, "w24fz ") == message_copy) {
-
-	    	char *token;
-	    	long size1, size2;
-
-	        // Tokenize the input message to extract size1 and size2
-		    token = strtok(message_copy, " ");
-		    token = strtok(NULL, " "); // Move to the next token (size1)
-
-		    if (token != NULL) {
-		        size1 = strtol(token, NULL, 10); // Convert size1 to long integer
-		        token = strtok(NULL, " "); // Move to the next token (size2)
-		        if (token != NULL) {
-		            size2 = strtol(token, NULL, 10); // Convert size2 to long integer
-		            token = strtok(NULL, " "); // Move to the next token
-		            if (token == NULL) {
-		                if(size1<0 || size2<0)
-		                {
-		                	fprintf(stderr, "Both sizes should be positive. Please try again.\n");
-
-		                	continue;
-		                }
-		                else if(size1>size2){
-		                	fprintf(stderr, "size1 should be <= size2. Please try again.\n");
-		                	continue;
-		                }
-		                else{
-		                	printf("size1: %ld, size2: %ld\n", size1, size2); // success
-		                }
-		            } else {
-		                fprintf(stderr,"Error: Only two size parameters are allowed.\n");
-		                continue;
-		            }
-		        } 
-		        else // exceeded number of sizes 
-		        {
-		            fprintf(stderr,"Error: Both size1 and size2 must be provided.\n");
-		            continue;
-		        }
-		    } // less number of sizes
-		    else {
-		        fprintf(stderr,"Error: Both size1 and size2 must be provided.\n");
-		        continue;
-		    }
-	    } 
-	    else if (strstr(message_copy, "w24ft ") == message_copy) {
-
-	    	char *token;
-		    char *file_types[3]; // Array to store file types
-		    int count = 0; // count to store number of file types
-		    int exceeded = 0; // to check for limit of extensions
-
-	    	    // Tokenize the input message to extract file types
-		    token = strtok(message_copy, " ");
-		    token = strtok(NULL, " "); // Move to the next token (first file type)
-
-		    // Store file types in the array
-		    while (token != NULL) {
-		    	if(count==3){
-		    		exceeded = 1;
-		    		fprintf(stderr, "Maximum 3 file types allowed. Please try again.\n" );
-		    		break;
-		    	}
-		    	else{
-		    		file_types[count] = strdup(token); // Store the file type
-			        count++;
-			        token = strtok(NULL, " "); // Move to the next token
-		    	}
-		    }
-
-		    if(exceeded==1)
-		    	continue;
-
-		    // Check if at least one file type is provided and at most three
-		    if (count >= 1 && count <= 3) {
-		    	// do nothing
-		    } else {
-		        printf("Error: Enter at least one and at most three file types.\n");
-		        continue;
-		    }
-	    } 
-	    else if ((strstr(message_copy, "w24fdb ") == message_copy) || (strstr(message_copy, "w24fda ") == message_copy)) {
-	        
-	        // check if excess arguments have been passed
-	        if(isWordLimitExceeded(message_copy,2)==1)
-		    {
-		    	printf("Too many arguments. Please try again\n\n");
-		    	continue;
-		    }
-
-	        char *token,*date;
-		    regex_t regex;
-		    int ret;
-
-		    token = strtok(message_copy, " "); // Tokenize the input message to extract the date
-		    token = strtok(NULL, " ");
-
-		    // Check if the date is not NULL and matches the expected format
-		    if (token != NULL) {
-		        
-		        date = strdup(token); // Store the date
-
-		        // Compile regular expression to match the date format (YYYY-MM-DD)
-		        ret = regcomp(&regex, "^[0-9]{4}-[0-9]{2}-[0-9]{2}$", REG_EXTENDED);
-
-		        if (ret == 0) {
-
-		            // Match the date against the regular expression
-		            ret = regexec(&regex, date, 0, NULL, 0);
-
-		            if (ret == 0) {
-		                // do nothing if okay
-		            } else {
-		                printf("Error: Invalid date format. Please enter date in YYYY-MM-DD format.\n");
-		                continue;
-		            }
-
-		            regfree(&regex);
-		        } else {
-		            printf("Error: Failed to compile regular expression.\n");
-		            continue;
-		        }
-
-		        free(date); // Free memory allocated by strdup
-		    } else {
-		        printf("Error: Date not provided.\n");
-		        continue;
-		    }
-	    } 
-	    else if (strcmp(message_copy, "quitc")==0) {
-	        printf("Command: quitc\n");
-	    }
-	    else {
-	        printf("Invalid command. Please try again.\n");
-	        continue;
-	    }
+        }
+        else {
+            char *newline = memchr(input.pending, '\n', input.length);
+            size_t line_length = newline != NULL ? (size_t)(newline - input.pending) : input.length;
 
-	
-		// now sending message to server
-        send(clientSocket, message, strlen(message), 0);
+            if (newline == NULL && (!input.eof || input.length == 0)) {
+                return input.eof ? -1 : 0;
+            }
+            snprintf(message, size, "%.*s", (int)line_length, input.pending);
+            line_length += newline != NULL;
+            memmove(input.pending, input.pending + line_length, input.length - line_length);
+            input.length -= line_length;
+        }
 
-        // Wait for the server's response
-        printf("Waiting for response...\n");
+        input.line++;
+
+        // Remove the newline character from the end of the input message
+        size_t length = strlen(message);
+        if (length > 0 && message[length - 1] == '\n') {
+            message[length - 1] = '\0';
+        }
+        if (input.script && (message[0] == '\0' || message[0] == '#')) {
+            continue;
+        }
+        return 1;
+    }
+}
+
+/*
+ * startCommand: Sends the next valid command on an idle session
+ * 
+ * Return Value:
+ * - int: 1 if a command was taken from the input, 0 if the session stays idle until more input arrives
+ * 
+ * Explanation:
+ * Invalid commands are reported and skipped. At the end of the input the session sends quitc, so the server
+ * releases its client count, and closes when the server answers.
+ * In batch mode (-b) nothing but the JSON line of an invalid command is printed.
+ */
 
-        memset(message, '\0', sizeof(message)); // emptying message
+int startCommand(struct w24_session *session) {
+    struct client_session *cs = w24_session_data(session);
+    char message[MAX_MSG_LENGTH];
+    enum w24_reply_shape shape = W24_REPLY_TEXT;
+    int ret;
 
-        ssize_t bytesRead = recv(clientSocket, message, sizeof(message), 0);
+    while ((ret = nextCommand(message, sizeof(message))) == 1) {
+        input.prompted = 0;
+        if (batch) {
+            char error[MAX_MSG_LENGTH];
 
-        if (bytesRead <= 0)
-        {
-            // Server disconnected or error
-            printf("Server disconnected.\n");
+            if (w24_client_check(message, &shape, error, sizeof(error))) {
+                break;
+            }
+            snprintf(cs->command, sizeof(cs->command), "%s", message);
+            cs->line = input.line;
+            printResult(cs, w24_session_port(session), error, 1);
+            continue;
+        }
+        if (num_sessions > 1) {
+            printf("[%d] %s\n", cs->index, message);
+        }
+        printf("-----------------------------------------\n");
+        if (checkCommand(message, &shape)) {
             break;
         }
-        else if(strcmp(message,"shut yourself")==0)
-        {
-        	printf("Client shutting down..\n");
-        	break;
+    }
+    if (ret == 0) {
+        if (!input.prompted && !batch) {
+            printf("Kindly enter your command: ");
+            fflush(stdout);
+            input.prompted = 1;
         }
-	
-		success_command_count+=1; //increment counter for sucess command. Used to name TAR file
-	
-        // HANDLE RESPONSES
-	
-        if(strcmp("dirlist -a", message_copy)==0){
-        	// Print server response
-        	printf("Directories under the home directory are (in alphabetical order): \n%s", message);
-        }
-        else if(strcmp("dirlist -t", message_copy)==0){
-        	printf("Directories under the home directory are (in order or creation): \n%s", message);
-        }
-        else if (strstr(message_copy2, "w24fn ") == message_copy2) {
-
-        	if(strcmp(message,"No file found")==0 || strcmp(message,"nftw failed.")==0 || strcmp(message,"Error in retrieving file stat.")==0){
-        		printf("%s\n",message);
-        		continue;
-        	}
-        	else{
-        		printf("File information: \n\n");
-
-        		printf("File name: %s\n", strtok(message_copy2 + 6, "\n"));
-        		printf("%s\n\n",message);
-        	}
-        }
-        else if((strstr(message_copy2, "w24fdb ") == message_copy2) || (strstr(message_copy2, "w24fda ") == message_copy2))
-        {
-        	if(strcmp(message,"No file found")==0){
-        		printf("No file found.\n");
-        	}
-        	else if(strcmp(message,"temp.tar.gz")==0){
-        		printf("TAR file received for dates. Saving to project folder $HOME/w24project/\n");
-        	}
-        }
-        else if(strstr(message_copy2, "w24fz ") == message_copy2){
-
-        	if(strcmp(message,"No file found")==0){
-        		printf("No file found.\n");
-        	}
-        	else if(strcmp(message,"temp.tar.gz")==0){
-        		printf("TAR file received for size constraints. Saving to project folder $HOME/w24project/\n");
-        	}
-        }
-        else if(strstr(message_copy2, "w24ft ") == message_copy2){
-
-        	if(strcmp(message,"No file found")==0){
-        		printf("No file found.\n");
-        	}
-        	else if(strcmp(message,"temp.tar.gz")==0){
-        		printf("No file found.\n");
-        		printf("TAR file received for extension list. Saving to project folder $HOME/w24project/\n");
-        	}
-        }		
-        else
-        {
-        	printf("Message from server: %s \n", message);
-        }
-        
-        sleep(1); // wait for TAR file to be saved in client side
-
-        // COPY tar file to project folder
-        if(strcmp(message,"temp.tar.gz")==0)
-        {
-            char *source_path = "temp.tar.gz"; // Current directory
-		    char *destination_path = getenv("HOME");
-		    char filename[MAX_MSG_LENGTH];
-		    int num1 = clientCount;
-		    int num2 = success_command_count;
-		    
-		    // Format the filename string with the integer variables
-		    snprintf(filename, sizeof(filename), "temp_client%d_cmd%d.tar.gz", num1, num2);
-		    
-		    if (!copy_file_to_home(source_path, destination_path, filename)) 
-		    {
-			fprintf(stderr, "Failed to copy file to home directory\n");
-			continue;
-		    }
+        return 0;
+    }
+    if (ret == -1) {
+        snprintf(message, sizeof(message), "quitc");
+        shape = W24_REPLY_TEXT;
+    }
+
+    // -d: commands without a "req" prefix of their own get one with the deadline
+    if (ret == 1 && deadline_ms > 0 && w24_client_request_prefix(message) == 0) {
+        char prefixed[MAX_MSG_LENGTH];
+
+        snprintf(prefixed, sizeof(prefixed), "req - %d %s", deadline_ms, message);
+        snprintf(message, sizeof(message), "%s", prefixed);
+    }
+
+    // the reply is printed, cached and downloaded for the command itself, without its prefix
+    int prefix_length = ret == 1 ? w24_client_request_prefix(message) : 0;
+    snprintf(cs->command, sizeof(cs->command), "%s", message + (prefix_length > 0 ? prefix_length : 0));
+    cs->line = ret == 1 ? input.line : 0;
+    clock_gettime(CLOCK_MONOTONIC, &cs->started);
+
+    // dirlist and w24fn are revalidated when their reply is cached (see w24client.h)
+    cs->conditional = ret == 1 && prefix_length == 0 && shape == W24_REPLY_TEXT && w24_client_cache_request(cs->command, w24_session_port(session), message, sizeof(message));
+    if (cs->conditional) {
+        shape = W24_REPLY_FRAME;
+    }
+
+    W24_TRACE_BEGIN_DETAIL("request", message);
+    if (w24_session_send(session, message, shape) == 0 && ret == 1 && !batch) {
+        printf("Waiting for response...\n");
+    }
+    W24_TRACE_END();
+    return 1;
+}
+
+/*
+ * dispatchCommands: Hands the commands that have arrived to the idle sessions
+ */
+
+void dispatchCommands(void) {
+    struct w24_session *session;
+
+    while ((session = w24_loop_idle_session(loop)) != NULL && startCommand(session)) {
+        // next idle session
+    }
+}
+
+/*
+ * readInput: Reads stdin when the event loop reports input, and starts the commands that arrived
+ */
+
+void readInput(int fd, void *arg) {
+    (void)arg;
+
+    if (input.size - input.length < MAX_MSG_LENGTH) {
+        char *pending = realloc(input.pending, input.size + MAX_MSG_LENGTH);
+        if (pending == NULL) {
+            perror("Cannot read commands");
+            exit(EXIT_FAILURE);
         }
+        input.pending = pending;
+        input.size += MAX_MSG_LENGTH;
+    }
+
+    ssize_t n = read(fd, input.pending + input.length, input.size - input.length);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        input.eof = 1;
+        w24_loop_unwatch(loop, fd);
+    }
+    else {
+        input.length += (size_t)n;
     }
+    dispatchCommands();
 }
 
-int main(){
-	
-    int clientSocket;
-    struct sockaddr_in serverAddr;
-    char message[MAX_MSG_LENGTH];
+void * downloadInBackground(void * arg) {
+    struct download_job *job = arg;
 
-    // Create socket
-    if ((clientSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+    W24_TRACE_BEGIN("download");
+    int downloaded = w24_client_download(&job->clientSocket, &job->port, job->archive_id, job->length, job->command, job->filename);
+    W24_TRACE_END();
+    if (!downloaded) {
+        fprintf(stderr, "Failed to download archive\n");
     }
+    ((struct client_session *)w24_session_data(job->session))->downloaded = downloaded; // read once the session is attached
 
-    // Initialize server address
-    memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = inet_addr(SERVER_IP); // add htonl()
-    serverAddr.sin_port = htons(SERVER_PORT);
+    // the session gets its connection back (-1 if it was lost for good, which closes the session)
+    w24_session_attach(job->session, job->clientSocket, job->port);
+    free(job);
+    return NULL;
+}
 
-    // Connect to server
-    if (connect(clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
-        perror("Connection failed");
-        exit(EXIT_FAILURE);
+/*
+ * startDownload: Downloads the archive announced by a reply ("ARCHIVE <id> <length> <extension>") on a thread of its own
+ * 
+ * Explanation:
+ * The archive is saved to $HOME/w24project/temp_client<count>_cmd<n><extension>. The download keeps the session's
+ * connection (see w24_client_download()), so the session is detached from the event loop until it is over; the other
+ * sessions go on meanwhile.
+ * 
+ * Return Value:
+ * - int: 1 if the download was started, 0 if the reply cannot be downloaded
+ */
+
+int startDownload(struct w24_session *session, const char *reply) {
+    struct client_session *cs = w24_session_data(session);
+    struct download_job *job = calloc(1, sizeof(*job));
+    char extension[MAX_MSG_LENGTH];
+    pthread_t thread;
+
+    if (job == NULL) {
+        perror("Failed to download archive");
+        return 0;
+    }
+    if (sscanf(reply, "ARCHIVE %4095s %llu %4095s", job->archive_id, &job->length, extension) != 3 || strchr(job->archive_id, '/') != NULL || strchr(extension, '/') != NULL) {
+        fprintf(stderr, "Malformed archive reply: %s\n", reply);
+        free(job);
+        return 0;
+    }
+
+    // Format the filename string with the client count and command number, keeping the extension of the negotiated codec
+    snprintf(job->filename, sizeof(job->filename), "%s/w24project/temp_client%d_cmd%d%s", getenv("HOME"), cs->count, cs->success_command_count, extension);
+    snprintf(job->command, sizeof(job->command), "%s", cs->command);
+    job->session = session;
+    job->port = w24_session_port(session);
+    job->clientSocket = w24_session_detach(session);
+    snprintf(cs->archive_path, sizeof(cs->archive_path), "%s", job->filename);
+    cs->downloading = 1;
+
+    if (pthread_create(&thread, NULL, downloadInBackground, job) != 0) {
+        downloadInBackground(job); // no thread: download right here, the other sessions wait
+        return 1;
     }
+    pthread_detach(thread);
+    return 1;
+}
 
-    printf("Connected to server\n");
+/*
+ * sessionReady: Called by the event loop when a session waits for a command
+ */
 
-    //receive client count from server
-    if (recv(clientSocket, message, MAX_MSG_LENGTH, 0) == -1) {
-        perror("Receive failed");
-        close(clientSocket);
-        exit(EXIT_FAILURE);
+void sessionReady(struct w24_session *session, void *arg) {
+    struct client_session *cs = w24_session_data(session);
+    (void)arg;
+
+    if (!cs->connected) {
+        cs->connected = 1;
+        cs->count = w24_session_count(session);
+        connected_sessions++;
+        if (!batch) {
+            printSessionTag(cs);
+            printf("Connected to server, client count: %d\n", cs->count);
+            if (w24_session_port(session) != SERVER_PORT) {
+                printSessionTag(cs);
+                printf("Redirected to mirror%d\n", w24_session_port(session) == MIRROR_IP_PORT1 ? 1 : 2);
+            }
+            printSessionTag(cs);
+            printf("Codecs offered: %s, server answered: %s\n", codec_offer, w24_session_codec(session));
+        }
+    }
+    if (cs->downloading) {
+        // back from the download of the last command's archive
+        cs->downloading = 0;
+        if (batch) {
+            printResult(cs, w24_session_port(session), cs->downloaded ? NULL : "download failed", 0);
+        }
     }
+    startCommand(session);
+}
 
-    clientCount = atoi(message);
-    printf("Received client count: %d\n", clientCount);
+/*
+ * batchReply: Collects the replies to a session's command and prints the result once it is complete (-b)
+ * 
+ * Explanation:
+ * The result of a command announcing an archive is printed when its download is over (see sessionReady()).
+ */
 
-    int change_connection = 0;
+void batchReply(struct w24_session *session, const struct w24_reply *reply) {
+    struct client_session *cs = w24_session_data(session);
 
-    // Conditions for switching between server and mirrors
+    if (strcmp(reply->type, "TEXT") == 0 && strcmp(reply->data, "shut yourself") == 0) {
+        if (cs->line != 0) {
+            printResult(cs, w24_session_port(session), NULL, 0); // quitc was part of the input
+        }
+        w24_session_close(session, NULL);
+        return;
+    }
+    if (w24_result_add(&cs->result, reply) == -1) {
+        w24_session_close(session, "out of memory");
+        return;
+    }
+    if (!reply->last) {
+        return;
+    }
 
-    if(clientCount>=1 && clientCount<=3){
-    	// do nothing
+    if (strcmp(reply->type, "TEXT") == 0) {
+        cs->success_command_count += 1; // names the archives, as for the interactive client
     }
-    else if(clientCount>=4 && clientCount<=6){
-    	serverAddr.sin_port = htons(MIRROR_IP_PORT1);
-    	change_connection=1;
+    if (cs->result.type != W24_RESULT_ARCHIVE) {
+        printResult(cs, w24_session_port(session), NULL, 0);
     }
-    else if(clientCount>=7 && clientCount<=9){
-    	serverAddr.sin_port = htons(MIRROR_IP_PORT2);
-    	change_connection=2;
+    else if (!startDownload(session, reply->data)) {
+        printResult(cs, w24_session_port(session), "malformed archive reply", 0);
     }
-    else if(clientCount%3==0){
-    	serverAddr.sin_port = htons(MIRROR_IP_PORT2);
-    	change_connection=2;
+}
+
+/*
+ * handleReply: Prints, or collects in batch mode, the reply to a session's command
+ */
+
+void handleReply(struct w24_session *session, const struct w24_reply *reply) {
+    struct client_session *cs = w24_session_data(session);
+
+    if (batch) {
+        batchReply(session, reply);
+        return;
+    }
+
+    if (strcmp(reply->type, "TEXT") != 0) {
+        if (num_sessions > 1 && strcmp(reply->type, "LINES") != 0 && strcmp(reply->type, "END") != 0) {
+            printf("[%d] %s\n", cs->index, cs->command);
+        }
+        printFrame(reply);
+        return;
     }
-    else if(clientCount%3==2){
-    	serverAddr.sin_port = htons(MIRROR_IP_PORT1);
-    	change_connection=1;
+
+    if (strcmp(reply->data, "shut yourself") == 0) {
+        printSessionTag(cs);
+        printf("Client shutting down..\n");
+        w24_session_close(session, NULL);
+        return;
     }
-    else if(clientCount%3==1){
-    	// do nothing
+
+    cs->success_command_count += 1; // increment counter for success command. Used to name TAR file
+    if (num_sessions > 1) {
+        printf("[%d] %s\n", cs->index, cs->command);
     }
+    printReply(cs->command, reply->data);
 
-    // Changing connections as per client count
+    // DOWNLOAD the archive to the project folder
+    if (isArchiveReply(reply->data)) {
+        startDownload(session, reply->data);
+    }
+}
 
-    if(change_connection==1){
-    	close(clientSocket); // close previous client socket
+/*
+ * sessionReply: Called by the event loop with the reply to a session's command
+ * 
+ * Explanation:
+ * The reply to a conditional request is turned into the text reply of the plain command first: the cached text
+ * when the server answered NOTMOD, or the fresh text, which is cached.
+ */
 
-    	// Create socket
-	    if ((clientSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-	        perror("Socket creation failed");
-	        exit(EXIT_FAILURE);
-	    }
+void sessionReply(struct w24_session *session, const struct w24_reply *reply, void *arg) {
+    struct client_session *cs = w24_session_data(session);
+    struct w24_reply unwrapped;
+    char *text = NULL;
+    (void)arg;
 
-	    printf("Redirecting to the mirror1...\n");
-    	// Connect to mirror
-	    if (connect(clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
-	        perror("Connection failed");
-	        exit(EXIT_FAILURE);
-	    }
+    if (cs->conditional) {
+        size_t length;
 
-	    printf("Redirected to mirror1\n");
+        cs->conditional = 0;
+        if ((text = w24_client_cache_reply(cs->command, w24_session_port(session), reply, &length)) != NULL) {
+            unwrapped = (struct w24_reply){ "TEXT", "", text, length, 1 };
+            reply = &unwrapped;
+        }
+        else if (strcmp(reply->type, "ERROR") != 0) {
+            unwrapped = (struct w24_reply){ "ERROR", "Cached reply lost, please try again.", "", 0, 1 };
+            reply = &unwrapped;
+        }
     }
-    else if(change_connection==2){
-    	close(clientSocket); // close previous client socket
+    handleReply(session, reply);
+    free(text);
+}
 
-    	// Create socket
-	    if ((clientSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-	        perror("Socket creation failed");
-	        exit(EXIT_FAILURE);
-	    }
+/*
+ * sessionClosed: Called by the event loop when a session is over
+ */
 
-	    printf("Redirecting to the mirror2...\n");
-    	// Connect to mirror
-	    if (connect(clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
-	        perror("Connection failed");
-	        exit(EXIT_FAILURE);
-	    }
+void sessionClosed(struct w24_session *session, const char *reason, void *arg) {
+    struct client_session *cs = w24_session_data(session);
+    (void)arg;
 
-	    printf("Redirected to mirror2\n");
+    if (batch) {
+        if (cs->line != 0) {
+            // the command in flight, or the download of its archive, is lost with the connection
+            printResult(cs, w24_session_port(session), reason != NULL ? reason : "connection closed", 0);
+        }
+        if (reason != NULL && !cs->connected) {
+            fprintf(stderr, "[%d] Connection failed: %s\n", cs->index, reason);
+        }
     }
+    else if (reason != NULL) {
+        printSessionTag(cs);
+        if (cs->connected) {
+            printf("Server disconnected (%s).\n", reason);
+        }
+        else {
+            printf("Connection failed: %s\n", reason);
+        }
+    }
+    w24_result_free(&cs->result);
+    free(cs);
+}
 
-    // creating thread and waiting for client to finish
-    
-    pthread_t server_write_thread;
+/*
+ * main: Runs the client's sessions until the input ends
+ * 
+ * Explanation:
+ * -j sets how many sessions run at once (1 by default); each connects on its own, so the server's client count
+ * spreads them over the server and both mirrors. Commands are read from stdin, or from the script given with -f,
+ * and each goes to the next idle session; with one session this is the interactive client as before.
+ * All sessions share one thread running the event loop; only archive downloads get threads of their own.
+ * -b runs the commands as a batch for other programs: input lines are taken like a script and each command's
+ * outcome is printed as one JSON line (see printResult()), in the order the replies arrive; the exit status
+ * is nonzero if any command failed.
+ * -d gives every command a deadline: the server stops working on it after that many milliseconds and answers
+ * "Request stopped: deadline exceeded". A command typed as "req <id> <deadline_ms> <command>" can also be stopped
+ * with "cancel <id>" from another client (see w24cancel.h).
+ */
 
-    if (pthread_create(&server_write_thread, NULL, write_to_server, (void *)&clientSocket) != 0)
-    {
-        perror("Error creating threads");
+int main(int argc, char *argv[]){
+	
+    const char *script = NULL;
+    int opt;
+
+    // codecs we can unpack, most preferred first; -c overrides the list, -l sets the preferred level
+    w24_codec_local_offer(codec_offer, sizeof(codec_offer));
+    while ((opt = getopt(argc, argv, "c:l:f:j:d:bn")) != -1) {
+        if (opt == 'c') {
+            snprintf(codec_offer, sizeof(codec_offer), "%s", optarg);
+        }
+        else if (opt == 'l') {
+            codec_level = atoi(optarg);
+        }
+        else if (opt == 'f') {
+            script = optarg;
+        }
+        else if (opt == 'j' && atoi(optarg) >= 1 && atoi(optarg) <= W24_SESSION_MAX) {
+            num_sessions = atoi(optarg);
+        }
+        else if (opt == 'b') {
+            batch = 1;
+        }
+        else if (opt == 'n') {
+            use_cache = 0;
+        }
+        else if (opt == 'd' && atoi(optarg) >= 0) {
+            deadline_ms = atoi(optarg);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-c codec,codec,...] [-l compression_level] [-f script] [-j sessions] [-d deadline_ms] [-b] [-n]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    w24_trace_init("client"); // spans are recorded only when W24_TRACE_DIR is set
+
+    signal(SIGPIPE, SIG_IGN); // a dropped connection is reported by send() and handled by the download retry
+
+    struct w24_session_config config = { SERVER_IP, SERVER_PORT, MIRROR_IP, { MIRROR_IP_PORT1, MIRROR_IP_PORT2 }, codec_offer, codec_level, HEARTBEAT_INTERVAL };
+    struct w24_session_handler handler = { sessionReady, sessionReply, sessionClosed };
+
+    w24_client_init(&config, batch ? NULL : stdout); // downloads report their progress, except in batch mode
+    if (use_cache) {
+        char cache_directory[MAX_MSG_LENGTH];
+
+        snprintf(cache_directory, sizeof(cache_directory), "%s/w24project/.cache", getenv("HOME"));
+        w24_client_cache_init(cache_directory); // without it every reply is fetched in full
+    }
+
+    if ((loop = w24_loop_new(&config, &handler, NULL)) == NULL) {
+        perror("Event loop creation failed");
         exit(EXIT_FAILURE);
     }
 
-    // Wait for both threads to finish
-    pthread_join(server_write_thread, NULL);
+    if (script != NULL) {
+        if ((input.file = fopen(script, "r")) == NULL) {
+            perror("Cannot open script");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (w24_loop_watch(loop, STDIN_FILENO, readInput, NULL) == -1) {
+        input.file = stdin; // a regular file: read when a session needs a command
+    }
+    input.script = script != NULL || batch;
+
+    for (int i = 1; i <= num_sessions; i++) {
+        struct client_session *cs = calloc(1, sizeof(*cs));
+        if (cs == NULL || w24_session_open(loop, cs) == NULL) {
+            perror("Socket creation failed");
+            free(cs);
+            continue;
+        }
+        cs->index = i;
+    }
 
-    // Close socket
-    close(clientSocket);
+    if (w24_loop_run(loop) == -1) {
+        perror("Event loop failed");
+    }
+    w24_loop_free(loop);
+    if (input.file != NULL && input.file != stdin) {
+        fclose(input.file);
+    }
+    free(input.pending);
 
-    return 0;
+    if (batch && (failed_commands > 0 || !input.eof)) {
+        return EXIT_FAILURE; // commands failed, or were left unsent when the sessions were lost
+    }
+    return connected_sessions > 0 ? 0 : EXIT_FAILURE;
 }
@@ -4,8 +4,7 @@
   TImestamp: 14-04-2024 23:50:00 EST
 */
 
-#define _XOPEN_SOURCE 500
-#include <ftw.h>
+#define _GNU_SOURCE // getopt_long, gettid, sched_setaffinity, statx
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,269 +17,2204 @@
 #include <sys/types.h>
 #include <time.h>
 #include <errno.h>
+#include <fnmatch.h>
+#include <locale.h>
 #include <libgen.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <signal.h>
+#include <zlib.h>
+
+#include "w24log.h"
+#include "w24trace.h"
+#include "w24pgzip.h"
+#include "w24codec.h"
+#include "w24zip.h"
+#include "w24metrics.h"
+#include "w24cache.h"
+#include "w24proto.h"
+#include "w24listen.h"
+#include "w24io.h"
+#include "w24scan.h"
+#include "w24match.h"
+#include "w24pattern.h"
+#include "w24grep.h"
+#include "w24fuzzy.h"
+#include "w24agg.h"
+#include "w24gen.h"
+#include "w24delta.h"
+#include "w24admit.h"
+#include "w24prio.h"
+#include "w24cancel.h"
 
-#define PORT 4500
 #define SERVER_IP "127.0.0.1"
 #define MAX_MSG_LENGTH 4096
 #define SERVER_PORT 4500
+#define THREAD_STACK_SIZE (16 * 1024 * 1024) // request handlers keep several MAX_BUFFER_LENGTH buffers on the stack
 #define MAX_BUFFER_LENGTH 1000000
 #define MAX_DATE_LENGTH 100
 #define MAX_PATH_LENGTH 4096
 #define MAX_EXTENSIONS 3
 #define MAX_EXTENSION_LENGTH 100
+#define MAX_GREP_LINES 10000 // matching lines sent for one w24grep request
+#define MAX_GREP_LINE_LENGTH 256 // longer matching lines are cut
+#define GREP_CHUNK_SIZE (64 * 1024) // matching lines are sent in framed chunks of about this size
+#define MAX_PEERS 8 // nodes named by --peers
+
+enum server_role { ROLE_PRIMARY, ROLE_MIRROR };
+enum concurrency_mode { MODE_FORK, MODE_THREAD };
+
+int *client_count_server; // counter for number of clients (primary only), shared by all acceptors and updated atomically
+const char *server_name; // --name
+int acceptor_count = 1; // --acceptors: SO_REUSEPORT listening sockets, each with its own pinned acceptor
+int cpu_steering = 0; // --cpu-steering: pick the acceptor by the CPU a connection arrives on
+cpu_set_t server_cpus; // CPUs the server may use; handlers run on all of them, not on their acceptor's
+pthread_attr_t handler_attr; // detached, THREAD_STACK_SIZE stack (--mode thread)
+int listen_fds[W24_LISTEN_MAX_ACCEPTORS]; // one listening socket per acceptor
+enum server_role server_role = ROLE_PRIMARY; // --role: the primary counts clients and redirects some to the mirrors
+enum concurrency_mode concurrency_mode = MODE_FORK; // --mode: a process or a thread per connection
+char server_root[MAX_PATH_LENGTH]; // --root: directory tree served to clients (default $HOME)
+int compress_threads = 0; // archive compression threads, set with -j (0: one per CPU)
+long cache_quota_mb = W24_CACHE_DEFAULT_QUOTA_MB; // archive store quota, set with -q (0: keep only the newest archive)
+int compress_level = 0; // default level for the negotiated codec, set with -l (0: codec default)
+char fuzzy_index_path[MAX_PATH_LENGTH]; // trigram index of the names under the root (w24fuzzy), named after the node
+int idle_timeout = W24_LISTEN_IDLE_TIMEOUT; // --idle-timeout: seconds a session may wait for a command (0: forever)
+int keepalive_idle = W24_LISTEN_KEEPALIVE_IDLE; // --keepalive idle,interval,count (idle 0: off)
+int keepalive_interval = W24_LISTEN_KEEPALIVE_INTERVAL;
+int keepalive_count = W24_LISTEN_KEEPALIVE_COUNT;
+struct w24_admit_limits admit_limits[W24_ADMIT_CLASSES] = { // --lookups, --archives: slots, queue length and longest wait;
+    [W24_ADMIT_LOOKUP] = { 0, 64, 2000, 4 },                    // --weights: share of the workers (see w24admit.h)
+    [W24_ADMIT_ARCHIVE] = { 2, 32, 15000, 1 },                  // running 0 here: twice the CPUs, set in main()
+};
+int admit_workers = 0; // --workers: commands of both classes run at once (0 here: twice the CPUs, set in main())
+struct w24_prio bulk_priority = { W24_PRIO_BULK_NICE, W24_PRIO_IO_BEST_EFFORT, W24_PRIO_BULK_IO_LEVEL }; // --bulk-priority: of archive writers
+pthread_attr_t bulk_attr; // joinable, THREAD_STACK_SIZE stack: the thread write_archive() runs on
+int peer_ports[MAX_PEERS]; // --peers: nodes suggested to the clients turned away with BUSY, in turn
+int peer_count = 0;
 
-char file_paths[1][MAX_PATH_LENGTH]; // Array to store file paths
-int num_files = 0; // Counter for the number of files
-int client_count_server = 0; // counter for number of clients
-char * user_file_name;
+/*
+ * file_query: What a w24fz, w24fdb/w24fda or w24ft request matches; hidden files are never matched
+ */
+
+enum query_kind { QUERY_SIZE, QUERY_DATE, QUERY_EXTENSIONS };
+
+struct file_query {
+    enum query_kind kind;
+    long min_size, max_size; // QUERY_SIZE: min_size < size < max_size
+    const char *date; // QUERY_DATE: birth date, YYYY-MM-DD
+    int before; // QUERY_DATE: born on or before date (w24fdb), or on or after it (w24fda)
+    char patterns[MAX_EXTENSIONS][MAX_EXTENSION_LENGTH + 3]; // QUERY_EXTENSIONS: "*.ext"
+    int num_patterns;
+    struct w24_match suffixes; // QUERY_EXTENSIONS: ".ext" of every pattern, when none is a glob
+    int literal; // whether suffixes is used instead of fnmatch()
+};
+
+struct query_scan {
+    const struct file_query *query;
+    FILE *out;
+};
+
+/*
+ * format_birth_time: Formats a birth time like stat --format=%w
+ *
+ * Parameters:
+ * - entry: Scanned entry, fetched with W24_SCAN_BTIME
+ * - buffer, size: Receives "YYYY-MM-DD HH:MM:SS.nnnnnnnnn +zzzz" in local time, or "-" when the file system has no birth time
+ */
+
+void format_birth_time(const struct w24_scan_entry *entry, char *buffer, size_t size) {
+    struct tm tm;
+    time_t seconds = (time_t)entry->btime_sec;
+    char zone[16];
+
+    if (!entry->has_btime || localtime_r(&seconds, &tm) == NULL) {
+        snprintf(buffer, size, "-");
+        return;
+    }
+    strftime(zone, sizeof(zone), "%z", &tm);
+    size_t len = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buffer + len, size - len, ".%09u %s", (unsigned)entry->btime_nsec, zone);
+}
+
+/*
+ * send_text: Sends a text reply as a "TEXT <length> [<generation>]" frame
+ * 
+ * Parameters:
+ * - client_fd: The client's socket
+ * - text: The reply
+ * - generation: Generation of the tree the reply was built from (see w24gen.h), "" for a plain request
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 if the send failed
+ * 
+ * Explanation:
+ * Every reply to a command is framed, so the client reads exactly the reply however many segments it takes,
+ * and a long dirlist or w24fn reply is not cut at what happened to be readable.
+ */
+
+int send_text(int client_fd, const char *text, const char *generation) {
+    return w24_proto_send_frame(client_fd, "TEXT", generation[0] != '\0' ? generation : NULL, text, strlen(text));
+}
+
+/*
+ * send_error: Answers a command that failed with why, as text or as an ERROR frame like the command's other errors
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 if the send failed (the socket is then shut down)
+ */
+
+int send_error(int client_fd, int framed, const char *text) {
+    if ((framed ? w24_proto_send_header(client_fd, "ERROR", 0, text) : send_text(client_fd, text, "")) == -1) {
+        perror("Send failed");
+        shutdown(client_fd, SHUT_RDWR);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * reply_if_stopped: Answers a command whose request stopped (see w24cancel.h) instead of its result
+ * 
+ * Parameters:
+ * - client_fd: The client's socket, shut down if the reply cannot be sent
+ * - framed: Whether the command is answered with frames: the reply is then an ERROR frame rather than text
+ * 
+ * Return Value:
+ * - int: 1 if the request stopped and was answered "Request stopped: <reason>", 0 if it goes on
+ */
+
+int reply_if_stopped(int client_fd, int framed) {
+    int reason = w24_cancel_checkpoint();
+    char reply[64];
+
+    if (reason == W24_CANCEL_NONE) {
+        return 0;
+    }
+    if (reason == W24_CANCEL_CANCELLED) {
+        W24_METRICS_ADD(requests_cancelled, 1);
+    }
+    else if (reason == W24_CANCEL_DEADLINE) {
+        W24_METRICS_ADD(requests_expired, 1);
+    }
+    else {
+        W24_METRICS_ADD(requests_abandoned, 1);
+    }
+    w24_log(W24_LOG_INFO, "Request stopped: %s", w24_cancel_reason_name(reason));
+    w24_cancel_end(w24_cancel_current()); // a "cancel" arriving after the reply no longer finds it
+
+    snprintf(reply, sizeof(reply), "Request stopped: %s", w24_cancel_reason_name(reason));
+    send_error(client_fd, framed, reply);
+    return 1;
+}
+
+/*
+ * match_file: Scanner callback that writes the path of every file matching a query to the result list
+ * 
+ * Return Value:
+ * - int: 0 to continue the scan, 1 to stop it if the list cannot be written or the request stopped (w24cancel.h)
+ * 
+ * Explanation:
+ * Sizes compare strictly, as find -size +Nc -size -Mc did. Birth dates compare as YYYY-MM-DD strings in local time, as the
+ * former find | stat | awk pipeline did; files without a recorded birth time never match. Plain extensions were already
+ * matched by the scanner's vectorized suffix filter; extensions containing glob characters match with fnmatch("*.ext"),
+ * like find -name.
+ */
+
+int match_file(const struct w24_scan_entry *entry, void *arg) {
+    struct query_scan *scan = arg;
+    const struct file_query *query = scan->query;
+    int match = 0;
+
+    if (w24_cancel_checkpoint() != W24_CANCEL_NONE) {
+        return 1;
+    }
+    if (query->kind == QUERY_SIZE) {
+        match = (long long)entry->size > query->min_size && (long long)entry->size < query->max_size;
+    }
+    else if (query->kind == QUERY_DATE) {
+        char birth[MAX_DATE_LENGTH];
+        format_birth_time(entry, birth, sizeof(birth));
+        if (entry->has_btime) {
+            birth[10] = '\0'; // YYYY-MM-DD
+            match = query->before ? strcmp(birth, query->date) <= 0 : strcmp(birth, query->date) >= 0;
+        }
+    }
+    else if (query->literal) {
+        match = 1; // only names passing the suffix filter are visited
+    }
+    else {
+        for (int i = 0; i < query->num_patterns && !match; i++) {
+            match = fnmatch(query->patterns[i], entry->name, 0) == 0;
+        }
+    }
+
+    if (match && fprintf(scan->out, "%s\n", entry->path) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * find_files: Lists the regular files under the server root that match a query
+ * 
+ * Parameters:
+ * - query: What to match
+ * 
+ * Return Value:
+ * - FILE *: The matching paths, one per line, read from the start; NULL on failure
+ * 
+ * Explanation:
+ * Replaces the find pipelines: the tree is walked with w24_scan(), which takes file types from getdents64 and only stats
+ * the regular files, for just the field the query needs (the size for w24fz, the birth time for w24fdb/w24fda, nothing
+ * for w24ft, whose extensions are matched in bulk per directory by w24match). The list is returned in a temporary file so callers read it like the former pipe.
+ */
+
+FILE *find_files(const struct file_query *query) {
+    struct query_scan scan = { query, tmpfile() };
+    unsigned flags = W24_SCAN_REGULAR;
+
+    if (scan.out == NULL) {
+        return NULL;
+    }
+    if (query->kind == QUERY_SIZE) {
+        flags |= W24_SCAN_SIZE;
+    }
+    else if (query->kind == QUERY_DATE) {
+        flags |= W24_SCAN_BTIME;
+    }
+
+    if (w24_scan(server_root, flags, query->kind == QUERY_EXTENSIONS && query->literal ? &query->suffixes : NULL, match_file, &scan) != 0 ||
+        fflush(scan.out) == EOF) {
+        fclose(scan.out);
+        return NULL;
+    }
+    rewind(scan.out);
+    return scan.out;
+}
+
+/*
+ * find_by_name: Scanner callback for w24fn that stops at the first non-directory named like the request
+ * 
+ * Explanation:
+ * Like the nftw() traversal it replaces, hidden directories are searched too and symbolic links are not followed.
+ * No entry is stat'ed during the search: the name and the type come from getdents64, and the scanner only calls this
+ * for names that passed its vectorized filter (w24_match_name_init), so it does not compare again.
+ */
+
+struct name_search {
+    struct w24_match name;
+    char path[MAX_PATH_LENGTH];
+    int found;
+};
+
+int find_by_name(const struct w24_scan_entry *entry, void *arg) {
+    struct name_search *search = arg;
+
+    snprintf(search->path, sizeof(search->path), "%s", entry->path);
+    w24_log(W24_LOG_INFO, "Matched file path: %s", search->path); // buffered, never blocks the traversal
+    search->found = 1;
+    return 1; // terminate traversal
+}
+
+/*
+ * directory_list: Lists the non-hidden directories under the server root, the root included (dirlist -a and -t)
+ */
+
+struct directory_entry {
+    char *path;
+    int has_btime;
+    int64_t btime_sec;
+    uint32_t btime_nsec;
+};
+
+struct directory_list {
+    struct directory_entry *entries;
+    size_t count, capacity;
+};
+
+int collect_directory(const struct w24_scan_entry *entry, void *arg) {
+    struct directory_list *list = arg;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity * 2 + 64;
+        struct directory_entry *grown = realloc(list->entries, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return 1;
+        }
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    list->entries[list->count].path = strdup(entry->path);
+    if (list->entries[list->count].path == NULL) {
+        return 1;
+    }
+    list->entries[list->count].has_btime = entry->has_btime;
+    list->entries[list->count].btime_sec = entry->btime_sec;
+    list->entries[list->count].btime_nsec = entry->btime_nsec;
+    list->count++;
+    return 0;
+}
+
+// dirlist -a: by name, as sort(1) orders them
+int compare_directory_name(const void *a, const void *b) {
+    return strcoll(((const struct directory_entry *)a)->path, ((const struct directory_entry *)b)->path);
+}
+
+// dirlist -t: newest first; directories without a birth time last, as "-" sorted in sort -r
+int compare_directory_birth(const void *a, const void *b) {
+    const struct directory_entry *x = a, *y = b;
+
+    if (x->has_btime != y->has_btime) {
+        return y->has_btime - x->has_btime;
+    }
+    if (x->has_btime && (x->btime_sec != y->btime_sec || x->btime_nsec != y->btime_nsec)) {
+        return (x->btime_sec != y->btime_sec) ? (x->btime_sec < y->btime_sec ? 1 : -1) : (x->btime_nsec < y->btime_nsec ? 1 : -1);
+    }
+    return strcoll(y->path, x->path);
+}
+
+/*
+ * list_directories: Builds the reply to dirlist -a or dirlist -t
+ * 
+ * Parameters:
+ * - by_birth: 0 to sort by name, 1 to sort newest first
+ * - buffer, size: Receives the paths, one per line (truncated to fit)
+ * 
+ * Return Value:
+ * - size_t: Number of directories listed; 0 if the root could not be scanned
+ * 
+ * Explanation:
+ * Only directories are visited and their type comes from getdents64, so dirlist -a stats nothing; dirlist -t fetches
+ * just the birth time of each directory.
+ */
+
+size_t list_directories(int by_birth, char *buffer, size_t size) {
+    struct directory_list list = { NULL, 0, 0 };
+    size_t len = 0;
+
+    buffer[0] = '\0';
+    if (w24_scan(server_root, W24_SCAN_DIRECTORIES | (by_birth ? W24_SCAN_BTIME : 0), NULL, collect_directory, &list) == -1) {
+        perror("Directory scan failed");
+    }
+    qsort(list.entries, list.count, sizeof(*list.entries), by_birth ? compare_directory_birth : compare_directory_name);
+
+    for (size_t i = 0; i < list.count; i++) {
+        size_t path_len = strlen(list.entries[i].path);
+        if (len + path_len + 2 <= size) {
+            memcpy(buffer + len, list.entries[i].path, path_len);
+            len += path_len;
+            buffer[len++] = '\n';
+            buffer[len] = '\0';
+        }
+        free(list.entries[i].path);
+    }
+    free(list.entries);
+    return list.count;
+}
+
+/*
+ * pattern_search: A w24fg/w24fr search, split by the entries of the server root so that worker threads can take them
+ * one at a time; each subtree's matches are kept apart and joined in scan order at the end
+ */
+
+struct subtree {
+    char *path; // entry of the server root
+    int is_directory;
+    char *matches; // paths, one per line (open_memstream)
+    size_t length;
+    size_t count;
+};
+
+struct pattern_search {
+    const struct w24_pattern *pattern;
+    struct subtree *subtrees;
+    size_t count, capacity;
+    size_t next; // next subtree to search, taken atomically by the workers
+    int root_seen;
+    int failed; // a subtree's results could not be kept, or the request stopped
+    struct w24_request *request; // adopted by the workers for their checkpoints
+};
+
+struct subtree_scan {
+    const struct w24_pattern *pattern;
+    struct subtree *subtree;
+    FILE *out;
+    int *failed;
+};
+
+int collect_subtree(const struct w24_scan_entry *entry, void *arg) {
+    struct pattern_search *search = arg;
+
+    if (!search->root_seen) { // the root itself comes first
+        search->root_seen = 1;
+        return 0;
+    }
+    if (search->count == search->capacity) {
+        size_t capacity = search->capacity * 2 + 64;
+        struct subtree *grown = realloc(search->subtrees, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return 1;
+        }
+        search->subtrees = grown;
+        search->capacity = capacity;
+    }
+    memset(&search->subtrees[search->count], 0, sizeof(search->subtrees[0]));
+    search->subtrees[search->count].path = strdup(entry->path);
+    search->subtrees[search->count].is_directory = entry->type == DT_DIR;
+    if (search->subtrees[search->count].path == NULL) {
+        return 1;
+    }
+    search->count++;
+    return 0;
+}
+
+int match_pattern(const struct w24_scan_entry *entry, void *arg) {
+    struct subtree_scan *scan = arg;
+
+    if (w24_cancel_checkpoint() != W24_CANCEL_NONE) {
+        __atomic_store_n(scan->failed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    if (w24_pattern_match(scan->pattern, entry->name, strlen(entry->name))) {
+        scan->subtree->count++;
+        return fprintf(scan->out, "%s\n", entry->path) < 0;
+    }
+    return 0;
+}
+
+void *search_subtrees(void *arg) {
+    struct pattern_search *search = arg;
+    size_t i;
+
+    w24_cancel_adopt(search->request);
+    while (!__atomic_load_n(&search->failed, __ATOMIC_RELAXED) && (i = __atomic_fetch_add(&search->next, 1, __ATOMIC_RELAXED)) < search->count) {
+        struct subtree *subtree = &search->subtrees[i];
+        struct subtree_scan scan = { search->pattern, subtree, open_memstream(&subtree->matches, &subtree->length), &search->failed };
+
+        if (scan.out == NULL) {
+            __atomic_store_n(&search->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (subtree->is_directory) {
+            w24_scan(subtree->path, W24_SCAN_REGULAR, NULL, match_pattern, &scan);
+        }
+        else {
+            struct w24_scan_entry entry = { .path = subtree->path, .name = strrchr(subtree->path, '/') + 1, .type = DT_REG };
+            match_pattern(&entry, &scan);
+        }
+        fclose(scan.out);
+    }
+    return NULL;
+}
+
+/*
+ * find_by_pattern: Lists the regular files under the server root whose name matches a compiled glob or regular expression
+ * 
+ * Parameters:
+ * - pattern: Compiled once per request (w24_pattern_compile)
+ * - count: Receives the number of matches
+ * 
+ * Return Value:
+ * - FILE *: The matching paths, one per line, read from the start; NULL on failure
+ * 
+ * Explanation:
+ * The entries of the root are listed first (W24_SCAN_SHALLOW); then one thread per CPU takes them one by one and scans
+ * each subtree, testing names against the pattern's DFA without any stat. Hidden files are skipped, as in the other
+ * queries. Joining the per-subtree results in the order they were listed gives exactly the order of a single scan, so
+ * the list, and the archive store key of an archive built from it, does not depend on the number of threads.
+ */
+
+FILE *find_by_pattern(const struct w24_pattern *pattern, size_t *count) {
+    struct pattern_search search = { .pattern = pattern, .request = w24_cancel_current() };
+    FILE *out = NULL;
+    int ret;
+
+    *count = 0;
+    ret = w24_scan(server_root, W24_SCAN_REGULAR | W24_SCAN_DIRECTORIES | W24_SCAN_SHALLOW, NULL, collect_subtree, &search);
+
+    if (ret == 0) {
+        w24_scan_run_workers(w24_scan_default_workers(), search.count, search_subtrees, &search, 0);
+        out = tmpfile();
+    }
+
+    for (size_t i = 0; i < search.count; i++) {
+        struct subtree *subtree = &search.subtrees[i];
+        if (out != NULL && subtree->length > 0 && fwrite(subtree->matches, 1, subtree->length, out) != subtree->length) {
+            fclose(out);
+            out = NULL;
+        }
+        *count += subtree->count;
+        free(subtree->matches);
+        free(subtree->path);
+    }
+    free(search.subtrees);
+
+    if (out != NULL && (search.failed || fflush(out) == EOF)) {
+        fclose(out);
+        out = NULL;
+    }
+    if (out != NULL) {
+        rewind(out);
+    }
+    return out;
+}
+
+/*
+ * aggregate_scan: A w24top or w24agg request, computed in one pass: the subtrees under the root are shared out to one
+ * thread per CPU and every thread aggregates into its own part (w24agg), merged into the first one at the end
+ */
+
+enum aggregate_kind { AGGREGATE_LARGEST, AGGREGATE_NEWEST, AGGREGATE_EXTENSIONS, AGGREGATE_DIRECTORIES };
+
+struct aggregate_scan;
+
+struct aggregate_part {
+    struct aggregate_scan *scan;
+    struct w24_top top; // w24top
+    struct w24_totals totals; // w24agg
+    const char *directory; // AGGREGATE_DIRECTORIES: top-level directory being scanned, "." for the files of the root
+    int failed;
+};
+
+struct aggregate_scan {
+    enum aggregate_kind kind;
+    char **subtrees; // directories under the root
+    size_t count, capacity;
+    size_t next; // next subtree to scan, taken atomically by the workers
+    int root_seen;
+    struct w24_request *request; // adopted by the workers for their checkpoints
+    struct aggregate_part parts[W24_SCAN_MAX_WORKERS];
+};
+
+int aggregate_file(const struct w24_scan_entry *entry, void *arg) {
+    struct aggregate_part *part = arg;
+    const char *extension = strrchr(entry->name, '.');
+    int ret = 0;
+
+    if (w24_cancel_checkpoint() != W24_CANCEL_NONE) {
+        part->failed = 1;
+        return 1;
+    }
+    switch (part->scan->kind) {
+    case AGGREGATE_LARGEST:
+        ret = w24_top_offer(&part->top, (int64_t)entry->size, 0, entry->path);
+        break;
+    case AGGREGATE_NEWEST:
+        if (entry->has_btime) { // like w24fdb/w24fda, files without a birth time are left out
+            ret = w24_top_offer(&part->top, entry->btime_sec, entry->btime_nsec, entry->path);
+        }
+        break;
+    case AGGREGATE_EXTENSIONS:
+        if (extension == NULL || extension == entry->name) {
+            extension = "(none)";
+        }
+        else {
+            extension++;
+        }
+        ret = w24_totals_add(&part->totals, extension, strlen(extension), 1, entry->size);
+        break;
+    case AGGREGATE_DIRECTORIES:
+        ret = w24_totals_add(&part->totals, part->directory, strlen(part->directory), 1, entry->size);
+        break;
+    }
+    part->failed |= ret == -1;
+    return ret == -1;
+}
+
+int collect_aggregate(const struct w24_scan_entry *entry, void *arg) {
+    struct aggregate_scan *scan = arg;
+
+    if (!scan->root_seen) { // the root itself comes first
+        scan->root_seen = 1;
+        return 0;
+    }
+    if (entry->type != DT_DIR) {
+        scan->parts[0].directory = ".";
+        return aggregate_file(entry, &scan->parts[0]);
+    }
+    if (scan->count == scan->capacity) {
+        size_t capacity = scan->capacity * 2 + 64;
+        char **grown = realloc(scan->subtrees, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return 1;
+        }
+        scan->subtrees = grown;
+        scan->capacity = capacity;
+    }
+    if ((scan->subtrees[scan->count] = strdup(entry->path)) == NULL) {
+        return 1;
+    }
+    scan->count++;
+    return 0;
+}
+
+void *aggregate_subtrees(void *arg) {
+    struct aggregate_part *part = arg;
+    struct aggregate_scan *scan = part->scan;
+    unsigned flags = W24_SCAN_REGULAR | (scan->kind == AGGREGATE_NEWEST ? W24_SCAN_BTIME : W24_SCAN_SIZE);
+    size_t i;
+
+    w24_cancel_adopt(scan->request);
+    while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) < scan->count && !part->failed) {
+        part->directory = strrchr(scan->subtrees[i], '/') + 1;
+        if (w24_scan(scan->subtrees[i], flags, NULL, aggregate_file, part) == 1) {
+            part->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * aggregate_tree: Computes a w24top or w24agg table over the regular files under the server root
+ * 
+ * Parameters:
+ * - kind: What to compute
+ * - k: Rows of a top-k (w24top)
+ * - table: Receives the rows, tab separated, a header line first (malloc'ed)
+ * - length, rows: Receive its length and its number of rows, header excluded
+ * 
+ * Return Value:
+ * - int: 0, -1 if the tree could not be scanned or memory is short
+ * 
+ * Explanation:
+ * Hidden files are skipped, as in the other queries. Only the metadata the table needs is fetched: sizes, or birth times
+ * for the newest files. w24top rows are "<size>\t<path>" (largest first) or "<birth time>\t<path>" (newest first);
+ * w24agg rows are "<extension or top-level directory>\t<files>\t<bytes>", most bytes first, then a TOTAL row.
+ */
+
+int aggregate_tree(enum aggregate_kind kind, int k, char **table, size_t *length, size_t *rows) {
+    struct aggregate_scan *scan = calloc(1, sizeof(*scan));
+    int wanted = w24_scan_default_workers(), ret = -1;
+    unsigned flags = W24_SCAN_SHALLOW | W24_SCAN_REGULAR | W24_SCAN_DIRECTORIES | (kind == AGGREGATE_NEWEST ? W24_SCAN_BTIME : W24_SCAN_SIZE);
+    FILE *out = open_memstream(table, length);
+
+    *rows = 0;
+    if (scan == NULL || out == NULL) {
+        free(scan);
+        if (out != NULL) {
+            fclose(out);
+            free(*table);
+        }
+        return -1;
+    }
+    scan->kind = kind;
+    scan->request = w24_cancel_current();
+    for (int i = 0; i < wanted; i++) {
+        scan->parts[i].scan = scan;
+        if (kind == AGGREGATE_LARGEST || kind == AGGREGATE_NEWEST ? w24_top_init(&scan->parts[i].top, k) : w24_totals_init(&scan->parts[i].totals)) {
+            wanted = i; // use the parts that could be set up
+            break;
+        }
+    }
+
+    if (wanted > 0 && w24_scan(server_root, flags, NULL, collect_aggregate, scan) == 0) {
+        // every worker aggregates into its own part, the calling thread into the first
+        w24_scan_run_workers(wanted, scan->count, aggregate_subtrees, scan->parts, sizeof(scan->parts[0]));
+
+        ret = 0;
+        for (int i = 0; i < wanted; i++) {
+            if (scan->parts[i].failed) {
+                ret = -1;
+            }
+            if (i > 0 && (kind == AGGREGATE_LARGEST || kind == AGGREGATE_NEWEST ? w24_top_merge(&scan->parts[0].top, &scan->parts[i].top) :
+                                                                                  w24_totals_merge(&scan->parts[0].totals, &scan->parts[i].totals)) == -1) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && (kind == AGGREGATE_LARGEST || kind == AGGREGATE_NEWEST)) {
+        struct w24_top *top = &scan->parts[0].top;
+
+        w24_top_sort(top);
+        fprintf(out, kind == AGGREGATE_LARGEST ? "BYTES\tPATH\n" : "BIRTH\tPATH\n");
+        for (int i = 0; i < top->count; i++) {
+            if (kind == AGGREGATE_LARGEST) {
+                fprintf(out, "%lld\t%s\n", (long long)top->items[i].key, top->items[i].path);
+            }
+            else {
+                struct w24_scan_entry entry = { .has_btime = 1, .btime_sec = top->items[i].key, .btime_nsec = (uint32_t)top->items[i].key2 };
+                char birth[MAX_DATE_LENGTH];
+                format_birth_time(&entry, birth, sizeof(birth));
+                fprintf(out, "%s\t%s\n", birth, top->items[i].path);
+            }
+        }
+        *rows = (size_t)top->count;
+    }
+    else if (ret == 0) {
+        struct w24_total *totals = w24_totals_sorted(&scan->parts[0].totals);
+        uint64_t files = 0, bytes = 0;
+
+        if (totals == NULL) {
+            ret = -1;
+        }
+        else {
+            fprintf(out, "%s\tFILES\tBYTES\n", kind == AGGREGATE_EXTENSIONS ? "EXTENSION" : "DIRECTORY");
+            for (size_t i = 0; i < scan->parts[0].totals.count; i++) {
+                fprintf(out, "%s\t%llu\t%llu\n", totals[i].key, (unsigned long long)totals[i].files, (unsigned long long)totals[i].bytes);
+                files += totals[i].files;
+                bytes += totals[i].bytes;
+            }
+            fprintf(out, "TOTAL\t%llu\t%llu\n", (unsigned long long)files, (unsigned long long)bytes);
+            *rows = scan->parts[0].totals.count + 1;
+            free(totals);
+        }
+    }
+
+    for (int i = 0; i < wanted; i++) {
+        if (kind == AGGREGATE_LARGEST || kind == AGGREGATE_NEWEST) {
+            w24_top_free(&scan->parts[i].top);
+        }
+        else {
+            w24_totals_free(&scan->parts[i].totals);
+        }
+    }
+    for (size_t i = 0; i < scan->count; i++) {
+        free(scan->subtrees[i]);
+    }
+    free(scan->subtrees);
+    free(scan);
+    if (fclose(out) == EOF) {
+        ret = -1;
+    }
+    if (ret == -1) {
+        free(*table);
+        *table = NULL;
+    }
+    return ret;
+}
+
+/*
+ * grep_request: A w24grep request, its content pattern and the filters of the other commands that pick the files to search
+ */
+
+struct grep_request {
+    struct w24_grep *grep;
+    struct w24_pattern *name; // -fg: name glob
+    struct w24_match suffixes; // -ft: extensions
+    int has_suffixes;
+    long min_size, max_size; // -fz: min_size < size < max_size
+    int has_size;
+    char date[MAX_DATE_LENGTH]; // -fdb / -fda: birth date, YYYY-MM-DD
+    int date_filter; // 0: none, 1: born on or before date, 2: on or after it
+};
+
+/*
+ * parse_grep_request: Parses "w24grep [-i] [-E] [-fg <glob>] [-ft <ext>[,<ext>...]] [-fz <min> <max>] [-fdb|-fda <date>] [--] <pattern>"
+ * 
+ * Parameters:
+ * - text: The request after "w24grep "; the pattern is the rest of the line after the options
+ * - request: Receives the compiled pattern and filters
+ * - error, size: Receives why the request was rejected
+ * 
+ * Return Value:
+ * - int: 0, or -1 with error set (nothing is left to free)
+ */
+
+int parse_grep_request(const char *text, struct grep_request *request, char *error, size_t size) {
+    unsigned flags = 0;
+    char option[8], argument[MAX_PATH_LENGTH], argument2[64];
+    int used;
+
+    memset(request, 0, sizeof(*request));
+    while (text[0] == '-' && sscanf(text, "%7s%n", option, &used) == 1) {
+        text += used;
+        if (strcmp(option, "--") == 0) {
+            text += *text == ' ';
+            break;
+        }
+        if (strcmp(option, "-i") == 0 || strcmp(option, "-E") == 0) {
+            flags |= option[1] == 'i' ? W24_GREP_NOCASE : W24_GREP_REGEX;
+        }
+        else if (strcmp(option, "-fg") == 0 && sscanf(text, " %4095s%n", argument, &used) == 1) {
+            w24_pattern_free(request->name);
+            request->name = w24_pattern_compile(argument, W24_PATTERN_GLOB, 0, error, size);
+            text += used;
+            if (request->name == NULL) {
+                return -1;
+            }
+        }
+        else if (strcmp(option, "-ft") == 0 && sscanf(text, " %4095s%n", argument, &used) == 1) {
+            // matched like w24ft: ".ext" suffixes
+            char suffixes[W24_MATCH_MAX_PATTERNS][MAX_EXTENSION_LENGTH + 2];
+            const char *list[W24_MATCH_MAX_PATTERNS];
+            char *saveptr, *token = strtok_r(argument, ",", &saveptr);
+            int count = 0;
+
+            for (; token != NULL && count < W24_MATCH_MAX_PATTERNS; token = strtok_r(NULL, ",", &saveptr)) {
+                snprintf(suffixes[count], sizeof(suffixes[0]), ".%.*s", MAX_EXTENSION_LENGTH, token);
+                list[count] = suffixes[count];
+                count++;
+            }
+            text += used;
+            if (w24_match_suffixes_init(&request->suffixes, list, count, 0) == -1) {
+                snprintf(error, size, "invalid -ft extensions");
+                w24_pattern_free(request->name);
+                return -1;
+            }
+            request->has_suffixes = 1;
+        }
+        else if (strcmp(option, "-fz") == 0 && sscanf(text, " %ld %ld%n", &request->min_size, &request->max_size, &used) == 2) {
+            request->has_size = 1;
+            text += used;
+        }
+        else if ((strcmp(option, "-fdb") == 0 || strcmp(option, "-fda") == 0) && sscanf(text, " %63s%n", argument2, &used) == 1) {
+            snprintf(request->date, sizeof(request->date), "%s", argument2);
+            request->date_filter = option[3] == 'b' ? 1 : 2;
+            text += used;
+        }
+        else {
+            snprintf(error, size, "unknown or incomplete option %s", option);
+            w24_pattern_free(request->name);
+            return -1;
+        }
+        text += *text == ' ';
+    }
+
+    request->grep = w24_grep_compile(text, flags, error, size);
+    if (request->grep == NULL) {
+        w24_pattern_free(request->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * grep_files: Searches the contents of the files a w24grep request selects and streams the matching lines to the client
+ * 
+ * Parameters:
+ * - client_fd: The connection
+ * - request: Parsed request (parse_grep_request)
+ * 
+ * Return Value:
+ * - int: 0 once the last frame is sent, -1 if the client could not be written to
+ * 
+ * Explanation:
+ * The files are picked with one scan (w24ft extensions filter names in bulk, sizes and birth times are fetched only if
+ * asked for); then one thread per CPU takes them one by one and reads each in large blocks (w24grep). Matching lines are
+ * sent as soon as every file before them is done, so the client sees results while the search runs and always in scan
+ * order: "LINES <length> <count>" frames of "path:line:text" lines ("Binary file <path> matches" for binary files), then
+ * "END 0 <files> <lines> [truncated]" once all are searched or MAX_GREP_LINES were sent; a search whose request stopped
+ * ends with an ERROR frame instead (see reply_if_stopped).
+ */
+
+struct grep_file {
+    char *path;
+    char *output; // "path:line:text" lines (open_memstream)
+    size_t length;
+    size_t lines;
+    int done;
+};
+
+struct grep_search {
+    const struct grep_request *request;
+    struct grep_file *files;
+    size_t count, capacity;
+    size_t next; // next file to search, taken atomically by the workers
+    size_t lines; // matching lines found so far, updated atomically; the search stops at MAX_GREP_LINES
+    int client_fd;
+    struct w24_request *cancel; // the request, adopted by the workers for their checkpoints
+    pthread_mutex_t lock; // protects what follows
+    size_t next_to_send; // files before this one are sent
+    char *chunk; // lines waiting to be sent, GREP_CHUNK_SIZE
+    size_t chunk_length, chunk_lines;
+    size_t matched_files;
+    int failed; // the client is gone or the request stopped
+};
+
+struct grep_hit {
+    struct grep_search *search;
+    struct grep_file *file;
+    FILE *out;
+};
+
+int collect_grep_file(const struct w24_scan_entry *entry, void *arg) {
+    struct grep_search *search = arg;
+    const struct grep_request *request = search->request;
+
+    if (w24_cancel_checkpoint() != W24_CANCEL_NONE) {
+        return 1;
+    }
+    if (request->name != NULL && !w24_pattern_match(request->name, entry->name, strlen(entry->name))) {
+        return 0;
+    }
+    if (request->has_size && ((long long)entry->size <= request->min_size || (long long)entry->size >= request->max_size)) {
+        return 0;
+    }
+    if (request->date_filter != 0) {
+        char birth[MAX_DATE_LENGTH];
+        format_birth_time(entry, birth, sizeof(birth));
+        birth[10] = '\0'; // YYYY-MM-DD
+        if (!entry->has_btime || (request->date_filter == 1 ? strcmp(birth, request->date) > 0 : strcmp(birth, request->date) < 0)) {
+            return 0;
+        }
+    }
+
+    if (search->count == search->capacity) {
+        size_t capacity = search->capacity * 2 + 64;
+        struct grep_file *grown = realloc(search->files, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return 1;
+        }
+        search->files = grown;
+        search->capacity = capacity;
+    }
+    memset(&search->files[search->count], 0, sizeof(search->files[0]));
+    search->files[search->count].path = strdup(entry->path);
+    if (search->files[search->count].path == NULL) {
+        return 1;
+    }
+    search->count++;
+    return 0;
+}
+
+int record_grep_line(unsigned long line_number, const char *line, size_t length, void *arg) {
+    struct grep_hit *hit = arg;
+
+    if (__atomic_fetch_add(&hit->search->lines, 1, __ATOMIC_RELAXED) >= MAX_GREP_LINES) {
+        return 1;
+    }
+    hit->file->lines++;
+    fprintf(hit->out, "%s:%lu:%.*s\n", hit->file->path, line_number, (int)(length < MAX_GREP_LINE_LENGTH ? length : MAX_GREP_LINE_LENGTH), line);
+    return 0;
+}
+
+// sends the chunk of matching lines as one LINES frame, held back for the END frame when it is the last one (more);
+// called with the lock held
+int send_grep_chunk(struct grep_search *search, int more) {
+    char attrs[32];
+
+    if (search->chunk_length == 0 || search->failed) {
+        return search->failed ? -1 : 0;
+    }
+    snprintf(attrs, sizeof(attrs), "%zu", search->chunk_lines);
+    if ((more ? w24_proto_send_frame_more : w24_proto_send_frame)(search->client_fd, "LINES", attrs, search->chunk, search->chunk_length) == -1) {
+        search->failed = 1;
+        return -1;
+    }
+    search->chunk_length = search->chunk_lines = 0;
+    return 0;
+}
+
+void *search_grep_files(void *arg) {
+    struct grep_search *search = arg;
+    char *buffer = malloc(W24_GREP_BLOCK_SIZE);
+    size_t i;
+
+    w24_cancel_adopt(search->cancel);
+    while ((i = __atomic_fetch_add(&search->next, 1, __ATOMIC_RELAXED)) < search->count) {
+        struct grep_file *file = &search->files[i];
+        struct grep_hit hit = { search, file, NULL };
+        int binary = 0;
+
+        if (w24_cancel_checkpoint() != W24_CANCEL_NONE) {
+            __atomic_store_n(&search->failed, 1, __ATOMIC_RELAXED);
+        }
+        if (buffer != NULL && !__atomic_load_n(&search->failed, __ATOMIC_RELAXED) && __atomic_load_n(&search->lines, __ATOMIC_RELAXED) < MAX_GREP_LINES &&
+            (hit.out = open_memstream(&file->output, &file->length)) != NULL) {
+            int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+            if (fd != -1) {
+                if (w24_grep_fd(search->request->grep, fd, buffer, &binary, record_grep_line, &hit) > 0 && binary &&
+                    __atomic_fetch_add(&search->lines, 1, __ATOMIC_RELAXED) < MAX_GREP_LINES) {
+                    file->lines = 1;
+                    fprintf(hit.out, "Binary file %s matches\n", file->path);
+                }
+                close(fd);
+            }
+            fclose(hit.out);
+        }
+
+        // send every finished file that follows the ones already sent, in scan order
+        pthread_mutex_lock(&search->lock);
+        file->done = 1;
+        while (search->next_to_send < search->count && search->files[search->next_to_send].done) {
+            struct grep_file *ready = &search->files[search->next_to_send++];
+
+            if (ready->length > GREP_CHUNK_SIZE - search->chunk_length) {
+                send_grep_chunk(search, 0);
+            }
+            if (ready->length > 0 && !search->failed) {
+                if (ready->length > GREP_CHUNK_SIZE) { // more than a chunk's worth on its own
+                    char *chunk = search->chunk;
+                    search->chunk = ready->output;
+                    search->chunk_length = ready->length;
+                    search->chunk_lines = ready->lines;
+                    send_grep_chunk(search, 0);
+                    search->chunk = chunk;
+                }
+                else {
+                    memcpy(search->chunk + search->chunk_length, ready->output, ready->length);
+                    search->chunk_length += ready->length;
+                    search->chunk_lines += ready->lines;
+                }
+                search->matched_files++;
+            }
+            free(ready->output);
+            ready->output = NULL;
+        }
+        pthread_mutex_unlock(&search->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+int grep_files(int client_fd, const struct grep_request *request) {
+    struct grep_search search = { .request = request, .client_fd = client_fd, .cancel = w24_cancel_current() };
+    unsigned flags = W24_SCAN_REGULAR | (request->has_size ? W24_SCAN_SIZE : 0) | (request->date_filter != 0 ? W24_SCAN_BTIME : 0);
+    char attrs[64];
+    int ret = 0;
+
+    pthread_mutex_init(&search.lock, NULL);
+    search.chunk = malloc(GREP_CHUNK_SIZE);
+    W24_TRACE_BEGIN("select files");
+    if (search.chunk == NULL || w24_scan(server_root, flags, request->has_suffixes ? &request->suffixes : NULL, collect_grep_file, &search) != 0) {
+        ret = reply_if_stopped(client_fd, 1) ? 1 : w24_proto_send_header(client_fd, "ERROR", 0, "scan failed");
+    }
+    W24_TRACE_END();
+
+    if (ret == 0 && search.chunk != NULL) {
+        W24_TRACE_BEGIN("search contents");
+        w24_scan_run_workers(w24_scan_default_workers(), search.count, search_grep_files, &search, 0);
+        W24_TRACE_END();
+
+        w24_log(W24_LOG_INFO, "w24grep: %zu files searched, %zu lines matched", search.count, search.lines < MAX_GREP_LINES ? search.lines : (size_t)MAX_GREP_LINES);
+        snprintf(attrs, sizeof(attrs), "%zu %zu%s", search.matched_files, search.lines < MAX_GREP_LINES ? search.lines : (size_t)MAX_GREP_LINES,
+                 search.lines > MAX_GREP_LINES ? " truncated" : "");
+        if (!reply_if_stopped(client_fd, 1) && (send_grep_chunk(&search, 1) == -1 || w24_proto_send_header(client_fd, "END", 0, attrs) == -1)) {
+            ret = -1;
+        }
+    }
+
+    for (size_t i = 0; i < search.count; i++) {
+        free(search.files[i].output);
+        free(search.files[i].path);
+    }
+    free(search.files);
+    free(search.chunk);
+    pthread_mutex_destroy(&search.lock);
+    return ret == 1 ? 0 : ret; // a stopped search was answered
+}
+
+/*
+ * tar_process: The tar process behind an archive being written, for the handler to kill when its request stops
+ *
+ * Explanation:
+ * pid is cleared under the lock before the process is waited for, so a pid read under the lock is never one that
+ * was already reaped and reused.
+ */
+
+struct tar_process {
+    pthread_mutex_t lock;
+    pid_t pid; // 0: none running
+};
+
+/*
+ * start_tar: Starts "tar -cf - -T list_path" with its output on a pipe
+ *
+ * Return Value:
+ * - int: The read end of the pipe, -1 on failure
+ */
+
+int start_tar(const char *list_path, struct tar_process *tar) {
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL); // the server ignores it; tar gets the usual behaviour back
+        if (dup2(fds[1], STDOUT_FILENO) == -1) {
+            _exit(127);
+        }
+        execlp("tar", "tar", "-cf", "-", "-T", list_path, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    pthread_mutex_lock(&tar->lock);
+    tar->pid = pid;
+    pthread_mutex_unlock(&tar->lock);
+    return fds[0];
+}
+
+// waits for tar; 0 unless it was killed, as tar also exits non-zero for files that changed while read
+int wait_tar(struct tar_process *tar) {
+    int status;
+
+    pthread_mutex_lock(&tar->lock);
+    pid_t pid = tar->pid;
+    tar->pid = 0;
+    pthread_mutex_unlock(&tar->lock);
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) == 127) ? -1 : 0;
+}
 
 /*
- * compareFileName: Compares the filename extracted from a file path with the user-input filename
+ * write_archive: Builds the archive of a saved file list
  * 
  * Parameters:
- * - file_path: Path of the file whose name is to be compared
+ * - list_file: The file list, one path per line
+ * - list_path: Path of that list on disk (read by tar)
+ * - codec, level: Compression codec and level
+ * - out_path: File to write the archive to
+ * - tar: Receives the tar process while it runs
  * 
  * Return Value:
- * - int: 1 if the filenames match, 0 otherwise
+ * - int: 0 on success, -1 if the archive could not be written or its request stopped (out_path is removed)
  * 
  * Explanation:
- * This function extracts the filename from the given file path using the basename() function.
- * It then compares the extracted filename with the user-input filename stored in the global variable user_file_name.
- * If the filenames match, it returns 1; otherwise, it returns 0.
- * The function also includes an assertion to ensure that the user has entered a non-zero length filename.
+ * The listed files are streamed through "tar -cf -" and the tar stream is compressed by the codec
+ * (gzip runs on parallel w24_pgzip() workers, zstd/lz4 through their own programs, none is stored as is)
+ * using compress_threads threads where the codec supports it.
+ * The zip codec reads the file list directly and stores already-compressed files (images, archives,
+ * media) without recompressing them; its member counts and CPU time go into the shared metrics.
+ * The zip writer stops at a checkpoint between members when the request stops (see w24cancel.h); tar is killed
+ * by the handler instead, which ends the compressor's input. Either way nothing partial reaches the archive store.
  */
 
-int compareFileName(const char * file_path) {
+int write_archive(FILE *list_file, const char *list_path, const struct w24_codec *codec, int level, const char *out_path, struct tar_process *tar) {
+    struct w24_zip_stats zip_stats;
+    struct stat archive_stat;
+    int ret = -1;
 
-  assert(sizeof(user_file_name) > 0); //checks if the user entered a non-zero length file name.
+    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644); // not inherited by tar or a compressor
+    if (out_fd == -1) {
+        return -1;
+    }
 
-  char * filename = basename((char * ) file_path); // basename() returns the filename out of the entire absolute/relative path
-  
-  // if match returns 1
-  if (!strcmp(filename, user_file_name)) {
-    return 1;
-  }
+    rewind(list_file);
+    if (codec->reads_file_list) {
+        ret = w24_zip_from_list(list_file, out_fd, level, &zip_stats);
+    }
+    else {
+        int tar_fd = start_tar(list_path, tar);
+        if (tar_fd != -1) {
+            int threads = compress_threads > 0 ? compress_threads : w24_pgzip_default_threads();
+            ret = w24_codec_compress(codec, tar_fd, out_fd, level, threads);
+            close(tar_fd); // a compressor that failed early leaves tar to a broken pipe
+            if (wait_tar(tar) == -1) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && (w24_cancel_checkpoint() != W24_CANCEL_NONE || fstat(out_fd, &archive_stat) == -1)) {
+        ret = -1;
+    }
+    if (close(out_fd) == -1 || ret == -1) {
+        unlink(out_path);
+        return -1;
+    }
+
+    w24_metrics_record_archive((uint64_t)archive_stat.st_size, codec->reads_file_list ? &zip_stats : NULL);
+    if (codec->reads_file_list) {
+        w24_log(W24_LOG_INFO, "zip: %llu members, %llu stored uncompressed, %llu -> %llu bytes",
+                (unsigned long long)zip_stats.members, (unsigned long long)zip_stats.stored_members,
+                (unsigned long long)zip_stats.bytes_in, (unsigned long long)zip_stats.bytes_out);
+    }
+
+    return 0;
+}
+
+/*
+ * bulk_write: What write_archive_bulk() hands to its thread
+ */
+
+struct bulk_write {
+    FILE *list_file;
+    const char *list_path;
+    const struct w24_codec *codec;
+    int level;
+    const char *out_path;
+    struct w24_request *request;
+    struct tar_process tar;
+    int ret;
+};
+
+void *run_bulk_write(void *arg) {
+    struct bulk_write *job = arg;
+
+    w24_cancel_adopt(job->request);
+    if (w24_prio_lowers(&bulk_priority) && w24_prio_apply(&bulk_priority) == -1) {
+        w24_log(W24_LOG_DEBUG, "Archive priority not lowered: %s", strerror(errno));
+    }
+    job->ret = write_archive(job->list_file, job->list_path, job->codec, job->level, job->out_path, &job->tar);
+    return NULL;
+}
+
+/*
+ * write_archive_bulk: Runs write_archive() on a thread of its own at the priority of bulk work (--bulk-priority, see w24prio.h)
+ *
+ * Explanation:
+ * The thread's lowered nice value and I/O priority, which it passes on to the compression threads and to tar, go
+ * away with it. The handler waits for the thread, checking the request every W24_CANCEL_POLL_MS meanwhile: once it
+ * stops (cancelled, past its deadline or its client gone) the handler kills tar, so the disk is free at once instead
+ * of when the archive would have been done. If no thread can be started the archive is written by the handler,
+ * which can then only stop at the zip writer's checkpoints.
+ */
+
+int write_archive_bulk(FILE *list_file, const char *list_path, const struct w24_codec *codec, int level, const char *out_path) {
+    struct bulk_write job = { list_file, list_path, codec, level, out_path, w24_cancel_current(), { PTHREAD_MUTEX_INITIALIZER, 0 }, -1 };
+    pthread_t thread;
+
+    if (pthread_create(&thread, &bulk_attr, run_bulk_write, &job) != 0) {
+        return write_archive(list_file, list_path, codec, level, out_path, &job.tar);
+    }
+    while (job.request != NULL) {
+        struct timespec until;
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += W24_CANCEL_POLL_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        if (pthread_timedjoin_np(thread, NULL, &until) == 0) {
+            return job.ret;
+        }
+        if (w24_cancel_check(job.request) != W24_CANCEL_NONE) {
+            pthread_mutex_lock(&job.tar.lock);
+            if (job.tar.pid != 0) {
+                kill(job.tar.pid, SIGKILL);
+            }
+            pthread_mutex_unlock(&job.tar.lock);
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+    return job.ret;
+}
+
+/*
+ * build_archive: Creates the archive of the files listed by a file scan, or finds it in the archive store
+ * 
+ * Parameters:
+ * - list: Matches of the file scan (find_files), one file path per line, positioned after the first line
+ * - first_path: The first line, already read by the caller to check that something matched
+ * - codec: Compression codec negotiated with the client
+ * - level: Compression level for the codec
+ * - archive_id: Receives the archive id (its archive store key) that clients fetch it by
+ * 
+ * Return Value:
+ * - int: Read-only descriptor of the archive in the store, -1 if it could not be built
+ * 
+ * Explanation:
+ * The scan runs only once: its output is saved to a list file that is both hashed into the
+ * archive store key (paths, sizes, mtimes, codec and level) and handed to tar or zip.
+ * If an identical archive was built before (for any client, by any node sharing the store) it is reused;
+ * otherwise it is built into the store first. Since the id only depends on the matched files, a client
+ * asking again after an interrupted download gets the same id and can resume.
+ */
+
+int build_archive(FILE *list, const char *first_path, const struct w24_codec *codec, int level, char archive_id[W24_CACHE_KEY_LENGTH + 1]) {
+    char list_path[MAX_PATH_LENGTH];
+    char build_path[MAX_PATH_LENGTH];
+    char salt[64];
+    char line[MAX_PATH_LENGTH];
+    int archive_fd = -1;
+
+    snprintf(list_path, sizeof(list_path), "temp.list.%d", (int)gettid()); // unique per connection in fork and thread mode
+
+    // save the file list once: it is hashed for the archive store and then read by tar or zip
+    FILE *list_file = fopen(list_path, "w+");
+    if (list_file == NULL) {
+        return -1;
+    }
+    fputs(first_path, list_file);
+    while (fgets(line, sizeof(line), list) != NULL) {
+        fputs(line, list_file);
+    }
 
-  // if not a match returns 0
-  return 0;
+    snprintf(salt, sizeof(salt), "%s:%d", codec->name, level);
+    if (fflush(list_file) != EOF) {
+        rewind(list_file);
+        if (w24_cache_key(list_file, salt, archive_id) == 0) {
+            W24_TRACE_BEGIN("archive store lookup");
+            archive_fd = w24_cache_lookup(archive_id);
+            W24_TRACE_END();
+
+            if (archive_fd == -1) {
+                w24_cache_temp_path(archive_id, build_path, sizeof(build_path));
+                if (write_archive_bulk(list_file, list_path, codec, level, build_path) == 0) {
+                    archive_fd = w24_cache_commit(build_path, archive_id);
+                }
+            }
+            else {
+                w24_log(W24_LOG_INFO, "Archive store hit %s", archive_id);
+            }
+        }
+    }
+
+    fclose(list_file);
+    unlink(list_path);
+
+    return archive_fd;
 }
 
 /*
- * traverse_and_extract: Callback function used for file traversal
+ * send_archive: Answers an archive command with the archive of the files its scan matched
  * 
  * Parameters:
- * - file_path: Path of the current file being traversed
- * - sb: Pointer to a struct containing information about the current file
- * - typeflag: Type of the current file (FTW_F for regular file, FTW_D for directory, etc.)
- * - ftwbuf: Pointer to a struct containing information about the file tree walk
+ * - client_fd: The client's socket
+ * - matches: The scan's output, one file path per line, NULL if the scan failed; closed here
+ * - codec_offer, codec_level: What the client asked for with "codecs", "" and 0 if nothing
+ * - archive_fd, archive_id: The session's last archive, replaced by this one
  * 
  * Return Value:
- * - int: 0 to continue traversal, -2 to terminate traversal if a matching file is found
+ * - int: 0 once answered, -1 if the send failed
  * 
  * Explanation:
- * This function is used as a callback for the nftw function to traverse the directory structure.
- * It receives information about each file encountered during traversal and performs actions based on the file type and name.
- * If the encountered item is a regular file (typeflag == FTW_F), it compares the file path with the user-input filename.
- * If the filename matches, it stores the file path in an array and increments the count of matched files.
- * The traversal terminates if a matching file is found to optimize performance (returning -2).
- * If the encountered item is not a file, the traversal continues (returning 0).
+ * The reply is "ARCHIVE <id> <length> <extension>", "No file found" when nothing matched, or "File scan failed",
+ * "Archive creation failed" or "Request stopped: <reason>", all as text. The archive is built by build_archive() or
+ * found in the archive store, and the client downloads it with fetch commands.
  */
-int traverse_and_extract(const char * file_path,  const struct stat * sb, int typeflag, struct FTW * ftwbuf) {
 
-  // if file encountered    
-  if (typeflag == FTW_F)
-  {
-    // if matches user input file name
-    if (compareFileName(file_path)) {
-      snprintf(file_paths[num_files], MAX_PATH_LENGTH, "%s", file_path);
-      // printf("Matched file path: %s\n", file_path);// print file path
-      printf("Matched file path: %s\n", file_paths[num_files]);// print file path
-      num_files+=1;
-      return -2; // terminate traversal
+int send_archive(int client_fd, FILE *matches, const char *codec_offer, int codec_level, int *archive_fd, char archive_id[W24_CACHE_KEY_LENGTH + 1]) {
+    char first_path[MAX_BUFFER_LENGTH], reply[MAX_BUFFER_LENGTH];
+    struct stat archive_stat;
+    int ret;
+
+    if (matches == NULL) {
+        if (reply_if_stopped(client_fd, 0)) {
+            return 0;
+        }
+        perror("File scan failed");
+        return send_error(client_fd, 0, "File scan failed");
+    }
+    if (fgets(first_path, sizeof(first_path), matches) == NULL) {
+        fclose(matches);
+        W24_TRACE_BEGIN("send");
+        ret = send_text(client_fd, "No file found", "");
+        W24_TRACE_END();
+        return ret;
     }
 
-  }
+    // Build the archive from the rest of the scan output, or reuse an identical one from the archive store
+    const struct w24_codec *codec = w24_codec_negotiate(codec_offer[0] != '\0' ? codec_offer : NULL);
+
+    if (*archive_fd != -1) {
+        close(*archive_fd); // previous archive of this session
+    }
+    W24_TRACE_BEGIN_DETAIL("build archive", codec->name);
+    *archive_fd = build_archive(matches, first_path, codec, w24_codec_level(codec, codec_level > 0 ? codec_level : compress_level), archive_id);
+    W24_TRACE_END();
+    fclose(matches);
+    if (*archive_fd != -1 && fstat(*archive_fd, &archive_stat) == -1) {
+        close(*archive_fd);
+        *archive_fd = -1;
+    }
+    if (*archive_fd == -1) {
+        if (reply_if_stopped(client_fd, 0)) {
+            return 0;
+        }
+        perror("Archive creation failed");
+        return send_error(client_fd, 0, "Archive creation failed");
+    }
 
-  return 0; // Continue traversal
+    snprintf(reply, sizeof(reply), "ARCHIVE %s %lld %s", archive_id, (long long)archive_stat.st_size, codec->extension);
+    W24_TRACE_BEGIN("send");
+    ret = send_text(client_fd, reply, "");
+    W24_TRACE_END();
+    return ret;
 }
 
 
 void crequest(int client_fd);
 
-int main()
-{
-    int server_fd, client_fd;
-    struct sockaddr_in server_addr, client_addr;
-    char message[MAX_MSG_LENGTH];
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--role primary|mirror] [--port port] [--bind address] [--root directory]\n"
+                    "       [--mode fork|thread] [--name log_name] [--acceptors count] [--cpu-steering] [--io uring|epoll|sync]\n"
+                    "       [--idle-timeout seconds] [--keepalive idle,interval,count]\n"
+                    "       [--lookups running[,queue[,wait_ms]]] [--archives running[,queue[,wait_ms]]] [--peers port,...]\n"
+                    "       [--workers count] [--weights lookups,archives] [--bulk-priority nice[,idle|io_level]]\n"
+                    "       [-j compression_threads] [-l compression_level] [-q archive_store_mb]\n", program);
+    exit(EXIT_FAILURE);
+}
 
-    // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+/*
+ * parse_admit_limits: Parses "running[,queue[,wait_ms]]" (--lookups, --archives); omitted fields keep their defaults
+ */
+
+int parse_admit_limits(const char *text, struct w24_admit_limits *limits) {
+    struct w24_admit_limits parsed = *limits;
+
+    if (sscanf(text, "%d,%d,%d", &parsed.running, &parsed.queue, &parsed.wait_ms) < 1 ||
+        parsed.running < 0 || parsed.queue < 0 || parsed.wait_ms < 0) {
+        return -1;
     }
+    *limits = parsed;
+    return 0;
+}
 
-    // Set SO_REUSEADDR option to allow reuse of the port
-    int reuse = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) == -1)
-    {
-        perror("Error setting socket option");
-        exit(EXIT_FAILURE);
+/*
+ * parse_peers: Parses "port,..." (--peers), "0" for none
+ */
+
+int parse_peers(const char *text) {
+    char *end;
+
+    peer_count = 0;
+    if (strcmp(text, "0") == 0) {
+        return 0;
+    }
+    while (peer_count < MAX_PEERS) {
+        long port = strtol(text, &end, 10);
+        if (end == text || port <= 0 || port > 65535 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        peer_ports[peer_count++] = (int)port;
+        if (*end == '\0') {
+            return 0;
+        }
+        text = end + 1;
     }
+    return -1;
+}
+
+/*
+ * serve_connection: Runs crequest() for one connection on its own thread (--mode thread)
+ */
 
-    // Initialize server address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = inet_addr(SERVER_IP);
-    server_addr.sin_port = htons(SERVER_PORT);
+void * serve_connection(void * arg) {
+    int client_fd = (int)(intptr_t)arg;
 
-    // Bind socket
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) 
-    {
-        perror("Bind failed");
-        exit(EXIT_FAILURE);
+    sched_setaffinity(0, sizeof(server_cpus), &server_cpus); // not confined to the acceptor's CPU
+    crequest(client_fd); // closes client_fd
+    return NULL;
+}
+
+/*
+ * reap_handlers: SIGCHLD handler of a fork mode acceptor; collects every handler process that exited
+ *
+ * Explanation:
+ * Without it each finished connection would stay a zombie until the acceptor exits. The handlers reset
+ * SIGCHLD to the default right after the fork, so the archive pipelines they wait for are not reaped here.
+ */
+
+void reap_handlers(int signal_number) {
+    int saved_errno = errno;
+    (void)signal_number;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        W24_METRICS_ADD(handlers_reaped, 1);
     }
+    errno = saved_errno;
+}
 
-    // Listen for connections
-    if (listen(server_fd, 100) == -1) // backlog(queue) = 100
-    {
-        perror("Listen failed");
+/*
+ * accept_connections: Accepts clients on one listening socket and hands each to a handler
+ *
+ * Parameters:
+ * - server_fd: listening socket of this acceptor
+ *
+ * Explanation:
+ * Connections are accepted in batches through the I/O engine (--io, see w24io.h).
+ * The primary sends every client its count and closes the connections it redirects to the mirrors.
+ * Each remaining connection is served by a new thread (--mode thread) or a forked child (--mode fork), with TCP keepalive
+ * and the idle timeout set on it (--keepalive, --idle-timeout); forked children are reaped as soon as they exit.
+ * With --acceptors several of these loops run at once, one per SO_REUSEPORT socket; the client count
+ * lives in shared memory so the redirect sequence stays the same whichever acceptor takes a client.
+ */
+
+void accept_connections(int server_fd) {
+    int client_fds[W24_IO_ACCEPT_DEPTH];
+    struct sockaddr_in client_addrs[W24_IO_ACCEPT_DEPTH];
+    struct w24_io_acceptor *acceptor = w24_io_acceptor_new(server_fd);
+
+    if (acceptor == NULL) {
+        perror("Acceptor setup failed");
         exit(EXIT_FAILURE);
     }
 
-    printf("Server listening on port %d\n", SERVER_PORT);
+    if (concurrency_mode == MODE_FORK) {
+        struct sigaction reaper;
 
-    while (1) {
-        socklen_t client_len = sizeof(client_addr);
+        memset(&reaper, 0, sizeof(reaper));
+        reaper.sa_handler = reap_handlers;
+        reaper.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigemptyset(&reaper.sa_mask);
+        sigaction(SIGCHLD, &reaper, NULL);
+    }
 
-        // Accept incoming connection
-        if ((client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len)) == -1) {
-            perror("Accept failed");
+    while (1) {
+        // Accept every incoming connection that is ready
+        int accepted = w24_io_accept(acceptor, client_fds, client_addrs, W24_IO_ACCEPT_DEPTH);
+        if (accepted == -1) {
+            if (errno != EINTR) { // EINTR: a handler was reaped
+                perror("Accept failed");
+            }
             continue;
         }
 
-        // increment client count
-        client_count_server+=1;
+        for (int i = 0; i < accepted; i++) {
+            int client_fd = client_fds[i];
+            struct sockaddr_in client_addr = client_addrs[i];
 
-        // send count to client
-        char informclient[MAX_MSG_LENGTH];
-        snprintf(informclient, sizeof(informclient), "%d", client_count_server);
-        printf("Sending client count to client.. %s \n", informclient);
+            if (server_role == ROLE_PRIMARY) {
+                // increment client count
+                int client_count = __atomic_add_fetch(client_count_server, 1, __ATOMIC_RELAXED);
 
-        if (send(client_fd, informclient, strlen(informclient), 0) == -1) {
-            perror("Send failed");
-            close(client_fd);
-            continue;
+                // send count to client
+                char informclient[MAX_MSG_LENGTH];
+                snprintf(informclient, sizeof(informclient), "%d", client_count);
+                w24_log(W24_LOG_INFO, "Sending client count to client.. %s", informclient);
+
+                if (send(client_fd, informclient, strlen(informclient), 0) == -1) {
+                    perror("Send failed");
+                    close(client_fd);
+                    continue;
+                }
+
+                // ignore connections in the below range and redirect to mirror1 or mirror2
+
+                if(client_count>=4 && client_count<=9)
+                {
+                    w24_log(W24_LOG_INFO, "Re-directing client to mirror..");
+                    close(client_fd);
+                    continue; // Go back to waiting for the next connection
+                }
+                else if(client_count>=10 && (client_count%3)!=1)
+                {
+                    w24_log(W24_LOG_INFO, "Re-directing client to mirror..");
+                    close(client_fd);
+                    continue; // Go back to waiting for the next connection
+                }
+            }
+
+            w24_log(W24_LOG_INFO, "Connection accepted on %s from %s", server_name, inet_ntoa(client_addr.sin_addr));
+
+            // replies leave as soon as they are written (see w24proto.h)
+            if (w24_listen_no_delay(client_fd) == -1) {
+                w24_log(W24_LOG_WARN, "TCP_NODELAY failed: %s", strerror(errno));
+            }
+
+            // dead clients are noticed by keepalive, idle ones by the timeout (see w24listen.h)
+            if (w24_listen_keepalive(client_fd, keepalive_idle, keepalive_interval, keepalive_count) == -1 ||
+                w24_listen_idle_timeout(client_fd, idle_timeout) == -1) {
+                w24_log(W24_LOG_WARN, "Connection liveness settings failed: %s", strerror(errno));
+            }
+
+            if (concurrency_mode == MODE_THREAD) {
+                pthread_t thread;
+                W24_TRACE_BEGIN("spawn");
+                int ret = pthread_create(&thread, &handler_attr, serve_connection, (void *)(intptr_t)client_fd);
+                W24_TRACE_END();
+                if (ret != 0) {
+                    w24_log(W24_LOG_ERROR, "Thread creation failed: %s", strerror(ret));
+                    close(client_fd);
+                }
+                continue;
+            }
+
+            W24_TRACE_BEGIN("fork");
+            int fork_pid = fork();
+
+            if(fork_pid==0) // child process
+            {
+                // This is the child process
+                close(server_fd);
+                signal(SIGCHLD, SIG_DFL); // the reaper is the acceptor's; this process waits for its own children
+                w24_io_acceptor_free(acceptor);
+                for (int j = i + 1; j < accepted; j++) { // the rest of the batch belongs to the parent
+                    close(client_fds[j]);
+                }
+                sched_setaffinity(0, sizeof(server_cpus), &server_cpus); // not confined to the acceptor's CPU
+                crequest(client_fd);
+                exit(EXIT_SUCCESS);
+            }
+            else if(fork_pid<0){
+                w24_log(W24_LOG_ERROR, "Fork failed: %s", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            else{
+                W24_TRACE_END();
+                // Close client socket
+                close(client_fd);
+            }
         }
+    }
+}
+
+/*
+ * run_acceptor: Pins the calling thread or process to its CPU and accepts on its socket (--acceptors)
+ */
 
-        // ignore connections in the below range and redirect to mirror1 or mirror2
+void * run_acceptor(void * arg) {
+    int index = (int)(intptr_t)arg;
+    int cpu = w24_listen_pin_to_cpu(index);
 
-        if(client_count_server>=4 && client_count_server<=9)
-        {
-            printf("Re-directing client to mirror..\n");
-            close(client_fd);
-            continue; // Go back to waiting for the next connection
+    if (cpu == -1) {
+        w24_log(W24_LOG_WARN, "Acceptor %d not pinned: %s", index, strerror(errno));
+    }
+    else {
+        w24_log(W24_LOG_DEBUG, "Acceptor %d pinned to CPU %d", index, cpu);
+    }
+    accept_connections(listen_fds[index]);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int server_port = SERVER_PORT;
+    const char *bind_address = SERVER_IP;
+    char default_name[64];
+    int io_engine_set = 0;
+
+    static const struct option long_options[] = {
+        { "role", required_argument, NULL, 'R' },
+        { "port", required_argument, NULL, 'p' },
+        { "bind", required_argument, NULL, 'b' },
+        { "root", required_argument, NULL, 'd' },
+        { "mode", required_argument, NULL, 'm' },
+        { "name", required_argument, NULL, 'n' },
+        { "acceptors", required_argument, NULL, 'A' },
+        { "cpu-steering", no_argument, NULL, 'S' },
+        { "io", required_argument, NULL, 'I' },
+        { "idle-timeout", required_argument, NULL, 'T' },
+        { "keepalive", required_argument, NULL, 'K' },
+        { "lookups", required_argument, NULL, 'L' },
+        { "archives", required_argument, NULL, 'X' },
+        { "peers", required_argument, NULL, 'P' },
+        { "workers", required_argument, NULL, 'W' },
+        { "weights", required_argument, NULL, 'E' },
+        { "bulk-priority", required_argument, NULL, 'B' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    snprintf(server_root, sizeof(server_root), "%s", getenv("HOME") != NULL ? getenv("HOME") : "/");
+    admit_limits[W24_ADMIT_LOOKUP].running = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    admit_workers = admit_limits[W24_ADMIT_LOOKUP].running;
+
+    // -j: archive compression threads, -l: compression level. Set per node so mirrors can be tuned independently.
+    while ((opt = getopt_long(argc, argv, "j:l:q:R:p:b:d:m:n:A:SI:T:K:L:X:P:W:E:B:", long_options, NULL)) != -1) {
+        if (opt == 'j') {
+            compress_threads = atoi(optarg);
         }
-        else if(client_count_server>=10 && (client_count_server%3)!=1)
-        {
-            printf("Re-directing client to mirror..\n");
-            close(client_fd);
-            continue; // Go back to waiting for the next connection
+        else if (opt == 'l') {
+            compress_level = atoi(optarg);
+        }
+        else if (opt == 'q') {
+            cache_quota_mb = atol(optarg);
+        }
+        else if (opt == 'R' && (strcmp(optarg, "primary") == 0 || strcmp(optarg, "mirror") == 0)) {
+            server_role = strcmp(optarg, "primary") == 0 ? ROLE_PRIMARY : ROLE_MIRROR;
+        }
+        else if (opt == 'p') {
+            server_port = atoi(optarg);
+        }
+        else if (opt == 'b') {
+            bind_address = optarg;
+        }
+        else if (opt == 'd') {
+            snprintf(server_root, sizeof(server_root), "%s", optarg);
+        }
+        else if (opt == 'm' && (strcmp(optarg, "fork") == 0 || strcmp(optarg, "thread") == 0)) {
+            concurrency_mode = strcmp(optarg, "fork") == 0 ? MODE_FORK : MODE_THREAD;
+        }
+        else if (opt == 'n') {
+            server_name = optarg;
+        }
+        else if (opt == 'A' && atoi(optarg) >= 1 && atoi(optarg) <= W24_LISTEN_MAX_ACCEPTORS) {
+            acceptor_count = atoi(optarg);
+        }
+        else if (opt == 'S') {
+            cpu_steering = 1;
+        }
+        else if (opt == 'T' && atoi(optarg) >= 0) {
+            idle_timeout = atoi(optarg);
+        }
+        else if (opt == 'K') {
+            if (strcmp(optarg, "0") == 0) {
+                keepalive_idle = 0;
+            }
+            else if (sscanf(optarg, "%d,%d,%d", &keepalive_idle, &keepalive_interval, &keepalive_count) != 3 ||
+                     keepalive_idle <= 0 || keepalive_interval <= 0 || keepalive_count <= 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (opt == 'L' || opt == 'X') {
+            if (parse_admit_limits(optarg, &admit_limits[opt == 'L' ? W24_ADMIT_LOOKUP : W24_ADMIT_ARCHIVE]) == -1) {
+                usage(argv[0]);
+            }
         }
+        else if (opt == 'P') {
+            if (parse_peers(optarg) == -1) {
+                usage(argv[0]);
+            }
+        }
+        else if (opt == 'W' && atoi(optarg) >= 0) {
+            admit_workers = atoi(optarg);
+        }
+        else if (opt == 'E') {
+            if (sscanf(optarg, "%d,%d", &admit_limits[W24_ADMIT_LOOKUP].weight, &admit_limits[W24_ADMIT_ARCHIVE].weight) != 2 ||
+                admit_limits[W24_ADMIT_LOOKUP].weight < 1 || admit_limits[W24_ADMIT_ARCHIVE].weight < 1) {
+                usage(argv[0]);
+            }
+        }
+        else if (opt == 'B') {
+            if (w24_prio_parse(optarg, &bulk_priority) == -1) {
+                usage(argv[0]);
+            }
+        }
+        else if (opt == 'I') {
+            if (w24_io_init(optarg) == -1) {
+                usage(argv[0]);
+            }
+            io_engine_set = 1;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (!io_engine_set) {
+        w24_io_init("uring"); // falls back to epoll when io_uring is not available
+    }
 
-        printf("Connection accepted from %s\n", inet_ntoa(client_addr.sin_addr));
+    setlocale(LC_COLLATE, ""); // dirlist sorts names the way sort(1) would
+    signal(SIGPIPE, SIG_IGN); // a send to a vanished client fails with EPIPE instead of killing the handler (or, in thread mode, the server)
 
-        int fork_pid = fork();
+    if (server_name == NULL) { // log and trace files are named after the node
+        snprintf(default_name, sizeof(default_name), server_role == ROLE_PRIMARY ? "server" : "mirror-%d", server_port);
+        server_name = default_name;
+    }
 
-        if(fork_pid==0) // child process
-        {
-            // This is the child process
-            crequest(client_fd);
+    w24_log_init(server_name); // buffered logging, flushed by a background thread
+    if (w24_metrics_init() == -1) { // counters shared with the connection handlers, forked or not
+        perror("Metrics mapping failed");
+    }
+    if (w24_cache_init(W24_CACHE_DEFAULT_DIR, (unsigned long long)cache_quota_mb * 1024 * 1024) == -1) { // finished archives, shared by all clients
+        perror("Archive store unavailable");
+        exit(EXIT_FAILURE);
+    }
+    w24_trace_init(server_name); // spans are recorded only when W24_TRACE_DIR is set
+    if (w24_admit_init(admit_limits, admit_workers) == -1) { // slots and queues shared with the connection handlers, forked or not
+        w24_log(W24_LOG_WARN, "Admission control unavailable, commands run without limit: %s", strerror(errno));
+    }
+    if (w24_cancel_init() == -1) { // ids of the running requests, shared with the connection handlers for "cancel"
+        w24_log(W24_LOG_WARN, "Requests cannot be cancelled by id: %s", strerror(errno));
+    }
+    snprintf(fuzzy_index_path, sizeof(fuzzy_index_path), "w24fuzzy-%s.idx", server_name); // built on the first w24fuzzy request
+    if (w24_gen_init(server_root) == -1) { // generation of the tree for conditional requests, watched by a thread of this process
+        w24_log(W24_LOG_WARN, "Tree changes not tracked, conditional requests are answered in full: %s", strerror(errno));
+    }
+
+
+    // shared so that every acceptor, thread or process, counts the same clients
+    client_count_server = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (client_count_server == MAP_FAILED) {
+        perror("Client count mapping failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Create, bind and listen on one socket per acceptor; several share the port with SO_REUSEPORT
+    for (int i = 0; i < acceptor_count; i++) {
+        if ((listen_fds[i] = w24_listen_open(bind_address, server_port, acceptor_count > 1)) == -1) {
+            perror(errno == EINVAL ? "Invalid bind address" : "Listen failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (cpu_steering && acceptor_count > 1 && w24_listen_steer_by_cpu(listen_fds[0], acceptor_count) == -1) {
+        w24_log(W24_LOG_WARN, "CPU steering unavailable, connections are spread by hash: %s", strerror(errno));
+    }
+
+    w24_log(W24_LOG_INFO, "%s listening on %s:%d (%s, %s mode, %d acceptor%s, %s I/O), serving %s", server_name, bind_address, server_port,
+            server_role == ROLE_PRIMARY ? "primary" : "mirror", concurrency_mode == MODE_FORK ? "fork" : "thread",
+            acceptor_count, acceptor_count > 1 ? "s" : "", w24_io_engine_name(), server_root);
+
+    sched_getaffinity(0, sizeof(server_cpus), &server_cpus);
+    pthread_attr_init(&handler_attr);
+    pthread_attr_setdetachstate(&handler_attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&handler_attr, THREAD_STACK_SIZE);
+    pthread_attr_init(&bulk_attr);
+    pthread_attr_setstacksize(&bulk_attr, THREAD_STACK_SIZE);
+
+    char bulk_description[64];
+    w24_prio_format(&bulk_priority, bulk_description, sizeof(bulk_description));
+    w24_log(W24_LOG_INFO, "%d workers: lookups %d (weight %d), archives %d (weight %d, %s)", admit_workers,
+            admit_limits[W24_ADMIT_LOOKUP].running, admit_limits[W24_ADMIT_LOOKUP].weight,
+            admit_limits[W24_ADMIT_ARCHIVE].running, admit_limits[W24_ADMIT_ARCHIVE].weight, bulk_description);
+
+    if (acceptor_count == 1) { // the original single accept loop, unpinned
+        accept_connections(listen_fds[0]);
+    }
+
+    pid_t acceptor_pids[W24_LISTEN_MAX_ACCEPTORS];
+    for (int i = 0; i < acceptor_count; i++) {
+        if (concurrency_mode == MODE_THREAD) {
+            pthread_t thread;
+            int ret = pthread_create(&thread, NULL, run_acceptor, (void *)(intptr_t)i);
+            if (ret != 0) {
+                fprintf(stderr, "Acceptor thread creation failed: %s\n", strerror(ret));
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+
+        pid_t acceptor_pid = fork();
+        if (acceptor_pid == 0) { // acceptor process: keeps only its own socket
+            for (int j = 0; j < acceptor_count; j++) {
+                if (j != i) {
+                    close(listen_fds[j]);
+                }
+            }
+            run_acceptor((void *)(intptr_t)i);
             exit(EXIT_SUCCESS);
         }
-        else if(fork_pid<0){
-            fprintf(stderr, "Fork failed");
+        else if (acceptor_pid < 0) {
+            perror("Acceptor fork failed");
             exit(EXIT_FAILURE);
         }
-        else{
-            // Close client socket
-            close(client_fd);
+        acceptor_pids[i] = acceptor_pid;
+    }
+
+    if (concurrency_mode == MODE_THREAD) {
+        pthread_exit(NULL); // the acceptor threads keep the process alive
+    }
+
+    // fork mode: the acceptor processes share the sockets' port; stop if one of them dies
+    int status;
+    pid_t acceptor_pid = wait(&status);
+    w24_log(W24_LOG_ERROR, "Acceptor process %d exited (status %d), shutting down", (int)acceptor_pid, status);
+    for (int i = 0; i < acceptor_count; i++) {
+        kill(acceptor_pids[i], SIGTERM);
+    }
+    return EXIT_FAILURE;
+}
+
+/*
+ * get_creation_date: Retrieves the creation date of a file
+ * 
+ * Parameters:
+ * - file_path: Path of the file whose creation date is to be retrieved
+ * 
+ * Return Value:
+ * - char *: A string representing the creation date of the file
+ * 
+ * Explanation:
+ * This function asks statx() for the birth time of the file (without following a final symbolic link) and formats it
+ * like stat --format=%w, which it used to run: "YYYY-MM-DD HH:MM:SS.nnnnnnnnn +zzzz", or "-" when it is not recorded.
+ * Note: The returned string is stored in a static (per-thread) array, so it should be used or copied immediately after the function call to avoid overwriting.
+ */
+
+char *get_creation_date(char *file_path) {
+    static __thread char ctime_str[MAX_DATE_LENGTH];
+    struct w24_scan_entry entry;
+    struct statx stx;
+
+    memset(&entry, 0, sizeof(entry));
+    if (statx(AT_FDCWD, file_path, AT_SYMLINK_NOFOLLOW, STATX_BTIME, &stx) == 0 && (stx.stx_mask & STATX_BTIME)) {
+        entry.has_btime = 1;
+        entry.btime_sec = stx.stx_btime.tv_sec;
+        entry.btime_nsec = stx.stx_btime.tv_nsec;
+    }
+    format_birth_time(&entry, ctime_str, sizeof(ctime_str));
+
+    return ctime_str;
+}
+
+/*
+ * admit_class_of: Tells which admission class a command runs in (see w24admit.h)
+ *
+ * Parameters:
+ * - message: The command, without its newline or ifgen prefix
+ *
+ * Return Value:
+ * - enum w24_admit_class: W24_ADMIT_ARCHIVE for the commands that build archives and for SIGS, which reads a whole
+ *   archive to build a delta, W24_ADMIT_LOOKUP for the other commands that scan the tree, W24_ADMIT_NONE for the rest
+ *   (fetch, stats, codecs, quitc), which are cheap
+ */
+
+enum w24_admit_class admit_class_of(const char *message) {
+    if (strstr(message, "w24fg ") == message || strstr(message, "w24fr ") == message) {
+        const char *text = message + 6;
+
+        // options as the w24fg/w24fr handler parses them; -a asks for an archive
+        while (text[0] == '-' && (text[1] == 'a' || text[1] == 'i' || text[1] == '-') && text[2] == ' ') {
+            if (text[1] == 'a') {
+                return W24_ADMIT_ARCHIVE;
+            }
+            if (text[1] == '-') {
+                break;
+            }
+            text += 3;
         }
+        return W24_ADMIT_LOOKUP;
+    }
+    if (strstr(message, "w24fz ") == message || strstr(message, "w24fdb ") == message ||
+        strstr(message, "w24fda ") == message || strstr(message, "w24ft ") == message || strstr(message, "SIGS ") == message) {
+        return W24_ADMIT_ARCHIVE;
+    }
+    if (strcmp(message, "dirlist -a") == 0 || strcmp(message, "dirlist -t") == 0 || strstr(message, "w24fn ") == message ||
+        strstr(message, "w24grep ") == message || strstr(message, "w24fuzzy ") == message ||
+        strstr(message, "w24top ") == message || strstr(message, "w24agg ") == message) {
+        return W24_ADMIT_LOOKUP;
     }
+    return W24_ADMIT_NONE;
+}
+
+/*
+ * send_busy: Turns a command away with "BUSY 0 <retry_ms> <port>", port being one of --peers or 0
+ *
+ * Parameters:
+ * - client_fd: The client's socket
+ * - retry_ms: When a slot is likely to be free (w24_admit_enter)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the send failed
+ */
 
-    // Close server socket
-    close(server_fd);
+int send_busy(int client_fd, int retry_ms) {
+    static unsigned next_peer = 0; // the peers in turn; a forked handler starts at its pid so that processes spread too
+    char attrs[32];
+    int port = 0;
 
-    return 0;
+    if (peer_count > 0) {
+        port = peer_ports[((unsigned)getpid() + __atomic_fetch_add(&next_peer, 1, __ATOMIC_RELAXED)) % (unsigned)peer_count];
+    }
+    snprintf(attrs, sizeof(attrs), "%d %d", retry_ms, port);
+    return w24_proto_send_header(client_fd, "BUSY", 0, attrs);
 }
 
 /*
- * get_creation_date: Retrieves the creation date of a file
+ * send_delta: Answers "SIGS <n> <id> <block_size> <basis_length>" with the archive as a delta against the client's basis (see w24delta.h)
  * 
  * Parameters:
- * - file_path: Path of the file whose creation date is to be retrieved
+ * - client_fd: The client's socket
+ * - message, received: What recv() returned for the request: the header line and the start of the signatures
+ * - archive_fd, archive_id: The archive last announced to this client, read through the descriptor kept open for it
+ * - admit_class, request: The admission class of SIGS (admit_class_of) and the request it runs as
+ * - admit_slot: Receives the slot taken, given back by the caller once the reply is sent; -1 if none
  * 
  * Return Value:
- * - char *: A string representing the creation date of the file
+ * - int: 0 once answered with a DELTA, BUSY or ERROR frame, -1 if the send failed or the request cannot be read to its end
  * 
  * Explanation:
- * This function constructs a command using the given file path to retrieve the creation date of the file.
- * The command is executed using popen(), and the output is read into the ctime_str array.
- * The newline character at the end of the output string is removed, if present.
- * The function then returns the string containing the creation date of the file.
- * Note: The returned string is stored in a static array, so it should be used or copied immediately after the function call to avoid overwriting.
+ * The rest of the signatures is read before anything is checked, so a request the server refuses leaves the connection
+ * in step. Building the delta reads and hashes the whole archive, so it then waits for a slot of its class like the
+ * commands that build archives; a BUSY or a stopped request makes the client fetch the archive instead. A delta of 90%
+ * of the archive or more is refused as not worthwhile: the client then fetches the archive.
  */
 
-char *get_creation_date(char *file_path) {
-    FILE *fp;
-    char command[MAX_PATH_LENGTH];
-    static char ctime_str[MAX_PATH_LENGTH];
+int send_delta(int client_fd, const char *message, size_t received, int archive_fd, const char *archive_id,
+               enum w24_admit_class admit_class, struct w24_request *request, int *admit_slot) {
+    const char *newline = memchr(message, '\n', received);
+    char line[W24_PROTO_HEADER_MAX], type[16], attrs[W24_PROTO_HEADER_MAX], id[W24_CACHE_KEY_LENGTH + 2];
+    unsigned long long signatures_length, basis_length;
+    size_t block_size;
+    struct stat archive_stat;
+    int retry_ms = 0;
+
+    *admit_slot = -1;
+    if (newline == NULL || (size_t)(newline - message) >= sizeof(line)) {
+        w24_proto_send_header(client_fd, "ERROR", 0, "bad delta request");
+        return -1;
+    }
+    memcpy(line, message, (size_t)(newline - message));
+    line[newline - message] = '\0';
+    w24_log(W24_LOG_INFO, "Received message: %s", line);
+    if (w24_proto_parse_header(line, type, sizeof(type), &signatures_length, attrs, sizeof(attrs)) == -1 ||
+        signatures_length > (unsigned long long)W24_DELTA_MAX_BLOCKS * W24_DELTA_SIG_SIZE) {
+        w24_proto_send_header(client_fd, "ERROR", 0, "bad delta request");
+        return -1;
+    }
 
-    // Construct and execute the command
-    snprintf(command, sizeof(command), "stat --format=%%w \"%s\"", file_path);
-    fp = popen(command, "r");
+    unsigned char *signatures = malloc(signatures_length + 1);
+    size_t buffered = received - (size_t)(newline + 1 - message);
+    if (signatures == NULL) {
+        return -1;
+    }
+    if (buffered > signatures_length) {
+        buffered = signatures_length;
+    }
+    memcpy(signatures, newline + 1, buffered);
+    if (w24_proto_recv_all(client_fd, signatures + buffered, signatures_length - buffered) == -1) {
+        free(signatures);
+        return -1;
+    }
 
-    // Read the output and close the pipe
-    if (fp == NULL || fgets(ctime_str, sizeof(ctime_str), fp) == NULL) {
-        perror("Error executing or reading from pipe");
-        exit(EXIT_FAILURE);
+    if (sscanf(attrs, "%65s %zu %llu", id, &block_size, &basis_length) != 3 || !w24_cache_valid_key(id) ||
+        block_size < 1024 || block_size > 65536 ||
+        // bounded before the block count is computed, which would otherwise overflow and let short signatures through
+        basis_length == 0 || basis_length > (unsigned long long)W24_DELTA_MAX_BLOCKS * block_size ||
+        signatures_length != (basis_length / block_size + (basis_length % block_size != 0)) * (unsigned long long)W24_DELTA_SIG_SIZE) {
+        free(signatures);
+        return w24_proto_send_header(client_fd, "ERROR", 0, "bad delta request");
     }
-    pclose(fp);
 
-    // Remove the newline character at the end of ctime_str, if present
-    size_t len = strlen(ctime_str);
-    if (len > 0 && ctime_str[len - 1] == '\n') {
-        ctime_str[len - 1] = '\0';
+    W24_TRACE_BEGIN_DETAIL("admission", w24_admit_class_name(admit_class));
+    *admit_slot = w24_admit_enter(admit_class, request, &retry_ms);
+    W24_TRACE_END();
+    if (*admit_slot == -2) {
+        free(signatures);
+        reply_if_stopped(client_fd, 1);
+        return 0;
+    }
+    if (*admit_slot == -1) {
+        free(signatures);
+        w24_log(W24_LOG_INFO, "Server busy with %ss, client told to retry in %d ms", w24_admit_class_name(admit_class), retry_ms);
+        return send_busy(client_fd, retry_ms);
     }
 
-    return ctime_str;
+    int fd = (archive_fd != -1 && strcmp(id, archive_id) == 0) ? dup(archive_fd) : w24_cache_open(id);
+    if (fd == -1 || fstat(fd, &archive_stat) == -1 || archive_stat.st_size == 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        free(signatures);
+        return w24_proto_send_header(client_fd, "ERROR", 0, fd == -1 ? "unknown archive" : "delta not worthwhile");
+    }
+
+    size_t length = (size_t)archive_stat.st_size;
+    unsigned char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(signatures);
+        return w24_proto_send_header(client_fd, "ERROR", 0, "archive unreadable");
+    }
+
+    unsigned char *delta = NULL;
+    size_t delta_length = 0;
+    W24_TRACE_BEGIN("delta");
+    int ret = w24_delta_generate(data, length, signatures, block_size, basis_length, length / 10 * 9, &delta, &delta_length);
+    W24_TRACE_END();
+    free(signatures);
+    if (ret != 0) {
+        munmap(data, length);
+        return w24_proto_send_header(client_fd, "ERROR", 0, ret == 1 ? "delta not worthwhile" : "out of memory");
+    }
+
+    // the client checks what it rebuilt against the length and CRC-32 of the archive
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (size_t done = 0; done < length; ) {
+        uInt piece = length - done > (1U << 30) ? (1U << 30) : (uInt)(length - done);
+        crc = crc32(crc, data + done, piece);
+        done += piece;
+    }
+    munmap(data, length);
+
+    snprintf(attrs, sizeof(attrs), "%zu %08lx", length, (unsigned long)crc);
+    ret = w24_proto_send_frame(client_fd, "DELTA", attrs, delta, delta_length);
+    free(delta);
+    if (ret == 0) {
+        W24_METRICS_ADD(delta_transfers, 1);
+        W24_METRICS_ADD(delta_bytes_out, delta_length);
+        W24_METRICS_ADD(delta_bytes_saved, length - delta_length);
+    }
+    return ret;
 }
 
 /*
  * This function processes messages received from a client connected to the server.
  * It continuously listens for messages from the client and performs appropriate actions based on the received message.
  * If the received message is "quitc", it decrements the client count, sends a shutdown message to the client, and breaks the loop to exit.
- * If the received message is "dirlist -a", it executes a command to list directories under the home directory in alphabetical order and sends the result back to the client.
- * If the received message is "dirlist -t", it executes a command to list directories under the home directory in the order of creation and sends the result back to the client.
+ * If the received message is "ping", a heartbeat of an idle client, it answers "pong". A client that sends nothing for --idle-timeout
+ * seconds, or that vanishes without "quitc", ends the session the same way, counted in the stats (see w24listen.h).
+ * If the received message is "dirlist -a", it lists the directories under the server root in alphabetical order and sends the result back to the client.
+ * If the received message is "dirlist -t", it lists the directories under the server root in the order of creation (newest first) and sends the result back to the client.
  * If the received message starts with "w24fn ", it extracts the filename from the message and retrieves file information such as size, creation date, and permissions, then sends the information back to the client.
  * If the received message starts with "w24fdb " or "w24fda ", it extracts the date filter from the message and searches for files created before or after the specified date, respectively. It then sends the list of files meeting the criteria back to the client.
  * If the received message starts with "w24fz ", it extracts the size constraints from the message and searches for files within the specified size range. It sends the list of files meeting the criteria back to the client.
- * If the received message starts with "w24ft ", it extracts a list of file extensions from the message and searches for files with those extensions. It sends the list of files back to the client as a compressed archive (tar.gz).
+ * If the received message starts with "w24ft ", it extracts a list of file extensions from the message and searches for files with those extensions. It sends the list of files back to the client as a compressed archive.
+ * If the received message starts with "w24fg " or "w24fr ", the rest of it is a glob or an extended regular expression, preceded by -i to ignore case and -a to get an archive instead of the framed "FILES <length> <count>" list of matching paths.
+ * If the received message starts with "w24fuzzy ", it answers with the files whose names are closest to the (misspelled) name that follows, by edit distance, looked up in a trigram index of the tree; "-k <count>" sets how many.
+ * If the received message is "w24top size|new [<k>]" or "w24agg ext|dir", it answers with a table computed in one pass over the tree: the k largest or newest files, or the files and bytes per extension or per top-level directory (see aggregate_tree).
+ * If the received message starts with "w24grep ", it searches the contents of the files picked by the -fg/-ft/-fz/-fdb/-fda filters for a fixed string (or a regular expression with -E) and streams back the matching lines in framed chunks (see grep_files).
+ * Archives are announced as "ARCHIVE <id> <length> <extension>" and downloaded by the client with "fetch <id> <offset> <length>", answered with a framed DATA message (see w24proto.h) sent with sendfile() from the archive store; a client can resume or fetch any range.
+ * A client holding an earlier archive of the same command can send "SIGS <n> <id> <block_size> <basis_length>" followed by the block signatures of that archive instead, answered with a DELTA frame that rebuilds the new archive from it (see w24delta.h).
+ * If the received message is "ifgen <generation> <command>" for dirlist -a, dirlist -t or w24fn, it answers with an empty NOTMOD frame while the tree is still at that generation (see w24gen.h), and otherwise runs the command and frames its text as "TEXT <length> <generation>".
+ * Before a command that scans the tree or builds an archive runs, the handler takes a slot of the command's class, lookups or
+ * archives (--lookups, --archives), waiting in the class's queue if all are taken; when the queue is full or the wait too long, the
+ * command is answered with "BUSY 0 <retry_ms> <port>" instead, port naming a node to try instead (--peers). The slot is given back
+ * once the reply is sent, before the handler waits for the next message (see w24admit.h).
+ * Any command may be sent as "req <id> <deadline_ms> <command>" ("-" for no id, 0 for no deadline; a malformed prefix is answered
+ * with an ERROR frame). If the received message is "cancel <id>", the running requests with that id, on any connection to this node,
+ * stop, answered "cancelled <n>" or "no running request <id>". The scans and archive writers check at every file or member whether
+ * their request was cancelled, is past its deadline or lost its client, and stop at once: tar is killed, nothing partial is kept,
+ * and the command is answered "Request stopped: <reason>", as text or as an ERROR frame like the command's other errors (see w24cancel.h).
+ * If the received message is "stats", it sends the server metrics (archives built, zip members stored vs compressed, ratio, CPU time saved).
+ * If the received message starts with "codecs ", it stores the client's advertised compression codecs (most preferred first) and preferred level; every later archive is built with the first of them this server supports.
  * If none of the above conditions are met, it echoes the received message back to the client.
+ * A scan or an archive build that fails is answered "File scan failed" or "Archive creation failed" (an ERROR frame for the
+ * framed commands) and the session goes on: in thread mode the handler shares the process with every other client.
+ * The function returns when the client quits or disconnects. It runs in a forked child or on its own thread (--mode), so per-request
+ * state lives on the stack or in thread-local variables, and a failed send only shuts the socket down: the descriptor is closed
+ * once, on return, so a thread can never close a descriptor number another connection has been given meanwhile.
  */
 
 void crequest(int client_fd){
     
+    char codec_offer[W24_CODEC_LIST_MAX] = ""; // codecs advertised by the client, empty: gzip only
+    int codec_level = 0; // level preferred by the client, 0: server default
+    char archive_id[W24_CACHE_KEY_LENGTH + 1] = ""; // last archive announced to the client
+    int archive_fd = -1; // kept open so eviction cannot break its download
     char message[MAX_MSG_LENGTH]; // message from client
+    char generation[W24_GEN_TOKEN_MAX]; // generation of the tree for a conditional request (ifgen), "" otherwise
+    int quit = 0; // the client said quitc
+    enum w24_admit_class admit_class = W24_ADMIT_NONE; // class of the last command and the slot it holds, -1: none
+    int admit_slot = -1;
+    int retry_ms = 0;
+    struct w24_request request = { .slot = -1 }; // the command running, for its checkpoints (see w24cancel.h)
+    char request_id[W24_CANCEL_ID_MAX + 1];
+    int deadline_ms;
+    int trace_depth;
+
+    if (concurrency_mode == MODE_FORK) {
+        W24_TRACE_END(); // the "fork" span opened by the parent ends here in the child
+    }
+    trace_depth = w24_trace_depth(); // spans left open by an early 'continue' are closed on the next iteration
 
     while(1)
     {
+        W24_TRACE_UNWIND(trace_depth);
+        w24_admit_leave(admit_class, admit_slot); // the last command is done
+        admit_slot = -1;
+        w24_cancel_end(&request);
         memset(message, '\0', sizeof(message)); // empty it
         
-        // Receive message from client
-        if (recv(client_fd, message, MAX_MSG_LENGTH, 0) == -1) {
-            perror("Receive failed");
-            close(client_fd);
+        // Receive message from client; stop when the client is gone. io_uring task work run for
+        // this thread can interrupt the wait even under SA_RESTART, since the socket has a timeout
+        ssize_t received;
+        do {
+            received = recv(client_fd, message, MAX_MSG_LENGTH - 1, 0);
+        } while (received == -1 && errno == EINTR);
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            w24_log(W24_LOG_INFO, "Closing session idle for %d s", idle_timeout);
+            W24_METRICS_ADD(sessions_timed_out, 1);
+            break;
+        }
+        if (received <= 0) {
+            if (received == -1) {
+                perror("Receive failed");
+            }
+            W24_METRICS_ADD(sessions_dropped, 1);
+            break;
+        }
+
+        // "SIGS ...": binary block signatures follow the header line, so it is answered before the message is handled as text;
+        // it stops like any request when its client goes away, and takes its admission slot once the signatures are read
+        if (received > 5 && memcmp(message, "SIGS ", 5) == 0) {
+            w24_cancel_begin(&request, "", 0, client_fd);
+            admit_class = admit_class_of(message);
+            if (send_delta(client_fd, message, (size_t)received, archive_fd, archive_id, admit_class, &request, &admit_slot) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
             continue;
         }
 
@@ -289,159 +2223,264 @@ void crequest(int client_fd){
             message[strlen(message) - 1] = '\0';
         }
 
-        printf("Received message: %s\n", message);
+        // heartbeat of an idle client: answered before logging, which would otherwise fill up with them
+        if (strcmp(message, "ping") == 0) {
+            W24_METRICS_ADD(heartbeats, 1);
+            if (send_text(client_fd, "pong", "") == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+            continue;
+        }
+
+        w24_log(W24_LOG_INFO, "Received message: %s", message);
         
         // if no message received
         if(strlen(message)==0){
-            printf("No message received from client.. continuing to look for client\n");
+            w24_log(W24_LOG_DEBUG, "No message received from client.. continuing to look for client");
+            continue;
+        }
+
+        W24_TRACE_BEGIN_DETAIL("request", message);
+
+        // "req <id> <deadline_ms> <command>": a command that can be cancelled by id or has a deadline
+        int prefixed = w24_cancel_parse(message, request_id, sizeof(request_id), &deadline_ms);
+        if (prefixed == -1 || (prefixed == 1 && message[0] == '\0')) {
+            if (w24_proto_send_header(client_fd, "ERROR", 0, "bad request prefix") == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
             continue;
         }
+        w24_cancel_begin(&request, request_id, deadline_ms, client_fd);
+
+        // "ifgen <generation> <command>": dirlist -a, dirlist -t or w24fn, from a client holding the reply of that generation
+        generation[0] = '\0';
+        if (strstr(message, "ifgen ") == message) {
+            char cached[W24_GEN_TOKEN_MAX];
+            int command_start = 0;
+
+            if (sscanf(message, "ifgen %47s %n", cached, &command_start) != 1 || command_start == 0 ||
+                (strcmp(message + command_start, "dirlist -a") != 0 && strcmp(message + command_start, "dirlist -t") != 0 &&
+                 strstr(message + command_start, "w24fn ") != message + command_start)) {
+                if (w24_proto_send_header(client_fd, "ERROR", 0, "bad conditional request") == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
+            }
+
+            // read before the scan, so that a change during the scan leaves the reply with an older generation
+            W24_METRICS_ADD(conditional_requests, 1);
+            w24_gen_token(generation, sizeof(generation));
+            if (strcmp(cached, generation) == 0 && strcmp(generation, "-") != 0) {
+                W24_METRICS_ADD(notmod_replies, 1);
+                if (w24_proto_send_header(client_fd, "NOTMOD", 0, generation) == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
+            }
+            memmove(message, message + command_start, strlen(message + command_start) + 1);
+        }
+
+        // commands that scan the tree or build archives wait for a slot of their class, or are turned away
+        admit_class = admit_class_of(message);
+        if (admit_class != W24_ADMIT_NONE) {
+            W24_TRACE_BEGIN_DETAIL("admission", w24_admit_class_name(admit_class));
+            admit_slot = w24_admit_enter(admit_class, &request, &retry_ms);
+            W24_TRACE_END();
+            if (admit_slot == -2) {
+                // the lookups other than dirlist and w24fn, and w24fg/w24fr without -a, answer with frames
+                int framed = admit_class == W24_ADMIT_LOOKUP && strstr(message, "dirlist ") != message && strstr(message, "w24fn ") != message;
+
+                reply_if_stopped(client_fd, framed);
+                continue;
+            }
+            if (admit_slot == -1) {
+                w24_log(W24_LOG_INFO, "Server busy with %ss, client told to retry in %d ms", w24_admit_class_name(admit_class), retry_ms);
+                if (send_busy(client_fd, retry_ms) == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
+            }
+        }
 
         // when client wants to shut
         if(strcmp(message,"quitc")==0)
         {
-            client_count_server-=1; //decrement client count
+            if (server_role == ROLE_PRIMARY) {
+                __atomic_sub_fetch(client_count_server, 1, __ATOMIC_RELAXED); //decrement client count
+            }
+            quit = 1;
             char *close_client_msg = "shut yourself";
-            if (send(client_fd, close_client_msg, strlen(close_client_msg), 0) == -1) {
+            if (send_text(client_fd, close_client_msg, "") == -1) {
                 perror("Send failed");
-                close(client_fd);
+                shutdown(client_fd, SHUT_RDWR);
             }
             break; // break loop because client is done
         }
-        else if(strcmp(message,"dirlist -a")==0) // FILES IN ALPHABETICAL ORDER - working
+        else if(strstr(message, "fetch ") == message) // ARCHIVE RANGE DOWNLOAD
         {
-            // Capture directory list
-            FILE *fp = popen("find $HOME -type d -not -wholename '*/[.]*' | sort", "r");
-            if (fp == NULL) {
-                perror("Error executing command");
-                exit(EXIT_FAILURE);
-            }
+            char fetch_id[W24_CACHE_KEY_LENGTH + 2];
+            unsigned long long offset, length;
+            char attrs[128];
+            struct stat archive_stat;
 
-            // read the command
-            char buffer[MAX_BUFFER_LENGTH];
-            size_t bytes_read = fread(buffer, 1, sizeof(buffer), fp);
-            if (bytes_read == 0) {
-                perror("Error reading from command output");
-                exit(EXIT_FAILURE);
+            if (sscanf(message, "fetch %65s %llu %llu", fetch_id, &offset, &length) != 3 || !w24_cache_valid_key(fetch_id)) {
+                if (w24_proto_send_header(client_fd, "ERROR", 0, "bad fetch request") == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
             }
 
-            // Close pipe
-            pclose(fp);
+            // this session's archive is read through the descriptor kept open since it was announced
+            int fetch_fd = (archive_fd != -1 && strcmp(fetch_id, archive_id) == 0) ? dup(archive_fd) : w24_cache_open(fetch_id);
+            if (fetch_fd == -1 || fstat(fetch_fd, &archive_stat) == -1 || offset > (unsigned long long)archive_stat.st_size) {
+                if (fetch_fd != -1) {
+                    close(fetch_fd);
+                }
+                if (w24_proto_send_header(client_fd, "ERROR", 0, "unknown archive or offset") == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
+            }
 
-            // printf("Return value: \n");
-            // printf("%s\n",buffer);
+            // length 0 or past the end: everything up to the end of the archive
+            unsigned long long available = (unsigned long long)archive_stat.st_size - offset;
+            if (length == 0 || length > available) {
+                length = available;
+            }
 
-            // send response to client
-            if (send(client_fd, buffer, strlen(buffer), 0) == -1) {
+            W24_TRACE_BEGIN("sendfile");
+            snprintf(attrs, sizeof(attrs), "%llu %lld", offset, (long long)archive_stat.st_size);
+            if (w24_proto_send_header(client_fd, "DATA", length, attrs) == -1 || w24_proto_sendfile(client_fd, fetch_fd, (off_t)offset, (size_t)length) == -1) {
                 perror("Send failed");
-                close(client_fd);
+                close(fetch_fd);
+                shutdown(client_fd, SHUT_RDWR);
                 continue;
             }
+            W24_TRACE_END();
+            close(fetch_fd);
         }
-        else if(strcmp(message,"dirlist -t")==0) // FILES IN time of creation ORDER - working
+        else if(strstr(message, "cancel ") == message) // STOP A REQUEST BY ID
         {
+            char reply[MAX_MSG_LENGTH];
+            int cancelled = w24_cancel_id(message + 7);
 
-            FILE *fp, *check_existence;
-            char output_for_client[MAX_BUFFER_LENGTH], message_to_client[MAX_BUFFER_LENGTH];
-
-            // path to search
-            char * root = "$HOME";
-            
-            // ignoring hidden files and using birth date as filter        
-            snprintf(output_for_client, sizeof(output_for_client), "find %s -type d -not -wholename '*/[.]*' -exec stat --format=%%w\' \'%%n {} + | sort -r | cut -d' ' -f4-", root);
-            
-            // Open a pipe to execute the command
-            check_existence = popen(output_for_client, "r");
-            if (check_existence == NULL) {
-                perror("popen failed to run.");
-                exit(EXIT_FAILURE);
+            if (cancelled > 0) {
+                snprintf(reply, sizeof(reply), "cancelled %d", cancelled);
             }
+            else {
+                snprintf(reply, sizeof(reply), "no running request %.*s", W24_CANCEL_ID_MAX, message + 7);
+            }
+            w24_log(W24_LOG_INFO, "%s", reply);
+            if (send_text(client_fd, reply, "") == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+                continue;
+            }
+        }
+        else if(strcmp(message, "stats") == 0) // SERVER METRICS
+        {
+            char reply[MAX_MSG_LENGTH];
 
-            memset(output_for_client, 0, sizeof(output_for_client)); //empty it
-
-            // Read the output of the command
-            if (fgets(output_for_client, MAX_BUFFER_LENGTH, check_existence) == NULL) {
-                
-                snprintf(message_to_client, sizeof(message_to_client), "No file found");
-
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
-                    perror("Send failed");
-                    close(client_fd);
-                    continue;
-                }
+            w24_metrics_format(reply, sizeof(reply));
+            if (send_text(client_fd, reply, "") == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+                continue;
             }
-            else
-            {
+        }
+        else if(strstr(message, "codecs ") == message) // CODEC NEGOTIATION
+        {
+            char reply[MAX_MSG_LENGTH];
 
-                memset(output_for_client, 0, sizeof(output_for_client)); //empty it
+            codec_level = 0;
+            if (sscanf(message, "codecs %127s %d", codec_offer, &codec_level) < 1) {
+                codec_offer[0] = '\0';
+            }
 
-                // checking for non-zero output
-                
-                // change f4 accordingly in debian
-                snprintf(output_for_client, sizeof(output_for_client), "find %s -type d -not -wholename '*/[.]*' -exec stat --format=%%w\' \'%%n {} + | sort -r | cut -d' ' -f4-", root);
-                // printf("Command to fopen is: %s\n", output_for_client);
+            snprintf(reply, sizeof(reply), "codec %s", w24_codec_negotiate(codec_offer[0] != '\0' ? codec_offer : NULL)->name);
+            if (send_text(client_fd, reply, "") == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+                continue;
+            }
+        }
+        else if(strcmp(message,"dirlist -a")==0) // FILES IN ALPHABETICAL ORDER - working
+        {
+            // Capture directory list
+            W24_TRACE_BEGIN("scan directories");
+            char buffer[MAX_BUFFER_LENGTH];
+            list_directories(0, buffer, sizeof(buffer));
+            W24_TRACE_END();
 
-                // Open a pipe to the command
-                if ((fp = popen(output_for_client, "r")) == NULL)
-                {
-                    perror("popen failed to run");
-                    exit(EXIT_FAILURE);
-                }
+            // send response to client
+            W24_TRACE_BEGIN("send");
+            if (send_text(client_fd, buffer, generation) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+                continue;
+            }
+            W24_TRACE_END();
+        }
+        else if(strcmp(message,"dirlist -t")==0) // FILES IN time of creation ORDER - working
+        {
 
-                char buffer[MAX_BUFFER_LENGTH];
-                size_t bytes_read = fread(buffer, 1, sizeof(buffer), fp);
-                if (bytes_read == 0) {
-                    perror("Error reading from command output");
-                    exit(EXIT_FAILURE);
-                }
+            char buffer[MAX_BUFFER_LENGTH];
 
-                // Close pipe
-                pclose(fp);
+            // ignoring hidden directories, newest birth time first
+            W24_TRACE_BEGIN("scan directories");
+            if (list_directories(1, buffer, sizeof(buffer)) == 0) {
+                snprintf(buffer, sizeof(buffer), "No file found");
+            }
+            W24_TRACE_END();
 
-                // printf("Return value: \n");
-                // printf("%s\n",buffer);
-                
-                if (send(client_fd, buffer, strlen(buffer), 0) == -1) {
-                    perror("Send failed");
-                    close(client_fd);
-                    continue;
-                }
+            W24_TRACE_BEGIN("send");
+            if (send_text(client_fd, buffer, generation) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+                continue;
             }
+            W24_TRACE_END();
         }
         else if(strstr(message, "w24fn ") == message) // FILE INFORMATION - WORKING
         {
 
-            num_files=0;
-            char * message_copy = strdup(message);
-            user_file_name = strtok(message_copy + 6, "\0"); // get the filename
+            struct name_search search = { .found = 0 };
+            int ret = 0;
 
-            char * root = getenv("HOME");
-            
-            int flags = FTW_PHYS; // For not following symbolic links. Ensures that traversal process stays within the boundaries of the directory structure being traversed.
-            
-            // using nftw to find the first match out of possibly many
-            int ret = nftw(root, traverse_and_extract, 1, flags);
+            // scanning for the first match out of possibly many; a name no file can have matches nothing
+            W24_TRACE_BEGIN("scan");
+            if (w24_match_name_init(&search.name, message + 6, 0) == 0 && strchr(message + 6, '/') == NULL) {
+                ret = w24_scan(server_root, W24_SCAN_REGULAR | W24_SCAN_OTHER | W24_SCAN_HIDDEN, &search.name, find_by_name, &search);
+            }
+            W24_TRACE_END();
             char *message_to_client = (char *)malloc(MAX_BUFFER_LENGTH * sizeof(char));
 
-            if (ret == -1) // if nftw fails
+            if (ret == -1) // if the scan fails
             {
-                perror("nftw");
-                snprintf(message_to_client, MAX_BUFFER_LENGTH, "nftw failed");
+                perror("scan");
+                snprintf(message_to_client, MAX_BUFFER_LENGTH, "scan failed");
             }
             else
             {
-                //printf("The number of files found is : %d\n", num_files);
-
-                if(num_files==0){
+                if(!search.found){
                     snprintf(message_to_client, MAX_BUFFER_LENGTH, "No file found");
-                    // printf("File not found.\n");
                 }
                 else
                 {
                     struct stat sb;
                     
                     // Call stat() to retrieve file information
-                    if (stat(file_paths[0], &sb) == -1) {
+                    W24_TRACE_BEGIN("stat");
+                    int stat_ret = stat(search.path, &sb);
+                    W24_TRACE_END();
+                    if (stat_ret == -1) {
                         snprintf(message_to_client, MAX_BUFFER_LENGTH, "Error in retrieving file stat.");
                     }
                     else{
@@ -449,7 +2488,9 @@ void crequest(int client_fd){
                         snprintf(message_to_client, MAX_BUFFER_LENGTH, "File Size: %ld bytes\n", sb.st_size);
 
                         // Print file creation date (using st_ctime)
-                        char *ctime_str = get_creation_date(file_paths[0]);
+                        W24_TRACE_BEGIN("get_creation_date");
+                        char *ctime_str = get_creation_date(search.path);
+                        W24_TRACE_END();
                         snprintf(message_to_client + strlen(message_to_client), MAX_BUFFER_LENGTH - strlen(message_to_client), "Creation Date: %s\n", ctime_str);
 
                         // Print file permissions
@@ -469,11 +2510,15 @@ void crequest(int client_fd){
 
             }   
 
-            if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
+            W24_TRACE_BEGIN("send");
+            int sent = send_text(client_fd, message_to_client, generation);
+            free(message_to_client);
+            if (sent == -1) {
                 perror("Send failed");
-                close(client_fd);
+                shutdown(client_fd, SHUT_RDWR);
                 continue;
             }
+            W24_TRACE_END();
         }
         else if((strstr(message, "w24fdb ") == message) || (strstr(message, "w24fda ") == message)) // DATE FILTER - WORKING ON DEBIAN
         {
@@ -481,74 +2526,16 @@ void crequest(int client_fd){
             
             char *date_sign = (strstr(message, "w24fdb ") == message) ? "<=" : ">=";
 
-            // Use the find command to search for files with creation date <= date
-            FILE *fp, *check_existence;
-            char output_for_client[MAX_BUFFER_LENGTH], message_to_client[MAX_BUFFER_LENGTH];
-
-            // path to search
-            char * root = "$HOME";
-
-            // change command as per sign. Ignoring hidden files
-            if(strcmp(date_sign,">=")==0)
-                snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -exec stat --format=%%w\\ %%n {} + | awk -v date='%s' '$1 >= date' | cut -d' ' -f4-", root, date);
-            else
-                snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -exec stat --format=%%w\\ %%n {} + | awk -v date='%s' '$1 <= date' | cut -d' ' -f4-", root, date);
-
-            printf("command: %s\n", output_for_client);
-            
-            // Open a pipe to execute the command
-            check_existence = popen(output_for_client, "r");
-            if (check_existence == NULL) {
-                perror("popen failed to run.");
-                exit(EXIT_FAILURE);
-            }
-
-            memset(output_for_client, 0, sizeof(output_for_client)); //empty it
-
-            // Read the output of the command
-            if (fgets(output_for_client, MAX_BUFFER_LENGTH, check_existence) == NULL) {
-                
-                snprintf(message_to_client, sizeof(message_to_client), "No file found");
-
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
-                    perror("Send failed");
-                    close(client_fd);
-                    continue;
-                }
-            }
-            else // if output is non=zero
-            {
-                memset(output_for_client, 0, sizeof(output_for_client)); //empty it
-
-                // checking for non-zero output
-                if(strcmp(date_sign,">=")==0)
-                    snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -exec stat --format=%%w\\ %%n {} + | awk -v date='%s' '$1 >= date' | cut -d' ' -f4- | tar -czvf temp.tar.gz -T -", root, date);
-                else
-                    snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -exec stat --format=%%w\\ %%n {} + | awk -v date='%s' '$1 <= date' | cut -d' ' -f4- | tar -czvf temp.tar.gz -T -", root, date);
-
-                    //printf("Command to fopen is: %s\n", output_for_client);
-
-                // Open a pipe to the command
-                if ((fp = popen(output_for_client, "r")) == NULL)
-                {
-                    perror("popen failed to run");
-                    exit(EXIT_FAILURE);
-                }
-
-                // implement send message
-                snprintf(message_to_client, sizeof(message_to_client), "temp.tar.gz");
+            // Scan the tree for files with creation date <= date (or >= date), ignoring hidden files
+            struct file_query query = { .kind = QUERY_DATE, .date = date, .before = strcmp(date_sign, "<=") == 0 };
 
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
-                    perror("Send failed");
-                    close(client_fd);
-                    continue;
-                }
-
-                pclose(fp);
+            W24_TRACE_BEGIN("existence check");
+            FILE *matches = find_files(&query);
+            W24_TRACE_END();
+            if (send_archive(client_fd, matches, codec_offer, codec_level, &archive_fd, archive_id) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
             }
-
-            pclose(check_existence);
-
         }
         else if(strstr(message, "w24fz ") == message) // SIZE CONSTRAINT - WORKING
         {
@@ -557,152 +2544,265 @@ void crequest(int client_fd){
             // store the sizes
             sscanf(message, "w24fz %ld %ld", &size1, &size2);
 
-            // Use the find command to search for files with creation date <= date
-            FILE *fp, *check_existence;
-            char output_for_client[MAX_BUFFER_LENGTH], message_to_client[MAX_BUFFER_LENGTH];
+            // Scan the tree for files strictly between the two sizes, ignoring hidden files
+            struct file_query query = { .kind = QUERY_SIZE, .min_size = size1, .max_size = size2 };
 
-            // path to search
-            char * root = "$HOME";
+            W24_TRACE_BEGIN("existence check");
+            FILE *matches = find_files(&query);
+            W24_TRACE_END();
+            if (send_archive(client_fd, matches, codec_offer, codec_level, &archive_fd, archive_id) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+        }
+        else if(strstr(message, "w24ft ") == message) // 3 EXTENSIONS - WORKING
+        {
 
-            // checking for non-zero output
-            snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -size +%ldc -size -%ldc", root, size1, size2);
+            struct file_query query = { .kind = QUERY_EXTENSIONS };
 
-            // Open a pipe to execute the command
-            check_existence = popen(output_for_client, "r");
-            
-            if (check_existence == NULL) {
-                perror("popen failed to run.");
-                exit(EXIT_FAILURE);
+            // Extract extensions
+            char extensionList2[MAX_BUFFER_LENGTH]; // Assuming MAX_BUFFER_LENGTH is large enough
+            snprintf(extensionList2, sizeof(extensionList2), "%s", message);
+            char *saveptr;
+            char *token = strtok_r(extensionList2, " ", &saveptr);
+            while (token != NULL) {
+                token = strtok_r(NULL, " ", &saveptr);
+                if(token==NULL || query.num_patterns == MAX_EXTENSIONS)
+                    break;
+                // matched like find -name '*.ext'
+                snprintf(query.patterns[query.num_patterns++], sizeof(query.patterns[0]), "*.%.*s", MAX_EXTENSION_LENGTH, token);
             }
 
-            memset(output_for_client, 0, sizeof(output_for_client)); //empty it
+            // plain extensions are matched as suffixes in bulk while scanning; globs go through fnmatch()
+            const char *suffixes[MAX_EXTENSIONS];
+            query.literal = query.num_patterns > 0;
+            for (int i = 0; i < query.num_patterns; i++) {
+                suffixes[i] = query.patterns[i] + 1; // ".ext"
+                query.literal = query.literal && strpbrk(suffixes[i], "*?[\\") == NULL;
+            }
+            query.literal = query.literal && w24_match_suffixes_init(&query.suffixes, suffixes, query.num_patterns, 0) == 0;
 
-            // Read the output of the command
-            if (fgets(output_for_client, MAX_BUFFER_LENGTH, check_existence) == NULL) {
-                
-                snprintf(message_to_client, sizeof(message_to_client), "No file found");
+            // Scan the tree into a list of matches. Ignoring hidden files
+            W24_TRACE_BEGIN("existence check");
+            FILE *matches = find_files(&query);
+            W24_TRACE_END();
+            if (send_archive(client_fd, matches, codec_offer, codec_level, &archive_fd, archive_id) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+        }
+        else if(strstr(message, "w24fg ") == message || strstr(message, "w24fr ") == message) // GLOB OR REGEX FILE NAMES
+        {
+            enum w24_pattern_syntax syntax = message[4] == 'g' ? W24_PATTERN_GLOB : W24_PATTERN_REGEX;
+            char error[128], attrs[64], message_to_client[MAX_BUFFER_LENGTH];
+            char *text = message + 6;
+            unsigned flags = 0;
+            int archive = 0;
+            size_t count = 0;
+
+            // options before the pattern, which is the rest of the line and may contain spaces
+            while (text[0] == '-' && (text[1] == 'a' || text[1] == 'i' || text[1] == '-') && text[2] == ' ') {
+                archive |= text[1] == 'a';
+                flags |= text[1] == 'i' ? W24_PATTERN_NOCASE : 0;
+                text += 3;
+                if (text[-2] == '-') {
+                    break;
+                }
+            }
 
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
+            W24_TRACE_BEGIN("compile pattern");
+            struct w24_pattern *pattern = w24_pattern_compile(text, syntax, flags, error, sizeof(error));
+            W24_TRACE_END();
+            if (pattern == NULL) {
+                snprintf(message_to_client, sizeof(message_to_client), "Invalid pattern: %s", error);
+                int ret = archive ? send_text(client_fd, message_to_client, "") : w24_proto_send_header(client_fd, "ERROR", 0, message_to_client);
+                if (ret == -1) {
                     perror("Send failed");
-                    close(client_fd);
-                    continue;
+                    shutdown(client_fd, SHUT_RDWR);
                 }
+                continue;
             }
-            else // if output is non=zero
-            {
-                memset(output_for_client, 0, sizeof(output_for_client)); //empty it
-                snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' -size +%ldc -size -%ldc -exec tar -cf temp.tar.gz {} +", root, size1, size2);
-                //printf("Command to fopen is: %s\n", output_for_client);
-
-                // Open a pipe to the command
-                if ((fp = popen(output_for_client, "r")) == NULL)
-                {
-                    perror("popen failed to run");
-                    exit(EXIT_FAILURE);
+            w24_log(W24_LOG_INFO, "Pattern \"%s\": %d DFA states, literal \"%s\"", text, w24_pattern_states(pattern), w24_pattern_literal(pattern));
+
+            W24_TRACE_BEGIN("existence check");
+            FILE *check_existence = find_by_pattern(pattern, &count);
+            w24_pattern_free(pattern);
+            W24_TRACE_END();
+            if (archive) {
+                if (send_archive(client_fd, check_existence, codec_offer, codec_level, &archive_fd, archive_id) == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
+            }
+            if (check_existence == NULL) {
+                if (!reply_if_stopped(client_fd, 1)) {
+                    perror("File scan failed");
+                    send_error(client_fd, 1, "File scan failed");
                 }
+                continue;
+            }
+
+            // the whole list in one framed reply: "FILES <length> <count>" and the paths, one per line
+            char *paths = malloc(MAX_BUFFER_LENGTH);
+            size_t length = paths != NULL ? fread(paths, 1, MAX_BUFFER_LENGTH, check_existence) : 0;
+            while (length == MAX_BUFFER_LENGTH && paths[length - 1] != '\n') {
+                length--; // a list too long for one reply ends with the last whole path
+            }
 
-                // implement send message
-                snprintf(message_to_client, sizeof(message_to_client), "temp.tar.gz");
+            snprintf(attrs, sizeof(attrs), "%zu", count);
+            W24_TRACE_BEGIN("send");
+            if (w24_proto_send_frame(client_fd, "FILES", attrs, paths, length) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+            W24_TRACE_END();
+            free(paths);
 
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
+            fclose(check_existence);
+        }
+        else if(strstr(message, "w24grep ") == message) // FILE CONTENTS
+        {
+            struct grep_request request;
+            char error[128], reply[MAX_MSG_LENGTH];
+
+            W24_TRACE_BEGIN("compile pattern");
+            int parsed = parse_grep_request(message + 8, &request, error, sizeof(error));
+            W24_TRACE_END();
+            if (parsed == -1) {
+                snprintf(reply, sizeof(reply), "Invalid request: %s", error);
+                if (w24_proto_send_header(client_fd, "ERROR", 0, reply) == -1) {
                     perror("Send failed");
-                    close(client_fd);
-                    continue;
+                    shutdown(client_fd, SHUT_RDWR);
                 }
-                pclose(fp);
+                continue;
             }
 
-            pclose(check_existence);
+            if (grep_files(client_fd, &request) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+            w24_grep_free(request.grep);
+            w24_pattern_free(request.name);
         }
-        else if(strstr(message, "w24ft ") == message) // 3 EXTENSIONS - WORKING
+        else if(strstr(message, "w24fuzzy ") == message) // CLOSEST FILE NAMES
         {
+            struct w24_fuzzy_result results[W24_FUZZY_MAX_RESULTS];
+            char attrs[32], reply[MAX_MSG_LENGTH];
+            const char *name = message + 9;
+            int k = 10, used = 0, count = -1;
 
-            char extensions[MAX_EXTENSIONS][MAX_EXTENSION_LENGTH + 1];
-            FILE *fp, *check_existence;
-            char output_for_client[MAX_BUFFER_LENGTH], output_for_client_final[MAX_BUFFER_LENGTH], message_to_client[MAX_BUFFER_LENGTH];
-            int numExtensions = 0;
-
-            // Find the start of extension list
-            char *extensionList = strstr(message, " ");
-            char * root = "$HOME";
-            extensionList++; // Move pointer past the space character
-
-            // Extract extensions
-            char extensionList2[MAX_BUFFER_LENGTH]; // Assuming MAX_BUFFER_LENGTH is large enough
-            strcpy(extensionList2, message);
-            char *token = strtok(extensionList2, " ");
-            int i=0;
-            while (token != NULL) {
-                //printf("token is: %s\n", token);    
-                token = strtok(NULL, " ");
-                if(token==NULL)
-                    break;
-                if(i==0)
-                    snprintf(output_for_client, sizeof(output_for_client), "find %s -type f -not -wholename '*/[.]*' \\( -name '*.%s'", root, token);
-                else // add extensions to command
-                    snprintf(output_for_client + strlen(output_for_client), sizeof(output_for_client) - strlen(output_for_client), " -o -name '*.%s'", token);
-                i+=1;
+            if (sscanf(name, "-k %d %n", &k, &used) == 1) { // "-k <count>" before the name
+                name += used;
+            }
+            if (k < 1 || k > W24_FUZZY_MAX_RESULTS || name[0] == '\0' || strlen(name) > W24_FUZZY_MAX_QUERY || strchr(name, '/') != NULL) {
+                snprintf(reply, sizeof(reply), "Invalid request: a name of at most %d bytes, and at most %d results", W24_FUZZY_MAX_QUERY, W24_FUZZY_MAX_RESULTS);
+                if (w24_proto_send_header(client_fd, "ERROR", 0, reply) == -1) {
+                    perror("Send failed");
+                    shutdown(client_fd, SHUT_RDWR);
+                }
+                continue;
             }
 
-            char *ending1 = " \\)";
-            snprintf(output_for_client + strlen(output_for_client), sizeof(output_for_client_final) - strlen(ending1), ending1);
-
-            // adding TAR component to command
-            char *ending2 = " -exec tar -cf temp.tar.gz {} +";
-            snprintf(output_for_client_final, sizeof(output_for_client_final), output_for_client);
-            snprintf(output_for_client_final + strlen(output_for_client_final), sizeof(output_for_client_final) - strlen(ending2), ending2);
-
-            // Open a pipe to execute the command
-            check_existence = popen(output_for_client, "r");
-
-            if (check_existence == NULL) {
-                perror("popen failed to run.");
-                exit(EXIT_FAILURE);
+            // the index is built by the first request and then reused by every handler until it is W24_FUZZY_MAX_AGE old
+            W24_TRACE_BEGIN("index");
+            struct w24_fuzzy_index *index = w24_fuzzy_open(server_root, fuzzy_index_path, W24_FUZZY_MAX_AGE);
+            W24_TRACE_END();
+            if (index == NULL) {
+                perror("Fuzzy index unavailable");
+            }
+            else {
+                W24_TRACE_BEGIN("search");
+                count = w24_fuzzy_search(index, name, w24_fuzzy_default_distance(strlen(name)), results, k);
+                W24_TRACE_END();
             }
 
-            memset(output_for_client, 0, sizeof(output_for_client)); //empty it
+            // "FILES <length> <count>" and one "<distance> <path>" line per result, closest first
+            size_t length = 0;
+            char *paths = malloc(MAX_BUFFER_LENGTH);
+            for (int i = 0; paths != NULL && i < count; i++) {
+                length += snprintf(paths + length, MAX_BUFFER_LENGTH - length, "%d %s\n", results[i].distance, results[i].path);
+            }
+            w24_fuzzy_close(index);
 
-            // if output is NULL
-            if (fgets(output_for_client, MAX_BUFFER_LENGTH, check_existence) == NULL) {
-                snprintf(message_to_client, sizeof(message_to_client), "No file found");
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
+            snprintf(attrs, sizeof(attrs), "%d", count > 0 ? count : 0);
+            W24_TRACE_BEGIN("send");
+            int ret = count == -1 ? w24_proto_send_header(client_fd, "ERROR", 0, "fuzzy index unavailable") :
+                      w24_proto_send_frame(client_fd, "FILES", attrs, paths, length);
+            if (ret == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+            W24_TRACE_END();
+            free(paths);
+        }
+        else if(strstr(message, "w24top ") == message || strstr(message, "w24agg ") == message) // TOP-K AND TOTALS
+        {
+            char what[16] = "", reply[MAX_MSG_LENGTH], attrs[32];
+            enum aggregate_kind kind;
+            int k = 10;
+            char *table = NULL;
+            size_t length = 0, rows = 0;
+
+            sscanf(message + 7, "%15s %d", what, &k);
+            if (message[3] == 't' && (strcmp(what, "size") == 0 || strcmp(what, "new") == 0) && k >= 1 && k <= W24_TOP_MAX) {
+                kind = what[0] == 's' ? AGGREGATE_LARGEST : AGGREGATE_NEWEST;
+            }
+            else if (message[3] == 'a' && (strcmp(what, "ext") == 0 || strcmp(what, "dir") == 0)) {
+                kind = what[0] == 'e' ? AGGREGATE_EXTENSIONS : AGGREGATE_DIRECTORIES;
+            }
+            else {
+                snprintf(reply, sizeof(reply), "Invalid request: w24top size|new [1-%d], or w24agg ext|dir", W24_TOP_MAX);
+                if (w24_proto_send_header(client_fd, "ERROR", 0, reply) == -1) {
                     perror("Send failed");
-                    close(client_fd);
-                    continue;
+                    shutdown(client_fd, SHUT_RDWR);
                 }
+                continue;
             }
-            else{
-                // Open a pipe to the command
-                if ((fp = popen(output_for_client_final, "r")) == NULL)
-                {
-                    perror("popen failed to run");
-                    exit(EXIT_FAILURE);
-                }
 
-                // implement send message
-                snprintf(message_to_client, sizeof(message_to_client), "temp.tar.gz");
+            W24_TRACE_BEGIN_DETAIL("aggregate", what);
+            int ret = aggregate_tree(kind, k, &table, &length, &rows);
+            W24_TRACE_END();
 
-                if (send(client_fd, message_to_client, strlen(message_to_client), 0) == -1) {
-                    perror("Send failed");
-                    close(client_fd);
-                    continue;
-                }
-                pclose(fp);
+            // "TABLE <length> <rows>": tab-separated rows after a header line
+            snprintf(attrs, sizeof(attrs), "%zu", rows);
+            W24_TRACE_BEGIN("send");
+            if (ret == -1 && reply_if_stopped(client_fd, 1)) {
+                free(table);
+                continue;
             }
-
-            pclose(check_existence);
+            if ((ret == -1 ? w24_proto_send_header(client_fd, "ERROR", 0, "scan failed") :
+                             w24_proto_send_frame(client_fd, "TABLE", attrs, table, length)) == -1) {
+                perror("Send failed");
+                shutdown(client_fd, SHUT_RDWR);
+            }
+            W24_TRACE_END();
+            free(table);
         }
         else{
             // Echo message back to client
-            if (send(client_fd, message, strlen(message), 0) == -1) {
+            if (send_text(client_fd, message, "") == -1) {
                 perror("Send failed");
-                close(client_fd);
+                shutdown(client_fd, SHUT_RDWR);
                 continue;
             }
         }
     }
 
-    // Close client socket in the child process
+    W24_TRACE_UNWIND(trace_depth);
+    w24_admit_leave(admit_class, admit_slot);
+    w24_cancel_end(&request);
+
+    if (archive_fd != -1) {
+        close(archive_fd);
+    }
+
+    // a client that vanished or timed out gives up its place in the count as one that quit does
+    if (!quit && server_role == ROLE_PRIMARY) {
+        __atomic_sub_fetch(client_count_server, 1, __ATOMIC_RELAXED);
+    }
+
+    // Close client socket, the only close: failed sends above just shut the connection down
     close(client_fd);
 
 }
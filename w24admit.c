@@ -0,0 +1,398 @@
+/*
+ * w24admit.c: admission control for the commands that scan the tree or build archives (see w24admit.h)
+ */
+
+#include "w24admit.h"
+#include "w24cancel.h"
+#include "w24metrics.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_SERVICE_MS 100 // assumed duration of a command until one was measured
+#define MIN_RETRY_MS 50
+#define MAX_RETRY_MS 5000
+#define STRIDE 1000000 // pass moved on by one grant to a class of weight 1
+
+struct admit_class {
+    struct w24_admit_limits limits;
+    int running;
+    pid_t owners[W24_ADMIT_MAX_RUNNING]; // handler process holding each slot, 0: free
+    long long started_ms[W24_ADMIT_MAX_RUNNING];
+    uint64_t head, tail; // tickets of the waiting handlers, [head, tail), served in order
+    unsigned char abandoned[W24_ADMIT_MAX_QUEUE]; // by ticket modulo W24_ADMIT_MAX_QUEUE: gave up waiting
+    pid_t waiters[W24_ADMIT_MAX_QUEUE]; // by ticket modulo W24_ADMIT_MAX_QUEUE: handler process waiting
+    long long service_ms; // moving average of the time a command holds its slot
+    uint64_t pass; // stride scheduling: the class with the lowest pass gets the next worker
+};
+
+struct w24_admit {
+    pthread_mutex_t lock;
+    uint32_t freed[W24_ADMIT_CLASSES]; // futex words, bumped when a slot or worker was given back or the next in line changed
+    int workers; // commands of all classes run at once, 0: no shared limit
+    int running;
+    uint64_t pass; // pass of the last grant, where a class that was idle resumes
+    struct admit_class classes[W24_ADMIT_CLASSES];
+};
+
+static struct w24_admit *admit = NULL;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a handler that died holding the lock left the state as it was: every update is a few stores
+static void lock(void)
+{
+    if (pthread_mutex_lock(&admit->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&admit->lock);
+}
+
+static void count_queued(enum w24_admit_class admit_class)
+{
+    if (admit_class == W24_ADMIT_LOOKUP)
+        W24_METRICS_ADD(lookups_queued, 1);
+    else
+        W24_METRICS_ADD(archives_queued, 1);
+}
+
+static void count_busy(enum w24_admit_class admit_class)
+{
+    if (admit_class == W24_ADMIT_LOOKUP)
+        W24_METRICS_ADD(lookups_busy, 1);
+    else
+        W24_METRICS_ADD(archives_busy, 1);
+}
+
+/*
+ * w24_admit_init: Maps the shared slots and queues; call once before the first fork
+ *
+ * Parameters:
+ * - limits: Slots, queue length, longest wait and weight of each class; running is capped at W24_ADMIT_MAX_RUNNING
+ *   and queue at W24_ADMIT_MAX_QUEUE, and the running limit in force is written back
+ * - workers: Commands of all the limited classes run at once, 0 for no shared limit; every class but the one with
+ *   the highest weight is left at least one worker short of them
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the mapping failed (commands are then admitted without limit)
+ */
+int w24_admit_init(struct w24_admit_limits limits[W24_ADMIT_CLASSES], int workers)
+{
+    pthread_mutexattr_t mutex_attr;
+    void *p = mmap(NULL, sizeof(struct w24_admit), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return -1;
+    admit = p; // zero filled by mmap
+    admit->workers = workers > 0 ? workers : 0;
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&admit->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    for (int i = 0; i < W24_ADMIT_CLASSES; i++) {
+        struct admit_class *c = &admit->classes[i];
+
+        c->limits = limits[i];
+        if (c->limits.running > W24_ADMIT_MAX_RUNNING)
+            c->limits.running = W24_ADMIT_MAX_RUNNING;
+        if (c->limits.queue > W24_ADMIT_MAX_QUEUE)
+            c->limits.queue = W24_ADMIT_MAX_QUEUE;
+        if (c->limits.queue < 0)
+            c->limits.queue = 0;
+        if (c->limits.weight < 1)
+            c->limits.weight = 1;
+    }
+
+    // the workers are not taken back from a long command, so only the heaviest class may hold all of them
+    int heaviest = 0;
+    for (int i = 1; i < W24_ADMIT_CLASSES; i++) {
+        if (admit->classes[i].limits.weight > admit->classes[heaviest].limits.weight)
+            heaviest = i;
+    }
+    for (int i = 0; i < W24_ADMIT_CLASSES; i++) {
+        struct admit_class *c = &admit->classes[i];
+
+        if (i != heaviest && admit->workers > 1 && c->limits.running >= admit->workers)
+            c->limits.running = limits[i].running = admit->workers - 1;
+    }
+    return 0;
+}
+
+static void skip_abandoned(struct admit_class *c)
+{
+    while (c->head < c->tail && c->abandoned[c->head % W24_ADMIT_MAX_QUEUE])
+        c->head++;
+}
+
+static int is_dead(pid_t pid)
+{
+    return pid != 0 && pid != getpid() && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static void wake_all(void)
+{
+    for (int i = 0; i < W24_ADMIT_CLASSES; i++) {
+        __atomic_add_fetch(&admit->freed[i], 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &admit->freed[i], FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * wait_freed: Waits with the lock released until wake_all() is called or the deadline is reached
+ *
+ * Parameters:
+ * - word: The futex word of the class
+ * - deadline_ms: Milliseconds on the monotonic clock (now_ms())
+ *
+ * Return Value:
+ * - int: ETIMEDOUT once the deadline is reached, 0 otherwise
+ *
+ * Explanation:
+ * A process-shared condition variable is not used: a handler process killed while it waits on one leaves its
+ * count in the variable, and the next broadcast then waits for it for good. A waiter on a bare futex word
+ * leaves nothing behind.
+ */
+static int wait_freed(uint32_t *word, long long deadline_ms)
+{
+    struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (deadline_ms % 1000) * 1000000};
+    uint32_t seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+    int timed_out;
+
+    pthread_mutex_unlock(&admit->lock);
+    timed_out = syscall(SYS_futex, word, FUTEX_WAIT_BITSET, seen, &deadline, NULL, FUTEX_BITSET_MATCH_ANY) == -1 &&
+                errno == ETIMEDOUT;
+    lock();
+    return timed_out ? ETIMEDOUT : 0;
+}
+
+/*
+ * reclaim: Takes back the slots and the queue tickets of handler processes that exited without giving them back (fork mode)
+ *
+ * Explanation:
+ * A ticket left in the queue by a process killed while it waited would hold up the class for good, as nothing behind it
+ * can get past it. The waiters are woken if anything was taken back, since the next in line may now be at the head.
+ */
+static void reclaim(void)
+{
+    int changed = 0;
+
+    for (int k = 0; k < W24_ADMIT_CLASSES; k++) {
+        struct admit_class *c = &admit->classes[k];
+
+        for (int i = 0; i < c->limits.running; i++) {
+            if (is_dead(c->owners[i])) {
+                c->owners[i] = 0;
+                c->running--;
+                admit->running--;
+                changed = 1;
+            }
+        }
+        for (uint64_t ticket = c->head; ticket < c->tail; ticket++) {
+            size_t i = ticket % W24_ADMIT_MAX_QUEUE;
+
+            if (!c->abandoned[i] && is_dead(c->waiters[i])) {
+                c->abandoned[i] = 1;
+                changed = 1;
+            }
+        }
+        skip_abandoned(c);
+    }
+    if (changed)
+        wake_all();
+}
+
+static int has_slot(const struct admit_class *c)
+{
+    return c->running < c->limits.running && (admit->workers == 0 || admit->running < admit->workers);
+}
+
+static uint64_t pass_of(const struct admit_class *c)
+{
+    return c->pass > admit->pass ? c->pass : admit->pass;
+}
+
+// whether the class may take a worker now, rather than another class waiting with a lower pass
+static int has_turn(enum w24_admit_class admit_class)
+{
+    uint64_t pass = pass_of(&admit->classes[admit_class]);
+
+    for (int i = 0; i < W24_ADMIT_CLASSES; i++) {
+        struct admit_class *other = &admit->classes[i];
+
+        if (i == (int)admit_class || other->limits.running <= 0)
+            continue;
+        skip_abandoned(other);
+        if (other->head < other->tail && has_slot(other) && pass_of(other) < pass)
+            return 0;
+    }
+    return 1;
+}
+
+// whether the next in line is a handler process that died waiting (one system call)
+static int head_is_dead(const struct admit_class *c)
+{
+    return c->head < c->tail && is_dead(c->waiters[c->head % W24_ADMIT_MAX_QUEUE]);
+}
+
+static int take_slot(struct admit_class *c)
+{
+    for (int i = 0; i < c->limits.running; i++) {
+        if (c->owners[i] == 0) {
+            c->owners[i] = getpid();
+            c->started_ms[i] = now_ms();
+            c->running++;
+            admit->running++;
+            admit->pass = pass_of(c);
+            c->pass = admit->pass + STRIDE / (uint64_t)c->limits.weight;
+            return i;
+        }
+    }
+    return -1; // not reached while running < limits.running
+}
+
+// when a slot is likely to be free for one more command: the queue ahead of it shared by the slots
+static int estimate_retry(const struct admit_class *c)
+{
+    long long service_ms = c->service_ms > 0 ? c->service_ms : DEFAULT_SERVICE_MS;
+    long long retry_ms = service_ms * (long long)(c->tail - c->head + 1) / c->limits.running;
+
+    if (retry_ms < MIN_RETRY_MS)
+        return MIN_RETRY_MS;
+    return retry_ms > MAX_RETRY_MS ? MAX_RETRY_MS : (int)retry_ms;
+}
+
+/*
+ * w24_admit_enter: Takes a slot of a class before running a command, waiting in its queue if need be
+ *
+ * Parameters:
+ * - admit_class: The class of the command
+ * - request: The request the command belongs to (see w24cancel.h), or NULL
+ * - retry_ms: Receives when to try again, if no slot is given
+ *
+ * Return Value:
+ * - int: The slot, to be given back with w24_admit_leave(); W24_ADMIT_MAX_RUNNING when the class has no limit;
+ *   -1 if the queue is full or the wait reached the class's deadline; -2 if the request stopped while it waited
+ *
+ * Explanation:
+ * A queued request wakes every W24_CANCEL_POLL_MS to look at its deadline, its "cancel" and its client, so one
+ * that is stopped gives up its place in the queue rather than holding it until the class's deadline.
+ */
+int w24_admit_enter(enum w24_admit_class admit_class, struct w24_request *request, int *retry_ms)
+{
+    if (admit == NULL || admit_class == W24_ADMIT_NONE || admit->classes[admit_class].limits.running <= 0)
+        return W24_ADMIT_MAX_RUNNING;
+
+    struct admit_class *c = &admit->classes[admit_class];
+    uint32_t *freed = &admit->freed[admit_class];
+    int slot = -1;
+
+    lock();
+    if (!has_slot(c) || head_is_dead(c))
+        reclaim();
+    if (c->head == c->tail && has_slot(c) && has_turn(admit_class)) {
+        slot = take_slot(c);
+        pthread_mutex_unlock(&admit->lock);
+        return slot;
+    }
+    if (c->tail - c->head >= (uint64_t)c->limits.queue) {
+        *retry_ms = estimate_retry(c);
+        pthread_mutex_unlock(&admit->lock);
+        count_busy(admit_class);
+        return -1;
+    }
+
+    uint64_t ticket = c->tail++;
+    long long enqueued_ms = now_ms();
+    long long deadline_ms = enqueued_ms + c->limits.wait_ms;
+
+    c->abandoned[ticket % W24_ADMIT_MAX_QUEUE] = 0;
+    c->waiters[ticket % W24_ADMIT_MAX_QUEUE] = getpid();
+    count_queued(admit_class);
+
+    while (1) {
+        skip_abandoned(c);
+        if (c->head != ticket && has_slot(c) && head_is_dead(c))
+            reclaim(); // a worker is free yet the one ahead does not take it: it died waiting
+        if (c->head == ticket && has_slot(c) && has_turn(admit_class)) {
+            c->head++;
+            slot = take_slot(c);
+            break;
+        }
+        if (request != NULL && w24_cancel_check(request) != W24_CANCEL_NONE) {
+            c->abandoned[ticket % W24_ADMIT_MAX_QUEUE] = 1;
+            skip_abandoned(c);
+            slot = -2;
+            break;
+        }
+
+        // the wait is cut at the request's own deadline, and short enough to notice a "cancel" or a client gone
+        long long now = now_ms(), wake_ms = deadline_ms;
+        if (request != NULL && wake_ms > now + W24_CANCEL_POLL_MS)
+            wake_ms = now + W24_CANCEL_POLL_MS;
+        if (request != NULL && request->deadline_ms > now && request->deadline_ms < wake_ms)
+            wake_ms = request->deadline_ms;
+        if (wait_freed(freed, wake_ms) == ETIMEDOUT && now_ms() >= deadline_ms) {
+            reclaim();
+            if (c->head == ticket && has_slot(c)) { // its deadline is up: the turn no longer matters
+                c->head++;
+                slot = take_slot(c);
+                break;
+            }
+            c->abandoned[ticket % W24_ADMIT_MAX_QUEUE] = 1;
+            skip_abandoned(c);
+            *retry_ms = estimate_retry(c);
+            break;
+        }
+    }
+    wake_all(); // the next in line may be at the head now, or have the turn
+    pthread_mutex_unlock(&admit->lock);
+
+    W24_METRICS_ADD(admission_wait_ms, now_ms() - enqueued_ms);
+    if (slot == -1)
+        count_busy(admit_class);
+    return slot;
+}
+
+/*
+ * w24_admit_leave: Gives back the slot taken by w24_admit_enter() once the command is done
+ */
+void w24_admit_leave(enum w24_admit_class admit_class, int slot)
+{
+    if (admit == NULL || admit_class == W24_ADMIT_NONE || slot < 0 || slot >= W24_ADMIT_MAX_RUNNING)
+        return;
+
+    struct admit_class *c = &admit->classes[admit_class];
+
+    lock();
+    if (c->owners[slot] != 0) {
+        long long duration = now_ms() - c->started_ms[slot];
+
+        c->service_ms += (duration - c->service_ms) / 8;
+        c->owners[slot] = 0;
+        c->running--;
+        admit->running--;
+    }
+    wake_all(); // the worker may go to the other class
+    pthread_mutex_unlock(&admit->lock);
+}
+
+const char *w24_admit_class_name(enum w24_admit_class admit_class)
+{
+    return admit_class == W24_ADMIT_LOOKUP ? "lookup" : admit_class == W24_ADMIT_ARCHIVE ? "archive" : "none";
+}
@@ -0,0 +1,60 @@
+/*
+ * w24admit.h: admission control for the commands that scan the tree or build archives
+ *
+ * A connection handler is cheap while it waits for a command; what overloads a node is many
+ * commands running at once, every one of them walking the tree and the heavy ones compressing.
+ * Before running a command its handler takes a slot of the command's class:
+ *
+ * - lookups: dirlist, w24fn, w24fg/w24fr, w24grep, w24fuzzy, w24top, w24agg
+ * - archives: w24fz, w24fdb/w24fda, w24ft and w24fg/w24fr -a, which build archives, and SIGS, which
+ *   reads a whole archive to build a delta against it
+ *
+ * Each class has its own number of slots, so a burst of archive jobs cannot hold up lookups.
+ * Both classes also draw on one pool of workers, a limit on the commands of either running at
+ * once. When both have commands waiting for a worker, they get them in proportion to their
+ * weights (stride scheduling: each grant moves the class's pass on by 1/weight, the class with
+ * the lowest pass goes next), so with the default 4:1 interactive lookups get four workers for
+ * every archive job, and archive jobs are never starved. A class that was idle resumes at the
+ * current pass instead of catching up. A running command keeps its worker to the end, so only
+ * the heaviest class may hold them all: archive jobs always leave one to the lookups. Archive jobs also run at a lower CPU and I/O priority
+ * (see w24prio.h).
+ *
+ * When all slots are taken the handler waits in the class's queue, served in arrival order, up
+ * to the class's deadline. When the queue is full or the deadline passes, the command is
+ * answered with a BUSY frame instead:
+ *
+ *     BUSY 0 <retry_ms> <port>\n
+ *
+ * retry_ms estimates when a slot frees up, from the average time a command of the class takes
+ * and the length of its queue. port names another node to try (see --peers), 0 for none.
+ *
+ * The slots and queues live in an anonymous shared mapping created before the first fork, like
+ * the metrics, with a process-shared mutex and a futex word per class, so they hold across the
+ * forked handlers as well as across threads. The slot of a handler process that died without
+ * giving it back is taken back by the next handler that finds the class full, and the queue
+ * ticket of one that died waiting is skipped once it reaches the head of the queue.
+ */
+
+#ifndef W24ADMIT_H
+#define W24ADMIT_H
+
+#define W24_ADMIT_MAX_RUNNING 256 // slots of one class
+#define W24_ADMIT_MAX_QUEUE 1024 // queue length of one class
+
+enum w24_admit_class { W24_ADMIT_NONE = -1, W24_ADMIT_LOOKUP, W24_ADMIT_ARCHIVE, W24_ADMIT_CLASSES };
+
+struct w24_admit_limits {
+    int running; // commands run at once, 0: no limit
+    int queue; // commands waiting for a slot
+    int wait_ms; // longest wait in the queue
+    int weight; // share of the workers while the other class wants them too, at least 1
+};
+
+struct w24_request;
+
+int w24_admit_init(struct w24_admit_limits limits[W24_ADMIT_CLASSES], int workers);
+int w24_admit_enter(enum w24_admit_class admit_class, struct w24_request *request, int *retry_ms);
+void w24_admit_leave(enum w24_admit_class admit_class, int slot);
+const char *w24_admit_class_name(enum w24_admit_class admit_class);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * w24agg.c: aggregates computed in one pass over a tree, per thread, then merged (see w24agg.h)
+ */
+
+#include "w24agg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// whether a ranks before b: larger keys first, then paths in byte order
+static int better(int64_t key, int64_t key2, const char *path, const struct w24_top_item *b)
+{
+    if (key != b->key)
+        return key > b->key;
+    if (key2 != b->key2)
+        return key2 > b->key2;
+    return strcmp(path, b->path) < 0;
+}
+
+static void sift_down(struct w24_top *top, int i)
+{
+    for (;;) {
+        int worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < top->count && better(top->items[worst].key, top->items[worst].key2, top->items[worst].path, &top->items[left]))
+            worst = left;
+        if (right < top->count && better(top->items[worst].key, top->items[worst].key2, top->items[worst].path, &top->items[right]))
+            worst = right;
+        if (worst == i)
+            return;
+        struct w24_top_item swap = top->items[i];
+        top->items[i] = top->items[worst];
+        top->items[worst] = swap;
+        i = worst;
+    }
+}
+
+static void sift_up(struct w24_top *top, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!better(top->items[parent].key, top->items[parent].key2, top->items[parent].path, &top->items[i]))
+            return;
+        struct w24_top_item swap = top->items[i];
+        top->items[i] = top->items[parent];
+        top->items[parent] = swap;
+        i = parent;
+    }
+}
+
+/*
+ * w24_top_init: prepares an empty top-k of 1 to W24_TOP_MAX entries
+ *
+ * Return Value:
+ * - int: 0, -1 if k is out of range or memory is short
+ */
+int w24_top_init(struct w24_top *top, int k)
+{
+    top->k = k;
+    top->count = 0;
+    top->items = k >= 1 && k <= W24_TOP_MAX ? malloc((size_t)k * sizeof(*top->items)) : NULL;
+    return top->items != NULL ? 0 : -1;
+}
+
+/*
+ * w24_top_offer: adds an entry if it ranks among the k best so far
+ *
+ * Return Value:
+ * - int: 0, -1 if the path could not be copied
+ */
+int w24_top_offer(struct w24_top *top, int64_t key, int64_t key2, const char *path)
+{
+    char *copy;
+
+    if (top->count == top->k && !better(key, key2, path, &top->items[0]))
+        return 0;
+    if ((copy = strdup(path)) == NULL)
+        return -1;
+
+    if (top->count < top->k) {
+        top->items[top->count] = (struct w24_top_item){ key, key2, copy };
+        sift_up(top, top->count++);
+    }
+    else {
+        free(top->items[0].path);
+        top->items[0] = (struct w24_top_item){ key, key2, copy };
+        sift_down(top, 0);
+    }
+    return 0;
+}
+
+/*
+ * w24_top_merge: moves the entries of another top-k (same k) in; from is left empty
+ */
+int w24_top_merge(struct w24_top *into, struct w24_top *from)
+{
+    int ret = 0;
+
+    for (int i = 0; i < from->count; i++) {
+        if (w24_top_offer(into, from->items[i].key, from->items[i].key2, from->items[i].path) == -1)
+            ret = -1;
+        free(from->items[i].path);
+    }
+    from->count = 0;
+    return ret;
+}
+
+static int compare_items(const void *a, const void *b)
+{
+    const struct w24_top_item *x = a, *y = b;
+    if (better(x->key, x->key2, x->path, y))
+        return -1;
+    return better(y->key, y->key2, y->path, x) ? 1 : 0;
+}
+
+/*
+ * w24_top_sort: orders the entries best first (the top-k is no longer a heap afterwards)
+ */
+void w24_top_sort(struct w24_top *top)
+{
+    qsort(top->items, (size_t)top->count, sizeof(*top->items), compare_items);
+}
+
+void w24_top_free(struct w24_top *top)
+{
+    for (int i = 0; i < top->count; i++)
+        free(top->items[i].path);
+    free(top->items);
+    top->items = NULL;
+    top->count = 0;
+}
+
+int w24_totals_init(struct w24_totals *totals)
+{
+    totals->capacity = 64;
+    totals->count = 0;
+    totals->slots = calloc(totals->capacity, sizeof(*totals->slots));
+    return totals->slots != NULL ? 0 : -1;
+}
+
+static uint64_t hash(const char *key, size_t length)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ull;
+    return h;
+}
+
+// the slot holding key, or the empty slot it would go to
+static struct w24_total *find_slot(struct w24_total *slots, size_t capacity, const char *key, size_t length)
+{
+    size_t i = hash(key, length) & (capacity - 1);
+
+    while (slots[i].key != NULL && (strncmp(slots[i].key, key, length) != 0 || slots[i].key[length] != '\0'))
+        i = (i + 1) & (capacity - 1);
+    return &slots[i];
+}
+
+static int grow(struct w24_totals *totals)
+{
+    size_t capacity = totals->capacity * 2;
+    struct w24_total *slots = calloc(capacity, sizeof(*slots));
+
+    if (slots == NULL)
+        return -1;
+    for (size_t i = 0; i < totals->capacity; i++) {
+        if (totals->slots[i].key != NULL)
+            *find_slot(slots, capacity, totals->slots[i].key, strlen(totals->slots[i].key)) = totals->slots[i];
+    }
+    free(totals->slots);
+    totals->slots = slots;
+    totals->capacity = capacity;
+    return 0;
+}
+
+/*
+ * w24_totals_add: adds files and bytes to the totals of a key
+ *
+ * Parameters:
+ * - key, key_length: need not be NUL-terminated
+ *
+ * Return Value:
+ * - int: 0, -1 if memory is short
+ */
+int w24_totals_add(struct w24_totals *totals, const char *key, size_t key_length, uint64_t files, uint64_t bytes)
+{
+    struct w24_total *slot;
+
+    if (2 * (totals->count + 1) > totals->capacity && grow(totals) == -1) // at most half full
+        return -1;
+    slot = find_slot(totals->slots, totals->capacity, key, key_length);
+    if (slot->key == NULL) {
+        if ((slot->key = strndup(key, key_length)) == NULL)
+            return -1;
+        totals->count++;
+    }
+    slot->files += files;
+    slot->bytes += bytes;
+    return 0;
+}
+
+int w24_totals_merge(struct w24_totals *into, const struct w24_totals *from)
+{
+    for (size_t i = 0; i < from->capacity; i++) {
+        if (from->slots[i].key != NULL && w24_totals_add(into, from->slots[i].key, strlen(from->slots[i].key), from->slots[i].files, from->slots[i].bytes) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static int compare_totals(const void *a, const void *b)
+{
+    const struct w24_total *x = a, *y = b;
+    if (x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return strcmp(x->key, y->key);
+}
+
+/*
+ * w24_totals_sorted: the totals, most bytes first
+ *
+ * Return Value:
+ * - struct w24_total *: totals->count entries whose keys still belong to totals (free the array only), NULL if memory is short
+ */
+struct w24_total *w24_totals_sorted(const struct w24_totals *totals)
+{
+    struct w24_total *sorted = malloc((totals->count + 1) * sizeof(*sorted));
+    size_t n = 0;
+
+    if (sorted == NULL)
+        return NULL;
+    for (size_t i = 0; i < totals->capacity; i++) {
+        if (totals->slots[i].key != NULL)
+            sorted[n++] = totals->slots[i];
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_totals);
+    return sorted;
+}
+
+void w24_totals_free(struct w24_totals *totals)
+{
+    for (size_t i = 0; i < totals->capacity; i++)
+        free(totals->slots[i].key);
+    free(totals->slots);
+    totals->slots = NULL;
+    totals->count = 0;
+}
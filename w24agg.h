@@ -0,0 +1,58 @@
+/*
+ * w24agg.h: aggregates computed in one pass over a tree, per thread, then merged
+ *
+ * - w24_top keeps the k best entries seen (largest size, newest birth time) in a bounded min-heap:
+ *   an entry costs one comparison with the worst one kept, and a path is only copied when the
+ *   entry makes it in.
+ * - w24_totals counts files and bytes per key (extension, directory) in an open-addressing hash
+ *   table.
+ * Each scanning thread fills its own, so nothing is shared while scanning; the partial results
+ * are merged at the end (w24_top_merge, w24_totals_merge). Ties are broken by path or key, so
+ * the merged result does not depend on how the work was split.
+ */
+
+#ifndef W24AGG_H
+#define W24AGG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W24_TOP_MAX 1000
+
+struct w24_top_item {
+    int64_t key; // size, or birth time in seconds
+    int64_t key2; // nanoseconds of the birth time, 0 for sizes
+    char *path;
+};
+
+struct w24_top {
+    int k;
+    int count;
+    struct w24_top_item *items; // min-heap of k items: items[0] is the worst kept
+};
+
+struct w24_total {
+    char *key;
+    uint64_t files;
+    uint64_t bytes;
+};
+
+struct w24_totals {
+    struct w24_total *slots; // NULL key: empty
+    size_t capacity; // power of two
+    size_t count;
+};
+
+int w24_top_init(struct w24_top *top, int k);
+int w24_top_offer(struct w24_top *top, int64_t key, int64_t key2, const char *path);
+int w24_top_merge(struct w24_top *into, struct w24_top *from);
+void w24_top_sort(struct w24_top *top);
+void w24_top_free(struct w24_top *top);
+
+int w24_totals_init(struct w24_totals *totals);
+int w24_totals_add(struct w24_totals *totals, const char *key, size_t key_length, uint64_t files, uint64_t bytes);
+int w24_totals_merge(struct w24_totals *into, const struct w24_totals *from);
+struct w24_total *w24_totals_sorted(const struct w24_totals *totals);
+void w24_totals_free(struct w24_totals *totals);
+
+#endif
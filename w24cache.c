@@ -0,0 +1,245 @@
+/*
+ * w24cache.c: content-addressed store of finished archives (see w24cache.h)
+ */
+
+#define _GNU_SOURCE
+#include "w24cache.h"
+#include "w24metrics.h"
+#include "w24io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+static char cache_dir[4096];
+static unsigned long long cache_quota; // bytes; 0 keeps only the newest entry
+
+struct cache_entry {
+    char name[256];
+    off_t size;
+    struct timespec mtime;
+};
+
+/*
+ * w24_cache_init: sets up the archive store
+ *
+ * Parameters:
+ * - dir: directory holding the entries, created if missing
+ * - quota_bytes: total size the store may use; the newest entry is kept even if it alone is larger
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the directory cannot be created
+ */
+int w24_cache_init(const char *dir, unsigned long long quota_bytes)
+{
+    snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    cache_quota = quota_bytes;
+    if (mkdir(cache_dir, 0755) == -1 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+/*
+ * w24_cache_key: computes the key of the archive of a file list
+ *
+ * Parameters:
+ * - list: file paths, one per line; read to EOF
+ * - salt: anything else the archive bytes depend on, e.g. "zstd:3"
+ * - key: receives the hex digest
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a digest error
+ *
+ * Explanation:
+ * Each path is hashed with its size and mtime (nanoseconds), so editing or touching any listed
+ * file changes the key. A file that cannot be stat'ed still contributes its path. The paths are
+ * stat'ed W24_IO_STATX_BATCH at a time through the I/O engine (one io_uring_enter() per batch).
+ */
+int w24_cache_key(FILE *list, const char *salt, char key[W24_CACHE_KEY_LENGTH + 1])
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    char (*paths)[4096] = malloc(W24_IO_STATX_BATCH * sizeof(*paths));
+    const char *batch[W24_IO_STATX_BATCH];
+    struct statx stats[W24_IO_STATX_BATCH];
+    int status[W24_IO_STATX_BATCH];
+    int ok, count;
+
+    if (ctx == NULL || paths == NULL) {
+        EVP_MD_CTX_free(ctx);
+        free(paths);
+        return -1;
+    }
+    ok = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) && EVP_DigestUpdate(ctx, salt, strlen(salt) + 1);
+
+    do {
+        for (count = 0; count < W24_IO_STATX_BATCH && fgets(paths[count], sizeof(paths[count]), list) != NULL; count++) {
+            paths[count][strcspn(paths[count], "\n")] = '\0';
+            batch[count] = paths[count];
+        }
+        w24_io_statx_many(batch, count, stats, status);
+
+        for (int i = 0; ok && i < count; i++) {
+            char record[64];
+
+            if (status[i] == 0)
+                snprintf(record, sizeof(record), "%lld %lld.%09u", (long long)stats[i].stx_size, (long long)stats[i].stx_mtime.tv_sec, stats[i].stx_mtime.tv_nsec);
+            else
+                snprintf(record, sizeof(record), "-");
+            ok = EVP_DigestUpdate(ctx, paths[i], strlen(paths[i]) + 1) && EVP_DigestUpdate(ctx, record, strlen(record) + 1);
+        }
+    } while (ok && count == W24_IO_STATX_BATCH);
+    free(paths);
+
+    ok = ok && EVP_DigestFinal_ex(ctx, digest, &digest_len);
+    EVP_MD_CTX_free(ctx);
+    if (!ok)
+        return -1;
+
+    for (unsigned int i = 0; i < digest_len && 2 * i < W24_CACHE_KEY_LENGTH; i++)
+        snprintf(key + 2 * i, 3, "%02x", digest[i]);
+    return 0;
+}
+
+/*
+ * w24_cache_valid_key: whether a string received from a client is a well-formed key
+ * (exactly W24_CACHE_KEY_LENGTH lowercase hex digits, so it cannot name anything outside the store)
+ */
+int w24_cache_valid_key(const char *key)
+{
+    size_t len = strspn(key, "0123456789abcdef");
+    return len == W24_CACHE_KEY_LENGTH && key[len] == '\0';
+}
+
+/*
+ * w24_cache_open: opens a stored archive by key
+ *
+ * Return Value:
+ * - int: read-only descriptor of the entry, -1 if it is not (or no longer) stored
+ *
+ * Explanation:
+ * Opening refreshes the entry's mtime, which is what eviction orders by, so archives that are
+ * being downloaded stay in the store.
+ */
+int w24_cache_open(const char *key)
+{
+    char path[4400];
+
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1)
+        futimens(fd, NULL);
+    return fd;
+}
+
+/*
+ * w24_cache_lookup: w24_cache_open() for a new archive request, counted as a store hit or miss
+ */
+int w24_cache_lookup(const char *key)
+{
+    int fd = w24_cache_open(key);
+    if (fd == -1)
+        W24_METRICS_ADD(cache_misses, 1);
+    else
+        W24_METRICS_ADD(cache_hits, 1);
+    return fd;
+}
+
+/*
+ * w24_cache_temp_path: name under which a new entry is built before w24_cache_commit()
+ */
+void w24_cache_temp_path(const char *key, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/%s.tmp.%d", cache_dir, key, (int)gettid()); // unique per builder, process or thread
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const struct cache_entry *x = a, *y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec)
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+        return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/*
+ * evict: removes the least recently used entries until the store fits its quota
+ *
+ * Parameters:
+ * - keep: entry name that must survive (the one just added)
+ */
+static void evict(const char *keep)
+{
+    struct cache_entry *entries = NULL;
+    size_t count = 0, cap = 0;
+    unsigned long long total = 0;
+    struct dirent *de;
+
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL)
+        return;
+
+    while ((de = readdir(dir)) != NULL) {
+        struct stat sb;
+        if (de->d_name[0] == '.' || strstr(de->d_name, ".tmp.") != NULL)
+            continue; // skip entries still being built
+        if (fstatat(dirfd(dir), de->d_name, &sb, 0) == -1 || !S_ISREG(sb.st_mode))
+            continue;
+        total += (unsigned long long)sb.st_size;
+        if (strcmp(de->d_name, keep) == 0)
+            continue;
+        if (count == cap) {
+            cap = cap ? 2 * cap : 64;
+            struct cache_entry *grown = realloc(entries, cap * sizeof(struct cache_entry));
+            if (grown == NULL)
+                break;
+            entries = grown;
+        }
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s", de->d_name);
+        entries[count].size = sb.st_size;
+        entries[count].mtime = sb.st_mtim;
+        count++;
+    }
+
+    if (total > cache_quota) {
+        qsort(entries, count, sizeof(struct cache_entry), compare_mtime);
+        for (size_t i = 0; i < count && total > cache_quota; i++) {
+            if (unlinkat(dirfd(dir), entries[i].name, 0) == 0) {
+                total -= (unsigned long long)entries[i].size;
+                W24_METRICS_ADD(cache_evictions, 1);
+            }
+        }
+    }
+
+    closedir(dir);
+    free(entries);
+}
+
+/*
+ * w24_cache_commit: publishes an archive built at w24_cache_temp_path() and enforces the quota
+ *
+ * Return Value:
+ * - int: read-only descriptor of the new entry, -1 on failure (the temporary file is removed)
+ */
+int w24_cache_commit(const char *temp_path, const char *key)
+{
+    char path[4400];
+
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, key);
+    if (rename(temp_path, path) == -1) {
+        unlink(temp_path);
+        return -1;
+    }
+
+    // open before evicting: an archive larger than the whole quota is still served once
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    evict(key);
+    return fd;
+}
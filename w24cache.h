@@ -0,0 +1,34 @@
+/*
+ * w24cache.h: content-addressed store of finished archives
+ *
+ * An archive is identified by a SHA-256 digest over the list of matched files (path, size and
+ * mtime of every file, in list order) and the codec and level used to build it. Two requests
+ * matching the same unchanged files get the same key, so the second one is served from the
+ * stored archive instead of running tar and the compressor again.
+ *
+ * Entries live in <dir>/<key>; the key doubles as the archive id clients download by (see the
+ * fetch command), so it only ever contains lowercase hex digits. Every hit refreshes the entry's mtime, and when the
+ * store grows past its quota the entries with the oldest mtime are removed first (LRU).
+ * The store is shared by all connection handlers; entries are written under a temporary name
+ * and renamed into place, so readers only ever open complete archives.
+ */
+
+#ifndef W24CACHE_H
+#define W24CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define W24_CACHE_KEY_LENGTH 64 // hex characters of a SHA-256 digest
+#define W24_CACHE_DEFAULT_DIR "w24cache"
+#define W24_CACHE_DEFAULT_QUOTA_MB 256
+
+int w24_cache_init(const char *dir, unsigned long long quota_bytes);
+int w24_cache_key(FILE *list, const char *salt, char key[W24_CACHE_KEY_LENGTH + 1]);
+int w24_cache_valid_key(const char *key);
+int w24_cache_open(const char *key);
+int w24_cache_lookup(const char *key);
+void w24_cache_temp_path(const char *key, char *buf, size_t size);
+int w24_cache_commit(const char *temp_path, const char *key);
+
+#endif
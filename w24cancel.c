@@ -0,0 +1,251 @@
+/*
+ * w24cancel.c: request ids, deadlines and cancellation (see w24cancel.h)
+ */
+
+#include "w24cancel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+struct registry_entry {
+    pid_t owner; // handler process serving the request, 0: free
+    int cancelled;
+    char id[W24_CANCEL_ID_MAX + 1];
+};
+
+struct registry {
+    pthread_mutex_t lock;
+    struct registry_entry entries[W24_CANCEL_SLOTS];
+};
+
+static struct registry *registry = NULL;
+static __thread struct w24_request *current = NULL;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a handler that died holding the lock left at most one entry half written
+static void lock(void)
+{
+    if (pthread_mutex_lock(&registry->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&registry->lock);
+}
+
+/*
+ * w24_cancel_init: Maps the registry of requests with an id; call once before the first fork
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the mapping failed (ids are then ignored, deadlines still apply)
+ */
+int w24_cancel_init(void)
+{
+    pthread_mutexattr_t attr;
+    void *p = mmap(NULL, sizeof(struct registry), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return -1;
+    registry = p; // zero filled by mmap
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&registry->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return 0;
+}
+
+static int valid_id(const char *id)
+{
+    if (id[0] == '\0')
+        return 0;
+    for (const char *c = id; *c != '\0'; c++) {
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '-' || *c == '_' || *c == '.'))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * w24_cancel_parse: Takes the "req <id> <deadline_ms> " prefix off a command
+ *
+ * Parameters:
+ * - message: The command, stripped of the prefix in place
+ * - id, id_size: Receive the id, "" for "-"
+ * - deadline_ms: Receives the deadline, 0 for none
+ *
+ * Return Value:
+ * - int: 1 if the prefix was taken off, 0 if there is none, -1 if it is malformed
+ */
+int w24_cancel_parse(char *message, char *id, size_t id_size, int *deadline_ms)
+{
+    char parsed[W24_CANCEL_ID_MAX + 2];
+    int start = 0;
+
+    id[0] = '\0';
+    *deadline_ms = 0;
+    if (strncmp(message, "req ", 4) != 0)
+        return 0;
+    if (sscanf(message, "req %33s %d %n", parsed, deadline_ms, &start) != 2 || start == 0 || *deadline_ms < 0 ||
+        strlen(parsed) > W24_CANCEL_ID_MAX || (strcmp(parsed, "-") != 0 && !valid_id(parsed)))
+        return -1;
+    if (strcmp(parsed, "-") != 0)
+        snprintf(id, id_size, "%s", parsed);
+    memmove(message, message + start, strlen(message + start) + 1);
+    return 1;
+}
+
+/*
+ * w24_cancel_begin: Starts a request and makes it the calling thread's
+ *
+ * Parameters:
+ * - id: Its id, "" for none; it is listed for w24_cancel_id() unless the registry is full
+ * - deadline_ms: Milliseconds from now, 0 for none
+ * - client_fd: The client's socket, watched for end of file
+ */
+void w24_cancel_begin(struct w24_request *request, const char *id, int deadline_ms, int client_fd)
+{
+    memset(request, 0, sizeof(*request));
+    snprintf(request->id, sizeof(request->id), "%s", id);
+    request->deadline_ms = deadline_ms > 0 ? now_ms() + deadline_ms : 0;
+    request->client_fd = client_fd;
+    request->slot = -1;
+    request->next_poll_ms = now_ms() + W24_CANCEL_POLL_MS;
+    current = request;
+
+    if (registry == NULL || id[0] == '\0')
+        return;
+    lock();
+    for (int pass = 0; pass < 2 && request->slot == -1; pass++) {
+        for (int i = 0; i < W24_CANCEL_SLOTS; i++) {
+            struct registry_entry *entry = &registry->entries[i];
+
+            // second pass: entries of handler processes that exited without ending their request
+            if (entry->owner == 0 || (pass == 1 && entry->owner != getpid() && kill(entry->owner, 0) == -1 && errno == ESRCH)) {
+                entry->owner = getpid();
+                __atomic_store_n(&entry->cancelled, 0, __ATOMIC_RELAXED);
+                snprintf(entry->id, sizeof(entry->id), "%s", id);
+                request->slot = i;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+/*
+ * w24_cancel_end: Ends a request: its id is no longer listed and the calling thread works for no request
+ */
+void w24_cancel_end(struct w24_request *request)
+{
+    if (current == request)
+        current = NULL;
+    if (request->slot == -1)
+        return;
+    lock();
+    registry->entries[request->slot].owner = 0;
+    registry->entries[request->slot].id[0] = '\0';
+    pthread_mutex_unlock(&registry->lock);
+    request->slot = -1;
+}
+
+/*
+ * w24_cancel_adopt: Makes a request the calling thread's, in threads started for it (NULL: none)
+ */
+void w24_cancel_adopt(struct w24_request *request)
+{
+    current = request;
+}
+
+struct w24_request *w24_cancel_current(void)
+{
+    return current;
+}
+
+/*
+ * w24_cancel_check: Tells whether a request has to stop
+ *
+ * Return Value:
+ * - int: W24_CANCEL_NONE to go on, or why to stop; once stopped a request stays stopped
+ *
+ * Explanation:
+ * Safe to call from every thread working for the request at once: its fields are only written with
+ * atomic stores, and checking twice within the poll interval is harmless.
+ */
+int w24_cancel_check(struct w24_request *request)
+{
+    int reason = __atomic_load_n(&request->reason, __ATOMIC_RELAXED);
+
+    if (reason != W24_CANCEL_NONE)
+        return reason;
+    if (request->slot != -1 && __atomic_load_n(&registry->entries[request->slot].cancelled, __ATOMIC_RELAXED))
+        reason = W24_CANCEL_CANCELLED;
+
+    long long now = now_ms();
+    if (reason == W24_CANCEL_NONE && now >= __atomic_load_n(&request->next_poll_ms, __ATOMIC_RELAXED)) {
+        char byte;
+
+        __atomic_store_n(&request->next_poll_ms, now + W24_CANCEL_POLL_MS, __ATOMIC_RELAXED);
+        if (request->deadline_ms != 0 && now >= request->deadline_ms) {
+            reason = W24_CANCEL_DEADLINE;
+        }
+        else {
+            // the client sends nothing while it waits for the reply: end of file or an error means it is gone
+            ssize_t n = recv(request->client_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                reason = W24_CANCEL_GONE;
+        }
+    }
+    if (reason != W24_CANCEL_NONE)
+        __atomic_store_n(&request->reason, reason, __ATOMIC_RELAXED);
+    return reason;
+}
+
+/*
+ * w24_cancel_checkpoint: w24_cancel_check() for the calling thread's request, W24_CANCEL_NONE if it has none
+ */
+int w24_cancel_checkpoint(void)
+{
+    return current != NULL ? w24_cancel_check(current) : W24_CANCEL_NONE;
+}
+
+/*
+ * w24_cancel_id: Cancels the running requests with an id ("cancel <id>")
+ *
+ * Return Value:
+ * - int: The number of requests cancelled, 0 if none is running with that id
+ */
+int w24_cancel_id(const char *id)
+{
+    int count = 0;
+
+    if (registry == NULL || !valid_id(id))
+        return 0;
+    lock();
+    for (int i = 0; i < W24_CANCEL_SLOTS; i++) {
+        struct registry_entry *entry = &registry->entries[i];
+
+        if (entry->owner != 0 && strcmp(entry->id, id) == 0) {
+            __atomic_store_n(&entry->cancelled, 1, __ATOMIC_RELAXED);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&registry->lock);
+    return count;
+}
+
+const char *w24_cancel_reason_name(int reason)
+{
+    return reason == W24_CANCEL_CANCELLED ? "cancelled" : reason == W24_CANCEL_DEADLINE ? "deadline exceeded" :
+           reason == W24_CANCEL_GONE ? "client gone" : "running";
+}
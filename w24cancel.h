@@ -0,0 +1,58 @@
+/*
+ * w24cancel.h: request ids, deadlines and cancellation
+ *
+ * A command may be sent as
+ *
+ *     req <id> <deadline_ms> <command>
+ *
+ * id names it for "cancel <id>", sent on any connection to the same node ("-" for no id), and
+ * deadline_ms bounds how long the node works on it (0 for no bound). Whether or not it has either,
+ * a command also stops when its client goes away: the socket reads end of file or fails.
+ *
+ * Cancellation is cooperative. The long loops of a command, the tree traversals and the archive
+ * writers, call w24_cancel_checkpoint() every entry or member; once it returns a reason they stop
+ * and unwind, and the partial result is thrown away. The checkpoint is cheap: it reads a flag in
+ * shared memory and only looks at the clock and the client's socket every W24_CANCEL_POLL_MS. The
+ * tar process behind an archive cannot call it, so the handler waiting for the archive kills it.
+ *
+ * Requests with an id are listed in an anonymous shared mapping created before the first fork, so
+ * "cancel" reaches a request served by another handler process or thread. Entries left by a
+ * handler process that died are taken back when the registry is full.
+ *
+ * The request a thread works for is kept in a thread-local variable, so checkpoints deep in the
+ * scanner callbacks or the zip writer need no extra parameter; threads started for a request
+ * adopt it with w24_cancel_adopt().
+ */
+
+#ifndef W24CANCEL_H
+#define W24CANCEL_H
+
+#include <stddef.h>
+
+#define W24_CANCEL_ID_MAX 32 // longest request id
+#define W24_CANCEL_SLOTS 1024 // requests with an id running at once on a node
+#define W24_CANCEL_POLL_MS 20 // how often a checkpoint looks at the clock and the client's socket
+
+enum w24_cancel_reason { W24_CANCEL_NONE, W24_CANCEL_CANCELLED, W24_CANCEL_DEADLINE, W24_CANCEL_GONE };
+
+struct w24_request {
+    char id[W24_CANCEL_ID_MAX + 1]; // "" for none
+    long long deadline_ms; // on the monotonic clock, 0 for none
+    int client_fd;
+    int slot; // in the shared registry, -1 if not listed
+    long long next_poll_ms;
+    int reason; // enum w24_cancel_reason, once stopped
+};
+
+int w24_cancel_init(void);
+int w24_cancel_parse(char *message, char *id, size_t id_size, int *deadline_ms);
+void w24_cancel_begin(struct w24_request *request, const char *id, int deadline_ms, int client_fd);
+void w24_cancel_end(struct w24_request *request);
+void w24_cancel_adopt(struct w24_request *request);
+struct w24_request *w24_cancel_current(void);
+int w24_cancel_check(struct w24_request *request);
+int w24_cancel_checkpoint(void);
+int w24_cancel_id(const char *id);
+const char *w24_cancel_reason_name(int reason);
+
+#endif
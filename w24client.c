@@ -0,0 +1,1607 @@
+/*
+ * w24client.c: the client side of the protocol as a library (see w24client.h)
+ */
+
+#include "w24client.h"
+#include "w24delta.h"
+#include "w24trace.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#define MAX_MSG_LENGTH 4096
+#define FETCH_CHUNK (4 * 1024 * 1024) // bytes requested per fetch command
+#define MAX_RECONNECTS 5 // reconnections tried while downloading one archive
+#define PARALLEL_MIN_LENGTH (2 * FETCH_CHUNK) // larger downloads are spread over all nodes
+#define NUM_NODES 3
+
+static struct w24_session_config config;
+static int node_ports[NUM_NODES];
+static FILE *progress; // progress messages of connections and downloads, NULL for none
+static char cache_directory[MAX_MSG_LENGTH]; // reply cache, "" when not used
+
+/*
+ * w24_client_init: Sets where to connect and what to offer
+ * 
+ * Parameters:
+ * - client_config: Server and mirror addresses, codec offer and level; the strings must stay valid
+ * - progress_file: Where connections and downloads report their progress (stdout for a terminal), NULL for silence
+ */
+
+void w24_client_init(const struct w24_session_config *client_config, FILE *progress_file)
+{
+    config = *client_config;
+    node_ports[0] = config.server_port;
+    node_ports[1] = config.mirror_ports[0];
+    node_ports[2] = config.mirror_ports[1];
+    progress = progress_file;
+}
+
+static void report(const char *format, ...)
+{
+    va_list args;
+
+    if (progress == NULL) {
+        return;
+    }
+    va_start(args, format);
+    vfprintf(progress, format, args);
+    va_end(args);
+    fflush(progress);
+}
+
+/*
+ * connect_node: Opens a blocking connection to the server or a mirror
+ * 
+ * Return Value:
+ * - int: The socket, -1 on failure with errno set
+ */
+
+static int connect_node(int port)
+{
+    struct sockaddr_in nodeAddr;
+    int clientSocket;
+
+    if ((clientSocket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+    memset(&nodeAddr, 0, sizeof(nodeAddr));
+    nodeAddr.sin_family = AF_INET;
+    nodeAddr.sin_addr.s_addr = inet_addr(port == config.server_port ? config.server_ip : config.mirror_ip);
+    nodeAddr.sin_port = htons(port);
+    if (connect(clientSocket, (struct sockaddr *)&nodeAddr, sizeof(nodeAddr)) == -1) {
+        int saved = errno;
+        close(clientSocket);
+        errno = saved;
+        return -1;
+    }
+    return clientSocket;
+}
+
+/*
+ * count_words: Counts the number of words in a given string
+ * 
+ * Parameters:
+ * - message: The string in which words are to be counted
+ * 
+ * Return Value:
+ * - int: The number of words in the given string
+ * 
+ * Explanation:
+ * This function iterates through each character in the given string.
+ * It maintains a flag 'in_word' to indicate whether the current character is inside a word or not.
+ * If the current character is a space and we were inside a word, it increments the word count.
+ * If the current character is not a space, it sets the 'in_word' flag to 1, indicating that we are inside a word.
+ * After iterating through the entire string, if the last character was part of a word, it increments the count.
+ * Finally, it returns the count of words in the string.
+ */
+
+static int count_words(const char *message)
+{
+    int count = 0;
+    int in_word = 0; // Flag to indicate whether we are currently inside a word
+
+    // Iterate through each character in the string
+    for (int i = 0; message[i] != '\0'; i++) {
+        // Check if the current character is a space
+        if (message[i] == ' ') {
+            // If we were inside a word, increment the word count
+            if (in_word) {
+                count++;
+                in_word = 0; // Reset the flag
+            }
+        } else {
+            // If the current character is not a space, we are inside a word
+            in_word = 1;
+        }
+    }
+
+    // Increment count if the string ends with a word
+    if (in_word) {
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * is_word_limit_exceeded: Checks if the word count in a message exceeds a specified limit
+ * 
+ * Parameters:
+ * - message: The message to be checked
+ * - limit: The maximum number of words allowed
+ * 
+ * Return Value:
+ * - int: 1 if the word count exceeds the limit, 0 otherwise
+ * 
+ * Explanation:
+ * This function calculates the number of words in the given message using the count_words() function.
+ * It then compares the word count with the specified limit.
+ * If the word count is greater than the limit, it returns 1, indicating that the word limit is exceeded.
+ * Otherwise, it returns 0, indicating that the word limit is not exceeded.
+ */
+
+static int is_word_limit_exceeded(const char *message, int limit)
+{
+    int word_count = count_words(message);
+    return word_count > limit ? 1 : 0;
+}
+
+/*
+ * recv_text: Receives a text reply (a TEXT frame, see w24proto.h) on a blocking connection
+ * 
+ * Parameters:
+ * - text, size: Receives the text, cut to fit
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 on a connection error, -2 if the node answered with another frame (BUSY, ERROR)
+ */
+
+static int recv_text(int clientSocket, char *text, size_t size)
+{
+    char type[32], attrs[W24_PROTO_HEADER_MAX];
+    unsigned long long length;
+
+    if (w24_proto_recv_header(clientSocket, type, sizeof(type), &length, attrs, sizeof(attrs)) == -1) {
+        return -1;
+    }
+    // what does not fit is read all the same, so the next reply starts where it should
+    unsigned long long kept = length < size ? length : size - 1;
+    if (w24_proto_recv_all(clientSocket, text, (size_t)kept) == -1) {
+        return -1;
+    }
+    text[kept] = '\0';
+    for (unsigned long long left = length - kept; left > 0; ) {
+        char discard[4096];
+        size_t n = left < sizeof(discard) ? (size_t)left : sizeof(discard);
+
+        if (w24_proto_recv_all(clientSocket, discard, n) == -1) {
+            return -1;
+        }
+        left -= n;
+    }
+    return strcmp(type, "TEXT") == 0 ? 0 : -2;
+}
+
+/*
+ * negotiate_codecs: Advertises the codecs we can unpack on a new connection
+ * 
+ * Parameters:
+ * - clientSocket: The connection
+ * - reply, reply_size: Receives the server's answer ("codec <name>")
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 on a connection error
+ */
+
+static int negotiate_codecs(int clientSocket, char *reply, size_t reply_size)
+{
+    char message[MAX_MSG_LENGTH];
+
+    snprintf(message, sizeof(message), "codecs %s %d", config.codec_offer, config.codec_level);
+    if (send(clientSocket, message, strlen(message), 0) == -1) {
+        return -1;
+    }
+
+    return recv_text(clientSocket, reply, reply_size) == 0 ? 0 : -1;
+}
+
+/*
+ * fetch_range: Downloads one byte range of an archive into the file
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 if the connection failed, -2 if the node answered with an error
+ *   (the bytes received before a failure are written but not counted as done)
+ */
+
+static int fetch_range(int clientSocket, const char *archive_id, unsigned long long offset, unsigned long long length, int fd, char *buffer, size_t buffer_size)
+{
+    char request[MAX_MSG_LENGTH];
+    char type[32], attrs[W24_PROTO_HEADER_MAX];
+    unsigned long long received;
+
+    snprintf(request, sizeof(request), "fetch %s %llu %llu", archive_id, offset, length);
+    if (w24_proto_send_all(clientSocket, request, strlen(request)) == -1 || w24_proto_recv_header(clientSocket, type, sizeof(type), &received, attrs, sizeof(attrs)) == -1) {
+        return -1;
+    }
+    if (strcmp(type, "DATA") != 0 || received != length) {
+        return -2;
+    }
+
+    while (received > 0) {
+        ssize_t n = recv(clientSocket, buffer, received < buffer_size ? (size_t)received : buffer_size, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        if (pwrite(fd, buffer, (size_t)n, (off_t)offset) != n) {
+            return -2;
+        }
+        offset += (unsigned long long)n;
+        received -= (unsigned long long)n;
+    }
+    return 0;
+}
+
+/*
+ * State shared by the threads of a parallel download: the archive is cut into FETCH_CHUNK
+ * chunks that every node thread takes from the same pool until none is left.
+ */
+struct parallel_download {
+    pthread_mutex_t lock;
+    const char *archive_id;
+    const char *command; // the archive command, re-issued on nodes that do not have the archive yet
+    int fd;
+    unsigned long long start; // first byte to download
+    unsigned long long total;
+    size_t num_chunks;
+    unsigned char *chunk_state; // 0 pending, 1 being fetched, 2 done
+};
+
+struct node_fetcher {
+    struct parallel_download *download;
+    int port;
+    int clientSocket; // the session connection, or -1 to open a helper connection to port
+    unsigned long long bytes; // bytes this node delivered
+    int failed; // a range failed on the session connection, which may be left in the middle of it
+};
+
+/*
+ * open_helper_connection: Opens an extra connection to one node for a parallel download
+ * 
+ * Return Value:
+ * - int: The connected socket, -1 if the node cannot serve this archive
+ * 
+ * Explanation:
+ * A connection to the server that the client count redirects to a mirror is closed by the server, so that node is skipped.
+ * If the node's archive store does not hold the archive yet, the archive command is sent to it; the node is used only
+ * if it builds the byte-identical archive (same id), which is what makes ranges from different nodes fit together.
+ */
+
+static int open_helper_connection(int port, const char *command, const char *archive_id)
+{
+    char message[MAX_MSG_LENGTH];
+    char probe;
+    int clientSocket;
+
+    if ((clientSocket = connect_node(port)) == -1) {
+        return -1;
+    }
+
+    if (port == config.server_port) {
+        memset(message, '\0', sizeof(message));
+        if (recv(clientSocket, message, sizeof(message) - 1, 0) <= 0 || w24_session_redirect(atoi(message)) != 0) {
+            close(clientSocket);
+            return -1;
+        }
+    }
+
+    if (negotiate_codecs(clientSocket, message, sizeof(message)) == -1) {
+        close(clientSocket);
+        return -1;
+    }
+
+    // does the node have the archive already? fetch one byte to find out
+    char type[32], attrs[W24_PROTO_HEADER_MAX];
+    unsigned long long length;
+    int ret = -1;
+    snprintf(message, sizeof(message), "fetch %s 0 1", archive_id);
+    if (w24_proto_send_all(clientSocket, message, strlen(message)) == 0 && w24_proto_recv_header(clientSocket, type, sizeof(type), &length, attrs, sizeof(attrs)) == 0) {
+        if (strcmp(type, "DATA") == 0) {
+            ret = length == 1 ? w24_proto_recv_all(clientSocket, &probe, 1) : -1;
+        }
+        else {
+            ret = -2;
+        }
+    }
+    if (ret == -2) {
+        char node_id[MAX_MSG_LENGTH];
+        if (send(clientSocket, command, strlen(command), 0) == -1 || recv_text(clientSocket, message, sizeof(message)) != 0) {
+            ret = -1;
+        }
+        else if (sscanf(message, "ARCHIVE %4095s", node_id) == 1 && strcmp(node_id, archive_id) == 0) {
+            ret = 0;
+        }
+    }
+    if (ret != 0) {
+        send(clientSocket, "quitc", 5, 0);
+        close(clientSocket);
+        return -1;
+    }
+    return clientSocket;
+}
+
+/*
+ * take_chunk: Claims the next pending chunk of a parallel download, -1 when none is left
+ */
+
+static long take_chunk(struct parallel_download *download)
+{
+    long chunk = -1;
+
+    pthread_mutex_lock(&download->lock);
+    for (size_t i = 0; i < download->num_chunks; i++) {
+        if (download->chunk_state[i] == 0) {
+            download->chunk_state[i] = 1;
+            chunk = (long)i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&download->lock);
+    return chunk;
+}
+
+static void * fetch_from_node(void * arg)
+{
+    struct node_fetcher *fetcher = arg;
+    struct parallel_download *download = fetcher->download;
+    int clientSocket = fetcher->clientSocket;
+    char *buffer = malloc(65536);
+
+    if (clientSocket == -1) {
+        clientSocket = open_helper_connection(fetcher->port, download->command, download->archive_id);
+    }
+
+    while (buffer != NULL && clientSocket != -1) {
+        long chunk = take_chunk(download);
+        if (chunk == -1) {
+            break;
+        }
+
+        unsigned long long offset = download->start + (unsigned long long)chunk * FETCH_CHUNK;
+        unsigned long long length = download->total - offset < FETCH_CHUNK ? download->total - offset : FETCH_CHUNK;
+        int ret = fetch_range(clientSocket, download->archive_id, offset, length, download->fd, buffer, 65536);
+
+        // a failed chunk goes back to the pool for the other nodes
+        pthread_mutex_lock(&download->lock);
+        download->chunk_state[chunk] = ret == 0 ? 2 : 0;
+        pthread_mutex_unlock(&download->lock);
+        if (ret != 0) {
+            fetcher->failed = fetcher->clientSocket != -1;
+            break;
+        }
+        fetcher->bytes += length;
+    }
+
+    if (fetcher->clientSocket == -1 && clientSocket != -1) {
+        send(clientSocket, "quitc", 5, 0);
+        close(clientSocket);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/*
+ * parallel_download: Downloads disjoint ranges of an archive from the server and both mirrors at once
+ * 
+ * Parameters:
+ * - clientSocket: The session connection, used for the node it is connected to
+ * - port: The node clientSocket is connected to
+ * - archive_id, command: The archive and the command that produced it
+ * - fd: The partial download file
+ * - start, total: First missing byte and archive length
+ * - session_failed: Set to 1 if a range failed on clientSocket, which must then not be used again
+ * 
+ * Return Value:
+ * - unsigned long long: Length of the contiguous prefix now on disk; the file is truncated to it so a
+ *   sequential download (or a later resume) can continue from there
+ * 
+ * Explanation:
+ * One thread per node pulls FETCH_CHUNK ranges from a shared pool, so faster nodes take more chunks and
+ * chunks of a node that fails are taken over by the others. Nodes that cannot serve the same archive are skipped.
+ */
+
+static unsigned long long parallel_download(int clientSocket, int port, const char *archive_id, const char *command, int fd, unsigned long long start, unsigned long long total, int *session_failed)
+{
+    struct parallel_download download;
+    struct node_fetcher fetchers[NUM_NODES];
+    pthread_t threads[NUM_NODES];
+    int started[NUM_NODES];
+
+    memset(&download, 0, sizeof(download));
+    pthread_mutex_init(&download.lock, NULL);
+    download.archive_id = archive_id;
+    download.command = command;
+    download.fd = fd;
+    download.start = start;
+    download.total = total;
+    download.num_chunks = (size_t)((total - start + FETCH_CHUNK - 1) / FETCH_CHUNK);
+    download.chunk_state = calloc(download.num_chunks, 1);
+    if (download.chunk_state == NULL) {
+        pthread_mutex_destroy(&download.lock);
+        return start;
+    }
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        memset(&fetchers[i], 0, sizeof(fetchers[i]));
+        fetchers[i].download = &download;
+        fetchers[i].port = node_ports[i];
+        fetchers[i].clientSocket = node_ports[i] == port ? clientSocket : -1;
+        started[i] = pthread_create(&threads[i], NULL, fetch_from_node, &fetchers[i]) == 0;
+    }
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        if (fetchers[i].bytes > 0) {
+            report("Fetched %llu bytes from port %d\n", fetchers[i].bytes, fetchers[i].port);
+        }
+        *session_failed |= fetchers[i].failed;
+    }
+
+    size_t done = 0;
+    while (done < download.num_chunks && download.chunk_state[done] == 2) {
+        done++;
+    }
+    unsigned long long prefix = done == download.num_chunks ? total : start + (unsigned long long)done * FETCH_CHUNK;
+    if (prefix < total && ftruncate(fd, (off_t)prefix) == -1) {
+        prefix = start;
+    }
+
+    free(download.chunk_state);
+    pthread_mutex_destroy(&download.lock);
+    return prefix;
+}
+
+/*
+ * open_part_file: Opens the partial download file of an archive, locked for this download
+ * 
+ * Parameters:
+ * - archive_id: The archive
+ * - part_path: Receives the path of the file
+ * 
+ * Return Value:
+ * - int: The file, locked with flock() until it is closed, or -1 on error
+ * 
+ * Explanation:
+ * The file is $HOME/w24project/.<id>.part, so that a later download of the same archive resumes it. Sessions (or
+ * clients) downloading the same archive at the same time each need their own file: when it is locked, .<id>.1.part,
+ * .<id>.2.part... are tried in turn. A file renamed away by the download that held the lock is not used.
+ */
+
+static int open_part_file(const char *archive_id, char *part_path, size_t size)
+{
+    int attempt = 0;
+
+    for (int tries = 0; tries < 1000; tries++) {
+        struct stat opened, named;
+
+        if (attempt == 0) {
+            snprintf(part_path, size, "%s/w24project/.%s.part", getenv("HOME"), archive_id);
+        }
+        else {
+            snprintf(part_path, size, "%s/w24project/.%s.%d.part", getenv("HOME"), archive_id, attempt);
+        }
+        int fd = open(part_path, O_WRONLY | O_CREAT, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+            int error = errno;
+            close(fd);
+            if (error != EWOULDBLOCK) {
+                errno = error;
+                return -1;
+            }
+            attempt++; // in use by another download
+            continue;
+        }
+        if (fstat(fd, &opened) == 0 && stat(part_path, &named) == 0 && opened.st_dev == named.st_dev && opened.st_ino == named.st_ino) {
+            return fd;
+        }
+        close(fd); // completed and renamed meanwhile: open the name again
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+/*
+ * hash_key: Hashes the key of a cache entry (FNV-1a)
+ */
+
+static unsigned long long hash_key(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *c = key; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return (unsigned long long)hash;
+}
+
+/*
+ * basis_path: Names the basis of a command, the last archive downloaded for it with the same extension
+ * 
+ * Explanation:
+ * Archives are deterministic across nodes, so unlike a cached reply the basis does not depend on the port.
+ */
+
+static void basis_path(const char *command, const char *destination, char *path, size_t size)
+{
+    char key[MAX_MSG_LENGTH + 80];
+    const char *name = strrchr(destination, '/');
+    const char *extension = strchr(name != NULL ? name : destination, '.');
+
+    snprintf(key, sizeof(key), "basis %s %s", extension != NULL ? extension : "", command);
+    snprintf(path, size, "%s/%016llx.basis", cache_directory, hash_key(key));
+}
+
+/*
+ * store_basis: Keeps a downloaded archive as the basis of the next delta transfer for its command
+ * 
+ * Explanation:
+ * The basis is a hard link to the archive, so it survives the archive being overwritten by a later download of another
+ * command with the same file name; it costs no space until then. Failures only cost the next download a full transfer.
+ */
+
+static void store_basis(const char *command, const char *destination)
+{
+    char path[MAX_MSG_LENGTH + 32], temporary[MAX_MSG_LENGTH + 40];
+
+    basis_path(command, destination, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+    unlink(temporary);
+    if (link(destination, temporary) == 0 && rename(temporary, path) == -1) {
+        unlink(temporary);
+    }
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * delta_download: Rebuilds an archive from the previous archive of its command and a delta (see w24delta.h)
+ * 
+ * Parameters:
+ * - clientSocket: The connection to the server
+ * - archive_id, total: Archive id and length from the ARCHIVE reply
+ * - basis_fd: The previous archive
+ * - fd: The empty part file
+ * 
+ * Return Value:
+ * - int: 1 if the archive was rebuilt, 0 if the server declined or the result does not check out (the connection
+ *   can be used on), -1 if the connection failed or the delta cannot be applied (it cannot)
+ * 
+ * Explanation:
+ * The instructions are applied as they arrive, so neither the delta nor the archive is held in memory, and the
+ * CRC-32 of the archive is computed on the way.
+ */
+
+static int delta_download(int clientSocket, const char *archive_id, unsigned long long total, int basis_fd, int fd)
+{
+    char type[32], attrs[W24_PROTO_HEADER_MAX];
+    unsigned char *signatures;
+    size_t signatures_length;
+    unsigned long long length, rebuilt_length, offset = 0, delta_length;
+    unsigned long expected_crc;
+    struct stat basis_stat;
+
+    if (fstat(basis_fd, &basis_stat) == -1 || basis_stat.st_size == 0) {
+        return 0;
+    }
+    unsigned long long basis_length = (unsigned long long)basis_stat.st_size;
+    size_t block_size = w24_delta_block_size(basis_length);
+    if (w24_delta_signatures(basis_fd, basis_length, block_size, &signatures, &signatures_length) == -1) {
+        return 0;
+    }
+
+    snprintf(attrs, sizeof(attrs), "%s %zu %llu", archive_id, block_size, basis_length);
+    int sent = w24_proto_send_frame(clientSocket, "SIGS", attrs, signatures, signatures_length);
+    free(signatures);
+    if (sent == -1 || w24_proto_recv_header(clientSocket, type, sizeof(type), &length, attrs, sizeof(attrs)) == -1) {
+        return -1;
+    }
+    if (strcmp(type, "DELTA") != 0) {
+        report("No delta transfer (%s), fetching the whole archive\n", attrs);
+        return length == 0 ? 0 : -1;
+    }
+    if (sscanf(attrs, "%llu %lx", &rebuilt_length, &expected_crc) != 2 || rebuilt_length != total) {
+        return -1;
+    }
+
+    unsigned char *buffer = malloc(65536);
+    uint64_t basis_blocks = (basis_length + block_size - 1) / block_size;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int ret = buffer != NULL ? 1 : -1;
+
+    delta_length = length;
+    while (ret == 1 && length > 0) {
+        unsigned char op[9];
+
+        if (w24_proto_recv_all(clientSocket, op, 1) == -1) {
+            ret = -1;
+        }
+        else if (op[0] == W24_DELTA_COPY && length >= 9 && w24_proto_recv_all(clientSocket, op + 1, 8) == 0) {
+            uint64_t first = get_u32(op + 1), count = get_u32(op + 5);
+
+            length -= 9;
+            if (first + count > basis_blocks) {
+                ret = -1;
+            }
+            for (uint64_t block = first; ret == 1 && block < first + count; block++) {
+                size_t piece = basis_length - block * block_size < block_size ? (size_t)(basis_length - block * block_size) : block_size;
+
+                if (offset + piece > total || pread(basis_fd, buffer, piece, (off_t)(block * block_size)) != (ssize_t)piece ||
+                    pwrite(fd, buffer, piece, (off_t)offset) != (ssize_t)piece) {
+                    ret = -1;
+                    break;
+                }
+                crc = crc32(crc, buffer, (uInt)piece);
+                offset += piece;
+            }
+        }
+        else if (op[0] == W24_DELTA_LITERAL && length >= 5 && w24_proto_recv_all(clientSocket, op + 1, 4) == 0) {
+            unsigned long long literal = get_u32(op + 1);
+
+            length -= 5;
+            if (literal > length || offset + literal > total) {
+                ret = -1;
+            }
+            while (ret == 1 && literal > 0) {
+                size_t piece = literal < 65536 ? (size_t)literal : 65536;
+
+                if (w24_proto_recv_all(clientSocket, buffer, piece) == -1 || pwrite(fd, buffer, piece, (off_t)offset) != (ssize_t)piece) {
+                    ret = -1;
+                    break;
+                }
+                crc = crc32(crc, buffer, (uInt)piece);
+                offset += piece;
+                literal -= piece;
+                length -= piece;
+            }
+        }
+        else {
+            ret = -1;
+        }
+    }
+    free(buffer);
+
+    if (ret == 1 && (offset != total || crc != expected_crc)) {
+        report("Delta transfer does not match the archive, fetching the whole archive\n");
+        ret = 0;
+    }
+    else if (ret == 1) {
+        report("Delta transfer: %llu bytes instead of %llu\n", delta_length, total);
+    }
+    return ret;
+}
+
+/*
+ * w24_client_download: Downloads an archive announced by the server into a local file
+ * 
+ * Parameters:
+ * - clientSocket: The connection to the server; replaced if the connection is re-established
+ * - port: The node clientSocket is connected to; updated with it
+ * - archive_id: Archive id from the ARCHIVE reply
+ * - total: Archive length from the ARCHIVE reply
+ * - command: The command the archive was announced for
+ * - destination: Path of the file to create
+ * 
+ * Return Value:
+ * - int: 1 if the archive was downloaded completely, 0 otherwise
+ * 
+ * Explanation:
+ * The archive is requested in FETCH_CHUNK ranges ("fetch <id> <offset> <length>") and written to
+ * $HOME/w24project/.<id>.part (see open_part_file()), which is renamed to destination once complete.
+ * When the reply cache is in use and a previous archive of the same command was kept, a fresh download is first
+ * tried as a delta against it (see delta_download()), and every complete archive is kept for the next one.
+ * Large archives are first fetched from all nodes at once (see parallel_download()); whatever is left after that
+ * is fetched over the session connection.
+ * If the connection drops, the client reconnects and continues from the bytes already on disk.
+ * The partial file is also kept when the download is abandoned: the archive id only depends on the
+ * matched files, so issuing the same command again later resumes where this download stopped.
+ */
+
+int w24_client_download(int *clientSocket, int *port, const char *archive_id, unsigned long long total, const char *command, const char *destination)
+{
+    char part_path[MAX_MSG_LENGTH];
+    char request[MAX_MSG_LENGTH];
+    char type[32], attrs[W24_PROTO_HEADER_MAX];
+    unsigned long long length;
+    struct stat part_stat;
+    int reconnects = 0;
+    int complete = 0;
+
+    int fd = open_part_file(archive_id, part_path, sizeof(part_path));
+    if (fd == -1 || fstat(fd, &part_stat) == -1) {
+        perror("Cannot open download file");
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    unsigned long long offset = (unsigned long long)part_stat.st_size;
+    if (offset > total) {
+        offset = 0; // not a prefix of this archive
+        ftruncate(fd, 0);
+    }
+    else if (offset > 0) {
+        report("Resuming download at byte %llu of %llu\n", offset, total);
+    }
+
+    if (offset == 0 && total > 0 && cache_directory[0] != '\0') {
+        char basis[MAX_MSG_LENGTH + 32];
+
+        basis_path(command, destination, basis, sizeof(basis));
+        int basis_fd = open(basis, O_RDONLY);
+        if (basis_fd != -1) {
+            W24_TRACE_BEGIN("delta download");
+            int delta = delta_download(*clientSocket, archive_id, total, basis_fd, fd);
+            W24_TRACE_END();
+            close(basis_fd);
+            if (delta == 1) {
+                offset = total;
+            }
+            else {
+                ftruncate(fd, 0);
+            }
+            if (delta == -1) {
+                reconnects++;
+                report("Delta transfer failed, reconnecting...\n");
+                close(*clientSocket);
+                W24_TRACE_BEGIN("reconnect");
+                *clientSocket = w24_client_connect(port, NULL);
+                W24_TRACE_END();
+            }
+        }
+    }
+
+    if (total - offset >= PARALLEL_MIN_LENGTH) {
+        int session_failed = 0;
+
+        W24_TRACE_BEGIN("parallel download");
+        offset = parallel_download(*clientSocket, *port, archive_id, command, fd, offset, total, &session_failed);
+        W24_TRACE_END();
+
+        // the rest of a failed range may still be on its way: the sequential download starts on a new connection
+        if (session_failed) {
+            reconnects++;
+            report("Parallel download failed on this connection, reconnecting...\n");
+            close(*clientSocket);
+            W24_TRACE_BEGIN("reconnect");
+            *clientSocket = w24_client_connect(port, NULL);
+            W24_TRACE_END();
+        }
+    }
+
+    char *buffer = malloc(65536);
+    while (buffer != NULL && offset < total) {
+        int lost = 0;
+
+        snprintf(request, sizeof(request), "fetch %s %llu %d", archive_id, offset, FETCH_CHUNK);
+        if (w24_proto_send_all(*clientSocket, request, strlen(request)) == -1 || w24_proto_recv_header(*clientSocket, type, sizeof(type), &length, attrs, sizeof(attrs)) == -1) {
+            lost = 1;
+        }
+        else if (strcmp(type, "DATA") != 0) {
+            report("Download failed: %s\n", attrs);
+            break;
+        }
+
+        // write the range as it arrives; whatever made it to disk survives a lost connection
+        while (!lost && length > 0) {
+            ssize_t n = recv(*clientSocket, buffer, length < 65536 ? (size_t)length : 65536, 0);
+            if (n <= 0) {
+                lost = 1;
+                break;
+            }
+            if (pwrite(fd, buffer, (size_t)n, (off_t)offset) != n) {
+                perror("Write failed");
+                lost = -1;
+                break;
+            }
+            offset += (unsigned long long)n;
+            length -= (unsigned long long)n;
+        }
+
+        if (lost == -1) {
+            break;
+        }
+        if (lost) {
+            if (++reconnects > MAX_RECONNECTS) {
+                report("Giving up after %d reconnections, %llu of %llu bytes kept in %s\n", MAX_RECONNECTS, offset, total, part_path);
+                break;
+            }
+            report("Connection lost at byte %llu of %llu, reconnecting...\n", offset, total);
+            close(*clientSocket);
+            W24_TRACE_BEGIN("reconnect");
+            *clientSocket = w24_client_connect(port, NULL);
+            W24_TRACE_END();
+            if (*clientSocket == -1) {
+                break;
+            }
+        }
+    }
+    free(buffer);
+
+    // renamed while still locked, so no other download picks up the finished file
+    if (offset == total) {
+        complete = rename(part_path, destination) == 0;
+    }
+    if (close(fd) != 0) {
+        complete = 0;
+    }
+    if (complete) {
+        report("Archive downloaded: %s (%llu bytes)\n", destination, total);
+        if (cache_directory[0] != '\0') {
+            store_basis(command, destination);
+        }
+    }
+    return complete;
+}
+
+/*
+ * pattern_start: Skips the options of a w24fg or w24fr command
+ * 
+ * Parameters:
+ * - command: The whole command, "w24fg [-a] [-i] [--] <pattern>"
+ * - archive: Receives 1 if -a asks for an archive instead of the list of paths
+ * 
+ * Return Value:
+ * - const char *: The pattern, the rest of the command
+ */
+
+static const char *pattern_start(const char *command, int *archive)
+{
+    const char *text = command + 6;
+
+    *archive = 0;
+    while (text[0] == '-' && (text[1] == 'a' || text[1] == 'i' || text[1] == '-') && text[2] == ' ') {
+        *archive |= text[1] == 'a';
+        text += 3;
+        if (text[-2] == '-') {
+            break;
+        }
+    }
+    return text;
+}
+
+/*
+ * w24_client_request_prefix: Measures the "req <id> <deadline_ms> " prefix of a command
+ * 
+ * Return Value:
+ * - int: The length of the prefix, the command following it; 0 if there is none, -1 if it is malformed
+ * 
+ * Explanation:
+ * id is up to 32 letters, digits, '.', '_' or '-', or "-" for a request without one; deadline_ms is at least 0, 0 for none.
+ */
+
+int w24_client_request_prefix(const char *message)
+{
+    char id[40];
+    int deadline_ms, start = 0;
+
+    if (strstr(message, "req ") != message) {
+        return 0;
+    }
+    if (sscanf(message, "req %39s %d %n", id, &deadline_ms, &start) != 2 || start == 0 || deadline_ms < 0 || strlen(id) > 32) {
+        return -1;
+    }
+    for (const char *c = id; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '.' && *c != '_' && *c != '-') {
+            return -1;
+        }
+    }
+    return start;
+}
+
+/*
+ * w24_client_check: Checks a command before it is sent and tells how its reply is delimited
+ * 
+ * Parameters:
+ * - message: The command as typed
+ * - shape: Receives the shape of the reply (see w24session.h)
+ * - error, error_size: Receive why the command was rejected
+ * 
+ * Return Value:
+ * - int: 1 if the command can be sent, 0 if it was rejected
+ * 
+ * Explanation:
+ * Supported commands include 'dirlist -a', 'dirlist -t', 'w24fn', 'w24fdb', 'w24fda', 'w24fz', 'w24ft', 'w24fg', 'w24fr', 'w24fuzzy', 'w24grep', 'w24top', 'w24agg', 'cancel' and 'stats'.
+ * Any of them may be preceded by "req <id> <deadline_ms> ", which names the request for "cancel <id>" and bounds how long the
+ * server works on it (see w24_client_request_prefix()); the reply is delimited like the command's.
+ * The file lists of w24fg/w24fr (without -a) and w24fuzzy and the tables of w24top/w24agg come back as one framed message,
+ * the matching lines of w24grep as a stream of frames; every other reply is a single text message.
+ */
+
+int w24_client_check(const char *message, enum w24_reply_shape *shape, char *error, size_t error_size)
+{
+    char message_copy[MAX_MSG_LENGTH];
+
+    snprintf(message_copy, sizeof(message_copy), "%s", message);
+    *shape = W24_REPLY_TEXT;
+
+    int prefix_length = w24_client_request_prefix(message_copy);
+    if (prefix_length == -1) {
+        snprintf(error, error_size, "Error: Use req <id> <deadline_ms> <command>, with an id of letters, digits, '.', '_' or '-' (or '-' for none).");
+        return 0;
+    }
+    if (prefix_length > 0 && w24_client_request_prefix(message + prefix_length) != 0) {
+        snprintf(error, error_size, "Error: Only one req prefix is allowed.");
+        return 0;
+    }
+    if (prefix_length > 0) {
+        return w24_client_check(message + prefix_length, shape, error, error_size);
+    }
+
+    if(strcmp("dirlist -a", message_copy)==0){
+        // do nothing. Skip to printing output of command
+    }
+    else if(strcmp("dirlist -t", message_copy)==0){
+        // do nothing. Skip to printing output of command
+    }
+    else if (strstr(message_copy, "w24fn ") == message_copy) {
+
+        // extract filename after "w24fn "
+        char * filename = strtok(message_copy + 6, "\n");
+
+        if (filename == NULL)
+        {
+            snprintf(error, error_size, "Invalid Command");
+            return 0;
+        }
+    }
+    else if (strstr(message_copy, "w24fz ") == message_copy) {
+
+        char *token;
+        long size1, size2;
+
+        // Tokenize the input message to extract size1 and size2
+        token = strtok(message_copy, " ");
+        token = strtok(NULL, " "); // Move to the next token (size1)
+
+        if (token != NULL) {
+            size1 = strtol(token, NULL, 10); // Convert size1 to long integer
+            token = strtok(NULL, " "); // Move to the next token (size2)
+            if (token != NULL) {
+                size2 = strtol(token, NULL, 10); // Convert size2 to long integer
+                token = strtok(NULL, " "); // Move to the next token
+                if (token == NULL) {
+                    if(size1<0 || size2<0)
+                    {
+                        snprintf(error, error_size, "Both sizes should be positive. Please try again.");
+
+                        return 0;
+                    }
+                    else if(size1>size2){
+                        snprintf(error, error_size, "size1 should be <= size2. Please try again.");
+                        return 0;
+                    }
+                } else {
+                    snprintf(error, error_size, "Error: Only two size parameters are allowed.");
+                    return 0;
+                }
+            }
+            else // exceeded number of sizes
+            {
+                snprintf(error, error_size, "Error: Both size1 and size2 must be provided.");
+                return 0;
+            }
+        } // less number of sizes
+        else {
+            snprintf(error, error_size, "Error: Both size1 and size2 must be provided.");
+            return 0;
+        }
+    }
+    else if (strstr(message_copy, "w24ft ") == message_copy) {
+
+        char *token;
+        int count = 0; // count to store number of file types
+        int exceeded = 0; // to check for limit of extensions
+
+            // Tokenize the input message to extract file types
+        token = strtok(message_copy, " ");
+        token = strtok(NULL, " "); // Move to the next token (first file type)
+
+        // Count the file types
+        while (token != NULL) {
+            if(count==3){
+                exceeded = 1;
+                snprintf(error, error_size, "Maximum 3 file types allowed. Please try again.");
+                break;
+            }
+            else{
+                count++;
+                token = strtok(NULL, " "); // Move to the next token
+            }
+        }
+
+        if(exceeded==1)
+            return 0;
+
+        // Check if at least one file type is provided and at most three
+        if (count >= 1 && count <= 3) {
+            // do nothing
+        } else {
+            snprintf(error, error_size, "Error: Enter at least one and at most three file types.");
+            return 0;
+        }
+    }
+    else if ((strstr(message_copy, "w24fdb ") == message_copy) || (strstr(message_copy, "w24fda ") == message_copy)) {
+
+        // check if excess arguments have been passed
+        if(is_word_limit_exceeded(message_copy,2)==1)
+        {
+            snprintf(error, error_size, "Too many arguments. Please try again");
+            return 0;
+        }
+
+        char *token,*date;
+        regex_t regex;
+        int ret;
+
+        token = strtok(message_copy, " "); // Tokenize the input message to extract the date
+        token = strtok(NULL, " ");
+
+        // Check if the date is not NULL and matches the expected format
+        if (token != NULL) {
+
+            date = token; // Store the date
+
+            // Compile regular expression to match the date format (YYYY-MM-DD)
+            ret = regcomp(&regex, "^[0-9]{4}-[0-9]{2}-[0-9]{2}$", REG_EXTENDED);
+
+            if (ret == 0) {
+
+                // Match the date against the regular expression
+                ret = regexec(&regex, date, 0, NULL, 0);
+
+                if (ret == 0) {
+                    // do nothing if okay
+                } else {
+                    snprintf(error, error_size, "Error: Invalid date format. Please enter date in YYYY-MM-DD format.");
+                    regfree(&regex);
+                    return 0;
+                }
+
+                regfree(&regex);
+            } else {
+                snprintf(error, error_size, "Error: Failed to compile regular expression.");
+                return 0;
+            }
+
+        } else {
+            snprintf(error, error_size, "Error: Date not provided.");
+            return 0;
+        }
+    }
+    else if ((strstr(message_copy, "w24fg ") == message_copy) || (strstr(message_copy, "w24fr ") == message_copy)) {
+
+        int archive;
+
+        // the pattern is the rest of the line: spaces are part of it
+        if (pattern_start(message_copy, &archive)[0] == '\0') {
+            snprintf(error, error_size, "Error: Pattern not provided.");
+            return 0;
+        }
+        *shape = archive ? W24_REPLY_TEXT : W24_REPLY_FRAME;
+    }
+    else if (strstr(message_copy, "w24fuzzy ") == message_copy) {
+
+        // "w24fuzzy [-k <count>] <name>": the closest names, one "<distance> <path>" per line
+        if (message_copy[9] == '\0') {
+            snprintf(error, error_size, "Error: File name not provided.");
+            return 0;
+        }
+        *shape = W24_REPLY_FRAME;
+    }
+    else if ((strstr(message_copy, "w24top ") == message_copy) || (strstr(message_copy, "w24agg ") == message_copy)) {
+
+        // "w24top size|new [<k>]" or "w24agg ext|dir", checked by the server
+        *shape = W24_REPLY_FRAME;
+    }
+    else if (strstr(message_copy, "w24grep ") == message_copy) {
+
+        // options and filters are checked by the server, which explains what it rejects
+        if (message_copy[8] == '\0') {
+            snprintf(error, error_size, "Error: Pattern not provided.");
+            return 0;
+        }
+        *shape = W24_REPLY_STREAM;
+    }
+    else if (strcmp(message_copy, "quitc")==0) {
+        // the server answers "shut yourself" and closes the connection
+    }
+    else if (strcmp(message_copy, "stats")==0) {
+        // server metrics, printed as received
+    }
+    else if (strstr(message_copy, "cancel ") == message_copy) {
+        // "cancel <id>": answered "cancelled <n>" or "no running request <id>"
+        if (message_copy[7] == '\0' || strchr(message_copy + 7, ' ') != NULL) {
+            snprintf(error, error_size, "Error: Request id not provided.");
+            return 0;
+        }
+    }
+    else {
+        snprintf(error, error_size, "Invalid command. Please try again.");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * w24_client_connect: Connects to the server, follows the redirection to a mirror and negotiates the codecs
+ * 
+ * Parameters:
+ * - port: Receives the port of the node the connection ends up on
+ * - count: Receives the client count sent by the server, may be NULL
+ * 
+ * Return Value:
+ * - int: The connected (blocking) socket, -1 on failure
+ * 
+ * Explanation:
+ * The server sends the client count on connect; depending on it the client stays or switches to mirror1 or mirror2.
+ * Failures are reported, not fatal: downloads use this to reconnect.
+ */
+
+int w24_client_connect(int *port, int *count)
+{
+    char message[MAX_MSG_LENGTH];
+    int clientSocket;
+
+    // Connect to server
+    W24_TRACE_BEGIN("connect");
+    clientSocket = connect_node(config.server_port);
+    W24_TRACE_END();
+    if (clientSocket == -1) {
+        perror("Connection failed");
+        return -1;
+    }
+    report("Connected to server\n");
+
+    // receive client count from server
+    memset(message, '\0', sizeof(message));
+    W24_TRACE_BEGIN("receive client count");
+    ssize_t received = recv(clientSocket, message, sizeof(message) - 1, 0);
+    W24_TRACE_END();
+    if (received <= 0) {
+        perror("Receive failed");
+        close(clientSocket);
+        return -1;
+    }
+
+    int client_count = atoi(message);
+    report("Received client count: %d\n", client_count);
+    if (count != NULL) {
+        *count = client_count;
+    }
+
+    // Changing connections as per client count; the server closes its end
+    int mirror = w24_session_redirect(client_count);
+    *port = config.server_port;
+    if (mirror != 0) {
+        close(clientSocket);
+        *port = config.mirror_ports[mirror - 1];
+        report("Redirecting to the mirror%d...\n", mirror);
+        W24_TRACE_BEGIN("redirect: connect mirror");
+        clientSocket = connect_node(*port);
+        W24_TRACE_END();
+        if (clientSocket == -1) {
+            perror("Connection failed");
+            return -1;
+        }
+        report("Redirected to mirror%d\n", mirror);
+    }
+
+    // advertise the compression codecs we can unpack; the server picks one per archive
+    if (negotiate_codecs(clientSocket, message, sizeof(message)) == -1) {
+        perror("Codec negotiation failed");
+        close(clientSocket);
+        return -1;
+    }
+    report("Codecs offered: %s, server answered: %s\n", config.codec_offer, message);
+
+    return clientSocket;
+}
+
+/*
+ * cache_path: Names the cache entry of a command answered by one node, after a hash of "<port> <command>"
+ */
+
+static void cache_path(const char *command, int port, char *path, size_t size)
+{
+    char key[MAX_MSG_LENGTH + 16];
+
+    snprintf(key, sizeof(key), "%d %s", port, command);
+    snprintf(path, size, "%s/%016llx", cache_directory, hash_key(key));
+}
+
+/*
+ * cache_load: Reads the cache entry of a command, "<port> <command>\n<generation>\n<text>"
+ * 
+ * Parameters:
+ * - generation, generation_size: Receive the generation of the entry
+ * - length: Receives the length of the text; NULL to read the generation only
+ * 
+ * Return Value:
+ * - char *: The text, NUL-terminated, to be freed by the caller (a non-NULL dummy when length is NULL);
+ *   NULL if there is no entry for the command
+ */
+
+static char *cache_load(const char *command, int port, char *generation, size_t generation_size, size_t *length)
+{
+    char path[MAX_MSG_LENGTH + 32], key[MAX_MSG_LENGTH + 16], line[MAX_MSG_LENGTH + 16];
+    struct stat entry_stat;
+    char *text = NULL;
+
+    cache_path(command, port, path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // the key guards against hash collisions, the newline against an entry cut short
+    snprintf(key, sizeof(key), "%d %s\n", port, command);
+    if (fgets(line, sizeof(line), file) != NULL && strcmp(line, key) == 0 &&
+        fgets(line, sizeof(line), file) != NULL && strchr(line, '\n') != NULL && fstat(fileno(file), &entry_stat) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(generation, generation_size, "%s", line);
+
+        if (length == NULL) {
+            text = (char *)command;
+        }
+        else {
+            long start = ftell(file);
+            size_t text_length = start >= 0 && entry_stat.st_size >= start ? (size_t)(entry_stat.st_size - start) : 0;
+
+            if ((text = malloc(text_length + 1)) != NULL && fread(text, 1, text_length, file) == text_length) {
+                text[text_length] = '\0';
+                *length = text_length;
+            }
+            else {
+                free(text);
+                text = NULL;
+            }
+        }
+    }
+    fclose(file);
+    return text;
+}
+
+/*
+ * cache_store: Replaces the cache entry of a command
+ * 
+ * Explanation:
+ * The entry is written to a temporary file and renamed, so concurrent sessions never read half an entry.
+ * Failures only cost the next request a full reply, so they are not reported.
+ */
+
+static void cache_store(const char *command, int port, const char *generation, const char *text, size_t length)
+{
+    char path[MAX_MSG_LENGTH + 32], temporary[MAX_MSG_LENGTH + 32];
+
+    cache_path(command, port, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s/.entry-XXXXXX", cache_directory);
+    int fd = mkstemp(temporary);
+    if (fd == -1) {
+        return;
+    }
+    FILE *file = fdopen(fd, "w");
+    if (file == NULL) {
+        close(fd);
+        unlink(temporary);
+        return;
+    }
+    fprintf(file, "%d %s\n%s\n", port, command, generation);
+    fwrite(text, 1, length, file);
+    if (ferror(file) | fclose(file) || rename(temporary, path) == -1) {
+        unlink(temporary);
+    }
+}
+
+/*
+ * w24_client_cache_init: Keeps the replies to dirlist and w24fn in a directory
+ * 
+ * Parameters:
+ * - directory: Where the entries are kept, created if needed (its parent must exist)
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 if the directory cannot be created; the cache is then not used
+ */
+
+int w24_client_cache_init(const char *directory)
+{
+    if (mkdir(directory, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    snprintf(cache_directory, sizeof(cache_directory), "%s", directory);
+    return 0;
+}
+
+/*
+ * w24_client_cache_request: Turns a command whose reply is cached into a conditional request
+ * 
+ * Parameters:
+ * - command: A checked command with a text reply
+ * - port: The node the command goes to
+ * - request, size: Receive "ifgen <generation> <command>"
+ * 
+ * Return Value:
+ * - int: 1 if request is to be sent instead of command, with its reply framed (W24_REPLY_FRAME) and passed to
+ *   w24_client_cache_reply(); 0 if command is sent as it is
+ * 
+ * Explanation:
+ * Without an entry the generation is "-", which the server never holds: the reply is complete, and cached.
+ */
+
+int w24_client_cache_request(const char *command, int port, char *request, size_t size)
+{
+    char generation[W24_PROTO_HEADER_MAX];
+
+    if (cache_directory[0] == '\0' ||
+        (strcmp(command, "dirlist -a") != 0 && strcmp(command, "dirlist -t") != 0 && strncmp(command, "w24fn ", 6) != 0)) {
+        return 0;
+    }
+    if (cache_load(command, port, generation, sizeof(generation), NULL) == NULL || strchr(generation, ' ') != NULL) {
+        snprintf(generation, sizeof(generation), "-");
+    }
+    snprintf(request, size, "ifgen %s %s", generation, command);
+    return 1;
+}
+
+/*
+ * w24_client_cache_reply: Takes the text out of the reply to a conditional request
+ * 
+ * Parameters:
+ * - command, port: As given to w24_client_cache_request()
+ * - reply: The framed reply
+ * - length: Receives the length of the text
+ * 
+ * Return Value:
+ * - char *: The text the server would have sent to the plain command, NUL-terminated, to be freed by the caller;
+ *   NULL for an ERROR frame, or a NOTMOD whose cache entry has gone meanwhile
+ * 
+ * Explanation:
+ * NOTMOD: the text comes from the cache entry, which must still be of the generation the server confirmed.
+ * TEXT: the text comes with the generation it was built from and replaces the entry; with "-" the server does not
+ * track changes and there is nothing worth keeping.
+ */
+
+char *w24_client_cache_reply(const char *command, int port, const struct w24_reply *reply, size_t *length)
+{
+    char generation[W24_PROTO_HEADER_MAX];
+    char *text;
+
+    if (strcmp(reply->type, "NOTMOD") == 0) {
+        text = cache_load(command, port, generation, sizeof(generation), length);
+        if (text != NULL && strcmp(generation, reply->attrs) != 0) {
+            free(text);
+            text = NULL;
+        }
+        return text;
+    }
+    if (strcmp(reply->type, "TEXT") != 0 || (text = malloc(reply->length + 1)) == NULL) {
+        return NULL;
+    }
+    if (strcmp(reply->attrs, "-") != 0) {
+        cache_store(command, port, reply->attrs, reply->data, reply->length);
+    }
+    memcpy(text, reply->data, reply->length);
+    text[reply->length] = '\0';
+    *length = reply->length;
+    return text;
+}
+
+/*
+ * w24_result_init: Empties a result before its first reply
+ */
+
+void w24_result_init(struct w24_result *result)
+{
+    memset(result, 0, sizeof(*result));
+}
+
+/*
+ * w24_result_add: Adds one reply (see w24session.h) to the result of a command
+ * 
+ * Return Value:
+ * - int: 0 on success, -1 if memory ran out
+ * 
+ * Explanation:
+ * The type follows the frames: FILES, TABLE, and LINES up to the END frame of w24grep, whose attributes
+ * (files, lines, truncated) are kept. A text reply announcing an archive becomes an ARCHIVE result with its
+ * id, length and extension parsed; an ERROR frame, or a malformed announcement, an ERROR result.
+ */
+
+int w24_result_add(struct w24_result *result, const struct w24_reply *reply)
+{
+    snprintf(result->attrs, sizeof(result->attrs), "%s", reply->attrs);
+
+    if (strcmp(reply->type, "TEXT") == 0) {
+        result->type = W24_RESULT_TEXT;
+        if (strncmp(reply->data, "ARCHIVE ", 8) == 0) {
+            result->type = W24_RESULT_ARCHIVE;
+            if (sscanf(reply->data, "ARCHIVE %255s %llu %63s", result->archive_id, &result->archive_length, result->extension) != 3 ||
+                strchr(result->archive_id, '/') != NULL || strchr(result->extension, '/') != NULL) {
+                result->type = W24_RESULT_ERROR;
+                snprintf(result->attrs, sizeof(result->attrs), "malformed archive reply");
+            }
+        }
+    }
+    else if (strcmp(reply->type, "FILES") == 0) {
+        result->type = W24_RESULT_FILES;
+    }
+    else if (strcmp(reply->type, "TABLE") == 0) {
+        result->type = W24_RESULT_TABLE;
+    }
+    else if (strcmp(reply->type, "LINES") == 0 || strcmp(reply->type, "END") == 0) {
+        result->type = W24_RESULT_LINES;
+    }
+    else {
+        result->type = W24_RESULT_ERROR;
+    }
+
+    if (reply->length > 0) {
+        char *data = realloc(result->data, result->length + reply->length + 1);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(data + result->length, reply->data, reply->length);
+        result->data = data;
+        result->length += reply->length;
+        result->data[result->length] = '\0';
+    }
+    return 0;
+}
+
+/*
+ * w24_result_free: Releases the data of a result, which is empty again afterwards
+ */
+
+void w24_result_free(struct w24_result *result)
+{
+    free(result->data);
+    w24_result_init(result);
+}
+
+/*
+ * request_once: Sends a command and receives its result, or the BUSY frame turning it away (see w24_client_request)
+ *
+ * Parameters:
+ * - retry_ms: Receives the wait a BUSY frame asks for, -1 for any other reply
+ */
+
+static int request_once(int fd, const char *command, enum w24_reply_shape shape, struct w24_result *result, int *retry_ms)
+{
+    struct w24_reply reply;
+    char type[32];
+    char request[MAX_MSG_LENGTH + W24_PROTO_HEADER_MAX];
+    unsigned long long length;
+    struct sockaddr_in peer;
+    socklen_t peer_length = sizeof(peer);
+    const char *plain = command;
+    int last = 0;
+
+    *retry_ms = -1;
+
+    // a cached reply is revalidated with the node the connection goes to
+    int conditional = shape == W24_REPLY_TEXT && getpeername(fd, (struct sockaddr *)&peer, &peer_length) == 0 &&
+                      w24_client_cache_request(command, ntohs(peer.sin_port), request, sizeof(request));
+    if (conditional) {
+        command = request;
+        shape = W24_REPLY_FRAME;
+    }
+
+    w24_result_init(result);
+    if (w24_proto_send_all(fd, command, strlen(command)) == -1) {
+        return -1;
+    }
+
+    while (!last) {
+        char attrs[W24_PROTO_HEADER_MAX];
+
+        if (w24_proto_recv_header(fd, type, sizeof(type), &length, attrs, sizeof(attrs)) == -1 || length > W24_SESSION_FRAME_MAX) {
+            return -1;
+        }
+        char *payload = malloc((size_t)length + 1);
+        if (payload == NULL || w24_proto_recv_all(fd, payload, (size_t)length) == -1) {
+            free(payload);
+            return -1;
+        }
+        payload[length] = '\0';
+        if (strcmp(type, "BUSY") == 0) {
+            *retry_ms = atoi(attrs);
+            free(payload);
+            return 0;
+        }
+        last = shape != W24_REPLY_STREAM || strcmp(type, "END") == 0 || strcmp(type, "ERROR") == 0;
+        reply = (struct w24_reply){ type, attrs, payload, (size_t)length, last };
+
+        char *text = NULL;
+        if (conditional) {
+            size_t text_length;
+
+            // the text the plain command gets, or why there is none
+            if ((text = w24_client_cache_reply(plain, ntohs(peer.sin_port), &reply, &text_length)) != NULL) {
+                reply = (struct w24_reply){ "TEXT", "", text, text_length, 1 };
+            }
+            else if (strcmp(type, "ERROR") != 0) {
+                reply = (struct w24_reply){ "ERROR", "cached reply lost, please try again", "", 0, 1 };
+            }
+        }
+        int ret = w24_result_add(result, &reply);
+        free(text);
+        free(payload);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * w24_client_request: Sends a command on a blocking connection and receives its result
+ * 
+ * Parameters:
+ * - fd: A connection from w24_client_connect()
+ * - command: The command, checked with w24_client_check()
+ * - shape: How its reply is delimited, from w24_client_check()
+ * - result: Receives the result; release it with w24_result_free()
+ * 
+ * Return Value:
+ * - int: 0 once the whole reply is in result, -1 if the connection failed
+ * 
+ * Explanation:
+ * The blocking counterpart of a session of the event loop, for programs that send one command at a time.
+ * An ARCHIVE result is downloaded with w24_client_download() on the same connection.
+ * With the reply cache, dirlist and w24fn are sent as conditional requests (see w24client.h).
+ * A command the node turns away with BUSY is sent again after the wait it asks for, up to W24_SESSION_BUSY_RETRIES
+ * times, on the same connection: unlike a session, the caller's connection cannot move to the node BUSY names.
+ */
+
+int w24_client_request(int fd, const char *command, enum w24_reply_shape shape, struct w24_result *result)
+{
+    for (int retries = 0; ; retries++) {
+        int retry_ms;
+        int ret = request_once(fd, command, shape, result, &retry_ms);
+
+        if (ret == -1 || retry_ms == -1) {
+            return ret;
+        }
+        if (retries == W24_SESSION_BUSY_RETRIES) {
+            result->type = W24_RESULT_ERROR;
+            snprintf(result->attrs, sizeof(result->attrs), "Server busy, please try again later.");
+            return 0;
+        }
+
+        struct timespec wait = { retry_ms / 1000, (long)(retry_ms % 1000) * 1000000 };
+        nanosleep(&wait, NULL);
+    }
+}
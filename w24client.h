@@ -0,0 +1,72 @@
+/*
+ * w24client.h: the client side of the protocol as a library
+ *
+ * Everything clientw24 does besides reading commands and printing answers, for programs that drive
+ * the servers themselves:
+ * - w24_client_connect(): a blocking connection to the server, following the redirection to a
+ *   mirror and negotiating the codecs (sessions of the event loop do the same, see w24session.h)
+ * - w24_client_check(): validates a command and tells how its reply is delimited
+ * - w24_client_request_prefix(): measures the "req <id> <deadline_ms> " prefix that names a command
+ *   for "cancel <id>" and bounds how long the server works on it (see w24cancel.h)
+ * - w24_client_request(): sends a command on a blocking connection and returns the typed result
+ * - w24_result_add(): builds the same typed result from the replies a session delivers
+ * - w24_client_download(): downloads, or resumes, the archive an ARCHIVE result announces
+ * - w24_client_cache_request(), w24_client_cache_reply(): keep the replies to dirlist and w24fn on
+ *   disk and revalidate them with the server instead of fetching them again (see below)
+ *
+ * w24_client_init() must be called first. The functions keep no state of their own besides the
+ * configuration, so they may be used from several threads at once.
+ *
+ * The reply cache: once w24_client_cache_init() has named a directory, the text of every dirlist -a,
+ * dirlist -t and w24fn reply is stored there with the generation of the tree it was built from (see
+ * w24gen.h), one entry per command and node. The command is then sent as "ifgen <generation>
+ * <command>"; the server answers with an empty NOTMOD frame while the tree has not changed, and the
+ * text is taken from the entry, or with a TEXT frame carrying the new generation, which replaces it.
+ * w24_client_request() does all of this itself; sessions call the two functions around the command.
+ */
+
+#ifndef W24CLIENT_H
+#define W24CLIENT_H
+
+#include <stdio.h>
+
+#include "w24proto.h"
+#include "w24session.h"
+
+#define W24_CLIENT_ID_MAX 256 // longest archive id kept
+
+enum w24_result_type {
+    W24_RESULT_TEXT, // text reply (TEXT frame): dirlist, w24fn, "No file found", stats...
+    W24_RESULT_FILES, // paths, one per line (w24fg, w24fr, w24fuzzy)
+    W24_RESULT_TABLE, // tab separated rows after a header row (w24top, w24agg)
+    W24_RESULT_LINES, // matching lines of w24grep, "path:line:text"
+    W24_RESULT_ARCHIVE, // an archive to download
+    W24_RESULT_ERROR // the server rejected the request; attrs says why
+};
+
+struct w24_result {
+    enum w24_result_type type;
+    char *data; // payload of every frame (or the text), NUL-terminated; NULL if empty
+    size_t length;
+    char attrs[W24_PROTO_HEADER_MAX]; // attributes of the last frame: count, rows, "<files> <lines> [truncated]", error
+    char archive_id[W24_CLIENT_ID_MAX];
+    unsigned long long archive_length;
+    char extension[64]; // of the archive's codec, e.g. ".tar.gz"
+};
+
+void w24_client_init(const struct w24_session_config *config, FILE *progress);
+int w24_client_connect(int *port, int *count);
+int w24_client_check(const char *command, enum w24_reply_shape *shape, char *error, size_t error_size);
+int w24_client_request_prefix(const char *command);
+int w24_client_request(int fd, const char *command, enum w24_reply_shape shape, struct w24_result *result);
+int w24_client_download(int *fd, int *port, const char *archive_id, unsigned long long total, const char *command, const char *destination);
+
+int w24_client_cache_init(const char *directory);
+int w24_client_cache_request(const char *command, int port, char *request, size_t size);
+char *w24_client_cache_reply(const char *command, int port, const struct w24_reply *reply, size_t *length);
+
+void w24_result_init(struct w24_result *result);
+int w24_result_add(struct w24_result *result, const struct w24_reply *reply);
+void w24_result_free(struct w24_result *result);
+
+#endif
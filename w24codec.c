@@ -0,0 +1,211 @@
+/*
+ * w24codec.c: pluggable archive compression codecs (see w24codec.h)
+ */
+
+#define _GNU_SOURCE
+#include "w24codec.h"
+#include "w24pgzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static const struct w24_codec codecs[] = {
+    // name    extension    levels        program  filter command (level, threads)  file list
+    { "zip",  ".zip",     1, 9,  6, NULL,   NULL,                                1 },
+    { "zstd", ".tar.zst", 1, 19, 3, "zstd", "zstd -q -c -%d -T%d",               0 },
+    { "lz4",  ".tar.lz4", 1, 12, 1, "lz4",  "lz4 -q -c -%d",                     0 },
+    { "gzip", ".tar.gz",  1, 9,  6, NULL,   NULL,                                0 },
+    { "none", ".tar",     0, 0,  0, NULL,   NULL,                                0 },
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+static int availability[NUM_CODECS]; // 0 unknown, 1 available, -1 missing
+
+/*
+ * w24_codec_find: looks up a codec by its protocol name
+ *
+ * Return Value:
+ * - const struct w24_codec *: the codec, or NULL for an unknown name
+ */
+const struct w24_codec *w24_codec_find(const char *name)
+{
+    for (size_t i = 0; i < NUM_CODECS; i++) {
+        if (strcmp(codecs[i].name, name) == 0)
+            return &codecs[i];
+    }
+    return NULL;
+}
+
+static int program_on_path(const char *program)
+{
+    const char *path = getenv("PATH");
+    char candidate[4096];
+
+    if (path == NULL)
+        path = "/usr/local/bin:/usr/bin:/bin";
+
+    while (*path != '\0') {
+        size_t len = strcspn(path, ":");
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, path, program);
+        if (access(candidate, X_OK) == 0)
+            return 1;
+        path += len;
+        if (*path == ':')
+            path++;
+    }
+    return 0;
+}
+
+/*
+ * w24_codec_available: whether this host can produce (or unpack) the codec
+ *
+ * Explanation:
+ * In-process codecs are always available; external ones need their program on the PATH.
+ * The PATH lookup is done once per codec and cached.
+ */
+int w24_codec_available(const struct w24_codec *codec)
+{
+    size_t idx = (size_t)(codec - codecs);
+
+    if (codec->program == NULL)
+        return 1;
+    if (availability[idx] == 0)
+        availability[idx] = program_on_path(codec->program) ? 1 : -1;
+    return availability[idx] == 1;
+}
+
+/*
+ * w24_codec_negotiate: picks the codec for one archive
+ *
+ * Parameters:
+ * - offer: comma separated codec names advertised by the client, most preferred first (may be NULL)
+ *
+ * Return Value:
+ * - const struct w24_codec *: first offered codec this server can produce, gzip if there is no offer
+ *   or none of the offered codecs is usable (every client understands gzip)
+ */
+const struct w24_codec *w24_codec_negotiate(const char *offer)
+{
+    char list[W24_CODEC_LIST_MAX];
+    char *saveptr = NULL;
+
+    if (offer != NULL) {
+        snprintf(list, sizeof(list), "%s", offer);
+        for (char *name = strtok_r(list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+            const struct w24_codec *codec = w24_codec_find(name);
+            if (codec != NULL && w24_codec_available(codec))
+                return codec;
+        }
+    }
+    return w24_codec_find("gzip");
+}
+
+/*
+ * w24_codec_level: clamps a requested level into the codec's range, <= 0 selects its default
+ */
+int w24_codec_level(const struct w24_codec *codec, int requested)
+{
+    if (requested <= 0)
+        return codec->default_level;
+    if (requested < codec->min_level)
+        return codec->min_level;
+    if (requested > codec->max_level)
+        return codec->max_level;
+    return requested;
+}
+
+static int copy_stream(int in_fd, int out_fd)
+{
+    char buf[65536];
+
+    while (1) {
+        ssize_t n = read(in_fd, buf, sizeof(buf));
+        if (n == 0)
+            return 0;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(out_fd, buf + done, (size_t)(n - done));
+            if (w == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            done += w;
+        }
+    }
+}
+
+static int run_filter(const struct w24_codec *codec, int in_fd, int out_fd, int level, int threads)
+{
+    char command[256];
+    int status;
+
+    snprintf(command, sizeof(command), codec->filter_format, level, threads);
+
+    pid_t pid = fork();
+    if (pid == -1)
+        return -1;
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL); // the server ignores it; the filter gets the usual behaviour back
+        if (dup2(in_fd, STDIN_FILENO) == -1 || dup2(out_fd, STDOUT_FILENO) == -1)
+            _exit(127);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/*
+ * w24_codec_compress: compresses everything readable from in_fd onto out_fd
+ *
+ * Parameters:
+ * - codec: codec returned by w24_codec_negotiate(), one that reads a tar stream
+ * - in_fd, out_fd: input read until EOF, output
+ * - level: codec level, already clamped with w24_codec_level()
+ * - threads: worker threads for codecs that can use them (gzip, zstd)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on failure (including a file list codec, which is driven through w24_zip_from_list())
+ */
+int w24_codec_compress(const struct w24_codec *codec, int in_fd, int out_fd, int level, int threads)
+{
+    if (codec->reads_file_list)
+        return -1;
+    if (strcmp(codec->name, "gzip") == 0)
+        return w24_pgzip(in_fd, out_fd, threads, level);
+    if (strcmp(codec->name, "none") == 0)
+        return copy_stream(in_fd, out_fd);
+    return run_filter(codec, in_fd, out_fd, level, threads);
+}
+
+/*
+ * w24_codec_local_offer: builds the codec list a client advertises: every codec it can unpack,
+ * in the default preference order (zip, zstd, lz4, gzip, none)
+ */
+void w24_codec_local_offer(char *buf, size_t size)
+{
+    size_t used = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < NUM_CODECS && used < size; i++) {
+        if (!w24_codec_available(&codecs[i]))
+            continue;
+        used += (size_t)snprintf(buf + used, size - used, "%s%s", used > 0 ? "," : "", codecs[i].name);
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ * w24codec.h: pluggable archive compression codecs
+ *
+ * A codec either compresses in-process (gzip through w24pgzip, none as a plain copy) or runs an
+ * external filter program reading the tar stream on stdin and writing the compressed stream on
+ * stdout (zstd, lz4). External codecs are only offered when their program is on the PATH.
+ * The zip codec is the exception: it reads the file list itself (see w24zip.h) instead of a
+ * tar stream, so it can decide per file whether compressing is worth it.
+ *
+ * Negotiation: the client advertises the codecs it can unpack, most preferred first, together
+ * with a preferred level ("codecs zip,zstd,lz4,gzip,none 3"). For every archive request the server
+ * picks the first advertised codec it can produce; the archive's file name carries the
+ * matching extension so the client stores it correctly.
+ */
+
+#ifndef W24CODEC_H
+#define W24CODEC_H
+
+#include <stddef.h>
+
+#define W24_CODEC_LIST_MAX 128 // longest codec list accepted from a client
+
+struct w24_codec {
+    const char *name; // protocol name: "zip", "zstd", "lz4", "gzip", "none"
+    const char *extension; // archive suffix, e.g. ".tar.zst"
+    int min_level, max_level, default_level;
+    const char *program; // external filter program, NULL for in-process codecs
+    const char *filter_format; // filter command line, formatted with (level, threads)
+    int reads_file_list; // consumes the list of files rather than a tar stream (zip)
+};
+
+const struct w24_codec *w24_codec_find(const char *name);
+int w24_codec_available(const struct w24_codec *codec);
+const struct w24_codec *w24_codec_negotiate(const char *offer);
+int w24_codec_level(const struct w24_codec *codec, int requested);
+int w24_codec_compress(const struct w24_codec *codec, int in_fd, int out_fd, int level, int threads);
+void w24_codec_local_offer(char *buf, size_t size);
+
+#endif
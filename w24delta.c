@@ -0,0 +1,338 @@
+/*
+ * w24delta.c: rsync-style delta transfer of archives (see w24delta.h)
+ */
+
+#include "w24delta.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct buffer {
+    unsigned char *data;
+    size_t length, capacity, limit;
+};
+
+static void put32(unsigned char *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void put64(unsigned char *p, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+    return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+/*
+ * w24_delta_block_size: Picks the block size for a basis, about its square root as rsync does
+ *
+ * Explanation:
+ * Larger blocks mean fewer signatures to send and look up, smaller ones less literal data around every change.
+ * The size is a multiple of 1 KiB between 1 KiB and 64 KiB, so a 30 MB archive is cut into 6 KiB blocks.
+ */
+size_t w24_delta_block_size(uint64_t basis_length)
+{
+    size_t block_size = ((size_t)sqrt((double)basis_length) + 1023) / 1024 * 1024;
+
+    if (block_size < 1024)
+        return 1024;
+    return block_size > 65536 ? 65536 : block_size;
+}
+
+/*
+ * w24_delta_weak: Computes the rolling sum of a block: a = sum of the bytes, b = sum of (length - i) * byte i,
+ * both modulo 2^16, as (b << 16) | a
+ */
+uint32_t w24_delta_weak(const unsigned char *data, size_t length)
+{
+    uint32_t a = 0, b = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        a += data[i];
+        b += (uint32_t)(length - i) * data[i];
+    }
+    return (b & 0xffff) << 16 | (a & 0xffff);
+}
+
+/*
+ * w24_delta_strong: Computes the strong hash of a block (MurmurHash64A)
+ */
+uint64_t w24_delta_strong(const unsigned char *data, size_t length)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    uint64_t h = 0x8445d61a4e774912ULL ^ (length * m);
+    size_t i;
+
+    for (i = 0; i + 8 <= length; i += 8) {
+        uint64_t k = get64(data + i);
+
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (i < length) {
+        for (size_t j = length - 1; j >= i && j < length; j--)
+            h ^= (uint64_t)data[j] << (8 * (j - i));
+        h *= m;
+    }
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+/*
+ * w24_delta_signatures: Computes the signatures of a basis
+ *
+ * Parameters:
+ * - fd: The basis, read with pread()
+ * - basis_length, block_size: Its length and the block size of w24_delta_block_size()
+ * - signatures, signatures_length: Receive the signatures, to be freed by the caller
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the basis cannot be read (errno set)
+ */
+int w24_delta_signatures(int fd, uint64_t basis_length, size_t block_size, unsigned char **signatures, size_t *signatures_length)
+{
+    uint64_t count = (basis_length + block_size - 1) / block_size;
+    unsigned char *block = malloc(block_size);
+    unsigned char *out = malloc(count * W24_DELTA_SIG_SIZE + 1);
+
+    if (count > W24_DELTA_MAX_BLOCKS || block == NULL || out == NULL) {
+        free(block);
+        free(out);
+        errno = count > W24_DELTA_MAX_BLOCKS ? EFBIG : ENOMEM;
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        size_t length = basis_length - i * block_size < block_size ? (size_t)(basis_length - i * block_size) : block_size;
+
+        if (pread(fd, block, length, (off_t)(i * block_size)) != (ssize_t)length) {
+            if (errno == 0)
+                errno = EIO; // the basis shrank
+            free(block);
+            free(out);
+            return -1;
+        }
+        put32(out + i * W24_DELTA_SIG_SIZE, w24_delta_weak(block, length));
+        put64(out + i * W24_DELTA_SIG_SIZE + 4, w24_delta_strong(block, length));
+    }
+    free(block);
+    *signatures = out;
+    *signatures_length = (size_t)count * W24_DELTA_SIG_SIZE;
+    return 0;
+}
+
+static int append(struct buffer *out, const void *data, size_t length)
+{
+    if (out->length + length > out->limit)
+        return 1;
+    if (out->length + length > out->capacity) {
+        size_t capacity = out->capacity * 2 + length + 4096;
+        unsigned char *grown = realloc(out->data, capacity);
+        if (grown == NULL)
+            return -1;
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+    return 0;
+}
+
+static int emit_literal(struct buffer *out, const unsigned char *data, size_t length)
+{
+    unsigned char op[5];
+    int ret = 0;
+
+    while (ret == 0 && length > 0) {
+        uint32_t piece = length > 0x40000000 ? 0x40000000 : (uint32_t)length;
+
+        op[0] = W24_DELTA_LITERAL;
+        put32(op + 1, piece);
+        ret = append(out, op, sizeof(op));
+        if (ret == 0)
+            ret = append(out, data, piece);
+        data += piece;
+        length -= piece;
+    }
+    return ret;
+}
+
+static int emit_copy(struct buffer *out, uint32_t first, uint32_t count)
+{
+    unsigned char op[9];
+
+    op[0] = W24_DELTA_COPY;
+    put32(op + 1, first);
+    put32(op + 5, count);
+    return append(out, op, sizeof(op));
+}
+
+/*
+ * w24_delta_generate: Expresses an archive as copies of basis blocks and literal data
+ *
+ * Parameters:
+ * - data, length: The new archive
+ * - signatures, block_size, basis_length: From the client's SIGS request, one signature per block of the basis;
+ *   the basis must be 1 to W24_DELTA_MAX_BLOCKS blocks long
+ * - limit: Largest delta worth sending
+ * - delta, delta_length: Receive the instructions (see w24delta.h), to be freed by the caller
+ *
+ * Return Value:
+ * - int: 0 on success, 1 if the delta would exceed limit, -1 if memory ran out or the basis length is out of range
+ *
+ * Explanation:
+ * The blocks are put in a hash table by weak sum. The window slides one byte at a time, its weak sum updated in
+ * constant time; only when the sum is in the table is the strong hash computed. After a match the window jumps a
+ * whole block, and consecutive blocks are merged into one copy. The short last block of the basis can only match
+ * at the end of the archive and is checked there.
+ */
+int w24_delta_generate(const unsigned char *data, size_t length, const unsigned char *signatures, size_t block_size,
+                       uint64_t basis_length, size_t limit, unsigned char **delta, size_t *delta_length)
+{
+    if (block_size == 0 || basis_length == 0 || basis_length > (uint64_t)W24_DELTA_MAX_BLOCKS * block_size) {
+        errno = EINVAL; // the signatures could not cover it
+        return -1;
+    }
+
+    uint32_t full = (uint32_t)(basis_length / block_size); // blocks of block_size bytes
+    uint32_t count = full + (basis_length % block_size != 0);
+    size_t last_length = (size_t)(basis_length - (uint64_t)full * block_size);
+    size_t table_size = 1;
+    struct buffer out = { NULL, 0, 0, limit };
+    int32_t *head, *next;
+    uint32_t run_first = 0, run_count = 0;
+    size_t literal_start = 0, pos = 0;
+    int ret = 0;
+
+    while (table_size < (size_t)count * 2)
+        table_size *= 2;
+    head = malloc(table_size * sizeof(*head));
+    next = malloc(((size_t)full + 1) * sizeof(*next));
+    if (head == NULL || next == NULL) {
+        free(head);
+        free(next);
+        return -1;
+    }
+    memset(head, 0xff, table_size * sizeof(*head));
+
+    // full blocks only; in reverse, so the chains start with the lowest index
+    for (uint32_t i = full; i-- > 0; ) {
+        uint32_t weak = get32(signatures + (size_t)i * W24_DELTA_SIG_SIZE);
+        size_t slot = (weak * 2654435761u) & (table_size - 1);
+
+        next[i] = head[slot];
+        head[slot] = (int32_t)i;
+    }
+
+    uint32_t a = 0, b = 0;
+    if (full > 0 && length >= block_size) {
+        uint32_t weak = w24_delta_weak(data, block_size);
+
+        a = weak & 0xffff;
+        b = weak >> 16;
+    }
+
+    while (full > 0 && ret == 0 && pos + block_size <= length) {
+        uint32_t weak = (b & 0xffff) << 16 | (a & 0xffff);
+        int32_t match = -1;
+        int strong_known = 0;
+        uint64_t strong = 0;
+
+        for (int32_t i = head[(weak * 2654435761u) & (table_size - 1)]; i != -1; i = next[i]) {
+            const unsigned char *signature = signatures + (size_t)i * W24_DELTA_SIG_SIZE;
+
+            if (get32(signature) != weak)
+                continue;
+            if (!strong_known) {
+                strong = w24_delta_strong(data + pos, block_size);
+                strong_known = 1;
+            }
+            if (get64(signature + 4) == strong) {
+                match = i;
+                break;
+            }
+        }
+
+        if (match != -1) {
+            if (literal_start < pos || (run_count > 0 && (uint32_t)match != run_first + run_count)) {
+                if (run_count > 0)
+                    ret = emit_copy(&out, run_first, run_count);
+                if (ret == 0)
+                    ret = emit_literal(&out, data + literal_start, pos - literal_start);
+                run_count = 0;
+            }
+            if (run_count == 0)
+                run_first = (uint32_t)match;
+            run_count++;
+            pos += block_size;
+            literal_start = pos;
+            if (pos + block_size <= length) {
+                weak = w24_delta_weak(data + pos, block_size);
+                a = weak & 0xffff;
+                b = weak >> 16;
+            }
+            continue;
+        }
+
+        // slide the window one byte
+        if (pos + block_size < length) {
+            a = a - data[pos] + data[pos + block_size];
+            b = b - (uint32_t)block_size * data[pos] + a;
+        }
+        pos++;
+    }
+
+    // the short last block, at the very end
+    if (ret == 0 && last_length > 0 && length >= literal_start + last_length) {
+        const unsigned char *signature = signatures + (size_t)full * W24_DELTA_SIG_SIZE;
+        const unsigned char *tail = data + length - last_length;
+
+        if (get32(signature) == w24_delta_weak(tail, last_length) && get64(signature + 4) == w24_delta_strong(tail, last_length)) {
+            if (literal_start < length - last_length || (run_count > 0 && full != run_first + run_count)) {
+                if (run_count > 0)
+                    ret = emit_copy(&out, run_first, run_count);
+                if (ret == 0)
+                    ret = emit_literal(&out, data + literal_start, length - last_length - literal_start);
+                run_count = 0;
+            }
+            if (run_count == 0)
+                run_first = full;
+            run_count++;
+            literal_start = length;
+        }
+    }
+
+    if (ret == 0 && run_count > 0)
+        ret = emit_copy(&out, run_first, run_count);
+    if (ret == 0)
+        ret = emit_literal(&out, data + literal_start, length - literal_start);
+
+    free(head);
+    free(next);
+    if (ret != 0) {
+        free(out.data);
+        return ret;
+    }
+    *delta = out.data;
+    *delta_length = out.length;
+    return 0;
+}
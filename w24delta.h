@@ -0,0 +1,46 @@
+/*
+ * w24delta.h: rsync-style delta transfer of archives
+ *
+ * A client that still has the archive it downloaded for a command the last time (the basis)
+ * cuts it into blocks and sends their signatures instead of fetching the new archive in full:
+ *
+ *     SIGS <n> <id> <block_size> <basis_length>\n<n bytes of signatures>
+ *
+ * A signature is the weak rolling sum of the block (32 bits, as in rsync) and a strong 64-bit
+ * hash of it, little endian, W24_DELTA_SIG_SIZE bytes; the last block may be short. The server
+ * slides a window over the new archive, looks the rolling sum of every offset up among the
+ * signatures and confirms a hit with the strong hash. It answers with the new archive as runs of
+ * basis blocks and literal bytes:
+ *
+ *     DELTA <n> <length> <crc32>\n<n bytes of instructions>
+ *
+ *     'C' <first block, u32> <blocks, u32>    copy blocks of the basis
+ *     'L' <length, u32> <bytes>               literal data
+ *
+ * The client rebuilds the archive from its basis and the literals and checks the length and CRC-32
+ * of the result. When the delta would not be much smaller than the archive, the server answers
+ * with an ERROR frame and the client fetches the archive as usual.
+ *
+ * Archives whose members are compressed one by one (zip, none) change only where their files
+ * changed, so a daily archive of a slowly changing tree mostly comes back as copy instructions.
+ */
+
+#ifndef W24DELTA_H
+#define W24DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define W24_DELTA_SIG_SIZE 12 // weak sum (4 bytes) and strong hash (8 bytes) of one block
+#define W24_DELTA_MAX_BLOCKS (4 * 1024 * 1024) // signatures accepted in one request
+#define W24_DELTA_COPY 'C'
+#define W24_DELTA_LITERAL 'L'
+
+size_t w24_delta_block_size(uint64_t basis_length);
+uint32_t w24_delta_weak(const unsigned char *data, size_t length);
+uint64_t w24_delta_strong(const unsigned char *data, size_t length);
+int w24_delta_signatures(int fd, uint64_t basis_length, size_t block_size, unsigned char **signatures, size_t *signatures_length);
+int w24_delta_generate(const unsigned char *data, size_t length, const unsigned char *signatures, size_t block_size,
+                       uint64_t basis_length, size_t limit, unsigned char **delta, size_t *delta_length);
+
+#endif
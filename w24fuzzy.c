@@ -0,0 +1,455 @@
+/*
+ * w24fuzzy.c: fuzzy file name lookup over a trigram index (see w24fuzzy.h)
+ */
+
+#define _GNU_SOURCE // gettid
+
+#include "w24fuzzy.h"
+#include "w24scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAGIC "W24FZY1"
+
+/*
+ * Index file layout, in host byte order:
+ *   header
+ *   entry[entry_count]
+ *   trigram[trigram_count + 1]   sorted; the last one only closes the postings of the one before
+ *   uint32_t posting[posting_count]   entry numbers, increasing within a trigram
+ *   char strings[strings_size]   NUL-terminated paths
+ */
+
+struct header {
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t trigram_count;
+    uint64_t posting_count;
+    uint64_t strings_size;
+};
+
+struct entry {
+    uint32_t path; // offset into strings
+    uint16_t name; // offset of the last component into the path
+    uint16_t name_length;
+};
+
+struct trigram {
+    uint32_t trigram; // three lowercase bytes
+    uint32_t first; // first posting
+};
+
+struct w24_fuzzy_index {
+    void *map;
+    size_t map_size;
+    const struct header *header;
+    const struct entry *entries;
+    const struct trigram *trigrams;
+    const uint32_t *postings;
+    const char *strings;
+};
+
+struct builder {
+    struct entry *entries;
+    size_t entry_count, entry_cap;
+    uint64_t *pairs; // trigram << 32 | entry
+    size_t pair_count, pair_cap;
+    char *strings;
+    size_t strings_size, strings_cap;
+    int failed;
+};
+
+static unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// the distinct trigrams of a lowercased, padded name; returns how many (at most length + 1)
+static size_t name_trigrams(const char *name, size_t length, uint32_t *trigrams)
+{
+    unsigned char padded[W24_FUZZY_MAX_QUERY * 4 + 3];
+    size_t count = 0, unique = 0;
+
+    if (length > sizeof(padded) - 3)
+        length = sizeof(padded) - 3;
+    padded[0] = padded[1] = 0;
+    for (size_t i = 0; i < length; i++)
+        padded[i + 2] = fold((unsigned char)name[i]);
+    padded[length + 2] = 0;
+
+    for (size_t i = 0; i + 3 <= length + 3; i++)
+        trigrams[count++] = (uint32_t)padded[i] << 16 | (uint32_t)padded[i + 1] << 8 | padded[i + 2];
+    qsort(trigrams, count, sizeof(*trigrams), compare_u32);
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || trigrams[unique - 1] != trigrams[i])
+            trigrams[unique++] = trigrams[i];
+    }
+    return unique;
+}
+
+static int add_entry(const struct w24_scan_entry *entry, void *arg)
+{
+    struct builder *b = arg;
+    size_t path_length = strlen(entry->path) + 1, name_length = strlen(entry->name);
+    uint32_t trigrams[W24_FUZZY_MAX_QUERY * 4 + 1];
+    size_t count = name_trigrams(entry->name, name_length, trigrams);
+
+    if (b->entry_count == UINT32_MAX || b->strings_size + path_length > UINT32_MAX) {
+        b->failed = 1;
+        return 1;
+    }
+    if (b->entry_count == b->entry_cap) {
+        struct entry *grown = realloc(b->entries, (b->entry_cap = b->entry_cap * 2 + 1024) * sizeof(*grown));
+        if (grown == NULL) {
+            b->failed = 1;
+            return 1;
+        }
+        b->entries = grown;
+    }
+    if (b->pair_count + count > b->pair_cap) {
+        uint64_t *grown = realloc(b->pairs, (b->pair_cap = b->pair_cap * 2 + count + 16384) * sizeof(*grown));
+        if (grown == NULL) {
+            b->failed = 1;
+            return 1;
+        }
+        b->pairs = grown;
+    }
+    if (b->strings_size + path_length > b->strings_cap) {
+        char *grown = realloc(b->strings, b->strings_cap = b->strings_cap * 2 + path_length + 65536);
+        if (grown == NULL) {
+            b->failed = 1;
+            return 1;
+        }
+        b->strings = grown;
+    }
+
+    b->entries[b->entry_count].path = (uint32_t)b->strings_size;
+    b->entries[b->entry_count].name = (uint16_t)(entry->name - entry->path); // paths are shorter than PATH_MAX
+    b->entries[b->entry_count].name_length = (uint16_t)name_length;
+    memcpy(b->strings + b->strings_size, entry->path, path_length);
+    b->strings_size += path_length;
+    for (size_t i = 0; i < count; i++)
+        b->pairs[b->pair_count++] = (uint64_t)trigrams[i] << 32 | b->entry_count;
+    b->entry_count++;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// scans root and writes its index to index_path (through a temporary file renamed into place)
+static int build(const char *root, const char *index_path)
+{
+    struct builder b;
+    struct header header;
+    struct trigram *trigrams = NULL;
+    uint32_t *postings = NULL;
+    size_t trigram_count = 0;
+    char temp_path[4200];
+    int fd, written, ret = -1;
+
+    memset(&b, 0, sizeof(b));
+    if (w24_scan(root, W24_SCAN_REGULAR | W24_SCAN_OTHER | W24_SCAN_HIDDEN, NULL, add_entry, &b) != 0 || b.failed)
+        goto out;
+
+    // sorting (trigram, entry) pairs groups the postings of a trigram, entries increasing
+    qsort(b.pairs, b.pair_count, sizeof(*b.pairs), compare_u64);
+    trigrams = malloc((b.pair_count + 1) * sizeof(*trigrams));
+    postings = malloc((b.pair_count + 1) * sizeof(*postings));
+    if (trigrams == NULL || postings == NULL)
+        goto out;
+    for (size_t i = 0; i < b.pair_count; i++) {
+        uint32_t trigram = (uint32_t)(b.pairs[i] >> 32);
+        if (trigram_count == 0 || trigrams[trigram_count - 1].trigram != trigram) {
+            trigrams[trigram_count].trigram = trigram;
+            trigrams[trigram_count++].first = (uint32_t)i;
+        }
+        postings[i] = (uint32_t)b.pairs[i];
+    }
+    trigrams[trigram_count].trigram = UINT32_MAX;
+    trigrams[trigram_count].first = (uint32_t)b.pair_count;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entry_count = (uint32_t)b.entry_count;
+    header.trigram_count = (uint32_t)trigram_count;
+    header.posting_count = b.pair_count;
+    header.strings_size = b.strings_size;
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%d", index_path, (int)gettid()); // unique per builder, process or thread
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        goto out;
+    written = write_all(fd, &header, sizeof(header)) == 0 &&
+              write_all(fd, b.entries, b.entry_count * sizeof(*b.entries)) == 0 &&
+              write_all(fd, trigrams, (trigram_count + 1) * sizeof(*trigrams)) == 0 &&
+              write_all(fd, postings, b.pair_count * sizeof(*postings)) == 0 &&
+              write_all(fd, b.strings, b.strings_size) == 0;
+    if (close(fd) == -1 || !written || rename(temp_path, index_path) == -1) {
+        unlink(temp_path);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    free(b.entries);
+    free(b.pairs);
+    free(b.strings);
+    free(trigrams);
+    free(postings);
+    return ret;
+}
+
+/*
+ * w24_fuzzy_open: maps the index of a tree, building it first if it is missing or too old
+ *
+ * Parameters:
+ * - root: directory tree the index covers
+ * - index_path: file the index is kept in
+ * - max_age: seconds after which the index is rebuilt (W24_FUZZY_MAX_AGE)
+ *
+ * Return Value:
+ * - struct w24_fuzzy_index *: the mapped index, NULL with errno set on failure
+ *
+ * Explanation:
+ * Concurrent builders each write their own temporary file and rename it over the index, so
+ * readers always map a complete one.
+ */
+struct w24_fuzzy_index *w24_fuzzy_open(const char *root, const char *index_path, int max_age)
+{
+    struct w24_fuzzy_index *index;
+    struct stat sb;
+    int fd;
+
+    if (stat(index_path, &sb) == -1 || time(NULL) - sb.st_mtime > max_age) {
+        if (build(root, index_path) == -1)
+            return NULL;
+    }
+
+    fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(struct header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        close(fd);
+        return NULL;
+    }
+    index->map_size = (size_t)sb.st_size;
+    index->map = mmap(NULL, index->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        free(index);
+        return NULL;
+    }
+
+    index->header = index->map;
+    index->entries = (const struct entry *)(index->header + 1);
+    index->trigrams = (const struct trigram *)(index->entries + index->header->entry_count);
+    index->postings = (const uint32_t *)(index->trigrams + index->header->trigram_count + 1);
+    index->strings = (const char *)(index->postings + index->header->posting_count);
+    if (memcmp(index->header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        (size_t)(index->strings - (const char *)index->map) + index->header->strings_size != index->map_size) {
+        w24_fuzzy_close(index);
+        errno = EINVAL;
+        return NULL;
+    }
+    return index;
+}
+
+size_t w24_fuzzy_entries(const struct w24_fuzzy_index *index)
+{
+    return index->header->entry_count;
+}
+
+/*
+ * w24_fuzzy_default_distance: largest edit distance worth reporting for a query of this length
+ */
+int w24_fuzzy_default_distance(size_t query_length)
+{
+    return query_length <= 4 ? 1 : query_length <= 10 ? 2 : 3;
+}
+
+// Levenshtein distance between the query (peq: positions of each byte, m <= 64 bytes) and a name, ASCII case ignored
+static int myers_distance(const uint64_t peq[256], int m, const char *name, size_t length)
+{
+    uint64_t pv = ~0ull, mv = 0, last = 1ull << (m - 1);
+    int score = m;
+
+    for (size_t i = 0; i < length; i++) {
+        uint64_t eq = peq[fold((unsigned char)name[i])];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & last)
+            score++;
+        else if (mh & last)
+            score--;
+        ph = ph << 1 | 1; // the top row of the global distance grows by one per name byte
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+// whether a sorts before b in the results
+static int closer(const struct w24_fuzzy_index *index, int distance_a, uint32_t a, int distance_b, uint32_t b)
+{
+    const struct entry *x = &index->entries[a], *y = &index->entries[b];
+    int order;
+
+    if (distance_a != distance_b)
+        return distance_a < distance_b;
+    order = strcmp(index->strings + x->path + x->name, index->strings + y->path + y->name);
+    if (order != 0)
+        return order < 0;
+    return strcmp(index->strings + x->path, index->strings + y->path) < 0;
+}
+
+/*
+ * w24_fuzzy_search: the names closest to a query
+ *
+ * Parameters:
+ * - index: from w24_fuzzy_open()
+ * - query: the misspelled name, 1 to W24_FUZZY_MAX_QUERY bytes
+ * - max_distance: largest edit distance returned (w24_fuzzy_default_distance())
+ * - results, k: receive the k closest names, nearest first
+ *
+ * Return Value:
+ * - int: number of results, -1 (EINVAL) for an empty or too long query
+ */
+int w24_fuzzy_search(const struct w24_fuzzy_index *index, const char *query, int max_distance, struct w24_fuzzy_result results[], int k)
+{
+    size_t m = strlen(query);
+    uint32_t entry_count = index->header->entry_count;
+    uint32_t query_trigrams[W24_FUZZY_MAX_QUERY + 1];
+    uint32_t found[W24_FUZZY_MAX_RESULTS]; // entries of the results so far, nearest first
+    uint64_t peq[256] = { 0 };
+    uint8_t *shared = NULL;
+    uint32_t *candidates = NULL;
+    size_t candidate_count = 0, query_trigram_count;
+    long threshold;
+    int result_count = 0;
+
+    if (m == 0 || m > W24_FUZZY_MAX_QUERY || k <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (k > W24_FUZZY_MAX_RESULTS)
+        k = W24_FUZZY_MAX_RESULTS;
+    for (size_t i = 0; i < m; i++)
+        peq[fold((unsigned char)query[i])] |= 1ull << i;
+
+    // names sharing fewer trigrams than this are further away than max_distance
+    query_trigram_count = name_trigrams(query, m, query_trigrams);
+    threshold = (long)query_trigram_count - 3L * max_distance;
+    if (threshold > 0) {
+        shared = calloc(entry_count > 0 ? entry_count : 1, 1);
+        candidates = malloc((entry_count > 0 ? entry_count : 1) * sizeof(*candidates));
+        if (shared == NULL || candidates == NULL) {
+            free(shared);
+            free(candidates);
+            return -1;
+        }
+        for (size_t t = 0; t < query_trigram_count; t++) {
+            size_t lo = 0, hi = index->header->trigram_count;
+            while (lo < hi) { // first trigram >= query_trigrams[t]
+                size_t mid = (lo + hi) / 2;
+                if (index->trigrams[mid].trigram < query_trigrams[t])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == index->header->trigram_count || index->trigrams[lo].trigram != query_trigrams[t])
+                continue;
+            for (uint32_t p = index->trigrams[lo].first; p < index->trigrams[lo + 1].first; p++) {
+                uint32_t e = index->postings[p];
+                if (++shared[e] == threshold)
+                    candidates[candidate_count++] = e;
+            }
+        }
+    }
+    else {
+        candidate_count = entry_count; // too short to rule anything out by trigrams
+    }
+
+    for (size_t c = 0; c < candidate_count; c++) {
+        uint32_t e = candidates != NULL ? candidates[c] : (uint32_t)c;
+        const struct entry *entry = &index->entries[e];
+        long length_difference = (long)entry->name_length - (long)m;
+        int distance, at;
+
+        if (length_difference > max_distance || -length_difference > max_distance)
+            continue;
+        distance = myers_distance(peq, (int)m, index->strings + entry->path + entry->name, entry->name_length);
+        if (distance > max_distance)
+            continue;
+
+        // insertion into the k nearest so far
+        if (result_count == k && !closer(index, distance, e, results[k - 1].distance, found[k - 1]))
+            continue;
+        at = result_count < k ? result_count++ : k - 1;
+        while (at > 0 && closer(index, distance, e, results[at - 1].distance, found[at - 1])) {
+            results[at] = results[at - 1];
+            found[at] = found[at - 1];
+            at--;
+        }
+        results[at].path = index->strings + entry->path;
+        results[at].distance = distance;
+        found[at] = e;
+    }
+
+    free(shared);
+    free(candidates);
+    return result_count;
+}
+
+void w24_fuzzy_close(struct w24_fuzzy_index *index)
+{
+    if (index == NULL)
+        return;
+    munmap(index->map, index->map_size);
+    free(index);
+}
@@ -0,0 +1,40 @@
+/*
+ * w24fuzzy.h: fuzzy file name lookup over a trigram index
+ *
+ * The index lists every non-directory under a root (hidden ones included, like w24fn) with the
+ * trigrams of its lowercased name, padded so that short names have some: "ab" gives "\0\0a",
+ * "\0ab" and "ab\0". It is written to a file once and mapped read-only by every request, so
+ * forked handlers, threads and restarts all share it; it is rebuilt when it gets older than the
+ * allowed age.
+ *
+ * A lookup counts, per name, the distinct trigrams it shares with the query. One edit changes at
+ * most three trigrams, so a name within edit distance d shares at least (query trigrams - 3d) of
+ * them and only those names are compared. The edit distance (Levenshtein, ASCII case ignored) is
+ * computed with Myers' bit-parallel algorithm, one 64-bit word per name character, which is why
+ * queries are limited to W24_FUZZY_MAX_QUERY bytes. The k closest names are returned, nearest
+ * first, ties broken by name and then path.
+ */
+
+#ifndef W24FUZZY_H
+#define W24FUZZY_H
+
+#include <stddef.h>
+
+#define W24_FUZZY_MAX_QUERY 64
+#define W24_FUZZY_MAX_RESULTS 50
+#define W24_FUZZY_MAX_AGE 60 // seconds an index is used before it is rebuilt
+
+struct w24_fuzzy_index;
+
+struct w24_fuzzy_result {
+    const char *path; // inside the index mapping: valid until w24_fuzzy_close()
+    int distance;
+};
+
+struct w24_fuzzy_index *w24_fuzzy_open(const char *root, const char *index_path, int max_age);
+size_t w24_fuzzy_entries(const struct w24_fuzzy_index *index);
+int w24_fuzzy_search(const struct w24_fuzzy_index *index, const char *query, int max_distance, struct w24_fuzzy_result results[], int k);
+int w24_fuzzy_default_distance(size_t query_length);
+void w24_fuzzy_close(struct w24_fuzzy_index *index);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * w24gen.c: generation number of the served tree (see w24gen.h)
+ */
+
+#include "w24gen.h"
+#include "w24log.h"
+#include "w24scan.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+struct w24_gen {
+    uint64_t epoch; // random, drawn at startup
+    uint64_t counter; // bumped after every batch of events
+    int tracked; // the watches are in place
+};
+
+static struct w24_gen *gen = NULL;
+static int inotify_fd = -1;
+static char gen_root[4096];
+static char **watch_paths; // directory of each watch descriptor, to watch the directories created in it
+static size_t watch_capacity;
+static size_t watch_count;
+
+/*
+ * add_watch: Watches one directory; a scanner callback
+ *
+ * Return Value:
+ * - int: 0 to go on, 1 to stop the scan when the watch limit is reached or memory runs out
+ */
+static int add_watch(const struct w24_scan_entry *entry, void *arg)
+{
+    (void)arg;
+
+    int wd = inotify_add_watch(inotify_fd, entry->path, WATCH_MASK);
+    if (wd == -1)
+        return errno == ENOSPC || errno == ENOMEM; // a directory that vanished meanwhile is skipped
+
+    if ((size_t)wd >= watch_capacity) {
+        size_t capacity = (size_t)wd * 2 + 64;
+        char **grown = realloc(watch_paths, capacity * sizeof(*grown));
+        if (grown == NULL)
+            return 1;
+        memset(grown + watch_capacity, 0, (capacity - watch_capacity) * sizeof(*grown));
+        watch_paths = grown;
+        watch_capacity = capacity;
+    }
+    if (watch_paths[wd] == NULL)
+        watch_count++;
+    free(watch_paths[wd]); // watched again: the directory was renamed
+    watch_paths[wd] = strdup(entry->path);
+    return watch_paths[wd] == NULL;
+}
+
+/*
+ * watch_tree: Watches every directory of a tree, hidden ones included
+ *
+ * Return Value:
+ * - int: 0 on success, 1 if the watch limit was reached, -1 if the tree cannot be read
+ *
+ * Explanation:
+ * Watching a directory that is already watched only refreshes its path, so a tree is simply watched
+ * again when directories were renamed or events were lost.
+ */
+static int watch_tree(const char *root)
+{
+    return w24_scan(root, W24_SCAN_DIRECTORIES | W24_SCAN_HIDDEN, NULL, add_watch, NULL);
+}
+
+static void untrack(const char *reason)
+{
+    __atomic_store_n(&gen->tracked, 0, __ATOMIC_RELEASE);
+    w24_log(W24_LOG_WARN, "Tree changes not tracked, conditional requests are answered in full: %s", reason);
+}
+
+/*
+ * watch_changes: Watcher thread; bumps the generation after every batch of events
+ *
+ * Explanation:
+ * A directory created in (or moved into) a watched one is watched with its whole subtree before the
+ * generation is bumped, so whatever was created in it meanwhile is covered by the new generation.
+ * A renamed directory keeps its watch under the old path, so the tree is watched again to refresh the
+ * paths; so it is after an event queue overflow, which may have hidden created directories.
+ */
+static void *watch_changes(void *arg)
+{
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    (void)arg;
+
+    int ret = watch_tree(gen_root);
+    if (ret != 0) {
+        untrack(ret == 1 ? "inotify watch limit reached" : strerror(errno));
+        return NULL;
+    }
+    __atomic_store_n(&gen->tracked, 1, __ATOMIC_RELEASE);
+    w24_log(W24_LOG_INFO, "Tracking changes under %s (%zu directories)", gen_root, watch_count);
+
+    while (1) {
+        ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+        int rescan = 0;
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            untrack(n == 0 ? "end of inotify events" : strerror(errno));
+            return NULL;
+        }
+
+        for (char *p = buffer; p < buffer + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+
+            p += sizeof(*event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                rescan = 1;
+            }
+            else if (event->mask & IN_IGNORED) {
+                if (event->wd >= 0 && (size_t)event->wd < watch_capacity && watch_paths[event->wd] != NULL) {
+                    free(watch_paths[event->wd]);
+                    watch_paths[event->wd] = NULL;
+                    watch_count--;
+                }
+            }
+            else if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM)) {
+                rescan = 1;
+            }
+            else if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 0 &&
+                     event->wd >= 0 && (size_t)event->wd < watch_capacity && watch_paths[event->wd] != NULL) {
+                char path[4096];
+
+                snprintf(path, sizeof(path), "%s/%s", watch_paths[event->wd], event->name);
+                if (watch_tree(path) == 1) { // -1: already gone again
+                    untrack("inotify watch limit reached");
+                    return NULL;
+                }
+            }
+        }
+        if (rescan && (ret = watch_tree(gen_root)) != 0) {
+            untrack(ret == 1 ? "inotify watch limit reached" : strerror(errno));
+            return NULL;
+        }
+        __atomic_add_fetch(&gen->counter, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * w24_gen_init: Maps the shared generation and starts watching the tree
+ *
+ * Parameters:
+ * - root: The served tree
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the tree cannot be watched at all (the token then stays "-")
+ *
+ * Explanation:
+ * Call once in the process that outlives the connection handlers, before the first fork: the watcher
+ * is a thread of that process. The directories are watched on the watcher thread, so a large tree does
+ * not delay the startup; until then the token is "-".
+ */
+int w24_gen_init(const char *root)
+{
+    pthread_t thread;
+    void *p = mmap(NULL, sizeof(struct w24_gen), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return -1;
+    gen = p; // zero filled by mmap: not tracked
+    if (getrandom(&gen->epoch, sizeof(gen->epoch), 0) != sizeof(gen->epoch))
+        gen->epoch = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+
+    snprintf(gen_root, sizeof(gen_root), "%s", root);
+    if ((inotify_fd = inotify_init1(IN_CLOEXEC)) == -1)
+        return -1;
+    if (pthread_create(&thread, NULL, watch_changes, NULL) != 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/*
+ * w24_gen_token: Reads the current generation of the tree
+ *
+ * Parameters:
+ * - token, size: Receive "<epoch>.<counter>", or "-" while changes are not tracked
+ */
+void w24_gen_token(char *token, size_t size)
+{
+    if (gen == NULL || !__atomic_load_n(&gen->tracked, __ATOMIC_ACQUIRE)) {
+        snprintf(token, size, "-");
+        return;
+    }
+    snprintf(token, size, "%016llx.%llu", (unsigned long long)gen->epoch,
+             (unsigned long long)__atomic_load_n(&gen->counter, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,31 @@
+/*
+ * w24gen.h: generation number of the served tree, for conditional requests
+ *
+ * A watcher thread puts an inotify watch on every directory under the root and bumps a counter
+ * whenever anything in them is created, deleted, renamed, written or has its attributes changed.
+ * The counter lives in an anonymous shared mapping created before the first fork, like the
+ * metrics, so every connection handler reads the same value. Together with a random number drawn
+ * at startup it forms the token "<epoch>.<counter>": a token from another node, or from before a
+ * restart, never matches.
+ *
+ * A client that cached a reply under a token sends "ifgen <token> <command>"; while the token is
+ * still current nothing the reply depends on has changed, and the server answers with a NOTMOD
+ * frame instead of scanning the tree again. The token is read before the scan, so a change during
+ * it makes the token stale. A change is only seen once the watcher has read its event, typically
+ * within a millisecond.
+ *
+ * Until the watches are in place, or when they cannot be (the inotify watch limit, see
+ * /proc/sys/fs/inotify/max_user_watches), the token is "-", which matches nothing.
+ */
+
+#ifndef W24GEN_H
+#define W24GEN_H
+
+#include <stddef.h>
+
+#define W24_GEN_TOKEN_MAX 48
+
+int w24_gen_init(const char *root);
+void w24_gen_token(char *token, size_t size);
+
+#endif
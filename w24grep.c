@@ -0,0 +1,189 @@
+/*
+ * w24grep.c: searching file contents for a string or a regular expression (see w24grep.h)
+ */
+
+#define _GNU_SOURCE // memrchr
+
+#include "w24grep.h"
+#include "w24match.h"
+#include "w24pattern.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct w24_grep {
+    struct w24_pattern *pattern; // W24_GREP_REGEX
+    struct w24_match literal; // the fixed string, or a literal every regular expression match contains
+    int has_literal;
+};
+
+/*
+ * w24_grep_compile: compiles a content pattern
+ *
+ * Parameters:
+ * - text: a fixed string (at most W24_MATCH_MAX_LENGTH bytes) or, with W24_GREP_REGEX, an extended
+ *   regular expression (w24pattern.h), matched anywhere in a line unless anchored with ^ or $
+ * - flags: W24_GREP_NOCASE, W24_GREP_REGEX
+ * - error, error_size: receive a message when the pattern is rejected (may be NULL)
+ *
+ * Return Value:
+ * - struct w24_grep *: the compiled pattern, NULL if it is invalid
+ */
+struct w24_grep *w24_grep_compile(const char *text, unsigned flags, char *error, size_t error_size)
+{
+    struct w24_grep *grep = calloc(1, sizeof(*grep));
+    unsigned match_flags = (flags & W24_GREP_NOCASE) ? W24_MATCH_NOCASE : 0;
+
+    if (grep == NULL) {
+        if (error != NULL)
+            snprintf(error, error_size, "out of memory");
+        return NULL;
+    }
+
+    if (flags & W24_GREP_REGEX) {
+        char literal[W24_MATCH_MAX_LENGTH + 1];
+
+        grep->pattern = w24_pattern_compile(text, W24_PATTERN_REGEX, (flags & W24_GREP_NOCASE) ? W24_PATTERN_NOCASE : 0, error, error_size);
+        if (grep->pattern == NULL) {
+            free(grep);
+            return NULL;
+        }
+        // any part of the required literal is required too
+        snprintf(literal, sizeof(literal), "%s", w24_pattern_literal(grep->pattern));
+        grep->has_literal = literal[0] != '\0' && w24_match_substring_init(&grep->literal, literal, 0) == 0;
+    }
+    else if (w24_match_substring_init(&grep->literal, text, match_flags) == 0) {
+        grep->has_literal = 1;
+    }
+    else {
+        if (error != NULL)
+            snprintf(error, error_size, text[0] == '\0' ? "empty pattern" : "pattern too long");
+        free(grep);
+        return NULL;
+    }
+    return grep;
+}
+
+static unsigned long count_lines(const char *from, const char *to)
+{
+    unsigned long count = 0;
+
+    while (from < to && (from = memchr(from, '\n', to - from)) != NULL) {
+        count++;
+        from++;
+    }
+    return count;
+}
+
+// searches whole lines; *line is the number of the first one. Returns the matching lines, *stop is set if hit asked to stop
+static long search_block(const struct w24_grep *grep, const char *block, size_t length, unsigned long *line, int binary, int *stop, w24_grep_fn hit, void *arg)
+{
+    const char *p = block, *end = block + length, *counted = block;
+    long hits = 0;
+
+    while (p < end) {
+        const char *line_start = p, *line_end;
+
+        if (grep->has_literal) {
+            const char *at = w24_match_find(&grep->literal, p, end - p);
+            if (at == NULL)
+                break;
+            line_start = memrchr(p, '\n', at - p);
+            line_start = line_start != NULL ? line_start + 1 : p;
+        }
+        line_end = memchr(line_start, '\n', end - line_start);
+        if (line_end == NULL)
+            line_end = end;
+        p = line_end + 1;
+
+        if (grep->pattern != NULL && !w24_pattern_match(grep->pattern, line_start, line_end - line_start))
+            continue;
+
+        hits++;
+        if (binary)
+            return hits; // one match is all a binary file reports
+        *line += count_lines(counted, line_start);
+        counted = line_start;
+        if (hit(*line, line_start, line_end - line_start, arg) != 0) {
+            *stop = 1;
+            return hits;
+        }
+    }
+    *line += count_lines(counted, end);
+    return hits;
+}
+
+/*
+ * w24_grep_fd: searches an open file
+ *
+ * Parameters:
+ * - grep: the compiled pattern
+ * - fd: the file, read from its current offset to the end
+ * - buffer: W24_GREP_BLOCK_SIZE bytes of scratch space, e.g. one per thread
+ * - binary: receives 1 if the file looks binary (then hit is never called)
+ * - hit, arg: called for every matching line, in order
+ *
+ * Return Value:
+ * - int: the number of matching lines (at most 1 for a binary file, or up to the one where hit
+ *   stopped the search), -1 with errno set if the file could not be read
+ */
+int w24_grep_fd(const struct w24_grep *grep, int fd, char *buffer, int *binary, w24_grep_fn hit, void *arg)
+{
+    unsigned long line = 1;
+    size_t keep = 0; // start of a line carried over from the previous block
+    int hits = 0, first = 1, stop = 0;
+
+    *binary = 0;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (;;) {
+        ssize_t n = read(fd, buffer + keep, W24_GREP_BLOCK_SIZE - keep);
+        size_t length, end;
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        length = keep + (size_t)n;
+        if (length == 0)
+            break;
+        if (first) {
+            *binary = memchr(buffer, '\0', length) != NULL;
+            first = 0;
+        }
+
+        // search up to the last whole line; the rest waits for the next block, unless the file ended or the block is full
+        end = length;
+        if (n > 0) {
+            const char *newline = memrchr(buffer, '\n', length);
+            if (newline != NULL)
+                end = (size_t)(newline - buffer) + 1;
+            else if (length < W24_GREP_BLOCK_SIZE) {
+                keep = length;
+                continue;
+            }
+        }
+
+        hits += (int)search_block(grep, buffer, end, &line, *binary, &stop, hit, arg);
+        if (stop || (*binary && hits > 0))
+            return hits;
+
+        memmove(buffer, buffer + end, length - end);
+        keep = length - end;
+        if (n == 0)
+            break;
+    }
+    return hits;
+}
+
+void w24_grep_free(struct w24_grep *grep)
+{
+    if (grep == NULL)
+        return;
+    w24_pattern_free(grep->pattern);
+    free(grep);
+}
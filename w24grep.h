@@ -0,0 +1,34 @@
+/*
+ * w24grep.h: searching file contents for a string or a regular expression, line by line
+ *
+ * Files are read in W24_GREP_BLOCK_SIZE blocks cut at the last newline, so a line is never split
+ * across two searches (lines longer than a block are searched in block-sized pieces). Within a
+ * block the kernels of w24match look for a literal: the string itself, or for a regular
+ * expression the longest literal every match must contain (w24pattern). Only the lines holding
+ * that literal are run through the regular expression's DFA; without a literal every line is.
+ * Line numbers are counted only up to the lines that match.
+ *
+ * A file whose first block contains a NUL byte is binary: it is searched for a match but no
+ * lines are reported.
+ */
+
+#ifndef W24GREP_H
+#define W24GREP_H
+
+#include <stddef.h>
+
+#define W24_GREP_BLOCK_SIZE (1024 * 1024)
+
+#define W24_GREP_NOCASE 0x1 // ASCII letters match either case
+#define W24_GREP_REGEX 0x2 // the pattern is an extended regular expression, not a fixed string
+
+struct w24_grep;
+
+// called for every matching line (without its newline); returns 0 to continue, anything else to stop
+typedef int (*w24_grep_fn)(unsigned long line_number, const char *line, size_t length, void *arg);
+
+struct w24_grep *w24_grep_compile(const char *text, unsigned flags, char *error, size_t error_size);
+int w24_grep_fd(const struct w24_grep *grep, int fd, char *buffer, int *binary, w24_grep_fn hit, void *arg);
+void w24_grep_free(struct w24_grep *grep);
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * w24io.c: I/O engine for accepting connections and stat'ing files in batches (see w24io.h)
+ */
+
+#define _GNU_SOURCE // accept4, statx
+
+#include "w24io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// a minimal io_uring: one submission and one completion queue mapped from the kernel
+struct ring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+    unsigned pending; // prepared but not yet submitted
+};
+
+struct w24_io_acceptor {
+    int listen_fd;
+    int epoll_fd; // epoll engine
+    struct ring ring; // uring engine
+    struct sockaddr_in addrs[W24_IO_ACCEPT_DEPTH]; // one accept in flight per slot
+    socklen_t addr_lens[W24_IO_ACCEPT_DEPTH];
+};
+
+static enum w24_io_engine engine = W24_IO_SYNC;
+
+// the ring of w24_io_statx_at(), set up by each thread on first use and kept until it exits
+static __thread struct ring statx_ring = { .fd = -1 };
+static __thread pid_t statx_ring_pid; // process that set it up: a forked child sets up its own
+static __thread int statx_ring_failed;
+static pthread_key_t statx_ring_key; // its destructor frees the ring when the thread exits
+static pthread_once_t statx_ring_once = PTHREAD_ONCE_INIT;
+
+static int ring_init(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd == -1)
+        return -1;
+
+    r->entries = p.sq_entries;
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_size > r->sq_map_size)
+            r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = r->sq_map_size;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map :
+        mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        int saved = errno;
+        if (r->sq_map != MAP_FAILED)
+            munmap(r->sq_map, r->sq_map_size);
+        if (r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+            munmap(r->cq_map, r->cq_map_size);
+        if (r->sqes != MAP_FAILED)
+            munmap(r->sqes, r->sqes_size);
+        close(r->fd);
+        r->fd = -1;
+        errno = saved;
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)((char *)r->sq_map + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_map + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_map + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_map + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_map + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_map + p.cq_off.cqes);
+    return 0;
+}
+
+static void ring_free(struct ring *r)
+{
+    if (r->fd == -1)
+        return;
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_size);
+    munmap(r->sq_map, r->sq_map_size);
+    close(r->fd);
+    r->fd = -1;
+}
+
+// next free submission entry, zeroed; NULL when the queue is full
+static struct io_uring_sqe *ring_sqe(struct ring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail + r->pending;
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= r->entries)
+        return NULL;
+    sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+    r->pending++;
+    return sqe;
+}
+
+// publishes the prepared entries and waits for at least wait_nr completions
+static int ring_submit(struct ring *r, unsigned wait_nr)
+{
+    unsigned submit = r->pending;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, *r->sq_tail + submit, __ATOMIC_RELEASE);
+    r->pending = 0;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, r->fd, submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR && (submit = 0, 1)); // a retry only waits: the entries were consumed
+    return ret == -1 ? -1 : 0;
+}
+
+// takes one completion if any is ready
+static int ring_reap(struct ring *r, struct io_uring_cqe *out)
+{
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    *out = r->cqes[head & *r->cq_mask];
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void queue_accept(struct w24_io_acceptor *a, int slot)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&a->ring);
+
+    a->addr_lens[slot] = sizeof(a->addrs[slot]);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = a->listen_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&a->addrs[slot];
+    sqe->addr2 = (uint64_t)(uintptr_t)&a->addr_lens[slot];
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)slot;
+}
+
+/*
+ * w24_io_init: selects the engine; call once before creating acceptors
+ *
+ * Parameters:
+ * - engine: "uring", "epoll" or "sync"
+ *
+ * Return Value:
+ * - int: 0 on success, -1 for an unknown name (EINVAL); if io_uring is unavailable the epoll
+ *   engine is selected instead, which w24_io_engine() reports
+ */
+int w24_io_init(const char *name)
+{
+    if (strcmp(name, "sync") == 0) {
+        engine = W24_IO_SYNC;
+    }
+    else if (strcmp(name, "epoll") == 0) {
+        engine = W24_IO_EPOLL;
+    }
+    else if (strcmp(name, "uring") == 0) {
+        struct ring probe;
+        engine = ring_init(&probe, 2) == 0 ? W24_IO_URING : W24_IO_EPOLL; // ENOSYS, or EPERM when disabled by sysctl
+        ring_free(&probe);
+    }
+    else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+enum w24_io_engine w24_io_engine(void)
+{
+    return engine;
+}
+
+const char *w24_io_engine_name(void)
+{
+    return engine == W24_IO_URING ? "uring" : engine == W24_IO_EPOLL ? "epoll" : "sync";
+}
+
+/*
+ * w24_io_acceptor_new: prepares a listening socket for w24_io_accept()
+ *
+ * Return Value:
+ * - struct w24_io_acceptor *: the acceptor, or NULL with errno set
+ *
+ * Explanation:
+ * uring queues W24_IO_ACCEPT_DEPTH accepts right away; epoll makes the socket non-blocking.
+ * The listening socket stays owned by the caller.
+ */
+struct w24_io_acceptor *w24_io_acceptor_new(int listen_fd)
+{
+    struct w24_io_acceptor *a = calloc(1, sizeof(*a));
+
+    if (a == NULL)
+        return NULL;
+    a->listen_fd = listen_fd;
+    a->epoll_fd = -1;
+    a->ring.fd = -1;
+
+    if (engine == W24_IO_URING) {
+        if (ring_init(&a->ring, W24_IO_ACCEPT_DEPTH) == -1) {
+            free(a);
+            return NULL;
+        }
+        for (int slot = 0; slot < W24_IO_ACCEPT_DEPTH; slot++)
+            queue_accept(a, slot);
+    }
+    else if (engine == W24_IO_EPOLL) {
+        struct epoll_event ev = { .events = EPOLLIN };
+        int flags = fcntl(listen_fd, F_GETFL);
+
+        if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+            (a->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+            epoll_ctl(a->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+            int saved = errno;
+            w24_io_acceptor_free(a);
+            errno = saved;
+            return NULL;
+        }
+    }
+    return a;
+}
+
+/*
+ * w24_io_accept: waits for connections and returns every one that is ready
+ *
+ * Parameters:
+ * - acceptor: from w24_io_acceptor_new()
+ * - fds: receives the accepted sockets (close-on-exec)
+ * - addrs: receives the peer addresses
+ * - max: capacity of fds and addrs
+ *
+ * Return Value:
+ * - int: number of connections accepted (at least 1), or -1 with errno set when none could be
+ *   accepted, e.g. EMFILE, or EINTR when the wait ended without one; the caller calls again
+ */
+int w24_io_accept(struct w24_io_acceptor *a, int fds[], struct sockaddr_in addrs[], int max)
+{
+    int count = 0;
+    int error = 0;
+
+    if (engine == W24_IO_URING) {
+        struct io_uring_cqe cqe;
+
+        if (ring_submit(&a->ring, 1) == -1) // resubmits the slots drained last time, then sleeps
+            return -1;
+        while (count < max && ring_reap(&a->ring, &cqe)) {
+            int slot = (int)cqe.user_data;
+
+            if (cqe.res >= 0) {
+                fds[count] = cqe.res;
+                addrs[count] = a->addrs[slot];
+                count++;
+            }
+            else {
+                error = -cqe.res;
+            }
+            queue_accept(a, slot); // submitted with the next wait
+        }
+    }
+    else if (engine == W24_IO_EPOLL) {
+        struct epoll_event ev;
+
+        if (epoll_wait(a->epoll_fd, &ev, 1, -1) == -1)
+            return -1;
+        while (count < max) {
+            socklen_t len = sizeof(addrs[count]);
+            int fd = accept4(a->listen_fd, (struct sockaddr *)&addrs[count], &len, SOCK_CLOEXEC);
+
+            if (fd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    error = errno;
+                break;
+            }
+            // accepted sockets inherit nothing from the non-blocking listener on Linux
+            fds[count++] = fd;
+        }
+    }
+    else {
+        socklen_t len = sizeof(addrs[0]);
+        int fd = accept4(a->listen_fd, (struct sockaddr *)&addrs[0], &len, SOCK_CLOEXEC);
+
+        if (fd == -1)
+            return -1;
+        fds[count++] = fd;
+    }
+
+    if (count == 0) {
+        // no error: woken without a connection, as when a signal cut the wait short after the
+        // resubmission went through (io_uring_enter() then reports the submission, not EINTR)
+        errno = error != 0 ? error : EINTR;
+        return -1;
+    }
+    return count;
+}
+
+/*
+ * w24_io_acceptor_free: releases the acceptor's ring or epoll instance, but not the listening socket.
+ * A forked connection handler calls it to drop its copies.
+ */
+void w24_io_acceptor_free(struct w24_io_acceptor *a)
+{
+    if (a == NULL)
+        return;
+    ring_free(&a->ring);
+    if (a->epoll_fd != -1)
+        close(a->epoll_fd);
+    free(a);
+}
+
+static void statx_ring_release(void *ring)
+{
+    ring_free(ring);
+}
+
+static void statx_ring_key_create(void)
+{
+    pthread_key_create(&statx_ring_key, statx_ring_release);
+}
+
+// the calling thread's statx ring, NULL if io_uring is not available
+static struct ring *statx_ring_get(void)
+{
+    if (statx_ring.fd != -1 && statx_ring_pid != getpid())
+        ring_free(&statx_ring); // inherited across fork: the parent goes on using it, the child gets its own
+    if (statx_ring.fd == -1) {
+        if (statx_ring_failed || ring_init(&statx_ring, W24_IO_STATX_BATCH) == -1) {
+            statx_ring_failed = 1;
+            return NULL;
+        }
+        statx_ring_pid = getpid();
+        pthread_once(&statx_ring_once, statx_ring_key_create);
+        pthread_setspecific(statx_ring_key, &statx_ring);
+    }
+    return &statx_ring;
+}
+
+/*
+ * w24_io_statx_at: stats a list of names relative to a directory
+ *
+ * Parameters:
+ * - dirfd: directory the names are relative to, or AT_FDCWD
+ * - names: files to stat
+ * - count: number of names
+ * - mask: STATX_* fields wanted
+ * - flags: AT_* flags for statx(), e.g. AT_SYMLINK_NOFOLLOW
+ * - results: receives the statx of each name
+ * - status: receives 0 for each name stat'ed, or the errno of its failure
+ *
+ * Return Value:
+ * - int: 0
+ *
+ * Explanation:
+ * With the uring engine up to W24_IO_STATX_BATCH statx requests go to the kernel in one
+ * io_uring_enter(), instead of one system call per file. Each thread sets up its ring once and keeps
+ * it until it exits, so a tree walk does not pay a ring setup and teardown per directory; a short
+ * list is stat'ed directly. A ring that failed mid-batch is dropped and set up again on the next call.
+ */
+int w24_io_statx_at(int dirfd, const char *const names[], int count, unsigned mask, int flags, struct statx results[], int status[])
+{
+    struct ring *ring;
+    int done = 0;
+
+    if (engine == W24_IO_URING && count > 8 && (ring = statx_ring_get()) != NULL) {
+        while (done < count) {
+            int batch = count - done < (int)ring->entries ? count - done : (int)ring->entries;
+            struct io_uring_cqe cqe;
+            int reaped = 0;
+
+            for (int i = 0; i < batch; i++) {
+                struct io_uring_sqe *sqe = ring_sqe(ring);
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = dirfd;
+                sqe->addr = (uint64_t)(uintptr_t)names[done + i];
+                sqe->len = mask;
+                sqe->off = (uint64_t)(uintptr_t)&results[done + i];
+                sqe->statx_flags = (uint32_t)flags;
+                sqe->user_data = (uint64_t)(done + i);
+            }
+            if (ring_submit(ring, (unsigned)batch) == -1) {
+                ring_free(ring); // the remaining files are stat'ed one by one below
+                break;
+            }
+            while (reaped < batch) {
+                if (!ring_reap(ring, &cqe)) {
+                    if (ring_submit(ring, 1) == -1)
+                        break;
+                    continue;
+                }
+                status[cqe.user_data] = cqe.res < 0 ? -cqe.res : 0;
+                reaped++;
+            }
+            if (reaped < batch) {
+                ring_free(ring); // completions still due must not land in a later call's results
+                break;
+            }
+            done += batch;
+        }
+    }
+
+    for (; done < count; done++)
+        status[done] = statx(dirfd, names[done], flags, mask, &results[done]) == 0 ? 0 : errno;
+    return 0;
+}
+
+/*
+ * w24_io_statx_many: stats a list of paths, following symbolic links as stat() does, for their
+ * type, mode, size and mtime (see w24_io_statx_at)
+ */
+int w24_io_statx_many(const char *const paths[], int count, struct statx results[], int status[])
+{
+    return w24_io_statx_at(AT_FDCWD, paths, count, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, 0, results, status);
+}
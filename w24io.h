@@ -0,0 +1,42 @@
+/*
+ * w24io.h: I/O engine for accepting connections and stat'ing files in batches
+ *
+ * The server can drive its batched I/O with one of three engines, chosen at runtime (--io):
+ * - uring: io_uring through the raw system calls (no liburing). An acceptor keeps
+ *   W24_IO_ACCEPT_DEPTH accepts queued on its listening socket and collects every connection
+ *   that completed with a single io_uring_enter(); a list of files (or the entries of a directory
+ *   being scanned) is stat'ed by submitting one statx per file in a single call.
+ * - epoll: the listening socket is non-blocking; the acceptor waits in epoll_wait() and then
+ *   accepts until the queue is empty. Files are stat'ed one statx() at a time.
+ * - sync: blocking accept() of one connection at a time and one statx() per file, as before.
+ * uring is the default and falls back to epoll when the kernel does not allow io_uring.
+ *
+ * Requests themselves are still served with blocking recv()/send() on the connection's own
+ * thread or process, where there is nothing to batch.
+ */
+
+#ifndef W24IO_H
+#define W24IO_H
+
+#include <netinet/in.h>
+#include <sys/stat.h>
+
+#define W24_IO_ACCEPT_DEPTH 32 // accepts kept queued per acceptor (uring)
+#define W24_IO_STATX_BATCH 256 // statx requests submitted per io_uring_enter()
+
+enum w24_io_engine { W24_IO_SYNC, W24_IO_EPOLL, W24_IO_URING };
+
+struct w24_io_acceptor;
+
+int w24_io_init(const char *engine);
+enum w24_io_engine w24_io_engine(void);
+const char *w24_io_engine_name(void);
+
+struct w24_io_acceptor *w24_io_acceptor_new(int listen_fd);
+int w24_io_accept(struct w24_io_acceptor *acceptor, int fds[], struct sockaddr_in addrs[], int max);
+void w24_io_acceptor_free(struct w24_io_acceptor *acceptor);
+
+int w24_io_statx_at(int dirfd, const char *const names[], int count, unsigned mask, int flags, struct statx results[], int status[]);
+int w24_io_statx_many(const char *const paths[], int count, struct statx results[], int status[]);
+
+#endif
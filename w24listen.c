@@ -0,0 +1,200 @@
+/*
+ * w24listen.c: listening sockets for one or several acceptors (see w24listen.h)
+ */
+
+#define _GNU_SOURCE // CPU_SET, sched_setaffinity
+
+#include "w24listen.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/*
+ * w24_listen_open: creates a listening TCP socket
+ *
+ * Parameters:
+ * - address: IPv4 address to bind to
+ * - port: port to bind to
+ * - reuseport: set SO_REUSEPORT so several sockets can share the port
+ *
+ * Return Value:
+ * - int: the socket, or -1 with errno set (EINVAL for an invalid address)
+ */
+int w24_listen_open(const char *address, int port, int reuseport)
+{
+    struct sockaddr_in addr;
+    int fd;
+    int on = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+
+    // SO_REUSEADDR allows a restart while old connections are in TIME_WAIT
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, W24_LISTEN_BACKLOG) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * w24_listen_steer_by_cpu: steers connections of a SO_REUSEPORT group by receiving CPU
+ *
+ * Parameters:
+ * - fd: any socket of the group
+ * - group_size: number of sockets in the group
+ *
+ * Return Value:
+ * - int: 0 on success, -1 with errno set
+ *
+ * Explanation:
+ * The program returns the index of the socket to use, in the order the sockets were bound:
+ * the CPU that received the connection modulo the group size. Since acceptor i is pinned to the
+ * i-th CPU, a connection handled by CPU i's network stack is accepted by the acceptor on CPU i.
+ */
+int w24_listen_steer_by_cpu(int fd, int group_size)
+{
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }, // A = current CPU
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned int)group_size }, // A %= group size
+        { BPF_RET | BPF_A, 0, 0, 0 }, // socket index
+    };
+    struct sock_fprog program = { sizeof(code) / sizeof(code[0]), code };
+
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+}
+
+/*
+ * w24_listen_pin_to_cpu: pins the calling thread to one of the CPUs it may run on
+ *
+ * Parameters:
+ * - index: acceptor index; acceptor i goes to the i-th allowed CPU, wrapping around
+ *
+ * Return Value:
+ * - int: the CPU pinned to, or -1 with errno set
+ */
+int w24_listen_pin_to_cpu(int index)
+{
+    cpu_set_t allowed, one;
+    int count, cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        return -1;
+    count = CPU_COUNT(&allowed);
+    if (count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    index %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+            break;
+    }
+
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) == -1)
+        return -1;
+    return cpu;
+}
+
+/*
+ * w24_listen_keepalive: turns TCP keepalive on for an accepted connection
+ *
+ * Parameters:
+ * - fd: the connection
+ * - idle, interval, count: seconds of silence before the first probe, seconds between probes and
+ *   unanswered probes before the connection is reset; idle 0 leaves keepalive off
+ *
+ * Return Value:
+ * - int: 0 on success, -1 with errno set
+ *
+ * Explanation:
+ * TCP_USER_TIMEOUT is set to the same bound, so a peer that stops acknowledging a reply is given
+ * up on as soon as a silent one is, instead of after the kernel's retransmissions (about 15 minutes).
+ */
+int w24_listen_keepalive(int fd, int idle, int interval, int count)
+{
+    int on = 1;
+    unsigned int user_timeout = (unsigned int)(idle + interval * count) * 1000;
+
+    if (idle <= 0)
+        return 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) == -1)
+        return -1;
+    return 0;
+}
+
+/*
+ * w24_listen_no_delay: sends every write on a connection at once (TCP_NODELAY)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 with errno set
+ *
+ * Explanation:
+ * Replies are written as whole frames, often followed by another write (an END frame, the next
+ * chunk), so Nagle's algorithm only ever held a short write back until the client's delayed ACK,
+ * some 40 ms, and coalesced nothing the frame writers do not already (see w24proto.h).
+ */
+int w24_listen_no_delay(int fd)
+{
+    int on = 1;
+
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/*
+ * w24_listen_idle_timeout: bounds every blocking receive and send on a connection
+ *
+ * Parameters:
+ * - fd: the connection
+ * - seconds: the bound, 0 for none
+ *
+ * Return Value:
+ * - int: 0 on success, -1 with errno set
+ *
+ * Explanation:
+ * A recv() or send() that makes no progress for that long fails with EAGAIN, so a handler notices a
+ * client that stopped sending commands or stopped reading its reply.
+ */
+int w24_listen_idle_timeout(int fd, int seconds)
+{
+    struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+
+    if (seconds <= 0)
+        return 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * w24listen.h: listening sockets for one or several acceptors
+ *
+ * With a single acceptor the server listens on one socket, as it always did. With --acceptors N
+ * every acceptor (a thread in thread mode, a process in fork mode) gets its own socket bound to
+ * the same address with SO_REUSEPORT, so the kernel spreads incoming connections over N accept
+ * queues instead of funnelling them through one. Acceptor i is pinned to the i-th allowed CPU.
+ *
+ * Optionally a classic BPF program is attached to the group that picks the socket by the CPU
+ * the connection arrived on (SKF_AD_CPU modulo N), so a connection is accepted on the core that
+ * processed its packets and the accept path stays CPU-local.
+ *
+ * Accepted connections are watched for dead peers twice over: TCP keepalive probes a connection
+ * that carries nothing (a peer that lost power or its network never sends a FIN), and the idle
+ * timeout bounds how long a handler waits for the next command or for the client to take a
+ * reply. Clients that sit idle on purpose send heartbeats ("ping") well within the timeout.
+ *
+ * Accepted connections also have TCP_NODELAY, so no reply waits behind a client's delayed ACK.
+ */
+
+#ifndef W24LISTEN_H
+#define W24LISTEN_H
+
+#define W24_LISTEN_BACKLOG 100
+#define W24_LISTEN_MAX_ACCEPTORS 256
+#define W24_LISTEN_IDLE_TIMEOUT 300 // seconds without a command before a session is closed
+#define W24_LISTEN_KEEPALIVE_IDLE 60 // seconds of silence before the first keepalive probe
+#define W24_LISTEN_KEEPALIVE_INTERVAL 10 // seconds between probes
+#define W24_LISTEN_KEEPALIVE_COUNT 5 // unanswered probes before the connection is reset
+
+int w24_listen_open(const char *address, int port, int reuseport);
+int w24_listen_steer_by_cpu(int fd, int group_size);
+int w24_listen_pin_to_cpu(int index);
+int w24_listen_keepalive(int fd, int idle, int interval, int count);
+int w24_listen_idle_timeout(int fd, int seconds);
+int w24_listen_no_delay(int fd);
+
+#endif
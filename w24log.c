@@ -0,0 +1,445 @@
+/*
+ * w24log.c: asynchronous, buffered structured logging (see w24log.h)
+ */
+
+#define _GNU_SOURCE
+#include "w24log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#define W24_LOG_MAX_THREADS 64
+#define W24_LOG_OUT_BUFFER 65536
+#define W24_LOG_MAX_FORMATTED 2048 // worst case for one record after JSON escaping
+#define W24_LOG_FLUSH_INTERVAL_NS 5000000L // 5 ms between background drains
+
+struct w24_log_record {
+    uint64_t ts_ns;
+    uint32_t tid;
+    uint16_t level;
+    uint16_t len;
+    char msg[W24_LOG_MSG_MAX];
+};
+
+/*
+ * One ring per logging thread. The owning thread is the only producer (advances head),
+ * the flusher is the only consumer (advances tail), so no locks are needed on the hot path.
+ * head and tail live on separate cache lines to avoid false sharing between the two.
+ * A ring is given back when its thread exits and taken over by the next thread that logs;
+ * records it still holds keep the tid they were written with.
+ */
+struct w24_log_ring {
+    _Atomic uint64_t head;
+    char pad1[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char pad2[64 - sizeof(uint64_t)];
+    _Atomic int in_use; // owned by a live thread
+    uint32_t tid;
+    uint32_t sample_counter;
+    struct w24_log_record slots[W24_LOG_RING_SLOTS];
+};
+
+int w24_log_min_level = W24_LOG_INFO;
+
+static int log_format = W24_LOG_TEXT;
+static unsigned int log_sample = 1;
+static int log_fd = STDOUT_FILENO;
+static const char *log_component = "w24";
+static int log_initialized = 0;
+
+static _Atomic(struct w24_log_ring *) rings[W24_LOG_MAX_THREADS];
+static _Atomic int ring_count = 0;
+static _Atomic uint64_t dropped_records = 0;
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER; // serializes consumers, never taken by producers
+static char out_buffer[W24_LOG_OUT_BUFFER]; // guarded by drain_lock
+static volatile int flusher_needed = 0; // set when the flusher has to be (re)started, e.g. in a forked child
+
+static __thread struct w24_log_ring *thread_ring;
+static pthread_key_t ring_key; // its destructor gives the ring back when the thread exits
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+static const char *level_names_json[] = { "debug", "info", "warn", "error" };
+
+/*
+ * write_all: writes the whole buffer to the log descriptor, retrying on short writes and EINTR
+ */
+static void write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(log_fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return; // nothing sensible to do if the log sink is gone
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/*
+ * json_escape: copies src into dst escaping it as a JSON string body. Returns bytes written.
+ */
+static size_t json_escape(char *dst, const char *src, size_t len)
+{
+    size_t used = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)src[i];
+        if (c == '"' || c == '\\') {
+            dst[used++] = '\\';
+            dst[used++] = (char)c;
+        } else if (c == '\n') {
+            dst[used++] = '\\';
+            dst[used++] = 'n';
+        } else if (c < 0x20) {
+            used += (size_t)sprintf(dst + used, "\\u%04x", c);
+        } else {
+            dst[used++] = (char)c;
+        }
+    }
+    return used;
+}
+
+/*
+ * format_record: renders one record in the configured format into dst (at least W24_LOG_MAX_FORMATTED bytes)
+ *
+ * Return Value:
+ * - size_t: number of bytes written
+ */
+static size_t format_record(char *dst, const struct w24_log_record *rec)
+{
+    pid_t pid = getpid();
+
+    if (log_format == W24_LOG_BINARY) {
+        struct w24_log_binary_header hdr;
+        hdr.ts_ns = rec->ts_ns;
+        hdr.pid = (uint32_t)pid;
+        hdr.tid = rec->tid;
+        hdr.level = rec->level;
+        hdr.len = rec->len;
+        memcpy(dst, &hdr, sizeof(hdr));
+        memcpy(dst + sizeof(hdr), rec->msg, rec->len);
+        return sizeof(hdr) + rec->len;
+    }
+
+    time_t secs = (time_t)(rec->ts_ns / 1000000000ULL);
+    unsigned long micros = (unsigned long)((rec->ts_ns % 1000000000ULL) / 1000);
+    struct tm tm;
+    char when[32];
+    gmtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    size_t used;
+    if (log_format == W24_LOG_JSON) {
+        used = (size_t)sprintf(dst, "{\"ts\":\"%s.%06luZ\",\"level\":\"%s\",\"component\":\"%s\",\"pid\":%d,\"tid\":%u,\"msg\":\"",
+                               when, micros, level_names_json[rec->level], log_component, (int)pid, rec->tid);
+        used += json_escape(dst + used, rec->msg, rec->len);
+        memcpy(dst + used, "\"}\n", 3);
+        return used + 3;
+    }
+
+    used = (size_t)sprintf(dst, "%s.%06luZ %-5s %s[%d/%u] ", when, micros, level_names[rec->level], log_component, (int)pid, rec->tid);
+    memcpy(dst + used, rec->msg, rec->len);
+    used += rec->len;
+    dst[used++] = '\n';
+    return used;
+}
+
+/*
+ * drain_locked: moves every buffered record from every ring to the log sink. Caller holds drain_lock.
+ */
+static void drain_locked(void)
+{
+    size_t used = 0;
+    int count = atomic_load(&ring_count);
+    if (count > W24_LOG_MAX_THREADS)
+        count = W24_LOG_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        struct w24_log_ring *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (ring == NULL)
+            continue;
+
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        while (tail != head) {
+            if (used + W24_LOG_MAX_FORMATTED > sizeof(out_buffer)) {
+                write_all(out_buffer, used);
+                used = 0;
+            }
+            used += format_record(out_buffer + used, &ring->slots[tail & (W24_LOG_RING_SLOTS - 1)]);
+            tail++;
+        }
+
+        // hand the slots back to the producer only after they have been formatted
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    if (used > 0)
+        write_all(out_buffer, used);
+}
+
+/*
+ * flusher_main: background thread draining all rings every W24_LOG_FLUSH_INTERVAL_NS
+ */
+static void *flusher_main(void *arg)
+{
+    struct timespec interval = { 0, W24_LOG_FLUSH_INTERVAL_NS };
+    (void)arg;
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&drain_lock);
+        drain_locked();
+        pthread_mutex_unlock(&drain_lock);
+    }
+    return NULL;
+}
+
+static void start_flusher(void)
+{
+    pthread_t flusher;
+
+    flusher_needed = 0;
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+        perror("Error creating log flusher thread");
+        return; // records are still written by w24_log_flush() and at exit
+    }
+    pthread_detach(flusher);
+}
+
+static void ring_detach(void *ring)
+{
+    atomic_store_explicit(&((struct w24_log_ring *)ring)->in_use, 0, memory_order_release);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_detach);
+}
+
+/*
+ * ring_attach: gives the calling thread a ring, one left by a thread that exited or else a new one
+ *
+ * Return Value:
+ * - struct w24_log_ring *: the ring, or NULL if allocation failed or W24_LOG_MAX_THREADS threads hold one
+ */
+static struct w24_log_ring *ring_attach(void)
+{
+    struct w24_log_ring *ring = NULL;
+    int count = atomic_load(&ring_count);
+    if (count > W24_LOG_MAX_THREADS)
+        count = W24_LOG_MAX_THREADS;
+
+    for (int i = 0; i < count && ring == NULL; i++) {
+        struct w24_log_ring *candidate = atomic_load_explicit(&rings[i], memory_order_acquire);
+        int free_ring = 0;
+
+        if (candidate != NULL && atomic_compare_exchange_strong(&candidate->in_use, &free_ring, 1))
+            ring = candidate;
+    }
+    if (ring == NULL) {
+        if (count >= W24_LOG_MAX_THREADS)
+            return NULL;
+        ring = calloc(1, sizeof(struct w24_log_ring));
+        if (ring == NULL)
+            return NULL;
+
+        int idx = atomic_fetch_add(&ring_count, 1);
+        if (idx >= W24_LOG_MAX_THREADS) {
+            free(ring);
+            return NULL;
+        }
+        atomic_store(&ring->in_use, 1);
+        atomic_store_explicit(&rings[idx], ring, memory_order_release);
+    }
+
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+    pthread_once(&ring_key_once, ring_key_create);
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/*
+ * atfork_child: the child inherits the rings but not the flusher thread nor the other threads
+ *
+ * Explanation:
+ * The records buffered at the fork are the parent's to write, so the child drops its copies rather than
+ * writing them a second time; this way the parent need not drain the rings before every fork. The rings of
+ * the threads that were not carried over are free for the child's threads.
+ */
+static void atfork_child(void)
+{
+    int count = atomic_load(&ring_count);
+    if (count > W24_LOG_MAX_THREADS)
+        count = W24_LOG_MAX_THREADS;
+
+    pthread_mutex_init(&drain_lock, NULL);
+    for (int i = 0; i < count; i++) {
+        struct w24_log_ring *ring = atomic_load(&rings[i]);
+        if (ring == NULL)
+            continue;
+        atomic_store(&ring->tail, atomic_load(&ring->head));
+        atomic_store(&ring->in_use, ring == thread_ring);
+    }
+    if (thread_ring != NULL)
+        thread_ring->tid = (uint32_t)syscall(SYS_gettid);
+    flusher_needed = 1;
+}
+
+/*
+ * w24_log_init: configures the logger from the environment and starts the background flusher
+ *
+ * Parameters:
+ * - component: name printed with every record (e.g. "server", "mirror1")
+ *
+ * Explanation:
+ * Safe to call more than once; only the first call installs the fork and exit handlers.
+ * Records still buffered at exit() are flushed by an atexit handler.
+ */
+void w24_log_init(const char *component)
+{
+    const char *value;
+
+    if (component != NULL)
+        log_component = component;
+    if (log_initialized)
+        return;
+    log_initialized = 1;
+
+    if ((value = getenv("W24_LOG_LEVEL")) != NULL) {
+        if (strcmp(value, "debug") == 0)
+            w24_log_min_level = W24_LOG_DEBUG;
+        else if (strcmp(value, "info") == 0)
+            w24_log_min_level = W24_LOG_INFO;
+        else if (strcmp(value, "warn") == 0)
+            w24_log_min_level = W24_LOG_WARN;
+        else if (strcmp(value, "error") == 0)
+            w24_log_min_level = W24_LOG_ERROR;
+        else if (strcmp(value, "off") == 0)
+            w24_log_min_level = W24_LOG_OFF;
+    }
+
+    if ((value = getenv("W24_LOG_FORMAT")) != NULL) {
+        if (strcmp(value, "json") == 0)
+            log_format = W24_LOG_JSON;
+        else if (strcmp(value, "binary") == 0)
+            log_format = W24_LOG_BINARY;
+    }
+
+    if ((value = getenv("W24_LOG_SAMPLE")) != NULL && atoi(value) > 1)
+        log_sample = (unsigned int)atoi(value);
+
+    if ((value = getenv("W24_LOG_FILE")) != NULL) {
+        int fd = open(value, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+            perror("Error opening log file, logging to stdout");
+        else
+            log_fd = fd;
+    }
+
+    pthread_atfork(NULL, NULL, atfork_child);
+    atexit(w24_log_flush);
+    start_flusher();
+}
+
+/*
+ * w24_log_write: formats a record into the calling thread's ring
+ *
+ * Parameters:
+ * - level: one of enum w24_log_level
+ * - fmt, ...: printf-style message
+ *
+ * Explanation:
+ * Never blocks and never takes a lock unless the thread could not get a ring of its own.
+ * Debug and info records are subject to W24_LOG_SAMPLE; warnings and errors are always kept.
+ * If the ring is full the record is dropped and counted (see w24_log_dropped()).
+ */
+void w24_log_write(int level, const char *fmt, ...)
+{
+    struct w24_log_ring *ring = thread_ring;
+    struct w24_log_record fallback;
+    struct w24_log_record *rec;
+    struct timespec now;
+    va_list ap;
+    uint64_t head = 0;
+
+    if (level < W24_LOG_DEBUG || level >= W24_LOG_OFF || level < w24_log_min_level)
+        return;
+    if (!log_initialized)
+        w24_log_init(NULL);
+    if (flusher_needed)
+        start_flusher();
+    if (ring == NULL)
+        ring = ring_attach();
+
+    if (ring != NULL) {
+        if (level < W24_LOG_WARN && log_sample > 1 && (ring->sample_counter++ % log_sample) != 0)
+            return;
+
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= W24_LOG_RING_SLOTS) {
+            atomic_fetch_add_explicit(&dropped_records, 1, memory_order_relaxed);
+            return;
+        }
+        rec = &ring->slots[head & (W24_LOG_RING_SLOTS - 1)];
+        rec->tid = ring->tid;
+    } else {
+        rec = &fallback;
+        rec->tid = (uint32_t)syscall(SYS_gettid);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->ts_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    rec->level = (uint16_t)level;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        n = 0;
+    rec->len = (uint16_t)((size_t)n < sizeof(rec->msg) ? (size_t)n : sizeof(rec->msg) - 1);
+
+    if (ring != NULL) {
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release); // publish to the flusher
+        return;
+    }
+
+    // no ring available for this thread: write synchronously
+    char out[W24_LOG_MAX_FORMATTED];
+    pthread_mutex_lock(&drain_lock);
+    write_all(out, format_record(out, rec));
+    pthread_mutex_unlock(&drain_lock);
+}
+
+/*
+ * w24_log_flush: synchronously drains every ring. Called at exit.
+ */
+void w24_log_flush(void)
+{
+    pthread_mutex_lock(&drain_lock);
+    drain_locked();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+/*
+ * w24_log_dropped: number of records discarded because a ring was full
+ */
+uint64_t w24_log_dropped(void)
+{
+    return atomic_load(&dropped_records);
+}
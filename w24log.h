@@ -0,0 +1,65 @@
+/*
+ * w24log.h: asynchronous, buffered structured logging for the w24 server and mirrors
+ *
+ * Every thread that logs gets its own lock-free single-producer/single-consumer ring buffer.
+ * w24_log() formats the record straight into the calling thread's ring and returns; a background
+ * flusher thread drains all rings and writes the records in batches, so the hot path never takes
+ * the stdio lock and never blocks on a slow terminal. When a ring is full the record is dropped
+ * and counted instead of blocking the caller.
+ *
+ * Runtime configuration (environment):
+ * - W24_LOG_LEVEL:  debug | info | warn | error | off          (default: info)
+ * - W24_LOG_FORMAT: text | json | binary                       (default: text)
+ * - W24_LOG_SAMPLE: keep 1 of every N debug/info records        (default: 1, keep all)
+ * - W24_LOG_FILE:   append records to this file instead of stdout
+ */
+
+#ifndef W24LOG_H
+#define W24LOG_H
+
+#include <stdint.h>
+
+enum w24_log_level {
+    W24_LOG_DEBUG = 0,
+    W24_LOG_INFO,
+    W24_LOG_WARN,
+    W24_LOG_ERROR,
+    W24_LOG_OFF
+};
+
+enum w24_log_format {
+    W24_LOG_TEXT = 0,
+    W24_LOG_JSON,
+    W24_LOG_BINARY
+};
+
+#define W24_LOG_MSG_MAX 240 // longest message kept per record, longer ones are truncated
+#define W24_LOG_RING_SLOTS 1024 // records buffered per thread, must be a power of two
+
+/*
+ * Layout of one record in the binary format. Records are written back to back,
+ * each header followed by 'len' bytes of message text (not NUL terminated).
+ */
+struct w24_log_binary_header {
+    uint64_t ts_ns; // CLOCK_REALTIME in nanoseconds
+    uint32_t pid;
+    uint32_t tid;
+    uint16_t level;
+    uint16_t len;
+} __attribute__((packed));
+
+extern int w24_log_min_level; // records below this level are discarded without formatting
+
+void w24_log_init(const char *component);
+void w24_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void w24_log_flush(void);
+uint64_t w24_log_dropped(void);
+
+// cheap level check at the call site so disabled levels cost one comparison
+#define w24_log(level, ...) \
+    do { \
+        if ((level) >= w24_log_min_level) \
+            w24_log_write((level), __VA_ARGS__); \
+    } while (0)
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * w24match.c: vectorized matching of file names against a name or a set of extensions (see w24match.h)
+ */
+
+#define _GNU_SOURCE // memmem
+
+#include "w24match.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+// compares len bytes of s with the padded pattern p; s is folded to lowercase when nocase is set
+typedef int (*equal_fn)(const char *s, const char *p, size_t len, int nocase);
+// first occurrence of the pattern p (plen bytes, folded like for equal_fn) in the len bytes at s, no padding needed
+typedef const char *(*find_fn)(const char *s, size_t len, const char *p, size_t plen, int nocase);
+// sets hits[i] for the names whose length and last byte fit a pattern, a whole vector of names per
+// step; returns how many names it went through, the caller confirms the hits and does the rest
+typedef size_t (*filter_fn)(const struct w24_match *m, const char *const names[], const size_t lengths[], size_t count, unsigned char hits[]);
+
+// a name's length and last byte as the filters compare them; names are at most NAME_MAX bytes,
+// and a longer one is clamped so that it still fits every suffix (w24_match_one() decides)
+static inline void length_and_last(const char *name, size_t length, unsigned char *len, unsigned char *last)
+{
+    *len = length > W24_MATCH_MAX_LENGTH ? W24_MATCH_MAX_LENGTH : (unsigned char)length;
+    *last = length > 0 ? (unsigned char)name[length - 1] : 0;
+}
+
+static int equal_scalar(const char *s, const char *p, size_t len, int nocase)
+{
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (nocase && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != (unsigned char)p[i])
+            return 0;
+    }
+    return 1;
+}
+
+// candidates found by the vector loops are confirmed here; they never read past len
+static const char *find_scalar(const char *s, size_t len, const char *p, size_t plen, int nocase)
+{
+    if (!nocase)
+        return memmem(s, len, p, plen);
+    for (size_t i = 0; i + plen <= len; i++) {
+        if (equal_scalar(s + i, p, plen, 1))
+            return s + i;
+    }
+    return NULL;
+}
+
+__attribute__((target("sse4.2")))
+static __m128i fold_sse(__m128i v)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+__attribute__((target("sse4.2")))
+static int equal_sse42(const char *s, const char *p, size_t len, int nocase)
+{
+    for (size_t off = 0; off < len; off += 16) {
+        int n = len - off < 16 ? (int)(len - off) : 16;
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + off));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + off));
+
+        if (nocase)
+            a = fold_sse(a);
+        // index of the first differing byte within n, or 16 when all n are equal
+        if (_mm_cmpestri(b, n, a, n, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT) < n)
+            return 0;
+    }
+    return 1;
+}
+
+__attribute__((target("sse4.2")))
+static size_t filter_sse42(const struct w24_match *m, const char *const names[], const size_t lengths[], size_t count, unsigned char hits[])
+{
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        unsigned char len[16], last[16];
+        __m128i any = _mm_setzero_si128();
+
+        for (int j = 0; j < 16; j++)
+            length_and_last(names[i + j], lengths[i + j], &len[j], &last[j]);
+        __m128i l = _mm_loadu_si128((const __m128i *)len);
+        __m128i b = _mm_loadu_si128((const __m128i *)last);
+        if (m->flags & W24_MATCH_NOCASE)
+            b = fold_sse(b);
+        for (int p = 0; p < m->count; p++) {
+            __m128i plen = _mm_set1_epi8((char)m->length[p]);
+            __m128i fits = m->kind == W24_MATCH_NAME ? _mm_cmpeq_epi8(l, plen) : _mm_cmpeq_epi8(_mm_max_epu8(l, plen), l);
+            any = _mm_or_si128(any, _mm_and_si128(fits, _mm_cmpeq_epi8(b, _mm_set1_epi8(m->text[p][m->length[p] - 1]))));
+        }
+        _mm_storeu_si128((__m128i *)(hits + i), any);
+    }
+    return i;
+}
+
+// compares the first and the last byte of the pattern at 16 positions per step; only positions where both match are compared fully
+__attribute__((target("sse4.2")))
+static const char *find_sse42(const char *s, size_t len, const char *p, size_t plen, int nocase)
+{
+    const __m128i first = _mm_set1_epi8(p[0]), last = _mm_set1_epi8(p[plen - 1]);
+    size_t i = 0;
+
+    for (; i + plen - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + plen - 1));
+        if (nocase) {
+            a = fold_sse(a);
+            b = fold_sse(b);
+        }
+        for (unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))); mask != 0; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (equal_scalar(s + at + 1, p + 1, plen - 1, nocase))
+                return s + at;
+        }
+    }
+    return i < len ? find_scalar(s + i, len - i, p, plen, nocase) : NULL;
+}
+
+__attribute__((target("avx2")))
+static __m256i fold_avx2(__m256i v)
+{
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+
+__attribute__((target("avx2")))
+static int equal_avx2(const char *s, const char *p, size_t len, int nocase)
+{
+    for (size_t off = 0; off < len; off += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + off));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + off));
+        unsigned diff;
+
+        if (nocase)
+            a = fold_avx2(a);
+        diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        if (len - off < 32)
+            diff &= (1u << (len - off)) - 1; // bytes past the end are padding
+        if (diff != 0)
+            return 0;
+    }
+    return 1;
+}
+
+// filter_sse42 with 32 names per step
+__attribute__((target("avx2")))
+static size_t filter_avx2(const struct w24_match *m, const char *const names[], const size_t lengths[], size_t count, unsigned char hits[])
+{
+    size_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        unsigned char len[32], last[32];
+        __m256i any = _mm256_setzero_si256();
+
+        for (int j = 0; j < 32; j++)
+            length_and_last(names[i + j], lengths[i + j], &len[j], &last[j]);
+        __m256i l = _mm256_loadu_si256((const __m256i *)len);
+        __m256i b = _mm256_loadu_si256((const __m256i *)last);
+        if (m->flags & W24_MATCH_NOCASE)
+            b = fold_avx2(b);
+        for (int p = 0; p < m->count; p++) {
+            __m256i plen = _mm256_set1_epi8((char)m->length[p]);
+            __m256i fits = m->kind == W24_MATCH_NAME ? _mm256_cmpeq_epi8(l, plen) : _mm256_cmpeq_epi8(_mm256_max_epu8(l, plen), l);
+            any = _mm256_or_si256(any, _mm256_and_si256(fits, _mm256_cmpeq_epi8(b, _mm256_set1_epi8(m->text[p][m->length[p] - 1]))));
+        }
+        _mm256_storeu_si256((__m256i *)(hits + i), any);
+    }
+    return i;
+}
+
+// find_sse42 with 32 positions per step
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *s, size_t len, const char *p, size_t plen, int nocase)
+{
+    const __m256i first = _mm256_set1_epi8(p[0]), last = _mm256_set1_epi8(p[plen - 1]);
+    size_t i = 0;
+
+    for (; i + plen - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + plen - 1));
+        if (nocase) {
+            a = fold_avx2(a);
+            b = fold_avx2(b);
+        }
+        for (unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))); mask != 0; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (equal_scalar(s + at + 1, p + 1, plen - 1, nocase))
+                return s + at;
+        }
+    }
+    return i < len ? find_scalar(s + i, len - i, p, plen, nocase) : NULL;
+}
+
+static const struct kernel {
+    const char *name;
+    const char *cpu_feature; // NULL: always available
+    equal_fn equal;
+    find_fn find;
+    filter_fn filter; // NULL: w24_match_many() checks every name with w24_match_one()
+} kernels[] = {
+    { "avx2", "avx2", equal_avx2, find_avx2, filter_avx2 },
+    { "sse4.2", "sse4.2", equal_sse42, find_sse42, filter_sse42 },
+    { "scalar", NULL, equal_scalar, find_scalar, NULL },
+};
+
+static const struct kernel *kernel = &kernels[2];
+
+static int kernel_supported(const struct kernel *k)
+{
+    __builtin_cpu_init();
+    if (k->cpu_feature == NULL)
+        return 1;
+    if (strcmp(k->cpu_feature, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    return __builtin_cpu_supports("sse4.2");
+}
+
+// picks the widest kernel the CPU supports before main() runs, so lookups never race
+__attribute__((constructor))
+static void select_kernel(void)
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (kernel_supported(&kernels[i])) {
+            kernel = &kernels[i];
+            return;
+        }
+    }
+}
+
+/*
+ * w24_match_kernel: name of the kernel in use ("avx2", "sse4.2" or "scalar")
+ */
+const char *w24_match_kernel(void)
+{
+    return kernel->name;
+}
+
+/*
+ * w24_match_set_kernel: forces a kernel, e.g. to compare them in a benchmark
+ *
+ * Return Value:
+ * - int: 0, or -1 with errno set if the name is unknown (EINVAL) or the CPU lacks it (ENOTSUP)
+ */
+int w24_match_set_kernel(const char *name)
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            if (!kernel_supported(&kernels[i])) {
+                errno = ENOTSUP;
+                return -1;
+            }
+            kernel = &kernels[i];
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+static int add_pattern(struct w24_match *m, const char *text)
+{
+    size_t len = strlen(text);
+
+    if (len == 0 || len > W24_MATCH_MAX_LENGTH || m->count == W24_MATCH_MAX_PATTERNS) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(m->text[m->count], 0, sizeof(m->text[m->count]));
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        m->text[m->count][i] = (m->flags & W24_MATCH_NOCASE) && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    m->length[m->count++] = len;
+    return 0;
+}
+
+/*
+ * w24_match_name_init: compiles a match of whole names
+ *
+ * Parameters:
+ * - match: receives the compiled pattern
+ * - name: the name to find (not a glob)
+ * - flags: W24_MATCH_NOCASE or 0
+ *
+ * Return Value:
+ * - int: 0, or -1 (EINVAL) if name is empty or longer than W24_MATCH_MAX_LENGTH
+ */
+int w24_match_name_init(struct w24_match *m, const char *name, unsigned flags)
+{
+    m->kind = W24_MATCH_NAME;
+    m->flags = flags;
+    m->count = 0;
+    return add_pattern(m, name);
+}
+
+/*
+ * w24_match_suffixes_init: compiles a match of names ending with any of a few suffixes
+ *
+ * Parameters:
+ * - match: receives the compiled pattern
+ * - suffixes: e.g. ".txt", ".jpg": a name matches if it ends with one of them (or is one of them)
+ * - count: number of suffixes, at most W24_MATCH_MAX_PATTERNS
+ * - flags: W24_MATCH_NOCASE or 0
+ *
+ * Return Value:
+ * - int: 0, or -1 (EINVAL) for too many, empty or too long suffixes
+ */
+int w24_match_suffixes_init(struct w24_match *m, const char *const suffixes[], int count, unsigned flags)
+{
+    m->kind = W24_MATCH_SUFFIX;
+    m->flags = flags;
+    m->count = 0;
+    for (int i = 0; i < count; i++) {
+        if (add_pattern(m, suffixes[i]) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * w24_match_substring_init: compiles a search for a string inside longer text (file contents)
+ *
+ * Parameters:
+ * - match: receives the compiled pattern
+ * - text: the string to find
+ * - flags: W24_MATCH_NOCASE or 0
+ *
+ * Return Value:
+ * - int: 0, or -1 (EINVAL) if text is empty or longer than W24_MATCH_MAX_LENGTH
+ */
+int w24_match_substring_init(struct w24_match *m, const char *text, unsigned flags)
+{
+    m->kind = W24_MATCH_SUBSTRING;
+    m->flags = flags;
+    m->count = 0;
+    return add_pattern(m, text);
+}
+
+/*
+ * w24_match_find: first occurrence of a substring pattern in text
+ *
+ * Parameters:
+ * - text, length: where to search; no padding is needed
+ *
+ * Return Value:
+ * - const char *: start of the first occurrence, NULL if there is none
+ */
+const char *w24_match_find(const struct w24_match *m, const char *text, size_t length)
+{
+    if (length < m->length[0])
+        return NULL;
+    return kernel->find(text, length, m->text[0], m->length[0], (m->flags & W24_MATCH_NOCASE) != 0);
+}
+
+/*
+ * w24_match_one: whether one name (followed by W24_MATCH_PADDING readable bytes) matches
+ */
+int w24_match_one(const struct w24_match *m, const char *name, size_t length)
+{
+    int nocase = (m->flags & W24_MATCH_NOCASE) != 0;
+
+    for (int i = 0; i < m->count; i++) {
+        size_t plen = m->length[i];
+
+        if (m->kind == W24_MATCH_NAME ? length != plen : length < plen)
+            continue;
+        // cheap scalar check of the last byte first: most names already differ there
+        char last = name[length - 1];
+        if (nocase && last >= 'A' && last <= 'Z')
+            last += 'a' - 'A';
+        if (last != m->text[i][plen - 1])
+            continue;
+        if (kernel->equal(name + length - plen, m->text[i], plen, nocase))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * w24_match_many: matches a batch of names, e.g. one getdents64 buffer
+ *
+ * Parameters:
+ * - names, lengths: the names and their lengths; each followed by W24_MATCH_PADDING readable bytes
+ * - count: number of names
+ * - hits: receives 1 for each matching name, 0 otherwise
+ *
+ * Return Value:
+ * - size_t: number of matches
+ *
+ * Explanation:
+ * The vector kernels first compare the lengths and last bytes of a whole vector of names with
+ * every pattern at once; only the few names that pass are compared in full, and the names of the
+ * last partial vector one by one.
+ */
+size_t w24_match_many(const struct w24_match *m, const char *const names[], const size_t lengths[], size_t count, unsigned char hits[])
+{
+    size_t filtered = kernel->filter != NULL ? kernel->filter(m, names, lengths, count, hits) : 0;
+    size_t matched = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + 8 <= filtered && i % 8 == 0) {
+            uint64_t any;
+            memcpy(&any, hits + i, sizeof(any));
+            if (any == 0) { // 8 names ruled out by the filter
+                i += 7;
+                continue;
+            }
+        }
+        if (i < filtered && hits[i] == 0)
+            continue;
+        hits[i] = (unsigned char)w24_match_one(m, names[i], lengths[i]);
+        matched += hits[i];
+    }
+    return matched;
+}
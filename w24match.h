@@ -0,0 +1,50 @@
+/*
+ * w24match.h: vectorized matching of file names against a name or a set of extensions
+ *
+ * A pattern is compiled once (w24_match_name_init, w24_match_suffixes_init) and then tested
+ * against many names, typically every entry of a directory read by getdents64 (w24_match_many).
+ * The comparison kernel is picked at startup from what the CPU supports: AVX2 (32 bytes per
+ * step), SSE4.2 (PCMPESTRI, 16 bytes per step) or plain C. All of them support ASCII
+ * case-insensitive matching (W24_MATCH_NOCASE). For a batch, the vector kernels first rule out
+ * 32 or 16 names at a time by their lengths and last bytes, and compare only the rest in full.
+ *
+ * The kernels load whole vectors, so every name passed in must be followed by at least
+ * W24_MATCH_PADDING readable bytes (their content does not matter).
+ *
+ * Substring patterns (w24_match_substring_init) search longer text such as file contents
+ * (w24_match_find): the kernels compare the first and last byte of the pattern at 32 or 16
+ * positions at once and only confirm the rare positions where both match. Text needs no padding.
+ */
+
+#ifndef W24MATCH_H
+#define W24MATCH_H
+
+#include <stddef.h>
+
+#define W24_MATCH_MAX_PATTERNS 8
+#define W24_MATCH_MAX_LENGTH 255 // NAME_MAX
+#define W24_MATCH_PADDING 32
+
+#define W24_MATCH_NOCASE 0x1 // ASCII letters match either case
+
+enum w24_match_kind { W24_MATCH_NAME, W24_MATCH_SUFFIX, W24_MATCH_SUBSTRING };
+
+struct w24_match {
+    enum w24_match_kind kind;
+    unsigned flags;
+    int count; // patterns
+    size_t length[W24_MATCH_MAX_PATTERNS];
+    char text[W24_MATCH_MAX_PATTERNS][W24_MATCH_MAX_LENGTH + W24_MATCH_PADDING]; // lowercase with W24_MATCH_NOCASE, zero padded
+};
+
+int w24_match_name_init(struct w24_match *match, const char *name, unsigned flags);
+int w24_match_suffixes_init(struct w24_match *match, const char *const suffixes[], int count, unsigned flags);
+int w24_match_one(const struct w24_match *match, const char *name, size_t length);
+int w24_match_substring_init(struct w24_match *match, const char *text, unsigned flags);
+const char *w24_match_find(const struct w24_match *match, const char *text, size_t length);
+size_t w24_match_many(const struct w24_match *match, const char *const names[], const size_t lengths[], size_t count, unsigned char hits[]);
+
+const char *w24_match_kernel(void);
+int w24_match_set_kernel(const char *name);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * w24metrics.c: server metrics shared by all connection handlers (see w24metrics.h)
+ */
+
+#include "w24metrics.h"
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+struct w24_metrics *w24_metrics = NULL;
+
+static void add(uint64_t *counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t get(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*
+ * w24_metrics_init: maps the shared counters; call once in the parent before accepting clients
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the mapping failed (metrics are then not recorded)
+ */
+int w24_metrics_init(void)
+{
+    void *p = mmap(NULL, sizeof(struct w24_metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    w24_metrics = p; // zero filled by mmap
+    return 0;
+}
+
+/*
+ * w24_metrics_record_archive: accounts one archive sent to a client
+ *
+ * Parameters:
+ * - bytes_out: archive size
+ * - zip: member statistics for zip archives, NULL for the tar based codecs
+ */
+void w24_metrics_record_archive(uint64_t bytes_out, const struct w24_zip_stats *zip)
+{
+    if (w24_metrics == NULL)
+        return;
+
+    add(&w24_metrics->archives_built, 1);
+    add(&w24_metrics->archive_bytes_out, bytes_out);
+    if (zip == NULL)
+        return;
+
+    add(&w24_metrics->zip_archives, 1);
+    add(&w24_metrics->zip_members_deflated, zip->deflated_members);
+    add(&w24_metrics->zip_members_stored, zip->stored_members);
+    add(&w24_metrics->zip_bytes_in, zip->bytes_in);
+    add(&w24_metrics->zip_bytes_out, zip->bytes_out);
+    add(&w24_metrics->zip_stored_bytes, zip->stored_bytes);
+    add(&w24_metrics->zip_compress_cpu_ns, zip->compress_cpu_ns);
+    add(&w24_metrics->zip_cpu_ns_saved, zip->cpu_ns_saved);
+}
+
+/*
+ * w24_metrics_format: renders the counters as "name value" lines
+ *
+ * Explanation:
+ * zip_ratio is archive bytes over member bytes (lower is better); the CPU times are in milliseconds.
+ */
+void w24_metrics_format(char *buf, size_t size)
+{
+    if (w24_metrics == NULL) {
+        snprintf(buf, size, "metrics unavailable\n");
+        return;
+    }
+
+    uint64_t zip_in = get(&w24_metrics->zip_bytes_in);
+    uint64_t zip_out = get(&w24_metrics->zip_bytes_out);
+
+    snprintf(buf, size,
+             "archives_built %llu\n"
+             "archive_bytes_out %llu\n"
+             "zip_archives %llu\n"
+             "zip_members_deflated %llu\n"
+             "zip_members_stored %llu\n"
+             "zip_bytes_in %llu\n"
+             "zip_bytes_out %llu\n"
+             "zip_stored_bytes %llu\n"
+             "zip_ratio %.3f\n"
+             "zip_compress_cpu_ms %.1f\n"
+             "zip_cpu_ms_saved %.1f\n"
+             "cache_hits %llu\n"
+             "cache_misses %llu\n"
+             "cache_evictions %llu\n"
+             "conditional_requests %llu\n"
+             "notmod_replies %llu\n"
+             "delta_transfers %llu\n"
+             "delta_bytes_out %llu\n"
+             "delta_bytes_saved %llu\n"
+             "heartbeats %llu\n"
+             "sessions_timed_out %llu\n"
+             "sessions_dropped %llu\n"
+             "handlers_reaped %llu\n"
+             "lookups_queued %llu\n"
+             "lookups_busy %llu\n"
+             "archives_queued %llu\n"
+             "archives_busy %llu\n"
+             "admission_wait_ms %llu\n"
+             "requests_cancelled %llu\n"
+             "requests_expired %llu\n"
+             "requests_abandoned %llu\n",
+             (unsigned long long)get(&w24_metrics->archives_built),
+             (unsigned long long)get(&w24_metrics->archive_bytes_out),
+             (unsigned long long)get(&w24_metrics->zip_archives),
+             (unsigned long long)get(&w24_metrics->zip_members_deflated),
+             (unsigned long long)get(&w24_metrics->zip_members_stored),
+             (unsigned long long)zip_in,
+             (unsigned long long)zip_out,
+             (unsigned long long)get(&w24_metrics->zip_stored_bytes),
+             zip_in > 0 ? (double)zip_out / (double)zip_in : 0.0,
+             get(&w24_metrics->zip_compress_cpu_ns) / 1e6,
+             get(&w24_metrics->zip_cpu_ns_saved) / 1e6,
+             (unsigned long long)get(&w24_metrics->cache_hits),
+             (unsigned long long)get(&w24_metrics->cache_misses),
+             (unsigned long long)get(&w24_metrics->cache_evictions),
+             (unsigned long long)get(&w24_metrics->conditional_requests),
+             (unsigned long long)get(&w24_metrics->notmod_replies),
+             (unsigned long long)get(&w24_metrics->delta_transfers),
+             (unsigned long long)get(&w24_metrics->delta_bytes_out),
+             (unsigned long long)get(&w24_metrics->delta_bytes_saved),
+             (unsigned long long)get(&w24_metrics->heartbeats),
+             (unsigned long long)get(&w24_metrics->sessions_timed_out),
+             (unsigned long long)get(&w24_metrics->sessions_dropped),
+             (unsigned long long)get(&w24_metrics->handlers_reaped),
+             (unsigned long long)get(&w24_metrics->lookups_queued),
+             (unsigned long long)get(&w24_metrics->lookups_busy),
+             (unsigned long long)get(&w24_metrics->archives_queued),
+             (unsigned long long)get(&w24_metrics->archives_busy),
+             (unsigned long long)get(&w24_metrics->admission_wait_ms),
+             (unsigned long long)get(&w24_metrics->requests_cancelled),
+             (unsigned long long)get(&w24_metrics->requests_expired),
+             (unsigned long long)get(&w24_metrics->requests_abandoned));
+}
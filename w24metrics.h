@@ -0,0 +1,60 @@
+/*
+ * w24metrics.h: server metrics shared by all connection handlers
+ *
+ * Every connection is served by a forked child, so the counters live in an anonymous shared
+ * mapping created before the first fork and are updated with atomic adds. Any child can read
+ * the totals for the whole server, which is what the "stats" command replies with.
+ */
+
+#ifndef W24METRICS_H
+#define W24METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "w24zip.h"
+
+struct w24_metrics {
+    uint64_t archives_built; // archives of any codec
+    uint64_t archive_bytes_out; // total size of those archives
+    uint64_t zip_archives; // archives built with the zip codec
+    uint64_t zip_members_deflated;
+    uint64_t zip_members_stored; // members stored because they would not compress
+    uint64_t zip_bytes_in; // uncompressed bytes of all zip members
+    uint64_t zip_bytes_out; // size of the zip archives
+    uint64_t zip_stored_bytes;
+    uint64_t zip_compress_cpu_ns; // CPU time spent deflating
+    uint64_t zip_cpu_ns_saved; // estimated CPU time not spent on incompressible members
+    uint64_t cache_hits; // archive requests served from the archive store
+    uint64_t cache_misses;
+    uint64_t cache_evictions;
+    uint64_t conditional_requests; // ifgen: dirlist and w24fn with the generation of a cached reply
+    uint64_t notmod_replies; // of those, answered with NOTMOD
+    uint64_t delta_transfers; // archives sent as a delta against the client's previous one
+    uint64_t delta_bytes_out; // size of those deltas
+    uint64_t delta_bytes_saved; // archive bytes they spared
+    uint64_t heartbeats; // pings from idle clients
+    uint64_t sessions_timed_out; // closed after the idle timeout (--idle-timeout)
+    uint64_t sessions_dropped; // ended without quitc: the client vanished or keepalive gave up on it
+    uint64_t handlers_reaped; // exited handler processes collected (fork mode)
+    uint64_t lookups_queued; // lookups that waited for a slot (--lookups)
+    uint64_t lookups_busy; // lookups answered with BUSY
+    uint64_t archives_queued; // archive jobs that waited for a slot (--archives)
+    uint64_t archives_busy; // archive jobs answered with BUSY
+    uint64_t admission_wait_ms; // total time spent waiting in those queues
+    uint64_t requests_cancelled; // stopped by "cancel <id>"
+    uint64_t requests_expired; // stopped at their deadline
+    uint64_t requests_abandoned; // stopped because their client went away
+};
+
+extern struct w24_metrics *w24_metrics;
+
+// adds to one counter, e.g. W24_METRICS_ADD(cache_hits, 1); a no-op before w24_metrics_init()
+#define W24_METRICS_ADD(field, value) \
+    do { if (w24_metrics != NULL) __atomic_fetch_add(&w24_metrics->field, (uint64_t)(value), __ATOMIC_RELAXED); } while (0)
+
+int w24_metrics_init(void);
+void w24_metrics_record_archive(uint64_t bytes_out, const struct w24_zip_stats *zip);
+void w24_metrics_format(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,760 @@
+/*
+ * w24pattern.c: glob and regular expression file name patterns compiled to a DFA (see w24pattern.h)
+ */
+
+#define _GNU_SOURCE // memmem
+
+#include "w24pattern.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NODES 65536 // syntax tree nodes, {m,n} copies included
+#define MAX_REPEAT 255 // largest bound of {m,n}
+#define MAX_NFA_STATES 16384 // nested repetitions multiply; refuse before the subset construction gets huge
+
+enum node_kind { NODE_EMPTY, NODE_SET, NODE_CAT, NODE_ALT, NODE_STAR, NODE_PLUS, NODE_QUEST };
+
+struct node {
+    enum node_kind kind;
+    int set; // NODE_SET: index into the byte sets
+    int left, right; // children
+};
+
+// NFA state: a byte transition (set != -1) to out, or up to two epsilon transitions
+struct nfa_state {
+    int set;
+    int out, out1;
+};
+
+struct compiler {
+    const char *p, *end; // parse position
+    enum w24_pattern_syntax syntax;
+    unsigned flags;
+    char *error;
+    size_t error_size;
+    int failed;
+    struct node *nodes;
+    int node_count, node_cap;
+    uint8_t (*sets)[32];
+    int set_count, set_cap;
+    struct nfa_state *states;
+    int state_count, state_cap;
+};
+
+struct w24_pattern {
+    int start;
+    int state_count;
+    int class_count;
+    uint8_t byte_class[256];
+    int *next; // [state][class]; state 0 is the dead state
+    uint8_t *state_flags; // ACCEPT, LIVE, SETTLED per state
+    size_t literal_length;
+    char literal[W24_PATTERN_MAX_LENGTH + 1]; // every match contains it
+};
+
+#define ACCEPT 0x1 // the name matches if it ends here
+#define LIVE 0x2 // an accepting state is still reachable
+#define SETTLED 0x4 // every continuation matches too (e.g. after the implicit ".*" of a regex)
+
+static void fail(struct compiler *c, const char *message)
+{
+    if (!c->failed && c->error != NULL)
+        snprintf(c->error, c->error_size, "%s", message);
+    c->failed = 1;
+}
+
+static int grow(struct compiler *c, void **array, int *cap, int count, size_t size)
+{
+    if (count < *cap)
+        return 0;
+    void *grown = realloc(*array, (size_t)(*cap = *cap * 2 + 64) * size);
+    if (grown == NULL) {
+        fail(c, "out of memory");
+        return -1;
+    }
+    *array = grown;
+    return 0;
+}
+
+static int new_node(struct compiler *c, enum node_kind kind, int set, int left, int right)
+{
+    if (c->failed)
+        return -1;
+    if (c->node_count == MAX_NODES) {
+        fail(c, "pattern too complex");
+        return -1;
+    }
+    if (grow(c, (void **)&c->nodes, &c->node_cap, c->node_count, sizeof(*c->nodes)) == -1)
+        return -1;
+    c->nodes[c->node_count] = (struct node){ kind, set, left, right };
+    return c->node_count++;
+}
+
+static int new_set(struct compiler *c)
+{
+    if (c->failed || grow(c, (void **)&c->sets, &c->set_cap, c->set_count, sizeof(*c->sets)) == -1)
+        return -1;
+    memset(c->sets[c->set_count], 0, sizeof(c->sets[0]));
+    return c->set_count++;
+}
+
+static void set_add(uint8_t *set, int byte)
+{
+    set[byte >> 3] |= (uint8_t)(1u << (byte & 7));
+}
+
+static int set_has(const uint8_t *set, int byte)
+{
+    return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+static void set_fold(uint8_t *set)
+{
+    for (int b = 'a'; b <= 'z'; b++) {
+        if (set_has(set, b) || set_has(set, b - 'a' + 'A')) {
+            set_add(set, b);
+            set_add(set, b - 'a' + 'A');
+        }
+    }
+}
+
+static int literal_node(struct compiler *c, int byte)
+{
+    int set = new_set(c);
+    if (set == -1)
+        return -1;
+    set_add(c->sets[set], byte);
+    if (c->flags & W24_PATTERN_NOCASE)
+        set_fold(c->sets[set]);
+    return new_node(c, NODE_SET, set, -1, -1);
+}
+
+static int any_node(struct compiler *c)
+{
+    int set = new_set(c);
+    if (set == -1)
+        return -1;
+    memset(c->sets[set], 0xff, sizeof(c->sets[set]));
+    return new_node(c, NODE_SET, set, -1, -1);
+}
+
+static int cat(struct compiler *c, int left, int right)
+{
+    if (left == -1)
+        return right;
+    return new_node(c, NODE_CAT, -1, left, right);
+}
+
+// [...] with c->p just past the '['; returns -1 and leaves c->p alone if it is not terminated
+static int parse_class(struct compiler *c)
+{
+    static const struct { const char *name; int (*test)(int); } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+        { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+        { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    const char *p = c->p;
+    int negate = 0, first = 1;
+    int set = new_set(c);
+
+    if (set == -1)
+        return -1;
+    if (p < c->end && (*p == '^' || (*p == '!' && c->syntax == W24_PATTERN_GLOB))) {
+        negate = 1;
+        p++;
+    }
+
+    while (p < c->end && (*p != ']' || first)) {
+        int lo, hi;
+
+        first = 0;
+        if (p[0] == '[' && p + 1 < c->end && p[1] == ':') {
+            const char *close = strstr(p + 2, ":]");
+            if (close != NULL && close + 2 > c->end)
+                close = NULL;
+            size_t i, len = close != NULL ? (size_t)(close - (p + 2)) : 0;
+            for (i = 0; close != NULL && i < sizeof(classes) / sizeof(classes[0]); i++) {
+                if (strlen(classes[i].name) == len && strncmp(classes[i].name, p + 2, len) == 0)
+                    break;
+            }
+            if (close == NULL || i == sizeof(classes) / sizeof(classes[0])) {
+                fail(c, "unknown character class");
+                return -1;
+            }
+            for (int b = 0; b < 128; b++) {
+                if (classes[i].test(b))
+                    set_add(c->sets[set], b);
+            }
+            p = close + 2;
+            continue;
+        }
+
+        if (*p == '\\' && c->syntax == W24_PATTERN_GLOB && p + 1 < c->end) // fnmatch() escapes inside brackets too
+            p++;
+        lo = hi = (unsigned char)*p++;
+        if (p + 1 < c->end && *p == '-' && p[1] != ']') {
+            p++;
+            if (*p == '\\' && c->syntax == W24_PATTERN_GLOB && p + 1 < c->end)
+                p++;
+            hi = (unsigned char)*p++;
+            if (hi < lo) {
+                fail(c, "invalid range in [...]");
+                return -1;
+            }
+        }
+        for (int b = lo; b <= hi; b++)
+            set_add(c->sets[set], b);
+    }
+
+    if (p >= c->end)
+        return -2; // unterminated
+    c->p = p + 1;
+    if (c->flags & W24_PATTERN_NOCASE)
+        set_fold(c->sets[set]);
+    if (negate) {
+        for (int i = 0; i < 32; i++)
+            c->sets[set][i] = (uint8_t)~c->sets[set][i];
+    }
+    return new_node(c, NODE_SET, set, -1, -1);
+}
+
+static int parse_glob(struct compiler *c)
+{
+    int root = -1;
+
+    while (c->p < c->end && !c->failed) {
+        char ch = *c->p++;
+        int atom;
+
+        if (ch == '*') {
+            atom = new_node(c, NODE_STAR, -1, any_node(c), -1);
+        }
+        else if (ch == '?') {
+            atom = any_node(c);
+        }
+        else if (ch == '[') {
+            atom = parse_class(c);
+            if (atom == -2) // an unterminated '[' matches itself, as in fnmatch()
+                atom = literal_node(c, '[');
+        }
+        else {
+            if (ch == '\\' && c->p < c->end)
+                ch = *c->p++;
+            atom = literal_node(c, (unsigned char)ch);
+        }
+        root = cat(c, root, atom);
+    }
+    return root == -1 ? new_node(c, NODE_EMPTY, -1, -1, -1) : root;
+}
+
+static int parse_alternation(struct compiler *c);
+
+static int parse_atom(struct compiler *c)
+{
+    char ch = *c->p++;
+
+    switch (ch) {
+    case '(': {
+        int inner = parse_alternation(c);
+        if (c->p >= c->end || *c->p != ')') {
+            fail(c, "unmatched (");
+            return -1;
+        }
+        c->p++;
+        return inner;
+    }
+    case '[': {
+        int set = parse_class(c);
+        if (set == -2)
+            fail(c, "unmatched [");
+        return set;
+    }
+    case '.':
+        return any_node(c);
+    case '\\':
+        if (c->p >= c->end) {
+            fail(c, "trailing backslash");
+            return -1;
+        }
+        return literal_node(c, (unsigned char)*c->p++);
+    case '^':
+    case '$':
+        fail(c, "^ and $ are only supported at the ends of the pattern");
+        return -1;
+    case '*':
+    case '+':
+    case '?':
+        fail(c, "nothing to repeat");
+        return -1;
+    default:
+        return literal_node(c, (unsigned char)ch);
+    }
+}
+
+// a{m}, a{m,}, a{m,n}: the tree of a is shared, the NFA gets one copy per repetition
+static int repeat(struct compiler *c, int atom, int min, int max)
+{
+    int root = -1;
+
+    for (int i = 0; i < min; i++)
+        root = cat(c, root, atom);
+    if (max == -1) {
+        root = cat(c, root, new_node(c, NODE_STAR, -1, atom, -1));
+    }
+    else {
+        for (int i = min; i < max; i++)
+            root = cat(c, root, new_node(c, NODE_QUEST, -1, atom, -1));
+    }
+    return root == -1 ? new_node(c, NODE_EMPTY, -1, -1, -1) : root;
+}
+
+static int parse_repetition(struct compiler *c)
+{
+    int atom = parse_atom(c);
+
+    while (c->p < c->end && !c->failed) {
+        char ch = *c->p;
+
+        if (ch == '*' || ch == '+' || ch == '?') {
+            c->p++;
+            atom = new_node(c, ch == '*' ? NODE_STAR : ch == '+' ? NODE_PLUS : NODE_QUEST, -1, atom, -1);
+        }
+        else if (ch == '{' && c->p + 1 < c->end && isdigit((unsigned char)c->p[1])) {
+            char *after;
+            long min = strtol(c->p + 1, &after, 10), max = min;
+
+            if (*after == ',') {
+                max = isdigit((unsigned char)after[1]) ? strtol(after + 1, &after, 10) : (after++, -1);
+            }
+            if (*after != '}' || min > MAX_REPEAT || max > MAX_REPEAT || (max != -1 && max < min)) {
+                fail(c, "invalid {m,n} repetition");
+                return -1;
+            }
+            c->p = after + 1;
+            atom = repeat(c, atom, (int)min, (int)max);
+        }
+        else {
+            break;
+        }
+    }
+    return atom;
+}
+
+static int parse_concatenation(struct compiler *c)
+{
+    int root = -1;
+
+    while (c->p < c->end && *c->p != '|' && *c->p != ')' && !c->failed)
+        root = cat(c, root, parse_repetition(c));
+    return root == -1 ? new_node(c, NODE_EMPTY, -1, -1, -1) : root;
+}
+
+static int parse_alternation(struct compiler *c)
+{
+    int root = parse_concatenation(c);
+
+    while (c->p < c->end && *c->p == '|' && !c->failed) {
+        c->p++;
+        root = new_node(c, NODE_ALT, -1, root, parse_concatenation(c));
+    }
+    return root;
+}
+
+static int new_state(struct compiler *c, int set, int out, int out1)
+{
+    if (c->failed)
+        return -1;
+    if (c->state_count == MAX_NFA_STATES) {
+        fail(c, "pattern too complex");
+        return -1;
+    }
+    if (grow(c, (void **)&c->states, &c->state_cap, c->state_count, sizeof(*c->states)) == -1)
+        return -1;
+    c->states[c->state_count] = (struct nfa_state){ set, out, out1 };
+    return c->state_count++;
+}
+
+// Thompson construction: returns the entry state, *accept receives the exit state (no transitions yet)
+static int build(struct compiler *c, int n, int *accept)
+{
+    const struct node *node = &c->nodes[n];
+    int start, inner_accept, inner, right_accept;
+
+    *accept = new_state(c, -1, -1, -1);
+    if (*accept == -1)
+        return -1;
+
+    switch (node->kind) {
+    case NODE_EMPTY:
+        return new_state(c, -1, *accept, -1);
+    case NODE_SET:
+        return new_state(c, node->set, *accept, -1);
+    case NODE_CAT: {
+        int left = build(c, node->left, &inner_accept);
+        int right = build(c, c->nodes[n].right, &right_accept);
+        if (left == -1 || right == -1)
+            return -1;
+        c->states[inner_accept].out = right;
+        c->states[right_accept].out = *accept;
+        return left;
+    }
+    case NODE_ALT: {
+        int left = build(c, node->left, &inner_accept);
+        int right = build(c, c->nodes[n].right, &right_accept);
+        if (left == -1 || right == -1)
+            return -1;
+        c->states[inner_accept].out = *accept;
+        c->states[right_accept].out = *accept;
+        return new_state(c, -1, left, right);
+    }
+    default: // STAR, PLUS, QUEST
+        inner = build(c, node->left, &inner_accept);
+        if (inner == -1)
+            return -1;
+        start = node->kind == NODE_PLUS ? inner : new_state(c, -1, inner, node->kind == NODE_QUEST || node->kind == NODE_STAR ? *accept : -1);
+        c->states[inner_accept].out = *accept;
+        if (c->nodes[n].kind != NODE_QUEST)
+            c->states[inner_accept].out1 = inner;
+        return start;
+    }
+}
+
+// appends the nodes of a concatenation chain in order
+static void flatten(const struct compiler *c, int n, int *items, int *count, int max)
+{
+    if (*count >= max)
+        return;
+    if (c->nodes[n].kind == NODE_CAT) {
+        flatten(c, c->nodes[n].left, items, count, max);
+        flatten(c, c->nodes[n].right, items, count, max);
+    }
+    else if (*count < max) {
+        items[(*count)++] = n;
+    }
+}
+
+// the longest run of single-byte atoms that every match of node n contains
+static void required_literal(const struct compiler *c, int n, struct w24_pattern *pattern)
+{
+    int items[W24_PATTERN_MAX_LENGTH * 2]; // a longer chain is cut short, its prefix still has to match
+    int count = 0;
+    char run[W24_PATTERN_MAX_LENGTH + 1];
+    size_t run_length = 0;
+
+    flatten(c, n, items, &count, (int)(sizeof(items) / sizeof(items[0])));
+    for (int i = 0; i <= count; i++) {
+        int byte = -1;
+
+        if (i < count && c->nodes[items[i]].kind == NODE_SET) {
+            const uint8_t *set = c->sets[c->nodes[items[i]].set];
+            for (int b = 0; b < 256; b++) {
+                if (set_has(set, b)) {
+                    byte = byte == -1 ? b : -2;
+                }
+            }
+        }
+        if (byte >= 0 && run_length < W24_PATTERN_MAX_LENGTH) {
+            run[run_length++] = (char)byte;
+            continue;
+        }
+        if (run_length > pattern->literal_length) {
+            memcpy(pattern->literal, run, run_length);
+            pattern->literal_length = run_length;
+            pattern->literal[run_length] = '\0';
+        }
+        run_length = 0;
+        if (i < count && c->nodes[items[i]].kind == NODE_PLUS) // a+ contains a
+            required_literal(c, c->nodes[items[i]].left, pattern);
+    }
+}
+
+// splits the bytes into classes that every set either contains entirely or not at all
+static int byte_classes(const struct compiler *c, uint8_t byte_class[256])
+{
+    int class_of[256] = { 0 };
+    int count = 1;
+
+    for (int s = 0; s < c->set_count; s++) {
+        int split[256]; // old class -> the class its members of set s move to
+        for (int k = 0; k < count; k++)
+            split[k] = -1;
+        for (int b = 0; b < 256; b++) {
+            if (set_has(c->sets[s], b)) {
+                if (split[class_of[b]] == -1)
+                    split[class_of[b]] = count++;
+                class_of[b] = split[class_of[b]];
+            }
+        }
+        // a class whose members all moved leaves its number unused; renumber densely
+        int dense[512], used = 0;
+        for (int k = 0; k < count; k++)
+            dense[k] = -1;
+        for (int b = 0; b < 256; b++) {
+            if (dense[class_of[b]] == -1)
+                dense[class_of[b]] = used++;
+            class_of[b] = dense[class_of[b]];
+        }
+        count = used;
+    }
+    for (int b = 0; b < 256; b++)
+        byte_class[b] = (uint8_t)class_of[b];
+    return count;
+}
+
+static void add_closure(const struct compiler *c, uint64_t *bits, int state, int *stack)
+{
+    int top = 0;
+
+    if (bits[state / 64] & (1ull << (state % 64)))
+        return;
+    bits[state / 64] |= 1ull << (state % 64);
+    stack[top++] = state;
+    while (top > 0) {
+        const struct nfa_state *s = &c->states[stack[--top]];
+        if (s->set != -1)
+            continue;
+        for (int i = 0; i < 2; i++) {
+            int t = i == 0 ? s->out : s->out1;
+            if (t != -1 && !(bits[t / 64] & (1ull << (t % 64)))) {
+                bits[t / 64] |= 1ull << (t % 64);
+                stack[top++] = t;
+            }
+        }
+    }
+}
+
+// subset construction; returns 0, or -1 with the error set
+static int determinize(struct compiler *c, int start, int accept, struct w24_pattern *pattern)
+{
+    int words = (c->state_count + 63) / 64;
+    int hash_size = 2 * W24_PATTERN_MAX_STATES;
+    uint64_t *subsets = calloc((size_t)W24_PATTERN_MAX_STATES * words, sizeof(uint64_t));
+    uint64_t *next = malloc((size_t)words * sizeof(uint64_t));
+    int *hash = malloc((size_t)hash_size * sizeof(int));
+    int *stack = malloc((size_t)c->state_count * sizeof(int));
+    int ret = -1;
+
+    pattern->class_count = byte_classes(c, pattern->byte_class);
+    pattern->next = calloc((size_t)W24_PATTERN_MAX_STATES * pattern->class_count, sizeof(int));
+    pattern->state_flags = calloc(W24_PATTERN_MAX_STATES, 1);
+    if (subsets == NULL || next == NULL || hash == NULL || stack == NULL || pattern->next == NULL || pattern->state_flags == NULL) {
+        fail(c, "out of memory");
+        goto out;
+    }
+    for (int i = 0; i < hash_size; i++)
+        hash[i] = -1;
+
+    // state 0 is the empty subset: the dead state
+    add_closure(c, subsets + words, start, stack);
+    pattern->state_count = 2;
+    pattern->start = 1;
+    for (int pass = 0; pass < 2; pass++) { // enter the dead and the start state into the hash
+        uint64_t h = 1469598103934665603ull;
+        for (int w = 0; w < words; w++)
+            h = (h ^ subsets[pass * words + w]) * 1099511628211ull;
+        int slot = (int)(h % (uint64_t)hash_size);
+        while (hash[slot] != -1)
+            slot = (slot + 1) % hash_size;
+        hash[slot] = pass;
+    }
+
+    for (int d = 1; d < pattern->state_count; d++) {
+        const uint64_t *subset = subsets + (size_t)d * words;
+
+        if (subset[accept / 64] & (1ull << (accept % 64)))
+            pattern->state_flags[d] |= ACCEPT;
+
+        for (int k = 0; k < pattern->class_count; k++) {
+            int byte = 0;
+            while (pattern->byte_class[byte] != k)
+                byte++;
+
+            memset(next, 0, (size_t)words * sizeof(uint64_t));
+            for (int w = 0; w < words; w++) {
+                for (uint64_t bits = subset[w]; bits != 0; bits &= bits - 1) {
+                    const struct nfa_state *s = &c->states[w * 64 + __builtin_ctzll(bits)];
+                    if (s->set != -1 && set_has(c->sets[s->set], byte))
+                        add_closure(c, next, s->out, stack);
+                }
+            }
+
+            uint64_t h = 1469598103934665603ull;
+            for (int w = 0; w < words; w++)
+                h = (h ^ next[w]) * 1099511628211ull;
+            int slot = (int)(h % (uint64_t)hash_size);
+            while (hash[slot] != -1 && memcmp(subsets + (size_t)hash[slot] * words, next, (size_t)words * sizeof(uint64_t)) != 0)
+                slot = (slot + 1) % hash_size;
+            if (hash[slot] == -1) {
+                if (pattern->state_count == W24_PATTERN_MAX_STATES) {
+                    fail(c, "pattern too complex");
+                    goto out;
+                }
+                memcpy(subsets + (size_t)pattern->state_count * words, next, (size_t)words * sizeof(uint64_t));
+                hash[slot] = pattern->state_count++;
+            }
+            pattern->next[d * pattern->class_count + k] = hash[slot];
+        }
+    }
+
+    // LIVE: an accepting state is reachable; SETTLED: only accepting states are reachable
+    for (int d = 0; d < pattern->state_count; d++)
+        pattern->state_flags[d] |= (pattern->state_flags[d] & ACCEPT) ? LIVE | SETTLED : 0;
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int d = 1; d < pattern->state_count; d++) {
+            const int *row = pattern->next + d * pattern->class_count;
+            int live = pattern->state_flags[d] & LIVE, settled = pattern->state_flags[d] & SETTLED;
+            for (int k = 0; k < pattern->class_count; k++) {
+                live |= pattern->state_flags[row[k]] & LIVE;
+                if (!(pattern->state_flags[row[k]] & SETTLED))
+                    settled = 0;
+            }
+            if (live != (pattern->state_flags[d] & LIVE) || settled != (pattern->state_flags[d] & SETTLED)) {
+                pattern->state_flags[d] = (uint8_t)((pattern->state_flags[d] & ACCEPT) | live | settled);
+                changed = 1;
+            }
+        }
+    }
+    ret = 0;
+
+out:
+    free(subsets);
+    free(next);
+    free(hash);
+    free(stack);
+    return ret;
+}
+
+/*
+ * w24_pattern_compile: compiles a glob or a regular expression
+ *
+ * Parameters:
+ * - text: the pattern
+ * - syntax: W24_PATTERN_GLOB or W24_PATTERN_REGEX
+ * - flags: W24_PATTERN_NOCASE or 0
+ * - error, error_size: receive a message when the pattern is rejected (may be NULL)
+ *
+ * Return Value:
+ * - struct w24_pattern *: the compiled pattern, or NULL if it is invalid, too long
+ *   (W24_PATTERN_MAX_LENGTH) or too complex (W24_PATTERN_MAX_STATES)
+ */
+struct w24_pattern *w24_pattern_compile(const char *text, enum w24_pattern_syntax syntax, unsigned flags, char *error, size_t error_size)
+{
+    struct compiler c;
+    struct w24_pattern *pattern = calloc(1, sizeof(*pattern));
+    size_t length = strlen(text);
+    int anchored_start = 0, anchored_end = 0;
+    int root, start, accept;
+
+    memset(&c, 0, sizeof(c));
+    c.syntax = syntax;
+    c.flags = flags;
+    c.error = error;
+    c.error_size = error_size;
+    if (pattern == NULL) {
+        fail(&c, "out of memory");
+        return NULL;
+    }
+    if (length == 0 || length > W24_PATTERN_MAX_LENGTH) {
+        fail(&c, length == 0 ? "empty pattern" : "pattern too long");
+        free(pattern);
+        return NULL;
+    }
+
+    c.p = text;
+    c.end = text + length;
+    if (syntax == W24_PATTERN_GLOB) {
+        root = parse_glob(&c);
+    }
+    else {
+        size_t backslashes = 0;
+        if (*c.p == '^') {
+            anchored_start = 1;
+            c.p++;
+        }
+        while (c.end - backslashes - 1 > c.p && c.end[-2 - (long)backslashes] == '\\')
+            backslashes++;
+        if (c.end > c.p && c.end[-1] == '$' && backslashes % 2 == 0) {
+            anchored_end = 1;
+            c.end--;
+        }
+        root = parse_alternation(&c);
+        if (!c.failed && c.p < c.end)
+            fail(&c, "unmatched )");
+    }
+
+    if (!c.failed) {
+        required_literal(&c, root, pattern);
+        if (syntax == W24_PATTERN_REGEX && !anchored_start) // search anywhere: ".*" before and after
+            root = cat(&c, new_node(&c, NODE_STAR, -1, any_node(&c), -1), root);
+        if (syntax == W24_PATTERN_REGEX && !anchored_end)
+            root = cat(&c, root, new_node(&c, NODE_STAR, -1, any_node(&c), -1));
+    }
+    if (!c.failed && (start = build(&c, root, &accept)) != -1)
+        determinize(&c, start, accept, pattern);
+
+    free(c.nodes);
+    free(c.sets);
+    free(c.states);
+    if (c.failed) {
+        w24_pattern_free(pattern);
+        return NULL;
+    }
+    return pattern;
+}
+
+/*
+ * w24_pattern_match: whether a file name matches
+ *
+ * Explanation:
+ * The required literal is looked for first; then the DFA runs until the name ends, the dead
+ * state is reached (no match possible) or a settled state is reached (match whatever follows).
+ */
+int w24_pattern_match(const struct w24_pattern *pattern, const char *name, size_t length)
+{
+    const int *next = pattern->next;
+    int classes = pattern->class_count;
+    int state = pattern->start;
+
+    if (pattern->literal_length > 0 && memmem(name, length, pattern->literal, pattern->literal_length) == NULL)
+        return 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t flags = pattern->state_flags[state];
+        if (!(flags & LIVE))
+            return 0;
+        if (flags & SETTLED)
+            return 1;
+        state = next[state * classes + pattern->byte_class[(unsigned char)name[i]]];
+    }
+    return (pattern->state_flags[state] & ACCEPT) != 0;
+}
+
+/*
+ * w24_pattern_literal: the literal prefilter ("" if the pattern has none); for logs and tests
+ */
+const char *w24_pattern_literal(const struct w24_pattern *pattern)
+{
+    return pattern->literal;
+}
+
+/*
+ * w24_pattern_states: number of DFA states, the dead state included
+ */
+int w24_pattern_states(const struct w24_pattern *pattern)
+{
+    return pattern->state_count;
+}
+
+void w24_pattern_free(struct w24_pattern *pattern)
+{
+    if (pattern == NULL)
+        return;
+    free(pattern->next);
+    free(pattern->state_flags);
+    free(pattern);
+}
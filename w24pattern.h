@@ -0,0 +1,36 @@
+/*
+ * w24pattern.h: glob and regular expression file name patterns compiled to a DFA
+ *
+ * A pattern is parsed once, turned into a Thompson NFA and then determinized (subset
+ * construction over byte equivalence classes) into a table-driven DFA, so testing a name costs
+ * one table lookup per byte with no backtracking, whatever the pattern. Before running the DFA
+ * the name is checked for the longest literal every match must contain (memmem), which rejects
+ * most names without looking at the automaton at all.
+ *
+ * - Globs match the whole name, like fnmatch() without flags: * ? [abc] [a-z] [!x] [[:digit:]] \x
+ * - Regular expressions are POSIX extended syntax and match anywhere in the name unless anchored:
+ *   . [...] * + ? {m} {m,} {m,n} | ( ) \x, with ^ and $ at the ends of the pattern.
+ *   Back-references and anchors in the middle of a pattern are not supported.
+ */
+
+#ifndef W24PATTERN_H
+#define W24PATTERN_H
+
+#include <stddef.h>
+
+#define W24_PATTERN_MAX_LENGTH 1024
+#define W24_PATTERN_MAX_STATES 4096 // DFA states; larger patterns are rejected as too complex
+
+#define W24_PATTERN_NOCASE 0x1 // ASCII letters match either case
+
+enum w24_pattern_syntax { W24_PATTERN_GLOB, W24_PATTERN_REGEX };
+
+struct w24_pattern;
+
+struct w24_pattern *w24_pattern_compile(const char *text, enum w24_pattern_syntax syntax, unsigned flags, char *error, size_t error_size);
+int w24_pattern_match(const struct w24_pattern *pattern, const char *name, size_t length);
+const char *w24_pattern_literal(const struct w24_pattern *pattern);
+int w24_pattern_states(const struct w24_pattern *pattern);
+void w24_pattern_free(struct w24_pattern *pattern);
+
+#endif
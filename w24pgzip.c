@@ -0,0 +1,323 @@
+/*
+ * w24pgzip.c: parallel gzip compression (see w24pgzip.h)
+ */
+
+#include "w24pgzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+enum job_state { JOB_FREE = 0, JOB_QUEUED, JOB_DONE, JOB_FAILED };
+
+struct pgzip_job {
+    enum job_state state;
+    int last; // final block: finished with Z_FINISH instead of a sync flush
+    unsigned char *in;
+    size_t in_len;
+    unsigned char dict[W24_PGZIP_DICT];
+    size_t dict_len;
+    unsigned char *out;
+    size_t out_cap;
+    size_t out_len;
+    unsigned long crc;
+};
+
+struct pgzip_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready; // a job was queued or the pool is shutting down
+    pthread_cond_t work_done; // a job finished
+    struct pgzip_job *jobs;
+    int window; // number of job slots, i.e. blocks in flight
+    long *queue; // FIFO of queued sequence numbers
+    int queue_head, queue_len;
+    int level;
+    int shutdown;
+};
+
+/*
+ * compress_block: deflates one block as a raw deflate fragment
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a zlib error
+ *
+ * Explanation:
+ * The dictionary makes the block compress as well as it would inside a single stream.
+ * A non-final block ends with Z_SYNC_FLUSH: that leaves the stream byte aligned without
+ * setting the final-block bit, so the next block's output can simply be appended.
+ */
+static int compress_block(struct pgzip_job *job, int level)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    if (job->dict_len > 0 && deflateSetDictionary(&strm, job->dict, (uInt)job->dict_len) != Z_OK) {
+        deflateEnd(&strm);
+        return -1;
+    }
+
+    strm.next_in = job->in;
+    strm.avail_in = (uInt)job->in_len;
+    strm.next_out = job->out;
+    strm.avail_out = (uInt)job->out_cap;
+
+    int ret = deflate(&strm, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+    job->out_len = job->out_cap - strm.avail_out;
+    deflateEnd(&strm);
+
+    if ((job->last && ret != Z_STREAM_END) || (!job->last && ret != Z_OK) || strm.avail_in != 0)
+        return -1;
+
+    job->crc = crc32(0L, job->in, (uInt)job->in_len);
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    struct pgzip_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->queue_len == 0 && !pool->shutdown)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (pool->queue_len == 0 && pool->shutdown)
+            break;
+
+        long seq = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->window;
+        pool->queue_len--;
+        struct pgzip_job *job = &pool->jobs[seq % pool->window];
+        pthread_mutex_unlock(&pool->lock);
+
+        int ret = compress_block(job, pool->level);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = ret == 0 ? JOB_DONE : JOB_FAILED;
+        pthread_cond_broadcast(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * fill_block: reads until the buffer is full or the input ends
+ *
+ * Return Value:
+ * - ssize_t: bytes read, -1 on error. *eof is set once the input is exhausted.
+ */
+static ssize_t fill_block(int fd, unsigned char *buf, size_t cap, int *eof)
+{
+    size_t used = 0;
+
+    while (used < cap) {
+        ssize_t n = read(fd, buf + used, cap - used);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0) {
+            *eof = 1;
+            break;
+        }
+        used += (size_t)n;
+    }
+    return (ssize_t)used;
+}
+
+/*
+ * w24_pgzip_default_threads: one compression thread per online CPU
+ */
+int w24_pgzip_default_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/*
+ * w24_pgzip: compresses everything readable from in_fd into a gzip stream on out_fd
+ *
+ * Parameters:
+ * - in_fd: input descriptor (a pipe from tar, a file, ...), read until EOF
+ * - out_fd: output descriptor
+ * - threads: number of compression threads; <= 1 compresses on the calling thread
+ * - level: zlib compression level (Z_DEFAULT_COMPRESSION or 0-9)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a read, write or compression error
+ *
+ * Explanation:
+ * The calling thread reads blocks, hands them to the workers and writes finished blocks in
+ * input order. At most 2 * threads blocks are in flight, which bounds memory to roughly
+ * 4 * threads * W24_PGZIP_BLOCK bytes however large the input is.
+ */
+int w24_pgzip(int in_fd, int out_fd, int threads, int level)
+{
+    struct pgzip_pool pool;
+    pthread_t *workers = NULL;
+    int nworkers = threads > 1 ? threads : 0;
+    int status = 0;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.level = level;
+    pool.window = nworkers > 0 ? 2 * nworkers : 1;
+    pool.jobs = calloc((size_t)pool.window, sizeof(struct pgzip_job));
+    pool.queue = calloc((size_t)pool.window, sizeof(long));
+    if (pool.jobs == NULL || pool.queue == NULL) {
+        free(pool.jobs);
+        free(pool.queue);
+        return -1;
+    }
+
+    for (int i = 0; i < pool.window; i++) {
+        pool.jobs[i].in = malloc(W24_PGZIP_BLOCK);
+        pool.jobs[i].out_cap = compressBound(W24_PGZIP_BLOCK) + 64; // room for the sync flush marker
+        pool.jobs[i].out = malloc(pool.jobs[i].out_cap);
+        if (pool.jobs[i].in == NULL || pool.jobs[i].out == NULL)
+            status = -1;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work_ready, NULL);
+    pthread_cond_init(&pool.work_done, NULL);
+
+    if (status == 0 && nworkers > 0) {
+        workers = calloc((size_t)nworkers, sizeof(pthread_t));
+        if (workers == NULL) {
+            nworkers = 0;
+            status = -1;
+        }
+        for (int i = 0; status == 0 && i < nworkers; i++) {
+            if (pthread_create(&workers[i], NULL, worker_main, &pool) != 0) {
+                nworkers = i; // run with the workers we got
+                break;
+            }
+        }
+    }
+
+    // gzip header: no name, mtime 0 so the output is reproducible, OS = Unix
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    if (status == 0 && write_all(out_fd, header, sizeof(header)) == -1)
+        status = -1;
+
+    unsigned char prev_tail[W24_PGZIP_DICT];
+    size_t prev_tail_len = 0;
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    unsigned long long total_in = 0;
+    long next_read = 0, next_write = 0;
+    int eof = 0, queued_last = 0;
+
+    while (status == 0 && (!queued_last || next_write < next_read)) {
+
+        // read and dispatch the next block while there is a free slot
+        if (!queued_last && next_read - next_write < pool.window) {
+            struct pgzip_job *job = &pool.jobs[next_read % pool.window];
+            ssize_t n = fill_block(in_fd, job->in, W24_PGZIP_BLOCK, &eof);
+            if (n == -1) {
+                status = -1;
+                break;
+            }
+
+            job->in_len = (size_t)n;
+            job->last = eof;
+            job->dict_len = prev_tail_len;
+            memcpy(job->dict, prev_tail, prev_tail_len);
+
+            // the tail of this block primes the next one
+            if ((size_t)n >= W24_PGZIP_DICT) {
+                memcpy(prev_tail, job->in + n - W24_PGZIP_DICT, W24_PGZIP_DICT);
+                prev_tail_len = W24_PGZIP_DICT;
+            } else if (n > 0) {
+                size_t keep = prev_tail_len + (size_t)n > W24_PGZIP_DICT ? W24_PGZIP_DICT - (size_t)n : prev_tail_len;
+                memmove(prev_tail, prev_tail + prev_tail_len - keep, keep);
+                memcpy(prev_tail + keep, job->in, (size_t)n);
+                prev_tail_len = keep + (size_t)n;
+            }
+
+            queued_last = eof;
+            if (nworkers == 0) {
+                job->state = compress_block(job, level) == 0 ? JOB_DONE : JOB_FAILED;
+            } else {
+                pthread_mutex_lock(&pool.lock);
+                job->state = JOB_QUEUED;
+                pool.queue[(pool.queue_head + pool.queue_len) % pool.window] = next_read;
+                pool.queue_len++;
+                pthread_cond_signal(&pool.work_ready);
+                pthread_mutex_unlock(&pool.lock);
+            }
+            next_read++;
+            if (next_read - next_write < pool.window && !queued_last)
+                continue; // keep the workers fed before blocking on output
+        }
+
+        // write the oldest block once it is compressed
+        struct pgzip_job *job = &pool.jobs[next_write % pool.window];
+        pthread_mutex_lock(&pool.lock);
+        while (job->state == JOB_QUEUED)
+            pthread_cond_wait(&pool.work_done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (job->state != JOB_DONE || write_all(out_fd, job->out, job->out_len) == -1) {
+            status = -1;
+            break;
+        }
+        crc = crc32_combine(crc, job->crc, (z_off_t)job->in_len);
+        total_in += job->in_len;
+        job->state = JOB_FREE;
+        next_write++;
+    }
+
+    if (status == 0) {
+        unsigned char trailer[8];
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (unsigned char)(crc >> (8 * i));
+            trailer[4 + i] = (unsigned char)(total_in >> (8 * i)); // ISIZE is the length modulo 2^32
+        }
+        if (write_all(out_fd, trailer, sizeof(trailer)) == -1)
+            status = -1;
+    }
+
+    // stop the workers; queued jobs are finished first so no thread touches freed memory
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = 1;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < nworkers; i++)
+        pthread_join(workers[i], NULL);
+
+    for (int i = 0; i < pool.window; i++) {
+        free(pool.jobs[i].in);
+        free(pool.jobs[i].out);
+    }
+    free(pool.jobs);
+    free(pool.queue);
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.work_ready);
+    pthread_cond_destroy(&pool.work_done);
+
+    return status;
+}
@@ -0,0 +1,23 @@
+/*
+ * w24pgzip.h: parallel gzip compression (pigz-style)
+ *
+ * The input is cut into W24_PGZIP_BLOCK byte blocks that are deflated independently on a pool
+ * of worker threads, each primed with the last 32 KiB of the previous block as its dictionary.
+ * Every block but the last ends with a sync flush, so the compressed blocks concatenate into one
+ * ordinary deflate stream; the per-block CRCs are combined into the gzip trailer. The result is a
+ * single standard gzip member readable by gzip -d / tar -xzf.
+ *
+ * The output depends only on the input and the level, never on the thread count, so archives
+ * built by nodes configured with different thread counts are byte-identical.
+ */
+
+#ifndef W24PGZIP_H
+#define W24PGZIP_H
+
+#define W24_PGZIP_BLOCK (128 * 1024) // uncompressed bytes per block
+#define W24_PGZIP_DICT (32 * 1024) // deflate window carried from one block into the next
+
+int w24_pgzip(int in_fd, int out_fd, int threads, int level);
+int w24_pgzip_default_threads(void);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * w24prio.c: CPU and I/O priority of the threads that do bulk work (see w24prio.h)
+ */
+
+#define _GNU_SOURCE // gettid
+
+#include "w24prio.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// from linux/ioprio.h, which older headers lack
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/*
+ * w24_prio_parse: Parses "nice[,io]" (--bulk-priority): a nice increment, then "idle" or a best-effort
+ * I/O level 0-7; "0" leaves both unchanged
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the text is malformed
+ */
+int w24_prio_parse(const char *text, struct w24_prio *prio)
+{
+    struct w24_prio parsed = { 0, W24_PRIO_IO_KEEP, 0 };
+    char *end;
+
+    parsed.nice = (int)strtol(text, &end, 10);
+    if (end == text || parsed.nice < 0 || parsed.nice > 19)
+        return -1;
+    if (*end == ',') {
+        text = end + 1;
+        if (strcmp(text, "idle") == 0) {
+            parsed.io_class = W24_PRIO_IO_IDLE;
+            end = (char *)text + 4;
+        }
+        else {
+            parsed.io_class = W24_PRIO_IO_BEST_EFFORT;
+            parsed.io_level = (int)strtol(text, &end, 10);
+            if (end == text || parsed.io_level < 0 || parsed.io_level > 7)
+                return -1;
+        }
+    }
+    if (*end != '\0')
+        return -1;
+    *prio = parsed;
+    return 0;
+}
+
+/*
+ * w24_prio_lowers: Tells whether applying the priority changes anything
+ */
+int w24_prio_lowers(const struct w24_prio *prio)
+{
+    return prio->nice > 0 || prio->io_class != W24_PRIO_IO_KEEP;
+}
+
+/*
+ * w24_prio_apply: Lowers the CPU and I/O priority of the calling thread, and of the threads and processes it starts
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if either could not be changed (errno set); the other is still applied
+ *
+ * Explanation:
+ * On Linux the nice value and the I/O priority belong to each thread: PRIO_PROCESS with the thread id,
+ * and ioprio_set() for "process" 0, the calling thread.
+ */
+int w24_prio_apply(const struct w24_prio *prio)
+{
+    int ret = 0;
+
+    if (prio->nice > 0) {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, (id_t)gettid());
+        if ((nice == -1 && errno != 0) || setpriority(PRIO_PROCESS, (id_t)gettid(), nice + prio->nice > 19 ? 19 : nice + prio->nice) == -1)
+            ret = -1;
+    }
+    if (prio->io_class != W24_PRIO_IO_KEEP) {
+        int value = prio->io_class == W24_PRIO_IO_IDLE ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+                                                       : IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | prio->io_level;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * w24_prio_format: Describes a priority for the startup line, e.g. "nice +10, I/O best-effort 7"
+ */
+void w24_prio_format(const struct w24_prio *prio, char *buf, size_t size)
+{
+    if (!w24_prio_lowers(prio)) {
+        snprintf(buf, size, "unchanged");
+        return;
+    }
+    if (prio->io_class == W24_PRIO_IO_KEEP)
+        snprintf(buf, size, "nice +%d", prio->nice);
+    else if (prio->io_class == W24_PRIO_IO_IDLE)
+        snprintf(buf, size, "nice +%d, I/O idle", prio->nice);
+    else
+        snprintf(buf, size, "nice +%d, I/O best-effort %d", prio->nice, prio->io_level);
+}
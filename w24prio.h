@@ -0,0 +1,36 @@
+/*
+ * w24prio.h: CPU and I/O priority of the threads that do bulk work
+ *
+ * Building an archive reads every matched file and compresses it, which can take the CPUs and
+ * the disk for minutes. Lookups need little of either but are waited on by a person, so archives
+ * are written by a worker thread that first lowers its own nice value and I/O priority (the
+ * ioprio_set system call, honoured by the BFQ and CFQ-style schedulers); the compression threads
+ * and the tar and compressor processes it starts inherit both. Lookups keep running at the
+ * server's priority and the scheduler lets them go first.
+ *
+ * The priorities of a thread cannot be raised back without privileges, which is why the work gets
+ * a thread of its own that exits with it, rather than lowering the handler's priority for a while.
+ */
+
+#ifndef W24PRIO_H
+#define W24PRIO_H
+
+#include <stddef.h>
+
+#define W24_PRIO_BULK_NICE 10 // nice increment of bulk work
+#define W24_PRIO_BULK_IO_LEVEL 7 // best-effort I/O level of bulk work (0 highest, 7 lowest)
+
+enum w24_prio_io { W24_PRIO_IO_KEEP, W24_PRIO_IO_BEST_EFFORT, W24_PRIO_IO_IDLE };
+
+struct w24_prio {
+    int nice; // added to the nice value, 0: unchanged
+    enum w24_prio_io io_class;
+    int io_level; // W24_PRIO_IO_BEST_EFFORT: 0-7
+};
+
+int w24_prio_parse(const char *text, struct w24_prio *prio);
+int w24_prio_lowers(const struct w24_prio *prio);
+int w24_prio_apply(const struct w24_prio *prio);
+void w24_prio_format(const struct w24_prio *prio, char *buf, size_t size);
+
+#endif
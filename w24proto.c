@@ -0,0 +1,242 @@
+/*
+ * w24proto.c: framed messages for binary payloads (see w24proto.h)
+ */
+
+#include "w24proto.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+/*
+ * w24_proto_send_all: sends the whole buffer, retrying short writes
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on error
+ */
+int w24_proto_send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * w24_proto_recv_all: receives exactly len bytes
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on error or if the peer closed the connection first
+ */
+int w24_proto_recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * w24_proto_send_header: sends the header line of a framed message
+ *
+ * Parameters:
+ * - type: message type, a single word ("DATA", "ERROR")
+ * - length: number of payload bytes that follow the header
+ * - attrs: type specific attributes, may be NULL
+ *
+ * Explanation:
+ * When a payload follows, the header is sent with MSG_MORE: the kernel holds it until the payload
+ * is written (with send() or w24_proto_sendfile()) and sends both in full segments, instead of a
+ * header segment the payload then waits behind until the peer's delayed ACK.
+ */
+int w24_proto_send_header(int fd, const char *type, unsigned long long length, const char *attrs)
+{
+    char header[W24_PROTO_HEADER_MAX];
+    int len = snprintf(header, sizeof(header), "%s %llu%s%s\n", type, length, attrs != NULL ? " " : "", attrs != NULL ? attrs : "");
+    const char *p = header;
+
+    if (len < 0 || (size_t)len >= sizeof(header))
+        return -1;
+    while (len > 0) {
+        ssize_t n = send(fd, p, (size_t)len, MSG_NOSIGNAL | (length > 0 ? MSG_MORE : 0));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (int)n;
+    }
+    return 0;
+}
+
+// sends header and payload in one sendmsg() with the given flags, and finishes a short write with send()
+static int send_frame(int fd, const char *type, const char *attrs, const void *payload, size_t length, int flags)
+{
+    char header[W24_PROTO_HEADER_MAX];
+    int len = snprintf(header, sizeof(header), "%s %zu%s%s\n", type, length, attrs != NULL ? " " : "", attrs != NULL ? attrs : "");
+    struct iovec iov[2] = { { header, 0 }, { (void *)payload, length } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    const char *rest;
+    size_t left;
+    ssize_t n;
+
+    if (len < 0 || (size_t)len >= sizeof(header))
+        return -1;
+    iov[0].iov_len = (size_t)len;
+    while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL | flags)) == -1 && errno == EINTR)
+        ;
+    if (n == -1)
+        return -1;
+
+    // finish a short write one iovec at a time
+    for (int i = 0; i < 2; i++) {
+        if ((size_t)n >= iov[i].iov_len) {
+            n -= (ssize_t)iov[i].iov_len;
+            continue;
+        }
+        rest = (const char *)iov[i].iov_base + n;
+        left = iov[i].iov_len - (size_t)n;
+        n = 0;
+        while (left > 0) {
+            ssize_t sent = send(fd, rest, left, MSG_NOSIGNAL | flags);
+            if (sent == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            rest += sent;
+            left -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+/*
+ * w24_proto_send_frame: sends a whole framed message
+ *
+ * Parameters:
+ * - type, attrs: as for w24_proto_send_header()
+ * - payload, length: the payload
+ *
+ * Explanation:
+ * Header and payload go out in one sendmsg(), so a short reply is one segment.
+ */
+int w24_proto_send_frame(int fd, const char *type, const char *attrs, const void *payload, size_t length)
+{
+    return send_frame(fd, type, attrs, payload, length, 0);
+}
+
+/*
+ * w24_proto_send_frame_more: sends a whole framed message that another one follows at once
+ *
+ * Explanation:
+ * Sent with MSG_MORE: the kernel holds the end of the frame until the next write, e.g. the last
+ * LINES chunk of a search until the END frame, so both leave in the same segment.
+ */
+int w24_proto_send_frame_more(int fd, const char *type, const char *attrs, const void *payload, size_t length)
+{
+    return send_frame(fd, type, attrs, payload, length, MSG_MORE);
+}
+
+/*
+ * w24_proto_recv_header: receives and parses the header line of a framed message
+ *
+ * Parameters:
+ * - type: receives the message type
+ * - length: receives the payload length
+ * - attrs: receives the attributes (empty if there are none)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a connection error or a malformed header
+ *
+ * Explanation:
+ * The line is read one byte at a time so that none of the payload is consumed; headers are short.
+ */
+int w24_proto_recv_header(int fd, char *type, size_t type_size, unsigned long long *length, char *attrs, size_t attrs_size)
+{
+    char line[W24_PROTO_HEADER_MAX];
+    size_t used = 0;
+
+    while (1) {
+        if (used == sizeof(line) - 1 || w24_proto_recv_all(fd, &line[used], 1) == -1)
+            return -1;
+        if (line[used] == '\n')
+            break;
+        used++;
+    }
+    line[used] = '\0';
+    return w24_proto_parse_header(line, type, type_size, length, attrs, attrs_size);
+}
+
+/*
+ * w24_proto_parse_header: parses a header line already received, without its newline
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if the line is malformed
+ *
+ * Explanation:
+ * Used by readers that buffer the connection themselves (non-blocking sockets) and so cannot
+ * let w24_proto_recv_header() read the line.
+ */
+int w24_proto_parse_header(const char *line, char *type, size_t type_size, unsigned long long *length, char *attrs, size_t attrs_size)
+{
+    int consumed = 0;
+
+    const char *space = strchr(line, ' ');
+    if (space == NULL || (size_t)(space - line) >= type_size)
+        return -1;
+    snprintf(type, type_size, "%.*s", (int)(space - line), line);
+    if (sscanf(space + 1, "%llu%n", length, &consumed) != 1)
+        return -1;
+
+    const char *rest = space + 1 + consumed;
+    while (*rest == ' ')
+        rest++;
+    snprintf(attrs, attrs_size, "%s", rest);
+    return 0;
+}
+
+/*
+ * w24_proto_sendfile: sends length bytes of a file starting at offset, without copying them
+ * through user space
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on error (including the file ending early)
+ */
+int w24_proto_sendfile(int sock, int fd, off_t offset, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = sendfile(sock, fd, &offset, length);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return -1;
+        length -= (size_t)n;
+    }
+    return 0;
+}
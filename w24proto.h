@@ -0,0 +1,39 @@
+/*
+ * w24proto.h: framed messages
+ *
+ * Commands are short text messages sent with a single send(). Replies are framed, so the receiver
+ * knows exactly how much to read however many segments a reply takes; text replies (dirlist,
+ * w24fn, "ARCHIVE ...", "pong", ...) are TEXT frames. Only the client count the server sends on
+ * connect is unframed. A frame is
+ *
+ *     TYPE length [attributes]\n
+ *     <length bytes of payload>
+ *
+ * e.g. "DATA 1048576 0 5242880\n" followed by 1 MiB of archive, or "ERROR 0 unknown archive\n".
+ * The header line is plain ASCII and at most W24_PROTO_HEADER_MAX bytes long.
+ *
+ * A header is never a write of its own that its payload then waits behind: w24_proto_send_frame()
+ * sends both in one sendmsg(), and w24_proto_send_header() sends the header with MSG_MORE when a
+ * payload follows (written with send() or w24_proto_sendfile()). Frames that follow each other at
+ * once are not held back by Nagle's algorithm either, since the server accepts connections with
+ * TCP_NODELAY (see w24listen.h).
+ */
+
+#ifndef W24PROTO_H
+#define W24PROTO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define W24_PROTO_HEADER_MAX 512
+
+int w24_proto_send_all(int fd, const void *buf, size_t len);
+int w24_proto_recv_all(int fd, void *buf, size_t len);
+int w24_proto_send_header(int fd, const char *type, unsigned long long length, const char *attrs);
+int w24_proto_send_frame(int fd, const char *type, const char *attrs, const void *payload, size_t length);
+int w24_proto_send_frame_more(int fd, const char *type, const char *attrs, const void *payload, size_t length);
+int w24_proto_recv_header(int fd, char *type, size_t type_size, unsigned long long *length, char *attrs, size_t attrs_size);
+int w24_proto_parse_header(const char *line, char *type, size_t type_size, unsigned long long *length, char *attrs, size_t attrs_size);
+int w24_proto_sendfile(int sock, int fd, off_t offset, size_t length);
+
+#endif
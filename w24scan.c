@@ -0,0 +1,306 @@
+/*
+ * w24scan.c: directory tree scanner built on getdents64 and statx (see w24scan.h)
+ */
+
+#define _GNU_SOURCE // statx, O_DIRECTORY
+
+#include "w24scan.h"
+#include "w24io.h"
+#include "w24match.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct scan {
+    unsigned flags;
+    unsigned mask; // statx fields wanted for visited entries, 0 when d_type is enough
+    const struct w24_match *filter; // names to visit, NULL for all
+    w24_scan_fn visit;
+    void *arg;
+    char path[PATH_MAX];
+    char buffer[W24_SCAN_BUFFER_SIZE]; // getdents64 records; only used before descending
+};
+
+struct item {
+    size_t name; // offset into the directory's name buffer
+    size_t length;
+    unsigned char type;
+};
+
+static int wanted(unsigned flags, unsigned char type)
+{
+    switch (type) {
+    case DT_REG:
+        return (flags & W24_SCAN_REGULAR) != 0;
+    case DT_DIR:
+        return (flags & W24_SCAN_DIRECTORIES) != 0;
+    case DT_LNK:
+        return 0;
+    default:
+        return (flags & W24_SCAN_OTHER) != 0;
+    }
+}
+
+static void fill(struct w24_scan_entry *entry, const struct statx *stx)
+{
+    entry->size = stx->stx_size;
+    entry->has_btime = (stx->stx_mask & STATX_BTIME) != 0;
+    entry->btime_sec = stx->stx_btime.tv_sec;
+    entry->btime_nsec = stx->stx_btime.tv_nsec;
+}
+
+// reads every entry of a directory; the names are kept in one growing buffer, padded for w24_match
+static int read_entries(struct scan *s, int fd, char **names, size_t *names_len, struct item **items, size_t *count)
+{
+    size_t names_cap = 0, items_cap = 0;
+    long n;
+
+    *names = NULL;
+    *items = NULL;
+    *names_len = *count = 0;
+
+    while ((n = syscall(SYS_getdents64, fd, s->buffer, sizeof(s->buffer))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(s->buffer + off);
+            size_t len = strlen(d->d_name) + 1;
+
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+                continue;
+            if (d->d_name[0] == '.' && !(s->flags & W24_SCAN_HIDDEN))
+                continue;
+
+            if (*names_len + len + W24_MATCH_PADDING > names_cap) {
+                char *grown = realloc(*names, names_cap = 2 * names_cap + len + W24_MATCH_PADDING + 4096);
+                if (grown == NULL)
+                    return -1;
+                *names = grown;
+            }
+            if (*count == items_cap) {
+                struct item *grown = realloc(*items, (items_cap = 2 * items_cap + 64) * sizeof(**items));
+                if (grown == NULL)
+                    return -1;
+                *items = grown;
+            }
+            memcpy(*names + *names_len, d->d_name, len);
+            (*items)[*count].name = *names_len;
+            (*items)[*count].length = len - 1;
+            (*items)[*count].type = d->d_type;
+            (*count)++;
+            *names_len += len;
+        }
+    }
+    return n == -1 ? -1 : 0;
+}
+
+// visits the entries of the directory open on fd, whose path (s->path) is len bytes long
+static int scan_directory(struct scan *s, int fd, size_t len)
+{
+    char *names;
+    size_t names_len, count;
+    struct item *items;
+    const char *batch[W24_IO_STATX_BATCH];
+    size_t batch_length[W24_IO_STATX_BATCH];
+    unsigned char hit[W24_IO_STATX_BATCH];
+    int batch_index[W24_IO_STATX_BATCH];
+    int status[W24_IO_STATX_BATCH];
+    struct statx *stats = malloc(W24_IO_STATX_BATCH * sizeof(*stats));
+    int stopped = 0;
+
+    if (stats == NULL || read_entries(s, fd, &names, &names_len, &items, &count) == -1) {
+        free(stats);
+        return 0; // unreadable directories are skipped, like find does
+    }
+
+    for (size_t first = 0; first < count && !stopped; first += W24_IO_STATX_BATCH) {
+        size_t last = count - first < W24_IO_STATX_BATCH ? count : first + W24_IO_STATX_BATCH;
+        int stat_count = 0;
+
+        // match the names of the whole batch at once; only matches are stat'ed and visited
+        memset(hit, 1, last - first);
+        if (s->filter != NULL) {
+            for (size_t i = first; i < last; i++) {
+                batch[i - first] = names + items[i].name;
+                batch_length[i - first] = items[i].length;
+            }
+            w24_match_many(s->filter, batch, batch_length, last - first, hit);
+        }
+
+        // one statx batch for the entries that need metadata or have no d_type
+        for (size_t i = first; i < last; i++) {
+            batch_index[i - first] = -1;
+            if (items[i].type == DT_UNKNOWN || (s->mask != 0 && hit[i - first] && wanted(s->flags, items[i].type))) {
+                batch_index[i - first] = stat_count;
+                batch[stat_count++] = names + items[i].name;
+            }
+        }
+        if (stat_count > 0)
+            w24_io_statx_at(fd, batch, stat_count, s->mask | STATX_TYPE, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, stats, status);
+
+        for (size_t i = first; i < last && !stopped; i++) {
+            const char *name = names + items[i].name;
+            size_t name_len = items[i].length;
+            int stat_slot = batch_index[i - first];
+            unsigned char type = items[i].type;
+            struct w24_scan_entry entry;
+
+            if (stat_slot != -1 && status[stat_slot] != 0)
+                continue; // removed since it was listed
+            if (type == DT_UNKNOWN)
+                type = IFTODT(stats[stat_slot].stx_mode);
+            if (len + 1 + name_len >= sizeof(s->path))
+                continue;
+
+            s->path[len] = '/';
+            memcpy(s->path + len + 1, name, name_len + 1);
+
+            if (hit[i - first] && wanted(s->flags, type)) {
+                memset(&entry, 0, sizeof(entry));
+                entry.path = s->path;
+                entry.name = s->path + len + 1;
+                entry.type = type;
+                if (stat_slot != -1)
+                    fill(&entry, &stats[stat_slot]);
+                stopped = s->visit(&entry, s->arg) != 0;
+            }
+
+            if (!stopped && type == DT_DIR && !(s->flags & W24_SCAN_SHALLOW)) {
+                int child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (child != -1) {
+                    stopped = scan_directory(s, child, len + 1 + name_len);
+                    close(child);
+                }
+            }
+            s->path[len] = '\0';
+        }
+    }
+
+    free(stats);
+    free(names);
+    free(items);
+    return stopped;
+}
+
+/*
+ * w24_scan: walks a directory tree
+ *
+ * Parameters:
+ * - root: directory to scan
+ * - flags: W24_SCAN_* entry types to visit, W24_SCAN_HIDDEN, and the metadata to fetch
+ * - filter: only entries whose name matches are stat'ed and visited (directories are still
+ *   descended into); NULL to visit every entry
+ * - visit: called for every matching entry, in directory order, a directory before its contents
+ * - arg: passed to visit
+ *
+ * Return Value:
+ * - int: 0 when the whole tree was scanned, 1 if visit stopped it, -1 with errno set if root
+ *   could not be opened
+ *
+ * Explanation:
+ * entry->path is only valid during the call to visit. Subdirectories that cannot be read are
+ * skipped.
+ */
+int w24_scan(const char *root, unsigned flags, const struct w24_match *filter, w24_scan_fn visit, void *arg)
+{
+    struct scan *s = malloc(sizeof(*s));
+    size_t len = strlen(root);
+    int fd, ret = 0;
+
+    if (s == NULL)
+        return -1;
+    if (len >= sizeof(s->path)) {
+        free(s);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        free(s);
+        return -1;
+    }
+
+    s->flags = flags;
+    s->mask = ((flags & W24_SCAN_SIZE) ? STATX_SIZE : 0) | ((flags & W24_SCAN_BTIME) ? STATX_BTIME : 0);
+    s->filter = filter;
+    s->visit = visit;
+    s->arg = arg;
+    memcpy(s->path, root, len + 1);
+    while (len > 1 && s->path[len - 1] == '/') // "dir/" scans as "dir", so paths get one separator
+        s->path[--len] = '\0';
+
+    if (flags & W24_SCAN_DIRECTORIES && filter == NULL) { // a filter never matches the root, see the header
+        struct w24_scan_entry entry;
+        struct statx stx;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.path = s->path;
+        entry.name = strrchr(s->path, '/') != NULL && len > 1 ? strrchr(s->path, '/') + 1 : s->path;
+        entry.type = DT_DIR;
+        if (s->mask != 0 && statx(fd, "", AT_EMPTY_PATH, s->mask, &stx) == 0)
+            fill(&entry, &stx);
+        ret = visit(&entry, arg) != 0;
+    }
+
+    if (ret == 0)
+        ret = scan_directory(s, fd, len == 1 && s->path[0] == '/' ? 0 : len);
+
+    close(fd);
+    free(s);
+    return ret;
+}
+
+/*
+ * w24_scan_default_workers: threads a parallel query uses, one per online CPU up to W24_SCAN_MAX_WORKERS
+ */
+int w24_scan_default_workers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1)
+        return 1;
+    return cpus > W24_SCAN_MAX_WORKERS ? W24_SCAN_MAX_WORKERS : (int)cpus;
+}
+
+/*
+ * w24_scan_run_workers: runs worker on several threads, the calling thread included, and waits for all of them
+ *
+ * Parameters:
+ * - workers: threads wanted, e.g. w24_scan_default_workers(); at most W24_SCAN_MAX_WORKERS are used
+ * - tasks: the subtrees or files the workers share out; no more threads are started than there are tasks
+ * - worker: takes tasks until there are none left
+ * - arg, arg_size: worker i is given (char *)arg + i * arg_size, so 0 gives every worker the same argument
+ *
+ * Return Value:
+ * - int: number of workers that ran, at least 1: the calling thread runs the first one even when no
+ *   thread could be started
+ */
+int w24_scan_run_workers(int workers, size_t tasks, void *(*worker)(void *), void *arg, size_t arg_size)
+{
+    pthread_t threads[W24_SCAN_MAX_WORKERS];
+    int started = 0;
+
+    if (workers > W24_SCAN_MAX_WORKERS)
+        workers = W24_SCAN_MAX_WORKERS;
+    while (started + 1 < workers && (size_t)started + 1 < tasks &&
+           pthread_create(&threads[started], NULL, worker, (char *)arg + (size_t)(started + 1) * arg_size) == 0)
+        started++;
+    worker(arg);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return started + 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * w24scan.h: directory tree scanner built on getdents64 and statx
+ *
+ * Walks a tree depth first in directory order, like nftw() with FTW_PHYS or find without -L
+ * (symbolic links are reported as such and never followed), but without an lstat() per entry:
+ * - entries are read with getdents64 into a large buffer, many per system call;
+ * - the entry type comes from d_type, so a query on names or types issues no stat at all;
+ * - statx is only issued for the entries that will be visited, only for the fields the query
+ *   asked for (size, birth time), and one directory's worth at a time through the I/O engine
+ *   (a single io_uring_enter() per W24_IO_STATX_BATCH entries with --io uring).
+ * - with a name filter (w24match.h), the names of a directory are matched in bulk by the
+ *   vectorized kernels and entries that do not match are never stat'ed or visited. The root
+ *   itself is not visited when a filter is given.
+ * Entries whose file system reports DT_UNKNOWN are stat'ed for their type.
+ *
+ * The queries that spread a tree over threads (w24fg/w24fr, w24grep, w24top/w24agg) share its
+ * subtrees or files out to w24_scan_default_workers() of them, at most W24_SCAN_MAX_WORKERS,
+ * started and joined by w24_scan_run_workers().
+ */
+
+#ifndef W24SCAN_H
+#define W24SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// which entries to visit
+#define W24_SCAN_REGULAR 0x01 // regular files
+#define W24_SCAN_DIRECTORIES 0x02 // directories, the root included
+#define W24_SCAN_OTHER 0x04 // everything else but symbolic links (fifos, sockets, devices)
+#define W24_SCAN_HIDDEN 0x08 // also entries below a name starting with '.'; skipped otherwise
+#define W24_SCAN_SHALLOW 0x40 // only the entries of the root, without descending into subdirectories
+// metadata to fetch for the visited entries
+#define W24_SCAN_SIZE 0x10
+#define W24_SCAN_BTIME 0x20
+
+#define W24_SCAN_BUFFER_SIZE (64 * 1024) // getdents64 buffer
+#define W24_SCAN_MAX_WORKERS 64 // threads of one parallel query, the calling thread included
+
+struct w24_scan_entry {
+    const char *path; // root-relative path, starting with the root as given
+    const char *name; // last component of path
+    unsigned char type; // DT_REG, DT_DIR, ...
+    uint64_t size; // with W24_SCAN_SIZE
+    int has_btime; // with W24_SCAN_BTIME, 0 if the file system does not record birth times
+    int64_t btime_sec;
+    uint32_t btime_nsec;
+};
+
+// returns 0 to continue, anything else to stop the scan
+typedef int (*w24_scan_fn)(const struct w24_scan_entry *entry, void *arg);
+
+struct w24_match;
+
+int w24_scan(const char *root, unsigned flags, const struct w24_match *filter, w24_scan_fn visit, void *arg);
+int w24_scan_default_workers(void);
+int w24_scan_run_workers(int workers, size_t tasks, void *(*worker)(void *), void *arg, size_t arg_size);
+
+#endif
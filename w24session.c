@@ -0,0 +1,947 @@
+/*
+ * w24session.c: non-blocking client sessions driven by one epoll loop (see w24session.h)
+ */
+
+#define _GNU_SOURCE // SOCK_NONBLOCK, MSG_NOSIGNAL
+
+#include "w24session.h"
+#include "w24proto.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define READ_CHUNK 65536 // free space kept in a session's buffer before each recv()
+#define MAX_EVENTS 64
+#define MAX_WATCHES 4
+
+enum state { STATE_CONNECT, STATE_COUNT, STATE_CODECS, STATE_IDLE, STATE_PING, STATE_REPLY, STATE_WAIT, STATE_DETACHED, STATE_CLOSED };
+
+struct w24_session {
+    struct w24_loop *loop;
+    int fd;
+    enum state state;
+    int port; // node the socket is connected (or connecting) to
+    int count; // client count the server sent, 0 until received
+    char codec[64]; // the server's answer to the codec offer
+    void *data; // the caller's
+    // the command being sent
+    char *out;
+    size_t out_length, out_sent;
+    // heartbeat: when the session became idle, and a command sent while the ping was in flight
+    long long idle_since;
+    char *deferred;
+    enum w24_reply_shape deferred_shape;
+    // the last command, sent again when the node answered BUSY: after retry_at (WAIT), or once connected elsewhere (resend)
+    char *command;
+    int busy_retries;
+    long long retry_at;
+    int resend;
+    // bytes received and not yet delivered; a frame's header is taken out once parsed
+    enum w24_reply_shape shape;
+    char *in;
+    size_t in_length, in_size;
+    int have_header;
+    char type[32];
+    char attrs[W24_PROTO_HEADER_MAX];
+    unsigned long long frame_length;
+    // handed back by w24_session_attach(), picked up on the loop's thread
+    int attached_fd, attached_port;
+    struct w24_session *next; // attached list, then list of closed sessions to free
+};
+
+struct watch {
+    int fd;
+    void (*readable)(int fd, void *arg);
+    void *arg;
+};
+
+struct w24_loop {
+    struct w24_session_config config;
+    struct w24_session_handler handler;
+    void *arg;
+    int epoll_fd;
+    int wake_fd; // eventfd: sessions were attached
+    pthread_mutex_t lock; // protects attached
+    struct w24_session *attached;
+    struct w24_session *closed; // freed once the current batch of events is handled
+    struct w24_session *sessions[W24_SESSION_MAX];
+    int num_sessions;
+    struct watch watches[MAX_WATCHES];
+    int num_watches;
+};
+
+/*
+ * w24_session_redirect: Tells which node serves a session, from the client count sent by the server
+ *
+ * Return Value:
+ * - int: 0 to stay on the server, 1 for mirror1, 2 for mirror2 (the server closes the connection)
+ */
+int w24_session_redirect(int count)
+{
+    if (count >= 1 && count <= 3)
+        return 0;
+    if (count >= 4 && count <= 6)
+        return 1;
+    if (count >= 7 && count <= 9)
+        return 2;
+    if (count % 3 == 0)
+        return 2;
+    if (count % 3 == 2)
+        return 1;
+    return 0;
+}
+
+// milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void free_session(struct w24_session *s)
+{
+    free(s->out);
+    free(s->in);
+    free(s->deferred);
+    free(s->command);
+    free(s);
+}
+
+static int set_events(struct w24_session *s, unsigned events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = s };
+
+    return epoll_ctl(s->loop->epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+static int start_connect(struct w24_session *s, const char *ip, int port)
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = s };
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd == -1)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(ip);
+    addr.sin_port = htons(port);
+    if ((connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) ||
+        epoll_ctl(s->loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    s->fd = fd;
+    s->port = port;
+    s->state = STATE_CONNECT;
+    return 0;
+}
+
+static void drop_socket(struct w24_session *s)
+{
+    if (s->fd != -1 && s->state != STATE_DETACHED) {
+        epoll_ctl(s->loop->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+    }
+    s->fd = -1;
+}
+
+/*
+ * w24_session_close: closes the session's connection and forgets the session
+ *
+ * Explanation:
+ * The handler's closed() callback runs before this returns; the session's memory is released
+ * after the loop finished handling the current events, so callers up the stack may still look at
+ * it. A detached session cannot be closed: its socket belongs to whoever detached it.
+ */
+void w24_session_close(struct w24_session *s, const char *reason)
+{
+    struct w24_loop *loop = s->loop;
+
+    if (s->state == STATE_CLOSED || s->state == STATE_DETACHED)
+        return;
+    drop_socket(s);
+    s->state = STATE_CLOSED;
+    for (int i = 0; i < loop->num_sessions; i++) {
+        if (loop->sessions[i] == s) {
+            loop->sessions[i] = loop->sessions[--loop->num_sessions];
+            break;
+        }
+    }
+    if (loop->handler.closed != NULL)
+        loop->handler.closed(s, reason, loop->arg);
+    s->next = loop->closed;
+    loop->closed = s;
+}
+
+static void become_idle(struct w24_session *s)
+{
+    s->state = STATE_IDLE;
+    s->in_length = 0;
+    s->have_header = 0;
+    s->idle_since = now_ms();
+    if (s->loop->handler.ready != NULL)
+        s->loop->handler.ready(s, s->loop->arg);
+}
+
+// sends what is left of the pending command; 0 once everything is out or the rest has to wait
+static int flush_output(struct w24_session *s)
+{
+    while (s->out_sent < s->out_length) {
+        ssize_t n = send(s->fd, s->out + s->out_sent, s->out_length - s->out_sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return set_events(s, EPOLLIN | EPOLLOUT);
+            return -1;
+        }
+        s->out_sent += (size_t)n;
+    }
+    free(s->out);
+    s->out = NULL;
+    s->out_length = s->out_sent = 0;
+    return set_events(s, EPOLLIN);
+}
+
+static int queue_output(struct w24_session *s, const char *text)
+{
+    free(s->out);
+    s->out = strdup(text);
+    if (s->out == NULL)
+        return -1;
+    s->out_length = strlen(text);
+    s->out_sent = 0;
+    return flush_output(s);
+}
+
+/*
+ * receive: reads what the socket has into the session's buffer
+ *
+ * Return Value:
+ * - int: 1 if bytes were read (call again), 0 when the socket is drained, -1 on an error or once
+ *   the server closed the connection
+ */
+static int receive(struct w24_session *s, size_t limit)
+{
+    if (s->in_size - s->in_length < READ_CHUNK + 1) {
+        size_t size = s->in_size == 0 ? 2 * READ_CHUNK : 2 * s->in_size;
+        char *in = realloc(s->in, size);
+        if (in == NULL)
+            return -1;
+        s->in = in;
+        s->in_size = size;
+    }
+
+    size_t room = s->in_size - s->in_length - 1;
+    if (s->in_length + room > limit)
+        room = limit - s->in_length;
+    if (room == 0)
+        return 0;
+
+    ssize_t n = recv(s->fd, s->in + s->in_length, room, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n <= 0)
+        return -1;
+    s->in_length += (size_t)n;
+    s->in[s->in_length] = '\0';
+    return 1;
+}
+
+// reads an unframed message, the client count: everything available now
+static int receive_text(struct w24_session *s)
+{
+    int ret;
+
+    while ((ret = receive(s, W24_SESSION_TEXT_MAX)) == 1)
+        ;
+    if (ret == -1 && s->in_length == 0)
+        return -1;
+    return s->in_length > 0;
+}
+
+// sends the last command again, after a BUSY
+static void resend_command(struct w24_session *s)
+{
+    s->resend = 0;
+    s->state = STATE_REPLY;
+    s->in_length = 0;
+    s->have_header = 0;
+    if (queue_output(s, s->command) == -1)
+        w24_session_close(s, "send failed");
+}
+
+/*
+ * handle_busy: answers "BUSY 0 <retry_ms> <port>" by sending the command again later, or elsewhere
+ *
+ * Explanation:
+ * On the first BUSY, a port naming the server or a mirror other than the current node moves the
+ * session there at once; the server then counts it afresh and may redirect it again. Otherwise the
+ * session waits retry_ms (see run_timers). Past W24_SESSION_BUSY_RETRIES the caller gets an ERROR
+ * reply instead.
+ */
+static void handle_busy(struct w24_session *s, const char *attrs)
+{
+    struct w24_loop *loop = s->loop;
+    int retry_ms = 0, port = 0;
+    const char *ip = NULL;
+
+    s->in_length = 0;
+    s->have_header = 0;
+    if (s->busy_retries == W24_SESSION_BUSY_RETRIES) {
+        const char *message = "Server busy, please try again later.";
+        struct w24_reply reply = { "ERROR", message, "", 0, 1 };
+
+        if (loop->handler.reply != NULL)
+            loop->handler.reply(s, &reply, loop->arg);
+        if (s->state == STATE_REPLY)
+            become_idle(s);
+        return;
+    }
+    sscanf(attrs, "%d %d", &retry_ms, &port);
+    if (s->busy_retries++ > 0)
+        ip = NULL; // moved once already: the nodes may all be busy, so wait rather than go round them
+    else if (port == loop->config.server_port)
+        ip = loop->config.server_ip;
+    else if (port == loop->config.mirror_ports[0] || port == loop->config.mirror_ports[1])
+        ip = loop->config.mirror_ip;
+    if (ip != NULL && port != s->port) {
+        drop_socket(s);
+        s->resend = 1;
+        if (start_connect(s, ip, port) == -1)
+            w24_session_close(s, strerror(errno));
+        return;
+    }
+    s->state = STATE_WAIT;
+    s->retry_at = now_ms() + (retry_ms > 0 ? retry_ms : 0);
+}
+
+// takes the header of the next frame out of the buffer; 1 once it is, 0 if incomplete, -1 if malformed
+static int take_header(struct w24_session *s)
+{
+    if (s->have_header)
+        return 1;
+
+    char *newline = memchr(s->in, '\n', s->in_length);
+    if (newline == NULL)
+        return s->in_length >= W24_PROTO_HEADER_MAX ? -1 : 0;
+    *newline = '\0';
+    if (w24_proto_parse_header(s->in, s->type, sizeof(s->type), &s->frame_length, s->attrs, sizeof(s->attrs)) == -1 ||
+        s->frame_length > W24_SESSION_FRAME_MAX)
+        return -1;
+    size_t header_length = (size_t)(newline - s->in) + 1;
+    memmove(s->in, s->in + header_length, s->in_length - header_length);
+    s->in_length -= header_length;
+    s->have_header = 1;
+    return 1;
+}
+
+/*
+ * receive_frame: reads a reply of a single frame outside STATE_REPLY, the codec answer or the pong
+ *
+ * Return Value:
+ * - int: 1 once the frame is in, its payload NUL-terminated at the start of the buffer, 0 while it is
+ *   incomplete, -1 on an error, a malformed frame or once the server closed the connection
+ */
+static int receive_frame(struct w24_session *s)
+{
+    int ret;
+
+    while (1) {
+        if ((ret = take_header(s)) == -1)
+            return -1;
+        if (ret == 1 && s->in_length >= s->frame_length) {
+            s->in[s->frame_length] = '\0';
+            s->in_length = 0;
+            s->have_header = 0;
+            return 1;
+        }
+        if ((ret = receive(s, (size_t)-1)) != 1)
+            return ret;
+    }
+}
+
+// delivers every complete frame in the buffer; 1 once the reply is complete, -1 on a protocol error
+static int deliver_frames(struct w24_session *s)
+{
+    int ret;
+
+    while (1) {
+        if ((ret = take_header(s)) != 1)
+            return ret;
+        if (s->in_length < s->frame_length)
+            return 0;
+
+        if (strcmp(s->type, "BUSY") == 0) {
+            handle_busy(s, s->attrs);
+            return 0;
+        }
+
+        size_t length = (size_t)s->frame_length;
+        char saved = s->in[length];
+        struct w24_reply reply = { s->type, s->attrs, s->in, length, 0 };
+
+        reply.last = s->shape != W24_REPLY_STREAM || strcmp(s->type, "END") == 0 || strcmp(s->type, "ERROR") == 0;
+        s->in[length] = '\0';
+        if (s->loop->handler.reply != NULL)
+            s->loop->handler.reply(s, &reply, s->loop->arg);
+        if (s->state != STATE_REPLY)
+            return 0; // closed by the callback
+        if (reply.last)
+            return 1;
+        s->in[length] = saved;
+        memmove(s->in, s->in + length, s->in_length - length);
+        s->in_length -= length;
+        s->have_header = 0;
+    }
+}
+
+static void send_codecs(struct w24_session *s)
+{
+    char message[256];
+
+    snprintf(message, sizeof(message), "codecs %s %d", s->loop->config.codec_offer, s->loop->config.codec_level);
+    s->state = STATE_CODECS;
+    if (queue_output(s, message) == -1)
+        w24_session_close(s, "codec negotiation failed");
+}
+
+static void handle_connected(struct w24_session *s)
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        w24_session_close(s, strerror(error != 0 ? error : errno));
+        return;
+    }
+
+    // the server tells its client count first; mirrors do not
+    if (s->port == s->loop->config.server_port) {
+        s->state = STATE_COUNT;
+        if (set_events(s, EPOLLIN) == -1)
+            w24_session_close(s, strerror(errno));
+        return;
+    }
+    send_codecs(s);
+}
+
+static void handle_readable(struct w24_session *s)
+{
+    struct w24_loop *loop = s->loop;
+    int ret;
+
+    switch (s->state) {
+    case STATE_COUNT:
+        if ((ret = receive_text(s)) <= 0) {
+            if (ret == -1)
+                w24_session_close(s, "server closed the connection");
+            return;
+        }
+        s->count = atoi(s->in);
+        s->in_length = 0;
+        int redirect = w24_session_redirect(s->count);
+        if (redirect != 0) {
+            // the server closes its end: continue on the mirror
+            drop_socket(s);
+            if (start_connect(s, loop->config.mirror_ip, loop->config.mirror_ports[redirect - 1]) == -1)
+                w24_session_close(s, strerror(errno));
+            return;
+        }
+        send_codecs(s);
+        return;
+
+    case STATE_CODECS:
+        if ((ret = receive_frame(s)) <= 0) {
+            if (ret == -1)
+                w24_session_close(s, "codec negotiation failed");
+            return;
+        }
+        snprintf(s->codec, sizeof(s->codec), "%s", s->in);
+        if (s->resend)
+            resend_command(s);
+        else
+            become_idle(s);
+        return;
+
+    case STATE_REPLY:
+        // frames are handed over as soon as they are complete, so a stream never piles up
+        while ((ret = receive(s, (size_t)-1)) == 1) {
+            int done = deliver_frames(s);
+            if (done == -1) {
+                w24_session_close(s, "malformed reply");
+                return;
+            }
+            if (s->state != STATE_REPLY)
+                return;
+            if (done == 1) {
+                become_idle(s);
+                return;
+            }
+        }
+        if (ret == -1)
+            w24_session_close(s, "server disconnected");
+        return;
+
+    case STATE_PING:
+        if ((ret = receive_frame(s)) <= 0) {
+            if (ret == -1)
+                w24_session_close(s, "server disconnected");
+            return;
+        }
+        // the pong; the session is idle again, unless a command is waiting for it
+        s->state = STATE_IDLE;
+        s->idle_since = now_ms();
+        if (s->deferred != NULL) {
+            char *command = s->deferred;
+
+            s->deferred = NULL;
+            w24_session_send(s, command, s->deferred_shape);
+            free(command);
+        }
+        return;
+
+    case STATE_IDLE:
+    case STATE_WAIT:
+        // nothing is expected: the server closed the connection (or sent something unasked)
+        if (receive_text(s) == -1)
+            w24_session_close(s, "server disconnected");
+        s->in_length = 0;
+        return;
+
+    default:
+        return;
+    }
+}
+
+static void handle_event(struct w24_session *s, unsigned events)
+{
+    if (s->state == STATE_CLOSED || s->state == STATE_DETACHED)
+        return; // closed or detached earlier in this batch
+
+    if (s->state == STATE_CONNECT) {
+        handle_connected(s);
+        return;
+    }
+    if ((events & EPOLLOUT) && s->out != NULL && flush_output(s) == -1) {
+        w24_session_close(s, "send failed");
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        handle_readable(s);
+}
+
+// takes back the sessions handed over by w24_session_attach()
+static void handle_attached(struct w24_loop *loop)
+{
+    uint64_t value;
+    struct w24_session *list;
+
+    if (read(loop->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        return;
+    pthread_mutex_lock(&loop->lock);
+    list = loop->attached;
+    loop->attached = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (list != NULL) {
+        struct w24_session *s = list;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+        int flags;
+
+        list = s->next;
+        s->next = NULL;
+        s->state = STATE_IDLE; // not detached any more, so w24_session_close() applies
+        s->fd = s->attached_fd;
+        s->port = s->attached_port;
+        if (s->fd == -1) {
+            w24_session_close(s, "connection lost");
+            continue;
+        }
+        if ((flags = fcntl(s->fd, F_GETFL)) == -1 || fcntl(s->fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, s->fd, &ev) == -1) {
+            w24_session_close(s, strerror(errno));
+            continue;
+        }
+        become_idle(s);
+    }
+}
+
+/*
+ * run_timers: pings the server on every session idle for heartbeat_interval seconds, and sends
+ * again the commands turned away with BUSY whose wait is over
+ *
+ * Return Value:
+ * - int: milliseconds until the next heartbeat or retry is due, -1 if none is
+ */
+static int run_timers(struct w24_loop *loop)
+{
+    long long interval = (long long)loop->config.heartbeat_interval * 1000;
+    long long now = now_ms();
+    long long next = -1;
+
+    for (int i = 0; i < loop->num_sessions; i++) {
+        struct w24_session *s = loop->sessions[i];
+
+        if (s->state == STATE_WAIT) {
+            if (now >= s->retry_at) {
+                resend_command(s);
+                if (s->state == STATE_CLOSED)
+                    i--; // the last session took its place
+                continue;
+            }
+            if (next == -1 || s->retry_at - now < next)
+                next = s->retry_at - now;
+            continue;
+        }
+        if (s->state != STATE_IDLE || interval <= 0)
+            continue;
+        if (now - s->idle_since >= interval) {
+            s->state = STATE_PING;
+            s->in_length = 0;
+            if (queue_output(s, "ping") == -1) {
+                w24_session_close(s, "send failed");
+                i--; // the last session took its place
+            }
+            continue;
+        }
+        if (next == -1 || s->idle_since + interval - now < next)
+            next = s->idle_since + interval - now;
+    }
+    return (int)next;
+}
+
+/*
+ * w24_loop_new: creates a loop without sessions
+ *
+ * Parameters:
+ * - config: where to connect and what to offer; copied, but the strings must outlive the loop
+ * - handler: callbacks for every session of the loop; copied
+ * - arg: passed to the callbacks
+ *
+ * Return Value:
+ * - struct w24_loop *: the loop, or NULL with errno set
+ */
+struct w24_loop *w24_loop_new(const struct w24_session_config *config, const struct w24_session_handler *handler, void *arg)
+{
+    struct w24_loop *loop = calloc(1, sizeof(*loop));
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    if (loop == NULL)
+        return NULL;
+    loop->config = *config;
+    loop->handler = *handler;
+    loop->arg = arg;
+    loop->wake_fd = -1;
+    pthread_mutex_init(&loop->lock, NULL);
+
+    ev.data.ptr = &loop->wake_fd;
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+        (loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == -1) {
+        int saved = errno;
+        w24_loop_free(loop);
+        errno = saved;
+        return NULL;
+    }
+    return loop;
+}
+
+/*
+ * w24_loop_watch: calls readable(fd, arg) on the loop's thread whenever fd has input, e.g. stdin
+ *
+ * Return Value:
+ * - int: 0 on success, -1 with errno set; regular files cannot be watched (EPERM), the caller
+ *   reads them directly
+ */
+int w24_loop_watch(struct w24_loop *loop, int fd, void (*readable)(int fd, void *arg), void *arg)
+{
+    if (loop->num_watches == MAX_WATCHES) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    struct watch *w = &loop->watches[loop->num_watches];
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+
+    w->fd = fd;
+    w->readable = readable;
+    w->arg = arg;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+    loop->num_watches++;
+    return 0;
+}
+
+/*
+ * w24_loop_unwatch: stops watching fd (at end of input); the descriptor is not closed
+ */
+void w24_loop_unwatch(struct w24_loop *loop, int fd)
+{
+    for (int i = 0; i < loop->num_watches; i++) {
+        if (loop->watches[i].fd == fd) {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            loop->watches[i].fd = -1; // kept in place: pending events still point at it
+            return;
+        }
+    }
+}
+
+/*
+ * w24_loop_run: handles events until every session is closed
+ *
+ * Return Value:
+ * - int: 0 once no session is left, -1 if epoll_wait() failed
+ */
+int w24_loop_run(struct w24_loop *loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (loop->num_sessions > 0) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, run_timers(loop));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            int watched = 0;
+
+            if (ptr == &loop->wake_fd) {
+                handle_attached(loop);
+                continue;
+            }
+            for (int w = 0; w < loop->num_watches; w++) {
+                if (ptr == &loop->watches[w]) {
+                    if (loop->watches[w].fd != -1)
+                        loop->watches[w].readable(loop->watches[w].fd, loop->watches[w].arg);
+                    watched = 1;
+                    break;
+                }
+            }
+            if (!watched)
+                handle_event(ptr, events[i].events);
+        }
+
+        while (loop->closed != NULL) {
+            struct w24_session *s = loop->closed;
+            loop->closed = s->next;
+            free_session(s);
+        }
+    }
+    return 0;
+}
+
+/*
+ * w24_loop_idle_session: returns a session waiting for a command, or NULL if every session is busy;
+ * one that is only waiting for the pong of a heartbeat counts as waiting
+ */
+struct w24_session *w24_loop_idle_session(struct w24_loop *loop)
+{
+    for (int i = 0; i < loop->num_sessions; i++) {
+        struct w24_session *s = loop->sessions[i];
+
+        if (s->state == STATE_IDLE || (s->state == STATE_PING && s->deferred == NULL))
+            return s;
+    }
+    return NULL;
+}
+
+/*
+ * w24_loop_sessions: number of sessions not closed yet
+ */
+int w24_loop_sessions(struct w24_loop *loop)
+{
+    return loop->num_sessions;
+}
+
+/*
+ * w24_loop_free: closes the remaining sessions and releases the loop; not while detached
+ * sessions are still in use on other threads
+ */
+void w24_loop_free(struct w24_loop *loop)
+{
+    if (loop == NULL)
+        return;
+    while (loop->num_sessions > 0)
+        w24_session_close(loop->sessions[0], "loop closed");
+    while (loop->closed != NULL) {
+        struct w24_session *s = loop->closed;
+        loop->closed = s->next;
+        free_session(s);
+    }
+    if (loop->wake_fd != -1)
+        close(loop->wake_fd);
+    if (loop->epoll_fd != -1)
+        close(loop->epoll_fd);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop);
+}
+
+/*
+ * w24_session_open: starts connecting a new session to the server
+ *
+ * Parameters:
+ * - data: the caller's data for the session, see w24_session_data()
+ *
+ * Return Value:
+ * - struct w24_session *: the session, or NULL with errno set; it becomes ready (the handler's
+ *   ready() callback) once connected, redirected if need be, and the codecs are negotiated
+ */
+struct w24_session *w24_session_open(struct w24_loop *loop, void *data)
+{
+    if (loop->num_sessions == W24_SESSION_MAX) {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    struct w24_session *s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+    s->loop = loop;
+    s->fd = -1;
+    s->data = data;
+    if (start_connect(s, loop->config.server_ip, loop->config.server_port) == -1) {
+        int saved = errno;
+        free(s);
+        errno = saved;
+        return NULL;
+    }
+    loop->sessions[loop->num_sessions++] = s;
+    return s;
+}
+
+/*
+ * w24_session_send: sends a command on an idle session
+ *
+ * Parameters:
+ * - command: the command, as typed
+ * - shape: how the reply is delimited
+ *
+ * Return Value:
+ * - int: 0 once the command is sent or queued, -1 if the session is not idle or the connection
+ *   failed (the session is then closed)
+ *
+ * Explanation:
+ * During a heartbeat the command is kept and sent as soon as the pong is in. It is kept after
+ * being sent as well, to send it again if the node answers BUSY.
+ */
+int w24_session_send(struct w24_session *s, const char *command, enum w24_reply_shape shape)
+{
+    if (s->state == STATE_PING && s->deferred == NULL) {
+        s->deferred = strdup(command);
+        s->deferred_shape = shape;
+        return s->deferred != NULL ? 0 : -1;
+    }
+    if (s->state != STATE_IDLE)
+        return -1;
+    free(s->command);
+    if ((s->command = strdup(command)) == NULL)
+        return -1;
+    s->busy_retries = 0;
+    s->state = STATE_REPLY;
+    s->shape = shape;
+    s->in_length = 0;
+    s->have_header = 0;
+    if (queue_output(s, command) == -1) {
+        w24_session_close(s, "send failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * w24_session_detach: takes an idle session's socket out of the loop, for blocking use
+ *
+ * Return Value:
+ * - int: the socket, now in blocking mode, or -1 if the session is not idle
+ *
+ * Explanation:
+ * The session stays open but gets no events until w24_session_attach() hands a socket back.
+ * Used for archive downloads, which keep their blocking fetch loop on a thread of their own.
+ */
+int w24_session_detach(struct w24_session *s)
+{
+    int flags;
+
+    if (s->state != STATE_IDLE && s->state != STATE_REPLY)
+        return -1;
+    epoll_ctl(s->loop->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    if ((flags = fcntl(s->fd, F_GETFL)) != -1)
+        fcntl(s->fd, F_SETFL, flags & ~O_NONBLOCK);
+    s->state = STATE_DETACHED;
+    return s->fd;
+}
+
+/*
+ * w24_session_attach: hands a detached session its socket back
+ *
+ * Parameters:
+ * - fd: the socket (possibly a new connection, after a reconnect), or -1 to close the session
+ * - port: the node fd is connected to
+ *
+ * Explanation:
+ * Safe to call from any thread: the session is queued and the loop is woken up; the session
+ * becomes ready on the loop's thread.
+ */
+void w24_session_attach(struct w24_session *s, int fd, int port)
+{
+    struct w24_loop *loop = s->loop;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&loop->lock);
+    s->attached_fd = fd;
+    s->attached_port = port;
+    s->next = loop->attached;
+    loop->attached = s;
+    pthread_mutex_unlock(&loop->lock);
+    if (write(loop->wake_fd, &one, sizeof(one)) == -1)
+        perror("Cannot wake the event loop");
+}
+
+void *w24_session_data(struct w24_session *s)
+{
+    return s->data;
+}
+
+/*
+ * w24_session_port: the node the session is connected to (the server's port or a mirror's)
+ */
+int w24_session_port(struct w24_session *s)
+{
+    return s->port;
+}
+
+/*
+ * w24_session_count: the client count the server sent when the session connected
+ */
+int w24_session_count(struct w24_session *s)
+{
+    return s->count;
+}
+
+/*
+ * w24_session_codec: the server's answer to the codec offer ("codec <name>")
+ */
+const char *w24_session_codec(struct w24_session *s)
+{
+    return s->codec;
+}
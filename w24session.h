@@ -0,0 +1,100 @@
+/*
+ * w24session.h: non-blocking client sessions driven by one epoll loop
+ *
+ * A session is one connection to the server, or to the mirror the server redirects it to. Every
+ * socket is non-blocking and a single epoll_wait() watches all of them, so one thread keeps many
+ * sessions busy: while one waits for its reply, the others connect, send or receive. A session
+ * goes through
+ *
+ *     CONNECT -> COUNT (server only) -> [redirected: CONNECT to the mirror] -> CODECS -> IDLE
+ *     IDLE -> REPLY -> IDLE ...
+ *     IDLE -> PING -> IDLE (heartbeat)
+ *     REPLY -> WAIT -> REPLY, or REPLY -> CONNECT to another node -> ... -> REPLY (BUSY)
+ *
+ * The server takes one command per recv(), so a session never has more than one command in
+ * flight; a client gets more done by opening more sessions, which the server's client count
+ * spreads over the mirrors as well.
+ *
+ * The caller says how the reply to a command is delimited when it sends it:
+ * - W24_REPLY_TEXT: one TEXT frame, handed over as type "TEXT" (see w24proto.h)
+ * - W24_REPLY_FRAME: one frame of any type
+ * - W24_REPLY_STREAM: framed messages up to an END or ERROR frame (w24grep)
+ *
+ * A session left idle for heartbeat_interval seconds sends "ping" and the server answers "pong",
+ * so the server's idle timeout only closes sessions whose client is gone. The heartbeat is not
+ * seen by the caller: a command sent while it is in flight goes out once the pong is in.
+ *
+ * A node too busy to run a command answers "BUSY 0 <retry_ms> <port>" (see w24admit.h). The
+ * session sends the command again after retry_ms, or, the first time, at once on the node named
+ * by port when it is the server or one of the mirrors, up to W24_SESSION_BUSY_RETRIES times; after
+ * that the caller gets an ERROR reply. Like the heartbeat, this is not seen by the caller.
+ *
+ * Archive downloads keep using blocking I/O on a thread of their own: w24_session_detach() takes
+ * the socket out of the loop and w24_session_attach(), which may be called from any thread,
+ * hands it (or a reconnected one) back.
+ */
+
+#ifndef W24SESSION_H
+#define W24SESSION_H
+
+#include <stddef.h>
+
+#define W24_SESSION_MAX 256 // sessions per loop
+#define W24_SESSION_TEXT_MAX (1024 * 1024) // longest unframed message kept (the client count)
+#define W24_SESSION_FRAME_MAX (64 * 1024 * 1024) // longest framed payload accepted
+#define W24_SESSION_BUSY_RETRIES 5 // times a command turned away with BUSY is sent again
+
+enum w24_reply_shape { W24_REPLY_TEXT, W24_REPLY_FRAME, W24_REPLY_STREAM };
+
+struct w24_reply {
+    const char *type; // frame type ("FILES", "LINES", "END", "ERROR", ...), "TEXT" for a text reply
+    const char *attrs; // frame attributes, "" for text
+    const char *data; // payload, NUL-terminated
+    size_t length;
+    int last; // the reply to the command is complete
+};
+
+struct w24_session_config {
+    const char *server_ip;
+    int server_port;
+    const char *mirror_ip;
+    int mirror_ports[2];
+    const char *codec_offer; // "codecs <offer> <level>" is sent on every new connection
+    int codec_level;
+    int heartbeat_interval; // seconds before an idle session pings the server, 0: never
+};
+
+struct w24_session;
+struct w24_loop;
+
+/*
+ * Callbacks run on the loop's thread. ready() is called every time a session becomes idle (after
+ * negotiation, after a complete reply, after w24_session_attach()); it may send the next command
+ * or leave the session idle. closed() is the last call for a session, whose memory is freed after it.
+ */
+struct w24_session_handler {
+    void (*ready)(struct w24_session *session, void *arg);
+    void (*reply)(struct w24_session *session, const struct w24_reply *reply, void *arg);
+    void (*closed)(struct w24_session *session, const char *reason, void *arg);
+};
+
+struct w24_loop *w24_loop_new(const struct w24_session_config *config, const struct w24_session_handler *handler, void *arg);
+int w24_loop_watch(struct w24_loop *loop, int fd, void (*readable)(int fd, void *arg), void *arg);
+void w24_loop_unwatch(struct w24_loop *loop, int fd);
+int w24_loop_run(struct w24_loop *loop);
+struct w24_session *w24_loop_idle_session(struct w24_loop *loop);
+int w24_loop_sessions(struct w24_loop *loop);
+void w24_loop_free(struct w24_loop *loop);
+
+struct w24_session *w24_session_open(struct w24_loop *loop, void *data);
+int w24_session_send(struct w24_session *session, const char *command, enum w24_reply_shape shape);
+int w24_session_detach(struct w24_session *session);
+void w24_session_attach(struct w24_session *session, int fd, int port);
+void w24_session_close(struct w24_session *session, const char *reason);
+void *w24_session_data(struct w24_session *session);
+int w24_session_port(struct w24_session *session);
+int w24_session_count(struct w24_session *session);
+const char *w24_session_codec(struct w24_session *session);
+int w24_session_redirect(int count);
+
+#endif
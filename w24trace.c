@@ -0,0 +1,341 @@
+/*
+ * w24trace.c: hot-path tracing spans (see w24trace.h)
+ */
+
+#define _GNU_SOURCE
+#include "w24trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#define W24_TRACE_MAX_THREADS 64
+
+struct w24_trace_event {
+    const char *name;
+    uint64_t begin_ns;
+    uint64_t dur_ns;
+    uint32_t tid; // the buffer may have had other owners since
+    char detail[W24_TRACE_DETAIL_MAX];
+};
+
+struct w24_trace_open_span {
+    const char *name;
+    uint64_t begin_ns;
+    char detail[W24_TRACE_DETAIL_MAX];
+};
+
+/*
+ * Per-thread buffer: only the owning thread writes it. 'written' counts every completed span
+ * ever recorded, so the live window is the last min(written, W24_TRACE_RING_EVENTS) slots.
+ * A buffer is given back when its thread exits and taken over, spans included, by the next
+ * thread that traces.
+ */
+struct w24_trace_buffer {
+    _Atomic uint64_t written;
+    _Atomic int in_use; // owned by a live thread
+    uint32_t tid;
+    int depth;
+    struct w24_trace_open_span open[W24_TRACE_MAX_DEPTH];
+    struct w24_trace_event events[W24_TRACE_RING_EVENTS];
+};
+
+int w24_trace_enabled = 0;
+
+static const char *trace_dir;
+static const char *trace_name = "w24";
+static int dump_seq = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static _Atomic(struct w24_trace_buffer *) buffers[W24_TRACE_MAX_THREADS];
+static _Atomic int buffer_count = 0;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct w24_trace_buffer *thread_buffer;
+static pthread_key_t buffer_key; // its destructor gives the buffer back when the thread exits
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void on_dump_signal(int sig)
+{
+    (void)sig;
+    dump_requested = 1; // dumping is not async-signal-safe, do it at the next span boundary
+}
+
+static void on_exit_dump(void)
+{
+    w24_trace_dump();
+}
+
+static void atfork_child(void)
+{
+    // the child starts a fresh timeline; buffers of threads that did not survive the fork are dropped
+    struct w24_trace_buffer *mine = thread_buffer;
+    int count = atomic_load(&buffer_count);
+
+    for (int i = 0; i < count && i < W24_TRACE_MAX_THREADS; i++) {
+        struct w24_trace_buffer *buf = atomic_load(&buffers[i]);
+        if (buf != NULL && buf != mine)
+            free(buf);
+        atomic_store(&buffers[i], NULL);
+    }
+    atomic_store(&buffer_count, mine != NULL);
+    if (mine != NULL) {
+        atomic_store(&buffers[0], mine);
+        atomic_store(&mine->written, 0);
+        mine->tid = (uint32_t)syscall(SYS_gettid);
+    }
+    pthread_mutex_init(&dump_lock, NULL);
+    dump_seq = 0;
+}
+
+static void buffer_detach(void *buf)
+{
+    atomic_store_explicit(&((struct w24_trace_buffer *)buf)->in_use, 0, memory_order_release);
+}
+
+static void buffer_key_create(void)
+{
+    pthread_key_create(&buffer_key, buffer_detach);
+}
+
+/*
+ * buffer_attach: gives the calling thread a buffer, one left by a thread that exited or else a new one
+ */
+static struct w24_trace_buffer *buffer_attach(void)
+{
+    struct w24_trace_buffer *buf = NULL;
+    int count = atomic_load(&buffer_count);
+    if (count > W24_TRACE_MAX_THREADS)
+        count = W24_TRACE_MAX_THREADS;
+
+    for (int i = 0; i < count && buf == NULL; i++) {
+        struct w24_trace_buffer *candidate = atomic_load_explicit(&buffers[i], memory_order_acquire);
+        int free_buffer = 0;
+
+        if (candidate != NULL && atomic_compare_exchange_strong(&candidate->in_use, &free_buffer, 1))
+            buf = candidate;
+    }
+    if (buf == NULL) {
+        if (count >= W24_TRACE_MAX_THREADS)
+            return NULL;
+        buf = calloc(1, sizeof(struct w24_trace_buffer));
+        if (buf == NULL)
+            return NULL;
+
+        int idx = atomic_fetch_add(&buffer_count, 1);
+        if (idx >= W24_TRACE_MAX_THREADS) {
+            free(buf);
+            return NULL;
+        }
+        atomic_store(&buf->in_use, 1);
+        atomic_store_explicit(&buffers[idx], buf, memory_order_release);
+    }
+
+    buf->tid = (uint32_t)syscall(SYS_gettid);
+    buf->depth = 0; // spans left open by the previous owner are not closed
+    pthread_once(&buffer_key_once, buffer_key_create);
+    pthread_setspecific(buffer_key, buf);
+    thread_buffer = buf;
+    return buf;
+}
+
+/*
+ * w24_trace_init: enables tracing if W24_TRACE_DIR is set
+ *
+ * Parameters:
+ * - process_name: used in the output file name and as the process name shown in the timeline
+ */
+void w24_trace_init(const char *process_name)
+{
+    if (process_name != NULL)
+        trace_name = process_name;
+
+    trace_dir = getenv("W24_TRACE_DIR");
+    if (trace_dir == NULL || trace_dir[0] == '\0' || w24_trace_enabled)
+        return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    pthread_atfork(NULL, NULL, atfork_child);
+    atexit(on_exit_dump);
+    w24_trace_enabled = 1;
+}
+
+/*
+ * w24_trace_begin: opens a span on the calling thread
+ *
+ * Parameters:
+ * - name: span name, must outlive the process (string literals)
+ * - detail: optional free-form text shown as the span's argument, copied (may be NULL)
+ */
+void w24_trace_begin(const char *name, const char *detail)
+{
+    struct w24_trace_buffer *buf = thread_buffer;
+
+    if (buf == NULL && (buf = buffer_attach()) == NULL)
+        return;
+
+    if (buf->depth < W24_TRACE_MAX_DEPTH) {
+        struct w24_trace_open_span *span = &buf->open[buf->depth];
+        span->name = name;
+        if (detail != NULL)
+            snprintf(span->detail, sizeof(span->detail), "%s", detail);
+        else
+            span->detail[0] = '\0';
+        span->begin_ns = now_ns();
+    }
+    buf->depth++; // spans beyond W24_TRACE_MAX_DEPTH are counted but not recorded
+}
+
+/*
+ * w24_trace_end: closes the innermost open span on the calling thread and records it
+ */
+void w24_trace_end(void)
+{
+    struct w24_trace_buffer *buf = thread_buffer;
+    uint64_t end = now_ns();
+
+    if (buf == NULL || buf->depth == 0)
+        return;
+
+    buf->depth--;
+    if (buf->depth < W24_TRACE_MAX_DEPTH) {
+        struct w24_trace_open_span *span = &buf->open[buf->depth];
+        uint64_t seq = atomic_load_explicit(&buf->written, memory_order_relaxed);
+        struct w24_trace_event *ev = &buf->events[seq % W24_TRACE_RING_EVENTS];
+
+        ev->name = span->name;
+        ev->begin_ns = span->begin_ns;
+        ev->dur_ns = end - span->begin_ns;
+        ev->tid = buf->tid;
+        memcpy(ev->detail, span->detail, sizeof(ev->detail));
+        atomic_store_explicit(&buf->written, seq + 1, memory_order_release);
+    }
+
+    if (dump_requested) {
+        dump_requested = 0;
+        w24_trace_dump();
+    }
+}
+
+/*
+ * w24_trace_depth: number of spans currently open on the calling thread
+ */
+int w24_trace_depth(void)
+{
+    return thread_buffer != NULL ? thread_buffer->depth : 0;
+}
+
+/*
+ * w24_trace_unwind: ends open spans on the calling thread until only 'depth' remain
+ *
+ * Explanation:
+ * Handlers leave through early 'continue'/'break' paths; unwinding at a known point
+ * closes whatever those paths left open instead of threading an end through every exit.
+ */
+void w24_trace_unwind(int depth)
+{
+    while (thread_buffer != NULL && thread_buffer->depth > depth)
+        w24_trace_end();
+}
+
+static void write_json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * w24_trace_dump: writes every thread's recorded spans as Chrome trace JSON
+ *
+ * Return Value:
+ * - int: 0 on success, -1 if tracing is disabled or the file could not be written
+ *
+ * Explanation:
+ * Events are emitted as complete ("X") events with microsecond timestamps, preceded by
+ * process/thread name metadata so Perfetto labels the tracks. Spans still open at dump
+ * time are not included. Each dump goes to a new file so repeated SIGUSR1 dumps never clobber.
+ */
+int w24_trace_dump(void)
+{
+    char path[4096];
+    int pid = (int)getpid();
+
+    if (!w24_trace_enabled)
+        return -1;
+
+    pthread_mutex_lock(&dump_lock);
+
+    snprintf(path, sizeof(path), "%s/w24trace-%s-%d-%d.json", trace_dir, trace_name, pid, dump_seq++);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        pthread_mutex_unlock(&dump_lock);
+        return -1;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", pid);
+    write_json_string(fp, trace_name);
+    fprintf(fp, "}}");
+
+    int count = atomic_load(&buffer_count);
+    for (int i = 0; i < count && i < W24_TRACE_MAX_THREADS; i++) {
+        struct w24_trace_buffer *buf = atomic_load_explicit(&buffers[i], memory_order_acquire);
+        if (buf == NULL)
+            continue;
+
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"thread-%u\"}}",
+                pid, buf->tid, buf->tid);
+
+        uint64_t written = atomic_load_explicit(&buf->written, memory_order_acquire);
+        uint64_t first = written > W24_TRACE_RING_EVENTS ? written - W24_TRACE_RING_EVENTS : 0;
+
+        for (uint64_t seq = first; seq < written; seq++) {
+            const struct w24_trace_event *ev = &buf->events[seq % W24_TRACE_RING_EVENTS];
+            fprintf(fp, ",\n{\"name\":");
+            write_json_string(fp, ev->name);
+            fprintf(fp, ",\"cat\":\"w24\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu",
+                    pid, ev->tid,
+                    (unsigned long long)(ev->begin_ns / 1000), (unsigned long long)(ev->begin_ns % 1000),
+                    (unsigned long long)(ev->dur_ns / 1000), (unsigned long long)(ev->dur_ns % 1000));
+            if (ev->detail[0] != '\0') {
+                fprintf(fp, ",\"args\":{\"detail\":");
+                write_json_string(fp, ev->detail);
+                fputc('}', fp);
+            }
+            fputc('}', fp);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+    int ret = fclose(fp) == 0 ? 0 : -1;
+    pthread_mutex_unlock(&dump_lock);
+    return ret;
+}
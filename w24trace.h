@@ -0,0 +1,56 @@
+/*
+ * w24trace.h: lightweight hot-path tracing spans with Chrome trace / Perfetto export
+ *
+ * Spans are recorded into a per-thread ring of completed events (the newest
+ * W24_TRACE_RING_EVENTS per thread are kept) and written out as Chrome trace JSON,
+ * which opens directly in ui.perfetto.dev or chrome://tracing.
+ *
+ * Tracing is off unless W24_TRACE_DIR is set; when off, W24_TRACE_BEGIN/END cost a
+ * single branch. When on, each process writes <dir>/w24trace-<name>-<pid>-<n>.json:
+ * - when it receives SIGUSR1 (dumped at the next span boundary), and
+ * - when it exits.
+ */
+
+#ifndef W24TRACE_H
+#define W24TRACE_H
+
+#define W24_TRACE_RING_EVENTS 4096 // completed spans kept per thread
+#define W24_TRACE_MAX_DEPTH 16 // maximum nesting of open spans per thread
+#define W24_TRACE_DETAIL_MAX 64 // bytes of free-form detail kept per span
+
+extern int w24_trace_enabled;
+
+void w24_trace_init(const char *process_name);
+void w24_trace_begin(const char *name, const char *detail);
+void w24_trace_end(void);
+int w24_trace_dump(void);
+int w24_trace_depth(void);
+void w24_trace_unwind(int depth);
+
+// name must be a string literal (or otherwise outlive the process); detail is copied
+#define W24_TRACE_BEGIN(name) \
+    do { \
+        if (w24_trace_enabled) \
+            w24_trace_begin((name), NULL); \
+    } while (0)
+
+#define W24_TRACE_BEGIN_DETAIL(name, detail) \
+    do { \
+        if (w24_trace_enabled) \
+            w24_trace_begin((name), (detail)); \
+    } while (0)
+
+#define W24_TRACE_END() \
+    do { \
+        if (w24_trace_enabled) \
+            w24_trace_end(); \
+    } while (0)
+
+// closes every span opened after w24_trace_depth() returned 'depth' (for early exits from a handler)
+#define W24_TRACE_UNWIND(depth) \
+    do { \
+        if (w24_trace_enabled) \
+            w24_trace_unwind(depth); \
+    } while (0)
+
+#endif
@@ -0,0 +1,515 @@
+/*
+ * w24zip.c: zip archive writer with per-member adaptive compression (see w24zip.h)
+ */
+
+#define _GNU_SOURCE
+#include "w24zip.h"
+#include "w24cancel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP64_END_SIG 0x06064b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP_METHOD_STORE 0
+#define ZIP_METHOD_DEFLATE 8
+#define ZIP_FLAG_UTF8 0x0800
+#define ZIP_MAX32 0xFFFFFFFFULL
+#define ZIP_MAX16 0xFFFF
+#define ZIP64_LOCAL_THRESHOLD 0xFFFF0000ULL // members this large get zip64 sizes in the local header
+#define ZIP_IO_CHUNK (256 * 1024)
+
+struct zip_entry {
+    char *name;
+    uint32_t crc;
+    uint64_t csize, usize, offset;
+    uint16_t method, dos_time, dos_date;
+    uint32_t mode;
+};
+
+struct zip_writer {
+    int fd;
+    uint64_t offset; // archive offset of the next byte written
+    unsigned char buf[ZIP_IO_CHUNK];
+    size_t used;
+    int failed;
+    // scratch buffers, kept here rather than static so concurrent archives on different threads do not share them
+    unsigned char in[ZIP_IO_CHUNK], out[ZIP_IO_CHUNK];
+    unsigned char sample[W24_ZIP_SAMPLE_BYTES];
+};
+
+// extensions of formats that are already compressed
+static const char *compressed_extensions[] = {
+    "jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+    "zip", "gz", "tgz", "bz2", "xz", "zst", "lz4", "7z", "rar", "jar", "apk",
+    "docx", "xlsx", "pptx", "odt", "epub",
+    "mp3", "mp4", "m4a", "mkv", "avi", "mov", "webm", "ogg", "flac", "opus",
+    NULL
+};
+
+static void put16(unsigned char *p, uint16_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put32(unsigned char *p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+static void put64(unsigned char *p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+static void writer_flush(struct zip_writer *w)
+{
+    size_t done = 0;
+
+    while (!w->failed && done < w->used) {
+        ssize_t n = write(w->fd, w->buf + done, w->used - done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            w->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    w->used = 0;
+}
+
+static void writer_put(struct zip_writer *w, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    w->offset += len;
+    while (len > 0) {
+        size_t room = sizeof(w->buf) - w->used;
+        size_t take = len < room ? len : room;
+        memcpy(w->buf + w->used, p, take);
+        w->used += take;
+        p += take;
+        len -= take;
+        if (w->used == sizeof(w->buf))
+            writer_flush(w);
+    }
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int has_compressed_extension(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    const char *dot = strrchr(base != NULL ? base : path, '.');
+
+    if (dot == NULL)
+        return 0;
+    for (int i = 0; compressed_extensions[i] != NULL; i++) {
+        if (strcasecmp(dot + 1, compressed_extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int has_compressed_magic(const unsigned char *p, size_t n)
+{
+    if (n >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) return 1; // JPEG
+    if (n >= 4 && memcmp(p, "\x89PNG", 4) == 0) return 1;
+    if (n >= 4 && memcmp(p, "GIF8", 4) == 0) return 1;
+    if (n >= 4 && memcmp(p, "PK\x03\x04", 4) == 0) return 1; // zip, docx, jar, ...
+    if (n >= 2 && p[0] == 0x1F && p[1] == 0x8B) return 1; // gzip
+    if (n >= 3 && memcmp(p, "BZh", 3) == 0) return 1;
+    if (n >= 6 && memcmp(p, "\xFD" "7zXZ\x00", 6) == 0) return 1;
+    if (n >= 4 && memcmp(p, "\x28\xB5\x2F\xFD", 4) == 0) return 1; // zstd
+    if (n >= 4 && memcmp(p, "\x04\x22\x4D\x18", 4) == 0) return 1; // lz4 frame
+    if (n >= 6 && memcmp(p, "7z\xBC\xAF\x27\x1C", 6) == 0) return 1;
+    if (n >= 4 && memcmp(p, "Rar!", 4) == 0) return 1;
+    if (n >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) return 1;
+    if (n >= 8 && memcmp(p + 4, "ftyp", 4) == 0) return 1; // mp4, mov, heic
+    if (n >= 4 && (memcmp(p, "OggS", 4) == 0 || memcmp(p, "fLaC", 4) == 0)) return 1;
+    if (n >= 3 && memcmp(p, "ID3", 3) == 0) return 1; // mp3
+    return 0;
+}
+
+static double sample_entropy(const unsigned char *p, size_t n)
+{
+    size_t counts[256] = { 0 };
+    double entropy = 0.0;
+
+    for (size_t i = 0; i < n; i++)
+        counts[p[i]]++;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] > 0) {
+            double f = (double)counts[i] / (double)n;
+            entropy -= f * log2(f);
+        }
+    }
+    return entropy;
+}
+
+/*
+ * w24_zip_should_store: decides whether a file is stored without compression
+ *
+ * Parameters:
+ * - path: file path, used for the extension check
+ * - sample: the first bytes of the file
+ * - sample_len: number of sample bytes (0 for an empty file)
+ *
+ * Return Value:
+ * - int: 1 to store the file as is, 0 to deflate it
+ */
+int w24_zip_should_store(const char *path, const unsigned char *sample, size_t sample_len)
+{
+    if (sample_len < 64)
+        return 1; // too small for deflate to pay off
+    if (has_compressed_extension(path) || has_compressed_magic(sample, sample_len))
+        return 1;
+    return sample_entropy(sample, sample_len) > W24_ZIP_ENTROPY_LIMIT;
+}
+
+static void dos_datetime(time_t t, uint16_t *dos_time, uint16_t *dos_date)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (tm.tm_year < 80) { // DOS dates start in 1980
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1;
+        return;
+    }
+    *dos_time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    *dos_date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+/*
+ * write_member_data: writes one member's data with the given method
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a read, write or zlib error. crc/usize/csize are filled in.
+ */
+static int write_member_data(struct zip_writer *w, int in_fd, int method, int level,
+                             uint32_t *crc, uint64_t *usize, uint64_t *csize, uint64_t *cpu_ns)
+{
+    unsigned char *in = w->in, *out = w->out;
+    z_stream strm;
+    uint64_t start = w->offset;
+    int flush = Z_NO_FLUSH;
+
+    *crc = (uint32_t)crc32(0L, Z_NULL, 0);
+    *usize = 0;
+
+    if (method == ZIP_METHOD_DEFLATE) {
+        memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return -1;
+    }
+
+    while (flush != Z_FINISH) {
+        ssize_t n = read(in_fd, in, ZIP_IO_CHUNK);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (method == ZIP_METHOD_DEFLATE)
+                deflateEnd(&strm);
+            return -1;
+        }
+        if (n == 0)
+            flush = Z_FINISH;
+
+        *crc = (uint32_t)crc32(*crc, in, (uInt)n);
+        *usize += (uint64_t)n;
+
+        if (method == ZIP_METHOD_STORE) {
+            writer_put(w, in, (size_t)n);
+            continue;
+        }
+
+        uint64_t t0 = thread_cpu_ns();
+        strm.next_in = in;
+        strm.avail_in = (uInt)n;
+        do {
+            strm.next_out = out;
+            strm.avail_out = ZIP_IO_CHUNK;
+            deflate(&strm, flush);
+            writer_put(w, out, ZIP_IO_CHUNK - strm.avail_out);
+        } while (strm.avail_out == 0);
+        *cpu_ns += thread_cpu_ns() - t0;
+    }
+
+    if (method == ZIP_METHOD_DEFLATE)
+        deflateEnd(&strm);
+    *csize = w->offset - start;
+    return w->failed ? -1 : 0;
+}
+
+static void write_local_header(unsigned char *h, const struct zip_entry *e, int zip64, size_t name_len)
+{
+    put32(h, ZIP_LOCAL_SIG);
+    put16(h + 4, zip64 ? 45 : 20);
+    put16(h + 6, ZIP_FLAG_UTF8);
+    put16(h + 8, e->method);
+    put16(h + 10, e->dos_time);
+    put16(h + 12, e->dos_date);
+    put32(h + 14, e->crc);
+    put32(h + 18, zip64 ? (uint32_t)ZIP_MAX32 : (uint32_t)e->csize);
+    put32(h + 22, zip64 ? (uint32_t)ZIP_MAX32 : (uint32_t)e->usize);
+    put16(h + 26, (uint16_t)name_len);
+    put16(h + 28, zip64 ? 20 : 0);
+    if (zip64) {
+        put16(h + 30, 0x0001);
+        put16(h + 32, 16);
+        put64(h + 34, e->usize);
+        put64(h + 42, e->csize);
+    }
+}
+
+/*
+ * add_member: appends one file to the archive
+ *
+ * Return Value:
+ * - int: 0 if written, 1 if the file was skipped (unreadable, not a regular file), -1 on a write error
+ *
+ * Explanation:
+ * The local header is written with placeholder sizes and patched with pwrite() once the data is
+ * out, so the archive never needs data descriptors. A member that deflate fails to shrink is
+ * truncated away and written again as stored.
+ */
+static int add_member(struct zip_writer *w, const char *path, int level, struct zip_entry *e, struct w24_zip_stats *stats)
+{
+    unsigned char *sample = w->sample;
+    unsigned char header[30 + 20];
+    struct stat sb;
+    uint64_t cpu_ns = 0;
+
+    memset(e, 0, sizeof(*e)); // the caller frees e->name whatever this returns
+    int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1)
+        return 1;
+    if (fstat(in_fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+        close(in_fd);
+        return 1;
+    }
+
+    ssize_t sample_len = pread(in_fd, sample, W24_ZIP_SAMPLE_BYTES, 0);
+    if (sample_len < 0)
+        sample_len = 0;
+
+    const char *name = path;
+    while (*name == '/')
+        name++; // member names are relative, like tar strips the leading '/'
+    size_t name_len = strlen(name);
+    if (name_len > ZIP_MAX16)
+        name_len = ZIP_MAX16;
+
+    int zip64 = (uint64_t)sb.st_size >= ZIP64_LOCAL_THRESHOLD;
+    size_t header_len = 30 + (zip64 ? 20 : 0);
+
+    e->name = strndup(name, name_len);
+    e->offset = w->offset;
+    e->mode = (uint32_t)sb.st_mode;
+    e->method = w24_zip_should_store(path, sample, (size_t)sample_len) ? ZIP_METHOD_STORE : ZIP_METHOD_DEFLATE;
+    dos_datetime(sb.st_mtime, &e->dos_time, &e->dos_date);
+
+    // placeholder header, patched below
+    write_local_header(header, e, zip64, name_len);
+    writer_put(w, header, header_len);
+    writer_put(w, name, name_len);
+    uint64_t data_start = w->offset;
+
+    int ret = write_member_data(w, in_fd, e->method, level, &e->crc, &e->usize, &e->csize, &cpu_ns);
+    if (ret == 0 && e->method == ZIP_METHOD_DEFLATE && e->csize >= e->usize) {
+        // deflate did not help: rewind and store the file instead
+        writer_flush(w);
+        if (ftruncate(w->fd, (off_t)data_start) == -1 || lseek(w->fd, (off_t)data_start, SEEK_SET) == -1 || lseek(in_fd, 0, SEEK_SET) == -1) {
+            ret = -1;
+        } else {
+            w->offset = data_start;
+            e->method = ZIP_METHOD_STORE;
+            ret = write_member_data(w, in_fd, e->method, level, &e->crc, &e->usize, &e->csize, &cpu_ns);
+        }
+    }
+    close(in_fd);
+
+    if (ret == 0 && !zip64 && (e->csize >= ZIP_MAX32 || e->usize >= ZIP_MAX32))
+        ret = -1; // grew past 4 GiB while being read
+    if (ret == -1)
+        return -1;
+
+    // patch the local header with the real CRC and sizes
+    writer_flush(w);
+    write_local_header(header, e, zip64, name_len);
+    if (w->failed || pwrite(w->fd, header, header_len, (off_t)e->offset) != (ssize_t)header_len)
+        return -1;
+
+    stats->members++;
+    stats->bytes_in += e->usize;
+    if (e->method == ZIP_METHOD_DEFLATE) {
+        stats->deflated_members++;
+        stats->deflated_bytes_in += e->usize;
+    } else {
+        stats->stored_members++;
+        stats->stored_bytes += e->usize;
+    }
+    stats->compress_cpu_ns += cpu_ns;
+    return 0;
+}
+
+static void write_central_directory(struct zip_writer *w, struct zip_entry *entries, size_t count)
+{
+    uint64_t cd_start = w->offset;
+    unsigned char h[46 + 28];
+
+    for (size_t i = 0; i < count; i++) {
+        struct zip_entry *e = &entries[i];
+        unsigned char *x = h + 46;
+        size_t extra = 4;
+
+        // zip64 extra field: only the values that do not fit in 32 bits, in this order
+        if (e->usize >= ZIP_MAX32) { put64(h + 46 + extra, e->usize); extra += 8; }
+        if (e->csize >= ZIP_MAX32) { put64(h + 46 + extra, e->csize); extra += 8; }
+        if (e->offset >= ZIP_MAX32) { put64(h + 46 + extra, e->offset); extra += 8; }
+        if (extra == 4)
+            extra = 0;
+        else {
+            put16(x, 0x0001);
+            put16(x + 2, (uint16_t)(extra - 4));
+        }
+
+        size_t name_len = strlen(e->name);
+        put32(h, ZIP_CENTRAL_SIG);
+        put16(h + 4, (3 << 8) | 45); // made by Unix, spec 4.5
+        put16(h + 6, extra ? 45 : 20);
+        put16(h + 8, ZIP_FLAG_UTF8);
+        put16(h + 10, e->method);
+        put16(h + 12, e->dos_time);
+        put16(h + 14, e->dos_date);
+        put32(h + 16, e->crc);
+        put32(h + 20, e->csize >= ZIP_MAX32 ? (uint32_t)ZIP_MAX32 : (uint32_t)e->csize);
+        put32(h + 24, e->usize >= ZIP_MAX32 ? (uint32_t)ZIP_MAX32 : (uint32_t)e->usize);
+        put16(h + 28, (uint16_t)name_len);
+        put16(h + 30, (uint16_t)extra);
+        put16(h + 32, 0); // comment
+        put16(h + 34, 0); // disk
+        put16(h + 36, 0); // internal attributes
+        put32(h + 38, e->mode << 16); // Unix mode in the high half
+        put32(h + 42, e->offset >= ZIP_MAX32 ? (uint32_t)ZIP_MAX32 : (uint32_t)e->offset);
+        writer_put(w, h, 46 + extra);
+        writer_put(w, e->name, name_len);
+    }
+
+    uint64_t cd_size = w->offset - cd_start;
+    int zip64 = count >= ZIP_MAX16 || cd_start >= ZIP_MAX32 || cd_size >= ZIP_MAX32;
+
+    if (zip64) {
+        unsigned char z[56 + 20];
+        uint64_t z_offset = w->offset;
+        put32(z, ZIP64_END_SIG);
+        put64(z + 4, 44);
+        put16(z + 12, (3 << 8) | 45);
+        put16(z + 14, 45);
+        put32(z + 16, 0);
+        put32(z + 20, 0);
+        put64(z + 24, count);
+        put64(z + 32, count);
+        put64(z + 40, cd_size);
+        put64(z + 48, cd_start);
+        put32(z + 56, ZIP64_LOCATOR_SIG);
+        put32(z + 60, 0);
+        put64(z + 64, z_offset);
+        put32(z + 72, 1);
+        writer_put(w, z, sizeof(z));
+    }
+
+    unsigned char end[22];
+    put32(end, ZIP_END_SIG);
+    put16(end + 4, 0);
+    put16(end + 6, 0);
+    put16(end + 8, count >= ZIP_MAX16 ? ZIP_MAX16 : (uint16_t)count);
+    put16(end + 10, count >= ZIP_MAX16 ? ZIP_MAX16 : (uint16_t)count);
+    put32(end + 12, cd_size >= ZIP_MAX32 ? (uint32_t)ZIP_MAX32 : (uint32_t)cd_size);
+    put32(end + 16, cd_start >= ZIP_MAX32 ? (uint32_t)ZIP_MAX32 : (uint32_t)cd_start);
+    put16(end + 20, 0);
+    writer_put(w, end, sizeof(end));
+}
+
+/*
+ * w24_zip_from_list: writes a zip archive of the files listed one per line on 'list'
+ *
+ * Parameters:
+ * - list: stream of file paths, one per line (e.g. the output of find)
+ * - out_fd: archive file, must be seekable and empty
+ * - level: deflate level for compressed members (1-9)
+ * - stats: receives member counts, sizes and compression CPU time (may not be NULL)
+ *
+ * Return Value:
+ * - int: 0 on success, -1 on a write error or if the calling thread's request stopped
+ *   (w24cancel.h), checked before every member. Unreadable files are skipped.
+ *
+ * Explanation:
+ * cpu_ns_saved estimates the compression time avoided by storing members, from the CPU time
+ * per byte measured while deflating the other members of the same archive.
+ */
+int w24_zip_from_list(FILE *list, int out_fd, int level, struct w24_zip_stats *stats)
+{
+    struct zip_writer *w = calloc(1, sizeof(struct zip_writer));
+    struct zip_entry *entries = NULL;
+    size_t count = 0, cap = 0;
+    char path[4096];
+    int status = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (w == NULL)
+        return -1;
+    w->fd = out_fd;
+
+    while (status == 0 && fgets(path, sizeof(path), list) != NULL) {
+        path[strcspn(path, "\n")] = '\0';
+        if (path[0] == '\0')
+            continue;
+        if (w24_cancel_checkpoint() != W24_CANCEL_NONE) { // the request stopped: the archive is thrown away
+            status = -1;
+            break;
+        }
+
+        if (count == cap) {
+            cap = cap ? 2 * cap : 256;
+            struct zip_entry *grown = realloc(entries, cap * sizeof(struct zip_entry));
+            if (grown == NULL) {
+                status = -1;
+                break;
+            }
+            entries = grown;
+        }
+
+        int ret = add_member(w, path, level, &entries[count], stats);
+        if (ret == 0) {
+            count++;
+        } else {
+            free(entries[count].name); // NULL if the file was skipped before it was named
+            if (ret == -1)
+                status = -1;
+        }
+    }
+
+    if (status == 0) {
+        write_central_directory(w, entries, count);
+        writer_flush(w);
+        if (w->failed)
+            status = -1;
+    }
+
+    stats->bytes_out = w->offset;
+    if (stats->deflated_bytes_in > 0)
+        stats->cpu_ns_saved = (uint64_t)((double)stats->compress_cpu_ns / (double)stats->deflated_bytes_in * (double)stats->stored_bytes);
+
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+    free(w);
+    return status;
+}
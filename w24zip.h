@@ -0,0 +1,38 @@
+/*
+ * w24zip.h: zip archive writer with per-member adaptive compression
+ *
+ * Unlike a compressed tar stream, zip compresses each member on its own, so every file can be
+ * stored or deflated independently. Before compressing a file the writer checks whether it is
+ * likely to shrink at all:
+ * - known compressed formats by extension (jpg, png, zip, gz, mp4, ...),
+ * - known compressed formats by magic bytes, whatever the extension,
+ * - otherwise the byte entropy of a sample of the file.
+ * Files judged incompressible are stored as is; anything deflate fails to shrink is rewritten
+ * as stored as well. Archives larger than 4 GiB or with more than 65535 members use zip64.
+ */
+
+#ifndef W24ZIP_H
+#define W24ZIP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define W24_ZIP_SAMPLE_BYTES 65536 // bytes sampled from the start of a file for the entropy check
+#define W24_ZIP_ENTROPY_LIMIT 7.5 // bits per byte above which a sample is treated as incompressible
+
+struct w24_zip_stats {
+    uint64_t members; // files written
+    uint64_t deflated_members; // files written compressed
+    uint64_t stored_members; // files stored because they would not compress
+    uint64_t bytes_in; // uncompressed bytes of all members
+    uint64_t bytes_out; // archive size
+    uint64_t deflated_bytes_in; // uncompressed bytes of the deflated members
+    uint64_t stored_bytes; // bytes stored without compression
+    uint64_t compress_cpu_ns; // CPU time spent deflating
+    uint64_t cpu_ns_saved; // estimated CPU time not spent compressing the stored members
+};
+
+int w24_zip_from_list(FILE *list, int out_fd, int level, struct w24_zip_stats *stats);
+int w24_zip_should_store(const char *path, const unsigned char *sample, size_t sample_len);
+
+#endif